@@ -337,8 +337,9 @@ find_sources() {
 	# Need to backslash-escape slashes so the upcoming seds work.
 	sd=`echo "$SRCDIR" | sed 's|/|\\\\/|g'`
 
-	# Remove test code.
+	# Remove test and benchmark code.
 	CXXSOURCES=`echo "$CXXSOURCES" | sed '/'"$sd"'\/tests/d'`
+	CXXSOURCES=`echo "$CXXSOURCES" | sed '/'"$sd"'\/bench/d'`
 
 	# Compared to above, the C sources are easy--they're always there,
 	# regardless of features.
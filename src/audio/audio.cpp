@@ -9,13 +9,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cstdint>
 #include <string>
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "../metrics.hpp"
 #include "../response.hpp"
+#include "../status_page.hpp"
+#include "../trace.hpp"
 #include "audio.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
@@ -31,6 +35,11 @@ std::unique_ptr<Response> Audio::Emit(const std::string &, bool)
 	return std::unique_ptr<Response>();
 }
 
+std::vector<Underrun> Audio::TakeUnderruns()
+{
+	return std::vector<Underrun>();
+}
+
 //
 // NoAudio
 //
@@ -66,13 +75,34 @@ std::uint64_t NoAudio::Position() const
 	throw NoAudioError(MSG_CMD_NEEDS_LOADED);
 }
 
+void NoAudio::Publish(StatusPage &page) const
+{
+	page.Publish(Audio::State::NONE, "", 0, 0);
+}
+
 //
 // PipeAudio
 //
 
+/// How long each call to AudioSource::Decode takes.
+static Histogram &decode_us = Metrics::Global().AddHistogram(
+        "audio/decode_us", "Time taken to decode one frame, in microseconds");
+
+/// How long one Update may spend feeding a sink that isn't real-time.
+/// This is kept under the IoCore's update period, so that the loop stays
+/// responsive to clients while rendering.
+static const std::chrono::milliseconds UNPACED_BUDGET(4);
+
+// Humans start to notice a progress display being out by a few frames of
+// video, so keep well under that.
+const std::uint64_t PipeAudio::ANCHOR_TOLERANCE = 20000;
+
 PipeAudio::PipeAudio(std::unique_ptr<AudioSource> &&src,
                      std::unique_ptr<AudioSink> &&sink)
-    : src(std::move(src)), sink(std::move(sink)), announced_time(false)
+    : src(std::move(src)),
+      sink(std::move(sink)),
+      announced_time(false),
+      anchored(false)
 {
 	this->ClearFrame();
 }
@@ -93,6 +123,20 @@ std::unique_ptr<Response> PipeAudio::Emit(const std::string &path,
 		value = playing ? "Playing" : "Stopped";
 	} else if (path == "/player/file") {
 		value = this->src->Path();
+	} else if (path == "/audio/latency/buffer") {
+		value = std::to_string(this->sink->BufferLatency());
+	} else if (path == "/audio/latency/period") {
+		value = std::to_string(this->sink->PeriodLatency());
+	} else if (path == "/audio/stats/underruns") {
+		auto underruns = this->sink->Underruns();
+		auto count = underruns == nullptr ? 0 : underruns->Count();
+		auto total = underruns == nullptr ? 0 : underruns->Total();
+
+		ret = std::unique_ptr<Response>(new Response(Response::Code::RES));
+		ret->AddArg(path).AddArg("Underruns");
+		ret->AddArg(std::to_string(count));
+		ret->AddArg(std::to_string(total));
+		return ret;
 	} else if (path == "/player/time/elapsed") {
 		std::uint64_t micros = this->Position();
 
@@ -101,11 +145,46 @@ std::unique_ptr<Response> PipeAudio::Emit(const std::string &path,
 		bool can = (!broadcast) || this->CanAnnounceTime(micros);
 		if (!can) return ret;
 		value = std::to_string(micros);
+	} else if (path == "/player/time/anchor") {
+		auto current = this->CurrentAnchor();
+
+		// As with the time, only announce broadcasts if they're news.
+		if (broadcast) {
+			if (!this->AnchorChanged(current)) return ret;
+			this->anchor = current;
+			this->anchored = true;
+		}
+
+		ret = std::unique_ptr<Response>(new Response(Response::Code::RES));
+		ret->AddArg(path).AddArg("Anchor");
+		ret->AddArg(std::to_string(current.samples));
+		ret->AddArg(std::to_string(this->src->SampleRate()));
+		ret->AddArg(std::to_string(current.stamp));
+		ret->AddArg(current.playing ? "Playing" : "Stopped");
+		return ret;
 	} else return ret;
 
 	return Response::Res("Entry", path, value);
 }
 
+void PipeAudio::Publish(StatusPage &page) const
+{
+	assert(this->src != nullptr);
+	assert(this->sink != nullptr);
+
+	page.Publish(this->sink->State(), this->src->Path(),
+	             this->sink->Position(), this->src->SampleRate());
+}
+
+std::vector<Underrun> PipeAudio::TakeUnderruns()
+{
+	assert(this->sink != nullptr);
+
+	auto underruns = this->sink->Underruns();
+	if (underruns == nullptr) return std::vector<Underrun>();
+	return underruns->Take();
+}
+
 void PipeAudio::SetPlaying(bool playing)
 {
 	assert(this->sink != nullptr);
@@ -136,6 +215,7 @@ void PipeAudio::Seek(std::uint64_t position)
 
 	// Make sure we always announce the new position to all response sinks.
 	this->announced_time = false;
+	this->anchored = false;
 
 	// We might still have decoded samples from the old position in
 	// our frame, so clear them out.
@@ -150,13 +230,25 @@ void PipeAudio::ClearFrame()
 
 Audio::State PipeAudio::Update()
 {
+	TraceSpan span("PipeAudio::Update");
+
 	assert(this->sink != nullptr);
 	assert(this->src != nullptr);
 
-	bool more_available = this->DecodeIfFrameEmpty();
-	if (!more_available) this->sink->SourceOut();
+	// Real-time sinks get a frame per update; others get as many as we
+	// can decode in the budget.
+	auto paced = this->sink->IsRealTime();
+	auto deadline = std::chrono::steady_clock::now() + UNPACED_BUDGET;
+	while (true) {
+		bool more_available = this->DecodeIfFrameEmpty();
+		if (!more_available) this->sink->SourceOut();
 
-	if (!this->FrameFinished()) this->TransferFrame();
+		if (!this->FrameFinished()) this->TransferFrame();
+
+		if (paced || !more_available) break;
+		if (this->sink->State() != Audio::State::PLAYING) break;
+		if (deadline <= std::chrono::steady_clock::now()) break;
+	}
 
 	return this->sink->State();
 }
@@ -194,7 +286,16 @@ bool PipeAudio::DecodeIfFrameEmpty()
 	if (!this->FrameFinished()) return true;
 
 	assert(this->src != nullptr);
-	AudioSource::DecodeResult result = this->src->Decode();
+	auto start = std::chrono::steady_clock::now();
+	AudioSource::DecodeResult result;
+	{
+		TraceSpan span("AudioSource::Decode");
+		result = this->src->Decode();
+	}
+	auto taken = std::chrono::steady_clock::now() - start;
+	decode_us.Record(static_cast<std::uint64_t>(
+	        std::chrono::duration_cast<std::chrono::microseconds>(taken)
+	                .count()));
 
 	this->frame = result.second;
 	this->frame_iterator = this->frame.begin();
@@ -222,3 +323,33 @@ bool PipeAudio::CanAnnounceTime(std::uint64_t micros)
 
 	return announce;
 }
+
+PipeAudio::Anchor PipeAudio::CurrentAnchor() const
+{
+	assert(this->sink != nullptr);
+
+	Anchor current;
+	current.samples = this->sink->Position();
+	current.stamp = this->sink->Stamp();
+	current.playing = this->sink->State() == Audio::State::PLAYING;
+	return current;
+}
+
+bool PipeAudio::AnchorChanged(const Anchor &current) const
+{
+	if (!this->anchored) return true;
+	if (current.playing != this->anchor.playing) return true;
+	if (!current.playing) return current.samples != this->anchor.samples;
+
+	// Where would a client extrapolating from the last anchor think we
+	// are now?
+	assert(this->src != nullptr);
+	auto rate = this->src->SampleRate();
+	auto elapsed = static_cast<std::uint64_t>(
+	        std::max<std::int64_t>(0, current.stamp - this->anchor.stamp));
+	auto predicted = this->anchor.samples + ((elapsed * rate) / 1000000);
+
+	auto drift = (predicted < current.samples) ? current.samples - predicted
+	                                           : predicted - current.samples;
+	return ANCHOR_TOLERANCE < this->src->MicrosFromSamples(drift);
+}
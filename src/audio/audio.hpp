@@ -18,8 +18,10 @@
 
 #include "../response.hpp"
 #include "audio_source.hpp"
+#include "underrun.hpp"
 
 class AudioSink;
+class StatusPage;
 
 /**
  * An audio item.
@@ -105,6 +107,20 @@ public:
 	 * @see Seek
 	 */
 	virtual std::uint64_t Position() const = 0;
+
+	/**
+	 * Publishes this Audio's state, file, position and sample rate.
+	 * @param page The status page to which they should be published.
+	 * @see StatusPage
+	 */
+	virtual void Publish(StatusPage &page) const = 0;
+
+	/**
+	 * Takes the underruns that have finished since the last call.
+	 * @return The underruns, oldest first; by default, none.
+	 * @see UnderrunMonitor::Take
+	 */
+	virtual std::vector<Underrun> TakeUnderruns();
 };
 
 /**
@@ -127,6 +143,8 @@ public:
 	void SetPlaying(bool playing) override;
 	void Seek(std::uint64_t position) override;
 	std::uint64_t Position() const override;
+
+	void Publish(StatusPage &page) const override;
 };
 
 /**
@@ -158,6 +176,8 @@ public:
 
 	std::unique_ptr<Response> Emit(const std::string &path, bool broadcast) override;
 	std::uint64_t Position() const override;
+	void Publish(StatusPage &page) const override;
+	std::vector<Underrun> TakeUnderruns() override;
 
 private:
 	/// The source of audio data.
@@ -178,6 +198,22 @@ private:
 	/// The last time into this Audio when the time was broadcast.
 	std::uint64_t last_time;
 
+	/// A point from which clients can extrapolate the position.
+	struct Anchor {
+		std::uint64_t samples; ///< The position, in samples.
+		std::int64_t stamp;    ///< The monotonic time, in microseconds.
+		bool playing;          ///< Whether the position is advancing.
+	};
+
+	/// The most drift, in microseconds, before the anchor is re-sent.
+	static const std::uint64_t ANCHOR_TOLERANCE;
+
+	/// Whether anchor contains the last anchor broadcast.
+	bool anchored;
+
+	/// The last anchor broadcast.
+	Anchor anchor;
+
 	/// Clears the current frame and its iterator.
 	void ClearFrame();
 
@@ -213,6 +249,24 @@ private:
 	 * @return Whether it is polite to broadcast TIME.
 	 */
 	bool CanAnnounceTime(std::uint64_t micros);
+
+	/**
+	 * Takes an anchor for the current instant.
+	 * @return The current anchor.
+	 */
+	Anchor CurrentAnchor() const;
+
+	/**
+	 * Determines whether we need to broadcast a new anchor.
+	 *
+	 * This is the case if no anchor has been broadcast since the last
+	 * load or seek, if playback has started or stopped since, or if
+	 * extrapolating from the last anchor is now noticeably wrong.
+	 *
+	 * @param current The anchor for the current instant.
+	 * @return Whether clients need the new anchor.
+	 */
+	bool AnchorChanged(const Anchor &current) const;
 };
 
 #endif // PLAYD_AUDIO_HPP
@@ -8,7 +8,9 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cstring>
 #include <memory>
@@ -18,8 +20,12 @@
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "../metrics.hpp"
+#include "../status_page.hpp"
+#include "../trace.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
+#include "realtime.hpp"
 #include "ringbuffer.hpp"
 #include "sample_formats.hpp"
 
@@ -32,11 +38,82 @@ Audio::State AudioSink::State()
 	return Audio::State::NONE;
 }
 
+std::uint64_t AudioSink::BufferLatency() const
+{
+	return 0;
+}
+
+std::uint64_t AudioSink::PeriodLatency() const
+{
+	return 0;
+}
+
+UnderrunMonitor *AudioSink::Underruns()
+{
+	return nullptr;
+}
+
+bool AudioSink::IsRealTime() const
+{
+	return true;
+}
+
+std::int64_t AudioSink::Stamp() const
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now)
+	        .count();
+}
+
 //
 // SdlAudioSink
 //
 
-const size_t SdlAudioSink::RINGBUF_POWER = 16;
+// At the common sample rates, this gives the 2^16 sample ring buffer playd
+// has always used.
+const std::uint32_t SdlAudioSink::DEFAULT_BUFFER_MS = 1000;
+
+const std::uint32_t SdlAudioSink::DEFAULT_PERIOD_MS = 0;
+
+// 256 samples is about 5ms at 48kHz: below that, we'd be relying on the
+// decoder being scheduled more often than is realistic.
+const int SdlAudioSink::MIN_RING_POWER = 8;
+
+// 2^24 samples is over five minutes at 48kHz, which is deep enough for
+// anyone, and keeps 1 << power well within the ring buffer's size type.
+const int SdlAudioSink::MAX_RING_POWER = 24;
+
+// SDL_AudioSpec::samples is a Uint16, and must be a power of two.
+static const std::uint32_t MAX_PERIOD_FRAMES = 32768;
+
+// The callback reads the clock and state; an atomic that isn't lock-free
+// hides a lock, which the callback must never take.
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2 &&
+                      ATOMIC_BOOL_LOCK_FREE == 2,
+              "the audio callback needs lock-free atomics");
+
+bool SdlAudioSink::realtime = false;
+
+/// How full the ring buffer was when the device last asked for audio.
+static Gauge &ring_fill = Metrics::Global().AddGauge(
+        "audio/ring_fill",
+        "Samples buffered when the device last asked for audio");
+
+/// How long between calls to the callback.
+static Histogram &callback_interval_us = Metrics::Global().AddHistogram(
+        "audio/callback_interval_us",
+        "Time between audio callbacks, in microseconds");
+
+/// How far each interval between callbacks was from the device period.
+static Histogram &callback_jitter_us = Metrics::Global().AddHistogram(
+        "audio/callback_jitter_us",
+        "Distance of each callback interval from the device period, in "
+        "microseconds");
+
+/// How much audio has gone into ring buffers.
+static Counter &transferred_bytes = Metrics::Global().AddCounter(
+        "audio/transferred_bytes",
+        "Bytes of decoded audio transferred into the ring buffer");
 
 /**
  * The callback used by SDL_Audio.
@@ -55,13 +132,38 @@ static void SDLCallback(void *vsink, std::uint8_t *data, int len)
 	return std::unique_ptr<AudioSink>(new SdlAudioSink(source, device_id));
 }
 
-SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id)
-    : bytes_per_sample(source.BytesPerSample()),
-      ring_buf(RINGBUF_POWER, source.BytesPerSample()),
-      position_sample_count(0),
+/* static */ std::unique_ptr<AudioSink> SdlAudioSink::Build(
+        const AudioSource &source, int device_id, std::uint32_t buffer_ms,
+        std::uint32_t period_ms, std::uint32_t rebuffer_ms, StatusPage *status)
+{
+	return std::unique_ptr<AudioSink>(new SdlAudioSink(
+	        source, device_id, buffer_ms, period_ms, rebuffer_ms, status));
+}
+
+SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id,
+                           std::uint32_t buffer_ms, std::uint32_t period_ms,
+                           std::uint32_t rebuffer_ms, StatusPage *status)
+    : pinned(false),
+      bytes_per_sample(source.BytesPerSample()),
+      rate(source.SampleRate()),
+      ring_power(RingPower(this->rate, buffer_ms,
+                           PeriodFrames(this->rate, period_ms))),
+      period_frames(0),
+      ring_buf(this->ring_power, source.BytesPerSample()),
+      status(status),
+      underruns(RebufferFrames(this->rate, rebuffer_ms, this->ring_power)),
+      last_callback(0),
+      clock_seq(0),
+      clock_base(0),
+      clock_floor(0),
+      clock_limit(0),
+      clock_stamp(0),
+      clock_running(false),
       source_out(false),
       state(Audio::State::STOPPED)
 {
+	assert(this->state.is_lock_free());
+
 	const char *name = SDL_GetAudioDeviceName(device_id, 0);
 	if (name == nullptr) {
 		throw ConfigError(std::string("invalid device id: ") +
@@ -73,26 +175,69 @@ SdlAudioSink::SdlAudioSink(const AudioSource &source, int device_id)
 	want.freq = source.SampleRate();
 	want.format = SDLFormat(source.OutputSampleFormat());
 	want.channels = source.ChannelCount();
+	want.samples = static_cast<std::uint16_t>(PeriodFrames(this->rate, period_ms));
 	want.callback = &SDLCallback;
 	want.userdata = (void *)this;
 
 	SDL_AudioSpec have;
 	SDL_zero(have);
 
+	if (SdlAudioSink::realtime) {
+		// The ring buffer was prefaulted on construction; pinning it
+		// (and us) keeps it from being paged out again.
+		if (!this->ring_buf.Pin()) {
+			Debug() << "sdl: couldn't lock ring buffer into RAM"
+			        << std::endl;
+		}
+		this->pinned = RealTime::Pin(this, sizeof(*this));
+		if (!this->pinned) {
+			Debug() << "sdl: couldn't lock sink into RAM" << std::endl;
+		}
+
+#ifdef SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL
+		// SDL always asks for its audio thread to be TIME_CRITICAL;
+		// this makes that mean SCHED_FIFO (through rtkit, if need be)
+		// rather than just a high nice level.
+		SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
+#endif
+	}
+
 	this->device = SDL_OpenAudioDevice(name, 0, &want, &have, 0);
 	if (this->device == 0) {
+		if (this->pinned) RealTime::Unpin(this, sizeof(*this));
 		throw ConfigError(std::string("couldn't open device: ") +
 		                  SDL_GetError());
 	}
+
+	// SDL may not have given us the period we asked for.  If it's given
+	// us a bigger one than the ring buffer can cope with, we'll just have
+	// to live with the odd underrun.
+	this->period_frames = have.samples;
+	if ((1u << this->ring_power) < 2 * this->period_frames) {
+		Debug() << "sdl: period of" << this->period_frames
+		        << "samples is over half the ring buffer" << std::endl;
+	}
 }
 
 SdlAudioSink::~SdlAudioSink()
 {
-	if (this->device == 0) return;
+	if (this->device != 0) {
+		// Silence any currently playing audio.
+		SDL_PauseAudioDevice(this->device, SDL_TRUE);
+		SDL_CloseAudioDevice(this->device);
+	}
+
+	if (this->pinned) RealTime::Unpin(this, sizeof(*this));
+}
+
+/* static */ void *SdlAudioSink::operator new(size_t size)
+{
+	return RealTime::Allocate(size);
+}
 
-	// Silence any currently playing audio.
-	SDL_PauseAudioDevice(this->device, SDL_TRUE);
-	SDL_CloseAudioDevice(this->device);
+/* static */ void SdlAudioSink::operator delete(void *p)
+{
+	RealTime::Free(p);
 }
 
 /* static */ void SdlAudioSink::InitLibrary()
@@ -108,10 +253,16 @@ SdlAudioSink::~SdlAudioSink()
 	SDL_Quit();
 }
 
+/* static */ void SdlAudioSink::SetRealTime(bool enabled)
+{
+	SdlAudioSink::realtime = enabled;
+}
+
 void SdlAudioSink::Start()
 {
 	if (this->state != Audio::State::STOPPED) return;
 
+	// The clock stays frozen until the callback hands over some audio.
 	SDL_PauseAudioDevice(this->device, 0);
 	this->state = Audio::State::PLAYING;
 }
@@ -120,7 +271,12 @@ void SdlAudioSink::Stop()
 {
 	if (this->state == Audio::State::STOPPED) return;
 
+	// Once this returns, the callback has stopped running, so we're free
+	// to write the clock.
 	SDL_PauseAudioDevice(this->device, 1);
+	this->FreezeClock();
+	this->underruns.Reset(Now());
+	this->last_callback = 0;
 	this->state = Audio::State::STOPPED;
 }
 
@@ -139,24 +295,156 @@ void SdlAudioSink::SourceOut()
 
 std::uint64_t SdlAudioSink::Position()
 {
-	return this->position_sample_count;
+	return Interpolate(this->LoadClock(), Now(), this->rate);
 }
 
 void SdlAudioSink::SetPosition(std::uint64_t samples)
 {
-	this->position_sample_count = samples;
+	// The callback mustn't run while we reset the clock and empty the
+	// ring buffer underneath it.
+	SDL_LockAudioDevice(this->device);
+
+	auto now = Now();
+	auto base = static_cast<std::int64_t>(samples);
+	this->StoreClock({base, samples, samples, now, false});
 
 	// We might have been at the end of the file previously.
 	// If so, we might not be now, so clear the out flags.
 	this->source_out = false;
+
+	// The ringbuf will have been full of samples from the old
+	// position, so we need to get rid of them.
+	this->ring_buf.Flush();
+	this->underruns.Reset(now);
+
+	SDL_UnlockAudioDevice(this->device);
+
 	if (this->state == Audio::State::AT_END) {
 		this->state = Audio::State::STOPPED;
 		this->Stop();
 	}
+}
 
-	// The ringbuf will have been full of samples from the old
-	// position, so we need to get rid of them.
-	this->ring_buf.Flush();
+/* static */ std::uint64_t SdlAudioSink::Interpolate(const Clock &clock,
+                                                    std::int64_t now,
+                                                    std::uint32_t rate)
+{
+	std::int64_t position = clock.base;
+	if (clock.running && clock.stamp < now) {
+		position += ((now - clock.stamp) * rate) / 1000000000;
+	}
+
+	// We can't have heard anything we haven't handed over yet, and we
+	// mustn't go back on what we've already said we've heard.
+	if (position < static_cast<std::int64_t>(clock.floor)) return clock.floor;
+	if (static_cast<std::int64_t>(clock.limit) < position) return clock.limit;
+	return static_cast<std::uint64_t>(position);
+}
+
+SdlAudioSink::Clock SdlAudioSink::LoadClock() const
+{
+	Clock clock;
+	std::uint32_t before, after;
+
+	do {
+		before = this->clock_seq.load(std::memory_order_acquire);
+
+		clock.base = this->clock_base.load(std::memory_order_relaxed);
+		clock.floor = this->clock_floor.load(std::memory_order_relaxed);
+		clock.limit = this->clock_limit.load(std::memory_order_relaxed);
+		clock.stamp = this->clock_stamp.load(std::memory_order_relaxed);
+		clock.running =
+		        this->clock_running.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = this->clock_seq.load(std::memory_order_relaxed);
+	} while ((before & 1) != 0 || before != after);
+
+	return clock;
+}
+
+void SdlAudioSink::StoreClock(const Clock &clock)
+{
+	auto seq = this->clock_seq.load(std::memory_order_relaxed);
+	this->clock_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	this->clock_base.store(clock.base, std::memory_order_relaxed);
+	this->clock_floor.store(clock.floor, std::memory_order_relaxed);
+	this->clock_limit.store(clock.limit, std::memory_order_relaxed);
+	this->clock_stamp.store(clock.stamp, std::memory_order_relaxed);
+	this->clock_running.store(clock.running, std::memory_order_relaxed);
+
+	this->clock_seq.store(seq + 2, std::memory_order_release);
+}
+
+void SdlAudioSink::FreezeClock()
+{
+	auto clock = this->LoadClock();
+	auto now = Now();
+	auto heard = Interpolate(clock, now, this->rate);
+
+	// Whatever was handed over but not yet heard is lost when the device
+	// pauses, so the clock stops where the listener did.
+	auto base = static_cast<std::int64_t>(heard);
+	this->StoreClock({base, heard, clock.limit, now, false});
+}
+
+/* static */ std::int64_t SdlAudioSink::Now()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+	        .count();
+}
+
+std::uint64_t SdlAudioSink::BufferLatency() const
+{
+	std::uint64_t frames = std::uint64_t(1) << this->ring_power;
+	return (frames * 1000000) / this->rate;
+}
+
+std::uint64_t SdlAudioSink::PeriodLatency() const
+{
+	return (std::uint64_t(this->period_frames) * 1000000) / this->rate;
+}
+
+/* static */ int SdlAudioSink::RingPower(std::uint32_t rate,
+                                         std::uint32_t buffer_ms,
+                                         std::uint32_t period_frames)
+{
+	// Round the number of samples up, so we never undershoot the latency.
+	std::uint64_t frames = (std::uint64_t(rate) * buffer_ms + 999) / 1000;
+	frames = std::max<std::uint64_t>(frames, 2 * std::uint64_t(period_frames));
+
+	int power = MIN_RING_POWER;
+	while (power < MAX_RING_POWER && (std::uint64_t(1) << power) < frames) {
+		power++;
+	}
+	return power;
+}
+
+/* static */ std::uint32_t SdlAudioSink::PeriodFrames(std::uint32_t rate,
+                                                     std::uint32_t period_ms)
+{
+	if (period_ms == 0) return 0;
+
+	std::uint64_t frames = (std::uint64_t(rate) * period_ms + 999) / 1000;
+
+	std::uint32_t pow2 = 1;
+	while (pow2 < MAX_PERIOD_FRAMES && pow2 < frames) pow2 <<= 1;
+	return pow2;
+}
+
+/* static */ std::uint64_t SdlAudioSink::RebufferFrames(
+        std::uint32_t rate, std::uint32_t rebuffer_ms, int ring_power)
+{
+	std::uint64_t frames = (std::uint64_t(rate) * rebuffer_ms + 999) / 1000;
+	return std::min(frames, (std::uint64_t(1) << ring_power) / 2);
+}
+
+UnderrunMonitor *SdlAudioSink::Underruns()
+{
+	return &this->underruns;
 }
 
 void SdlAudioSink::Transfer(AudioSink::TransferIterator &start,
@@ -184,6 +472,7 @@ void SdlAudioSink::Transfer(AudioSink::TransferIterator &start,
 	// Since we never write more than the ring buffer can take, the written
 	// count should equal the requested written count.
 	assert(written_count == count);
+	transferred_bytes.Add(written_count * this->bytes_per_sample);
 
 	start += (written_count * this->bytes_per_sample);
 	assert(start <= end);
@@ -191,6 +480,11 @@ void SdlAudioSink::Transfer(AudioSink::TransferIterator &start,
 
 void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 {
+	// In debug builds, this asserts that nothing below allocates.
+	RealTimeScope scope;
+	Tracer::Global().NameThread("audio");
+	TraceSpan span("SdlAudioSink::Callback");
+
 	assert(out != nullptr);
 
 	assert(0 <= nbytes);
@@ -204,6 +498,18 @@ void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 	// If we're not supposed to be playing, don't play anything.
 	if (this->state != Audio::State::PLAYING) return;
 
+	auto now = Now();
+	if (this->last_callback != 0) {
+		auto interval = static_cast<std::uint64_t>(
+		        std::max<std::int64_t>(0, now - this->last_callback) /
+		        1000);
+		auto period = this->PeriodLatency();
+		callback_interval_us.Record(interval);
+		callback_jitter_us.Record(interval < period ? period - interval
+		                                            : interval - period);
+	}
+	this->last_callback = now;
+
 	// Let's find out how many samples are available in total to give SDL.
 	//
 	// Note: Since we run concurrently with the decoder, which is also
@@ -214,25 +520,46 @@ void SdlAudioSink::Callback(std::uint8_t *out, int nbytes)
 	// `avail_samples`, as this is the only place where we can *decrease*
 	// it.
 	auto avail_samples = this->ring_buf.ReadCapacity();
+	ring_fill.Set(static_cast<std::int64_t>(avail_samples));
+
+	// How many samples do we want to pull out of the ring buffer?
+	auto req_samples = lnbytes / this->bytes_per_sample;
+
+	// How many should we pull out?  If we're short, this is an underrun,
+	// and we might hold off until we've rebuffered.
+	auto samples = static_cast<unsigned long>(this->underruns.Playable(
+	        avail_samples, req_samples, this->source_out, now));
 
 	// Have we run out of things to feed?
-	if (avail_samples == 0) {
+	if (samples == 0) {
 		// Is this a temporary condition, or have we genuinely played
 		// out all we can?  If the latter, we're now out too.
-		if (this->source_out) this->state = Audio::State::AT_END;
+		if (avail_samples == 0 && this->source_out) {
+			this->state = Audio::State::AT_END;
+		}
 
 		// Don't even bother reading from the ring buffer.
 		return;
 	}
 
-	// How many samples do we want to pull out of the ring buffer?
-	auto req_samples = lnbytes / this->bytes_per_sample;
-
-	// How many can we pull out?  Send this amount to SDL.
-	auto samples = std::min(req_samples, avail_samples);
+	// Send this amount to SDL.
 	auto read_samples =
 	        this->ring_buf.Read(reinterpret_cast<char *>(out), samples);
-	this->position_sample_count += read_samples;
+
+	// SDL plays what we've just given it once it's finished with what it
+	// already has, which is about a period's worth.  So, a period from
+	// now, we'll be hearing the first of these samples.
+	auto clock = this->LoadClock();
+	auto heard = Interpolate(clock, now, this->rate);
+	auto base = static_cast<std::int64_t>(clock.limit) -
+	            static_cast<std::int64_t>(this->period_frames);
+	this->StoreClock(
+	        {base, heard, clock.limit + read_samples, now, true});
+
+	// Now() is in nanoseconds; the status page works in microseconds.
+	if (this->status != nullptr) {
+		this->status->PublishPosition(heard, now / 1000);
+	}
 }
 
 /// Mappings from SampleFormats to their equivalent SDL_AudioFormats.
@@ -10,6 +10,7 @@
 #ifndef PLAYD_AUDIO_SINK_HPP
 #define PLAYD_AUDIO_SINK_HPP
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -22,6 +23,9 @@
 #include "audio_source.hpp"
 #include "ringbuffer.hpp"
 #include "sample_formats.hpp"
+#include "underrun.hpp"
+
+class StatusPage;
 
 /// Abstract class for audio output sinks.
 class AudioSink
@@ -56,8 +60,8 @@ public:
 
 	/**
 	 * Gets the current played position in the song, in samples.
-	 * As this may be executing whilst the playing callback is running,
-	 * do not expect it to be highly accurate.
+	 * This should be the sample currently being heard, not the last one
+	 * handed to the output device.
 	 * @return The current position, as a count of elapsed samples.
 	 */
 	virtual std::uint64_t Position() = 0;
@@ -71,6 +75,40 @@ public:
 	 */
 	virtual void SetPosition(std::uint64_t samples) = 0;
 
+	/**
+	 * Gets the latency introduced by this AudioSink's buffer.
+	 * This is how long it takes to play out a full buffer.
+	 * @return The buffer latency, in microseconds, or 0 if unknown.
+	 */
+	virtual std::uint64_t BufferLatency() const;
+
+	/**
+	 * Gets the period with which this AudioSink's device asks for audio.
+	 * @return The device period, in microseconds, or 0 if unknown.
+	 */
+	virtual std::uint64_t PeriodLatency() const;
+
+	/**
+	 * Gets the monitor counting this AudioSink's underruns.
+	 * @return The monitor, or nullptr if this AudioSink doesn't count them.
+	 */
+	virtual UnderrunMonitor *Underruns();
+
+	/**
+	 * Checks whether this AudioSink plays audio out in real time.
+	 * Sinks that don't are given audio as fast as it can be decoded.
+	 * @return True, unless overridden.
+	 */
+	virtual bool IsRealTime() const;
+
+	/**
+	 * Gets the current time on this AudioSink's clock.
+	 * This is the clock against which /player/time/anchor is stamped.
+	 * @return The time, in microseconds; unless overridden, this is the
+	 *   monotonic system clock.
+	 */
+	virtual std::int64_t Stamp() const;
+
 	/**
 	 * Tells this AudioSink that the source has run out.
 	 *
@@ -116,25 +154,154 @@ public:
 	static std::unique_ptr<AudioSink> Build(const AudioSource &source,
 	                                        int device_id);
 
+	/**
+	 * Helper function for creating uniquely pointed-to AudioSinks.
+	 * @param source The source from which this sink will receive audio.
+	 * @param device_id The device ID to which this sink will output.
+	 * @param buffer_ms The requested buffer length, in milliseconds.
+	 * @param period_ms The requested device period, in milliseconds, or 0
+	 *   to let SDL choose.
+	 * @param rebuffer_ms The audio to buffer again after an underrun
+	 *   before resuming, in milliseconds, or 0 to resume at once.
+	 * @param status The status page to which the playback position is
+	 *   published, if any.
+	 * @return A unique pointer to an AudioSink.
+	 */
+	static std::unique_ptr<AudioSink> Build(const AudioSource &source,
+	                                        int device_id,
+	                                        std::uint32_t buffer_ms,
+	                                        std::uint32_t period_ms,
+	                                        std::uint32_t rebuffer_ms = 0,
+	                                        StatusPage *status = nullptr);
+
 	/**
 	 * Constructs an SdlAudioSink.
 	 * @param source The source from which this sink will receive audio.
 	 * @param device_id The device ID to which this sink will output.
+	 * @param buffer_ms The requested buffer length, in milliseconds.  The
+	 *   buffer actually used may be slightly longer.
+	 * @param period_ms The requested device period, in milliseconds, or 0
+	 *   to let SDL choose.
+	 * @param rebuffer_ms The audio to buffer again after an underrun
+	 *   before resuming, in milliseconds, or 0 to resume at once.
+	 * @param status The status page to which the playback position is
+	 *   published, if any.
 	 */
-	SdlAudioSink(const AudioSource &source, int device_id);
+	SdlAudioSink(const AudioSource &source, int device_id,
+	             std::uint32_t buffer_ms = DEFAULT_BUFFER_MS,
+	             std::uint32_t period_ms = DEFAULT_PERIOD_MS,
+	             std::uint32_t rebuffer_ms = 0,
+	             StatusPage *status = nullptr);
 
 	/// Destructs an SdlAudioSink.
 	~SdlAudioSink() override;
 
+	/**
+	 * Allocates an SdlAudioSink on pages of its own.
+	 * Real-time mode can then lock the sink into RAM, and unlock it
+	 * again, without touching any other object's pages.
+	 * @param size The size of the sink, in bytes.
+	 * @return The memory for the sink.
+	 * @see RealTime::Allocate
+	 */
+	static void *operator new(size_t size);
+
+	/**
+	 * Frees the memory of an SdlAudioSink.
+	 * @param p The memory, from operator new.
+	 */
+	static void operator delete(void *p);
+
 	void Start() override;
 	void Stop() override;
 	Audio::State State() override;
 	std::uint64_t Position() override;
 	void SetPosition(std::uint64_t samples) override;
+	std::uint64_t BufferLatency() const override;
+	std::uint64_t PeriodLatency() const override;
+	UnderrunMonitor *Underruns() override;
 	void SourceOut() override;
 	void Transfer(TransferIterator &start,
 	              const TransferIterator &end) override;
 
+	/// The default buffer length, in milliseconds.
+	static const std::uint32_t DEFAULT_BUFFER_MS;
+
+	/// The default device period, in milliseconds (0: SDL's choice).
+	static const std::uint32_t DEFAULT_PERIOD_MS;
+
+	/**
+	 * Works out how big a ring buffer needs to be.
+	 * The ring buffer holds at least @a buffer_ms of audio, and at least
+	 * two device periods.
+	 * @param rate The sample rate, in Hz.
+	 * @param buffer_ms The requested buffer length, in milliseconds.
+	 * @param period_frames The device period, in samples, or 0 if unknown.
+	 * @return n, where 2^n is the number of samples the ring buffer holds.
+	 */
+	static int RingPower(std::uint32_t rate, std::uint32_t buffer_ms,
+	                     std::uint32_t period_frames);
+
+	/**
+	 * Works out the device period to request from SDL.
+	 * @param rate The sample rate, in Hz.
+	 * @param period_ms The requested period, in milliseconds.
+	 * @return The period, in samples, rounded up to a power of two; or 0
+	 *   (meaning SDL's default) if @a period_ms is 0.
+	 */
+	static std::uint32_t PeriodFrames(std::uint32_t rate,
+	                                  std::uint32_t period_ms);
+
+	/**
+	 * Works out how much audio to buffer again after an underrun.
+	 * This is capped at half the ring buffer, so that it is always
+	 * reachable.
+	 * @param rate The sample rate, in Hz.
+	 * @param rebuffer_ms The requested amount, in milliseconds.
+	 * @param ring_power n, where 2^n is the ring buffer's capacity.
+	 * @return The amount, in samples.
+	 */
+	static std::uint64_t RebufferFrames(std::uint32_t rate,
+	                                    std::uint32_t rebuffer_ms,
+	                                    int ring_power);
+
+	/**
+	 * A snapshot of the sink's playback clock.
+	 *
+	 * The clock says which sample was (or will be) heard at a given
+	 * instant; the position at any other instant is interpolated from it
+	 * at the sample rate, within the bounds of what has actually been
+	 * handed to the device.
+	 */
+	struct Clock {
+		/// The sample heard at @a stamp.  This may be negative, or
+		/// below @a floor, if nothing was yet audible at @a stamp.
+		std::int64_t base;
+
+		/// The earliest position the clock may report.
+		std::uint64_t floor;
+
+		/// The latest position the clock may report: the number of
+		/// samples handed to the device.
+		std::uint64_t limit;
+
+		/// The monotonic time of the snapshot, in nanoseconds.
+		std::int64_t stamp;
+
+		/// Whether the position is advancing.
+		bool running;
+	};
+
+	/**
+	 * Works out the position a Clock gives for a given instant.
+	 * @param clock The clock snapshot.
+	 * @param now The monotonic time, in nanoseconds.
+	 * @param rate The sample rate, in Hz.
+	 * @return The position, in samples.
+	 */
+	static std::uint64_t Interpolate(const Clock &clock, std::int64_t now,
+	                                 std::uint32_t rate);
+
 	/**
 	 * The callback proper.
 	 * This is executed in a separate thread by SDL once a stream is
@@ -171,28 +338,103 @@ public:
 	/// Cleans up the AudioSink's libraries, if not cleaned up already.
 	static void CleanupLibrary();
 
+	/**
+	 * Sets whether SdlAudioSinks constructed from now on run in real-time
+	 * mode.  In real-time mode, each sink locks its ring buffer and its
+	 * own state into RAM, and asks SDL to run its audio thread with
+	 * real-time (SCHED_FIFO, or rtkit) priority.  Either may be refused
+	 * without the right privileges, in which case playd carries on
+	 * without.
+	 * @param enabled Whether to enable real-time mode.
+	 */
+	static void SetRealTime(bool enabled);
+
 private:
+	/// Whether SdlAudioSinks are being constructed in real-time mode.
+	static bool realtime;
+
 	/// The SDL device to which we are outputting sound.
 	SDL_AudioDeviceID device;
 
-	/// n, where 2^n is the capacity of the Audio ring buffer.
-	/// @see RINGBUF_SIZE
-	static const size_t RINGBUF_POWER;
+	/// Whether this sink's state is locked into RAM.
+	bool pinned;
+
+	/// The smallest allowed ring buffer power.
+	static const int MIN_RING_POWER;
+
+	/// The largest allowed ring buffer power.
+	static const int MAX_RING_POWER;
 
 	/// Number of bytes in one sample.
 	size_t bytes_per_sample;
 
+	/// The sample rate, in Hz.
+	std::uint32_t rate;
+
+	/// n, where 2^n is the capacity of the Audio ring buffer.
+	int ring_power;
+
+	/// The device period SDL actually gave us, in samples.
+	std::uint32_t period_frames;
+
 	/// The ring buffer used to transfer samples to the playing callback.
 	RingBuffer ring_buf;
 
-	/// The current position, in samples.
-	std::uint64_t position_sample_count;
+	/// The status page to which the callback publishes, if any.
+	StatusPage *status;
+
+	/// Counts underruns, and decides when to resume after them.
+	UnderrunMonitor underruns;
+
+	/// When the callback last ran while playing, in nanoseconds, or 0
+	/// if it hasn't since playback started.
+	std::int64_t last_callback;
+
+	//
+	// The playback clock is written by the SDL callback thread, and by
+	// the main thread with the device locked, and read by the main thread.
+	// It is a seqlock: writers make clock_seq odd while writing, and
+	// readers retry if it was odd or changed while they were reading.
+	//
+
+	std::atomic<std::uint32_t> clock_seq;     ///< The clock's sequence.
+	std::atomic<std::int64_t> clock_base;     ///< @see Clock::base
+	std::atomic<std::uint64_t> clock_floor;   ///< @see Clock::floor
+	std::atomic<std::uint64_t> clock_limit;   ///< @see Clock::limit
+	std::atomic<std::int64_t> clock_stamp;    ///< @see Clock::stamp
+	std::atomic<bool> clock_running;          ///< @see Clock::running
 
 	/// Whether the source has run out of things to feed the sink.
-	bool source_out;
+	std::atomic<bool> source_out;
 
 	/// The decoder's current state.
-	Audio::State state;
+	std::atomic<Audio::State> state;
+
+	/**
+	 * Reads a consistent snapshot of the playback clock.
+	 * @return The snapshot.
+	 */
+	Clock LoadClock() const;
+
+	/**
+	 * Replaces the playback clock.
+	 * Only one thread may call this at once: either the callback, or
+	 * another thread with the device locked.
+	 * @param clock The new snapshot.
+	 */
+	void StoreClock(const Clock &clock);
+
+	/**
+	 * Freezes the playback clock at the current position.
+	 * The device must be locked, or paused.
+	 */
+	void FreezeClock();
+
+	/**
+	 * Gets the current monotonic time.
+	 * @return The time, in nanoseconds since an arbitrary epoch.
+	 */
+	static std::int64_t Now();
 };
 
 #endif // PLAYD_AUDIO_SINK_HPP
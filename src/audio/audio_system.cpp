@@ -9,11 +9,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <list>
 #include <map>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "../errors.hpp"
 #include "../messages.h"
@@ -21,15 +27,29 @@
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
 #include "audio_system.hpp"
+#include "pcm_cache.hpp"
+#include "prefetcher.hpp"
 #include "sample_formats.hpp"
 
 #include "sources/mp3.hpp"
 #include "sources/sndfile.hpp"
 
+// This is enough to see past the start of most files, but small enough that
+// reading it costs about the same as the decoder's own first read.
+const size_t AudioSystem::SNIFF_SIZE = 4096;
+
+// This covers the first few seconds of all but the most extravagant files.
+const std::uint64_t AudioSystem::PREFETCH_LENGTH = 8 * 1024 * 1024;
+
+// Far more than a show's worth of tracks, so repeat loads stay cheap, but
+// a scan of a whole library can't grow the cache without bound.
+const size_t AudioSystem::MAX_FORMATS = 256;
+
 AudioSystem::AudioSystem(int device_id)
     : sink([](const AudioSource &, int) -> std::unique_ptr<AudioSink> {
 	      throw InternalError("No audio sink!");
       }),
+      prefetcher(new Prefetcher(PREFETCH_LENGTH)),
       device_id(device_id)
 {
 }
@@ -41,7 +61,26 @@ std::unique_ptr<Audio> AudioSystem::Null() const
 
 std::unique_ptr<Audio> AudioSystem::Load(const std::string &path) const
 {
-	std::unique_ptr<AudioSource> source = this->LoadSource(path);
+	std::unique_ptr<AudioSource> source;
+	if (this->cache != nullptr) source = this->cache->Lookup(path);
+
+	if (source == nullptr) {
+		// Reading the file's start here would stall every client on
+		// the disk, and prewarming it in the background now would be
+		// too late to help, so only files prefetched ahead of time
+		// skip the disk.  A cold one is worth a note, though.
+		if (!this->prefetcher->IsWarm(path)) {
+			Debug() << "prefetch: wasn't warm:" << path << std::endl;
+		}
+
+		source = this->LoadSource(path);
+
+		// Decode a second copy into the cache, so next time we can
+		// skip straight to the samples.
+		if (this->cache != nullptr) {
+			this->cache->Fill(path, this->Builder(path));
+		}
+	}
 	assert(source != nullptr);
 
 	auto sink = this->sink(*source, this->device_id);
@@ -51,15 +90,145 @@ std::unique_ptr<Audio> AudioSystem::Load(const std::string &path) const
 
 std::unique_ptr<AudioSource> AudioSystem::LoadSource(const std::string &path) const
 {
-	size_t extpoint = path.find_last_of('.');
-	std::string ext = path.substr(extpoint + 1);
+	auto &builder = this->Builder(path);
 
-	auto ibuilder = this->sources.find(ext);
+	try {
+		return builder(path);
+	} catch (FileError &) {
+		// The file might have been replaced since we cached its format,
+		// so make sure the next attempt looks at it afresh.
+		this->ForgetFormat(path);
+		throw;
+	}
+}
+
+const AudioSystem::SourceBuilder &AudioSystem::Builder(
+        const std::string &path) const
+{
+	std::string format = this->Format(path);
+
+	auto ibuilder = this->sources.find(format);
 	if (ibuilder == this->sources.end()) {
-		throw FileError("Unknown file format: " + ext);
+		throw FileError("Unknown file format: " + format);
+	}
+
+	return ibuilder->second;
+}
+
+std::string AudioSystem::Format(const std::string &path) const
+{
+	auto cached = this->formats.find(path);
+	if (cached != this->formats.end()) {
+		this->formats_order.splice(this->formats_order.end(),
+		                           this->formats_order,
+		                           cached->second.order);
+		return cached->second.format;
+	}
+
+	// What the file says it is trumps what its name says it is, but only
+	// if we can actually do something with that format.
+	std::string format = AudioSystem::SniffFile(path);
+	if (this->sources.count(format) == 0) {
+		format = AudioSystem::Extension(path);
+	}
+
+	// Don't cache failures; the user might yet register a source for it,
+	// or fix the file.
+	if (this->sources.count(format) != 0) {
+		auto order = this->formats_order.insert(
+		        this->formats_order.end(), path);
+		this->formats.emplace(path, CachedFormat{format, order});
+	}
+
+	while (MAX_FORMATS < this->formats_order.size()) {
+		this->formats.erase(this->formats_order.front());
+		this->formats_order.pop_front();
+	}
+
+	return format;
+}
+
+void AudioSystem::ForgetFormat(const std::string &path) const
+{
+	auto cached = this->formats.find(path);
+	if (cached == this->formats.end()) return;
+
+	this->formats_order.erase(cached->second.order);
+	this->formats.erase(cached);
+}
+
+/* static */ std::string AudioSystem::SniffFile(const std::string &path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file) return "";
+
+	std::vector<std::uint8_t> header(SNIFF_SIZE);
+	file.read(reinterpret_cast<char *>(&header.front()), header.size());
+	header.resize(static_cast<size_t>(file.gcount()));
+
+	return AudioSystem::SniffFormat(header);
+}
+
+/* static */ std::string AudioSystem::SniffFormat(
+        const std::vector<std::uint8_t> &header)
+{
+	auto size = header.size();
+	auto has_magic = [&header, size](size_t at, const char *magic) {
+		size_t len = std::strlen(magic);
+		if (size < at + len) return false;
+		return std::equal(magic, magic + len, header.begin() + at);
+	};
+
+	if (has_magic(0, "fLaC")) return "flac";
+	if (has_magic(0, "OggS")) return "ogg";
+	if (has_magic(0, "RIFF") && has_magic(8, "WAVE")) return "wav";
+
+	if (has_magic(0, "ID3") && 10 <= size) {
+		// ID3v2 tags are usually on MP3s, but can precede other
+		// formats.  If we can see past the tag, check what follows;
+		// its length is a 28-bit 'synchsafe' integer (7 bits per byte).
+		size_t tag = 10 + ((header[6] & 0x7F) << 21) +
+		             ((header[7] & 0x7F) << 14) +
+		             ((header[8] & 0x7F) << 7) + (header[9] & 0x7F);
+		if (tag < size) {
+			std::vector<std::uint8_t> rest(header.begin() + tag,
+			                               header.end());
+			auto format = AudioSystem::SniffFormat(rest);
+			if (!format.empty()) return format;
+		}
+		return "mp3";
 	}
 
-	return (ibuilder->second)(path);
+	// An MPEG audio frame header starts with 11 set sync bits.  We also
+	// reject the reserved version, layer, bitrate and sample rate values,
+	// as random data is otherwise quite likely to look like a frame.
+	if (4 <= size && header[0] == 0xFF && (header[1] & 0xE0) == 0xE0) {
+		bool version_ok = ((header[1] >> 3) & 0x03) != 0x01;
+		bool layer_ok = ((header[1] >> 1) & 0x03) != 0x00;
+		bool bitrate_ok = ((header[2] >> 4) & 0x0F) != 0x0F;
+		bool rate_ok = ((header[2] >> 2) & 0x03) != 0x03;
+		if (version_ok && layer_ok && bitrate_ok && rate_ok) {
+			return "mp3";
+		}
+	}
+
+	return "";
+}
+
+/* static */ std::string AudioSystem::Extension(const std::string &path)
+{
+	size_t extpoint = path.find_last_of('.');
+	return AudioSystem::Lowercase(path.substr(extpoint + 1));
+}
+
+/* static */ std::string AudioSystem::Lowercase(const std::string &str)
+{
+	std::string lower(str);
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) {
+		return static_cast<char>(
+		        std::tolower(static_cast<unsigned char>(c)));
+	});
+	return lower;
 }
 
 void AudioSystem::SetSink(AudioSystem::SinkBuilder sink)
@@ -67,8 +236,34 @@ void AudioSystem::SetSink(AudioSystem::SinkBuilder sink)
 	this->sink = sink;
 }
 
+void AudioSystem::SetCache(std::unique_ptr<PcmCache> cache)
+{
+	this->cache = std::move(cache);
+}
+
+void AudioSystem::SetPrefetcher(std::unique_ptr<Prefetcher> prefetcher)
+{
+	assert(prefetcher != nullptr);
+	this->prefetcher = std::move(prefetcher);
+}
+
+void AudioSystem::Prefetch(const std::string &path)
+{
+	this->prefetcher->Add(path);
+}
+
+std::vector<std::string> AudioSystem::Prefetched() const
+{
+	return this->prefetcher->Warmed();
+}
+
+void AudioSystem::ClearPrefetched()
+{
+	this->prefetcher->Clear();
+}
+
 void AudioSystem::AddSource(const std::string &ext,
                             AudioSystem::SourceBuilder source)
 {
-	this->sources.emplace(ext, source);
+	this->sources.emplace(AudioSystem::Lowercase(ext), source);
 }
@@ -10,13 +10,19 @@
 #ifndef PLAYD_AUDIO_SYSTEM_HPP
 #define PLAYD_AUDIO_SYSTEM_HPP
 
+#include <cstdint>
 #include <functional>
+#include <list>
+#include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "audio.hpp"
 #include "audio_sink.hpp"
 #include "audio_source.hpp"
+#include "pcm_cache.hpp"
+#include "prefetcher.hpp"
 
 /**
  * An AudioSystem represents the entire audio stack used by playd.
@@ -24,7 +30,8 @@
  * The AudioSystem is responsible for creating Audio instances,
  * enumerating and resolving device IDs, and initialising and terminating the
  * audio libraries.  It creates Audio by chaining together audio _sources_,
- * selected by file extension, and an audio _sink_.
+ * selected by sniffing the file's contents (falling back to its extension),
+ * and an audio _sink_.
  *
  * @see NoAudio
  * @see PipeAudio
@@ -67,25 +74,142 @@ public:
 	 */
 	void SetSink(SinkBuilder sink);
 
+	/**
+	 * Sets a cache of decoded audio to use when loading files.
+	 * Files not yet in the cache are added to it in the background as
+	 * they are loaded.
+	 * @param cache The cache to use, or nullptr to stop using a cache.
+	 */
+	void SetCache(std::unique_ptr<PcmCache> cache);
+
+	/**
+	 * Sets the prefetcher used to prewarm files before they are loaded.
+	 * @param prefetcher The prefetcher to use.
+	 */
+	void SetPrefetcher(std::unique_ptr<Prefetcher> prefetcher);
+
+	/**
+	 * Queues a file to be prewarmed in the background, ahead of its load.
+	 * Load itself never prewarms, so only files queued here spare their
+	 * first decodes the disk.
+	 * @param path The path to the file.
+	 * @see Prefetcher
+	 */
+	void Prefetch(const std::string &path);
+
+	/**
+	 * Lists the files that have been prewarmed.
+	 * @return The paths of the warm files, least recently warmed first.
+	 */
+	std::vector<std::string> Prefetched() const;
+
+	/// Forgets about all prewarmed and queued files.
+	void ClearPrefetched();
+
 	/**
 	 * Assign an AudioSource for a file extension.
-	 * @param ext The file extension to associate with this source.
+	 * @param ext The file extension to associate with this source.  This
+	 *   is also the format name returned by SniffFormat, and is matched
+	 *   case-insensitively.
 	 * @param source The function to use when building source.
 	 * @note If two AddSource invocations name the first file extension,
 	 *   the first is used for said extension.
 	 */
 	void AddSource(const std::string &ext, SourceBuilder source);
 
+	/**
+	 * Guesses the format of a file from the first few bytes of its data.
+	 * @param header The first bytes of the file (at most SNIFF_SIZE).
+	 * @return The format name (one of "mp3", "flac", "ogg" or "wav"), or
+	 *   the empty string if the format was not recognised.
+	 */
+	static std::string SniffFormat(const std::vector<std::uint8_t> &header);
+
+	/// The number of paths whose formats are remembered.
+	static const size_t MAX_FORMATS;
+
 private:
+	/// The number of bytes read from the start of a file for sniffing.
+	static const size_t SNIFF_SIZE;
+
+	/// The default number of bytes prewarmed from the start of a file.
+	static const std::uint64_t PREFETCH_LENGTH;
+
 	/// The current sink builder.
 	SinkBuilder sink;
 
 	/// Map from file extensions to source builders.
 	std::map<std::string, SourceBuilder> sources;
 
+	/// The cache of decoded audio, if any.
+	std::unique_ptr<PcmCache> cache;
+
+	/// The prefetcher for files that are about to be loaded.
+	std::unique_ptr<Prefetcher> prefetcher;
+
+	/// A format chosen for a loaded path.
+	struct CachedFormat {
+		std::string format; ///< The name of the format.
+
+		/// This entry's position in formats_order.
+		std::list<std::string>::iterator order;
+	};
+
+	/// Cache of the source format already chosen for each loaded path.
+	/// This saves re-sniffing files that are loaded repeatedly.
+	mutable std::map<std::string, CachedFormat> formats;
+
+	/// The paths in formats, least recently used first.
+	mutable std::list<std::string> formats_order;
+
 	/// The device ID for the sink.
 	int device_id;
 
+	/**
+	 * Finds the source builder to use when loading a file.
+	 * @param path The path to the file to load.
+	 * @return The builder for the file's format.
+	 * @exception FileError Thrown if no source handles the file's format.
+	 */
+	const SourceBuilder &Builder(const std::string &path) const;
+
+	/**
+	 * Decides which format to use when loading a file.
+	 * The result is cached per path.
+	 * @param path The path to the file to load.
+	 * @return The format name, which may not have a source registered.
+	 */
+	std::string Format(const std::string &path) const;
+
+	/**
+	 * Forgets the cached format of a file.
+	 * @param path The path to the file.
+	 */
+	void ForgetFormat(const std::string &path) const;
+
+	/**
+	 * Reads the start of a file and sniffs its format.
+	 * @param path The path to the file to sniff.
+	 * @return The format name, or the empty string if the file couldn't
+	 *   be read or its format was not recognised.
+	 * @see SniffFormat
+	 */
+	static std::string SniffFile(const std::string &path);
+
+	/**
+	 * Gets the lowercased extension of a path.
+	 * @param path The path whose extension is wanted.
+	 * @return The text after the last '.' in @a path, in lowercase.
+	 */
+	static std::string Extension(const std::string &path);
+
+	/**
+	 * Converts a string to lowercase.
+	 * @param str The string to convert.
+	 * @return @a str, with any ASCII capitals in lowercase.
+	 */
+	static std::string Lowercase(const std::string &str);
+
 	/**
 	 * Loads a file, creating an AudioSource.
 	 * @param path The path to the file to load.
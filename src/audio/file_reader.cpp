@@ -0,0 +1,276 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the FileReader class.
+ * @see audio/file_reader.hpp
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../errors.hpp"
+#include "file_reader.hpp"
+
+// Big enough that each read is worth the trip to the disk, and that a
+// decoder's typical few-KiB reads rarely straddle two blocks.
+const std::uint64_t FileReader::BLOCK_SIZE = 64 * 1024;
+
+// Half a MiB in flight covers several seconds of even lossless audio.
+const std::uint64_t FileReader::DEPTH = 8;
+
+FileReader::FileReader(const std::string &path)
+    : fd(FileReader::Open(path)),
+      length(FileReader::LengthOf(this->fd)),
+      position(0),
+      failed(false),
+      stopping(false)
+{
+	if (this->length < 0) {
+		close(this->fd);
+		throw FileError("can't stat " + path);
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	// We do our own read-ahead, but the kernel may as well know too.
+	posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	this->worker = std::thread(&FileReader::Work, this);
+}
+
+FileReader::~FileReader()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->moved.notify_all();
+	this->worker.join();
+
+	close(this->fd);
+}
+
+std::int64_t FileReader::Read(void *buf, std::uint64_t count)
+{
+	auto out = static_cast<std::uint8_t *>(buf);
+	std::uint64_t done = 0;
+
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	// Decoders tend to treat short reads as the end of the file, so keep
+	// going until we've either filled the buffer or actually hit the end.
+	while (done < count && this->position < this->length) {
+		auto block = static_cast<std::uint64_t>(this->position) / BLOCK_SIZE;
+
+		this->loaded.wait(guard, [this, block] {
+			return this->failed || this->blocks.count(block) != 0;
+		});
+
+		auto it = this->blocks.find(block);
+		if (it == this->blocks.end()) {
+			// The read-ahead failed; report what we have so far.
+			return done == 0 ? -1 : static_cast<std::int64_t>(done);
+		}
+
+		auto offset = static_cast<std::uint64_t>(this->position) -
+		              (block * BLOCK_SIZE);
+		if (it->second.size() <= offset) break; // File shrank.
+
+		auto n = std::min(count - done, it->second.size() - offset);
+		std::memcpy(out + done, &it->second[offset], n);
+
+		done += n;
+		this->position += n;
+
+		// Let the worker know it can start on the next block.
+		this->moved.notify_one();
+	}
+
+	return static_cast<std::int64_t>(done);
+}
+
+std::int64_t FileReader::Seek(std::int64_t offset, int whence)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	std::int64_t base = 0;
+	switch (whence) {
+		case SEEK_SET:
+			base = 0;
+			break;
+		case SEEK_CUR:
+			base = this->position;
+			break;
+		case SEEK_END:
+			base = this->length;
+			break;
+		default:
+			return -1;
+	}
+	if (base + offset < 0) return -1;
+
+	this->position = base + offset;
+
+	// Whatever went wrong before might have been specific to the old
+	// position, so give the worker another go.
+	this->failed = false;
+	this->moved.notify_one();
+
+	return this->position;
+}
+
+std::int64_t FileReader::Tell()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->position;
+}
+
+std::int64_t FileReader::Length() const
+{
+	return this->length;
+}
+
+void FileReader::Work()
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	while (true) {
+		std::uint64_t first = 0;
+		std::uint64_t count = 0;
+		this->moved.wait(guard, [this, &first, &count] {
+			return this->stopping || this->NextBlocks(first, count);
+		});
+		if (this->stopping) return;
+
+		guard.unlock();
+		std::vector<std::vector<std::uint8_t>> data;
+		bool ok = this->ReadBlocks(first, count, data);
+		guard.lock();
+
+		if (ok) {
+			for (std::uint64_t i = 0; i < count; i++) {
+				this->blocks.emplace(first + i, std::move(data[i]));
+			}
+		} else {
+			Debug() << "reader: read failed at" << first * BLOCK_SIZE
+			        << std::endl;
+			this->failed = true;
+		}
+		this->loaded.notify_all();
+	}
+}
+
+bool FileReader::NextBlocks(std::uint64_t &first, std::uint64_t &count)
+{
+	if (this->failed) return false;
+
+	auto current = static_cast<std::uint64_t>(this->position) / BLOCK_SIZE;
+	auto last = current + DEPTH;
+
+	// Anything outside the window is either behind us, or was read ahead
+	// of a position we've since seeked away from.
+	for (auto it = this->blocks.begin(); it != this->blocks.end();) {
+		if (it->first < current || last <= it->first) {
+			it = this->blocks.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	count = 0;
+	for (auto b = current; b < last; b++) {
+		if (this->length <= static_cast<std::int64_t>(b * BLOCK_SIZE)) {
+			break;
+		}
+
+		bool missing = this->blocks.count(b) == 0;
+		if (count == 0 && missing) first = b;
+		if (0 < count && !missing) break;
+		if (missing) count++;
+
+		// A reader may be waiting on the current block, so it mustn't
+		// wait on the rest of the window too.
+		if (b == current && missing) break;
+	}
+
+	return 0 < count;
+}
+
+bool FileReader::ReadBlocks(std::uint64_t first, std::uint64_t count,
+                            std::vector<std::vector<std::uint8_t>> &data) const
+{
+	auto start = static_cast<std::int64_t>(first * BLOCK_SIZE);
+
+	data.resize(static_cast<size_t>(count));
+	std::vector<struct iovec> iov(static_cast<size_t>(count));
+	std::int64_t total = 0;
+	for (size_t i = 0; i < iov.size(); i++) {
+		auto size = std::min<std::int64_t>(BLOCK_SIZE,
+		                                   this->length - start - total);
+		data[i].resize(static_cast<size_t>(size));
+		iov[i].iov_base = data[i].data();
+		iov[i].iov_len = static_cast<size_t>(size);
+		total += size;
+	}
+
+	std::int64_t got = 0;
+	size_t next = 0;
+	while (got < total) {
+		auto n = preadv(this->fd, &iov[next],
+		                static_cast<int>(iov.size() - next), start + got);
+		if (n < 0) return false;
+		if (n == 0) break; // File shrank.
+		got += n;
+
+		// Skip past the buffers that read filled, and into the one it
+		// left part-filled.
+		auto left = static_cast<size_t>(n);
+		while (next < iov.size() && iov[next].iov_len <= left) {
+			left -= iov[next].iov_len;
+			next++;
+		}
+		if (next < iov.size()) {
+			iov[next].iov_base =
+			        static_cast<std::uint8_t *>(iov[next].iov_base) + left;
+			iov[next].iov_len -= left;
+		}
+	}
+
+	// Trim whatever a shrunken file didn't fill.
+	for (size_t i = 0; i < data.size(); i++) {
+		auto offset = static_cast<std::int64_t>(i * BLOCK_SIZE);
+		auto filled = std::max<std::int64_t>(0, got - offset);
+		if (filled < static_cast<std::int64_t>(data[i].size())) {
+			data[i].resize(static_cast<size_t>(filled));
+		}
+	}
+	return true;
+}
+
+/* static */ int FileReader::Open(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw FileError("can't open " + path);
+	return fd;
+}
+
+/* static */ std::int64_t FileReader::LengthOf(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return -1;
+	return static_cast<std::int64_t>(st.st_size);
+}
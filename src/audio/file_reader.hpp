@@ -0,0 +1,159 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the FileReader class.
+ * @see audio/file_reader.cpp
+ */
+
+#ifndef PLAYD_FILE_READER_HPP
+#define PLAYD_FILE_READER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A FileReader reads a file for a decoder, keeping reads ahead in flight.
+ *
+ * The file is divided into fixed-size blocks.  A background thread keeps
+ * the blocks just ahead of the read position loaded, so that a decoder
+ * reading sequentially through the file only ever copies out of memory,
+ * rather than waiting on the disk in the middle of a Decode.  The thread
+ * asks for every missing block of the window in one preadv(2), so the disk
+ * sees the whole read-ahead at once rather than one block at a time.  The
+ * block at the read position itself is the exception: a reader may be
+ * waiting on it, so it is read on its own first.
+ *
+ * The interface mimics read(2) and lseek(2), so that it can sit behind the
+ * decoders' custom I/O hooks.
+ *
+ * @see Mp3AudioSource
+ * @see SndfileAudioSource
+ */
+class FileReader
+{
+public:
+	/**
+	 * Constructs a FileReader, and starts reading ahead.
+	 * @param path The path of the file to read.
+	 * @exception FileError Thrown if the file can't be opened.
+	 */
+	FileReader(const std::string &path);
+
+	/// Destructs a FileReader, closing its file.
+	~FileReader();
+
+	/// Deleted copy constructor.
+	FileReader(const FileReader &) = delete;
+
+	/// Deleted copy-assignment.
+	FileReader &operator=(const FileReader &) = delete;
+
+	/**
+	 * Reads from the current position, advancing it.
+	 * This only blocks if the read-ahead hasn't got to the data yet.
+	 * @param buf The buffer to read into.
+	 * @param count The maximum number of bytes to read.
+	 * @return The number of bytes read (0 at end of file), or -1 on error.
+	 */
+	std::int64_t Read(void *buf, std::uint64_t count);
+
+	/**
+	 * Moves the current position.
+	 * @param offset The offset to move to, relative to @a whence.
+	 * @param whence One of SEEK_SET, SEEK_CUR or SEEK_END.
+	 * @return The new position, or -1 if the seek was invalid.
+	 */
+	std::int64_t Seek(std::int64_t offset, int whence);
+
+	/**
+	 * Gets the current position.
+	 * @return The current position, in bytes from the start of the file.
+	 */
+	std::int64_t Tell();
+
+	/**
+	 * Gets the length of the file.
+	 * @return The length of the file, in bytes.
+	 */
+	std::int64_t Length() const;
+
+private:
+	/// The size of each block read from the file.
+	static const std::uint64_t BLOCK_SIZE;
+
+	/// The number of blocks kept loaded ahead of the read position.
+	static const std::uint64_t DEPTH;
+
+	int fd;                    ///< The file descriptor of the file.
+	const std::int64_t length; ///< The length of the file.
+
+	std::mutex lock; ///< Lock guarding everything below this point.
+
+	/// The current read position.
+	std::int64_t position;
+
+	/// Map from block numbers to loaded blocks.
+	std::map<std::uint64_t, std::vector<std::uint8_t>> blocks;
+
+	/// Whether a read from the file has failed.
+	bool failed;
+
+	/// Signals the worker that the read position has moved.
+	std::condition_variable moved;
+
+	/// Signals readers that a block has been loaded.
+	std::condition_variable loaded;
+
+	/// Whether the worker should exit.
+	bool stopping;
+
+	/// The background thread that loads blocks.
+	std::thread worker;
+
+	/// The body of the worker thread.
+	void Work();
+
+	/**
+	 * Finds the next run of blocks the worker should load.
+	 * The lock must be held.  Also drops blocks outside the window.
+	 * @param first Set to the first block to load.
+	 * @param count Set to the number of consecutive blocks to load.
+	 * @return Whether there are blocks to load.
+	 */
+	bool NextBlocks(std::uint64_t &first, std::uint64_t &count);
+
+	/**
+	 * Reads a run of blocks from the file, without the lock.
+	 * @param first The first block to read.
+	 * @param count The number of consecutive blocks to read.
+	 * @param data Set to the blocks read; those past the end of the file
+	 *   come back short, or empty.
+	 * @return Whether the read succeeded.
+	 */
+	bool ReadBlocks(std::uint64_t first, std::uint64_t count,
+	                std::vector<std::vector<std::uint8_t>> &data) const;
+
+	/**
+	 * Opens a file.
+	 * @param path The path of the file to open.
+	 * @return The file descriptor.
+	 * @exception FileError Thrown if the file can't be opened.
+	 */
+	static int Open(const std::string &path);
+
+	/**
+	 * Gets the length of an open file.
+	 * @param fd The file descriptor.
+	 * @return The file's length, in bytes.
+	 */
+	static std::int64_t LengthOf(int fd);
+};
+
+#endif // PLAYD_FILE_READER_HPP
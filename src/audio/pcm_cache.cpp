@@ -0,0 +1,375 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the PcmCache class.
+ * @see audio/pcm_cache.hpp
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#include "../errors.hpp"
+#include "audio_source.hpp"
+#include "pcm_cache.hpp"
+#include "sources/raw.hpp"
+
+// Oversized files are rare, so this is plenty, while keeping a daemon that
+// sees many of them from remembering them all.
+const size_t PcmCache::MAX_REJECTED = 64;
+
+PcmCache::PcmCache(const std::string &dir, std::uint64_t budget)
+    : dir(dir), budget(budget), size(0), stopping(false)
+{
+	struct stat st;
+	if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+		throw ConfigError("PCM cache directory doesn't exist: " + dir);
+	}
+
+	this->Scan();
+	this->worker = std::thread(&PcmCache::Work, this);
+}
+
+PcmCache::~PcmCache()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	this->worker.join();
+}
+
+std::unique_ptr<AudioSource> PcmCache::Lookup(const std::string &path)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	auto it = this->entries.find(path);
+	if (it == this->entries.end()) return nullptr;
+
+	// If the original has changed since we cached it, the cache file is
+	// useless.
+	std::uint64_t source_size;
+	std::int64_t source_mtime;
+	if (!PcmCache::Stat(path, source_size, source_mtime) ||
+	    source_size != it->second.source_size ||
+	    source_mtime != it->second.source_mtime) {
+		this->Evict(path);
+		return nullptr;
+	}
+
+	std::unique_ptr<AudioSource> source;
+	try {
+		source = std::unique_ptr<AudioSource>(
+		        new RawAudioSource(path, it->second.file));
+	} catch (FileError &e) {
+		Debug() << "pcm-cache: bad cache file:" << e.Message()
+		        << std::endl;
+		this->Evict(path);
+		return nullptr;
+	}
+
+	// Mark the file as recently used, both here and on disk (where Scan
+	// will see it the next time playd starts).
+	this->lru.splice(this->lru.end(), this->lru, it->second.lru);
+	utime(it->second.file.c_str(), nullptr);
+
+	return source;
+}
+
+void PcmCache::Fill(const std::string &path, SourceBuilder builder)
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (this->entries.count(path) != 0) return;
+		if (this->IsRejected(path)) return;
+		if (!this->pending.insert(path).second) return;
+		this->queue.emplace_back(path, builder);
+	}
+	this->wake.notify_one();
+}
+
+std::uint64_t PcmCache::Size()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->size;
+}
+
+bool PcmCache::Store(const std::string &path, AudioSource &source)
+{
+	Entry entry;
+	entry.file = this->CacheFile(path);
+	if (!PcmCache::Stat(path, entry.source_size, entry.source_mtime)) {
+		return false;
+	}
+
+	RawAudioSource::Header header;
+	header.rate = source.SampleRate();
+	header.channels = source.ChannelCount();
+	header.format = static_cast<std::uint8_t>(source.OutputSampleFormat());
+	header.samples = 0;
+	header.source_size = entry.source_size;
+	header.source_mtime = entry.source_mtime;
+
+	// We decode into a temporary file and rename it into place, so that
+	// nobody ever maps a half-written cache file.
+	std::string temp = entry.file + ".tmp";
+	std::ofstream os(temp, std::ios::out | std::ios::binary |
+	                               std::ios::trunc);
+	if (!os) return false;
+	RawAudioSource::WriteHeader(os, header, path);
+
+	std::uint64_t bytes = 0;
+	bool ok = true;
+	bool too_big = false;
+	while (ok) {
+		{
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (this->stopping) {
+				ok = false;
+				break;
+			}
+		}
+
+		auto result = source.Decode();
+		if (result.first == AudioSource::DecodeState::END_OF_FILE) break;
+
+		auto &decoded = result.second;
+		if (decoded.empty()) continue;
+
+		// No point caching a file that would evict everything else and
+		// still not fit.
+		bytes += decoded.size();
+		if (this->budget < bytes) {
+			too_big = true;
+			ok = false;
+			break;
+		}
+
+		os.write(reinterpret_cast<const char *>(&decoded.front()),
+		         decoded.size());
+		if (!os) ok = false;
+	}
+
+	if (ok) {
+		// Now we know how long the file is, fill in the header properly.
+		header.samples = bytes / source.BytesPerSample();
+		os.seekp(0);
+		RawAudioSource::WriteHeader(os, header, path);
+		os.close();
+		ok = static_cast<bool>(os);
+	}
+
+	if (ok) ok = std::rename(temp.c_str(), entry.file.c_str()) == 0;
+
+	if (!ok) {
+		std::remove(temp.c_str());
+		if (too_big) {
+			std::lock_guard<std::mutex> guard(this->lock);
+			this->Reject(path, Rejection{entry.source_size,
+			                             entry.source_mtime});
+		}
+		return false;
+	}
+
+	std::uint64_t file_size;
+	std::int64_t file_mtime;
+	if (!PcmCache::Stat(entry.file, file_size, file_mtime)) return false;
+	entry.bytes = file_size;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->Insert(path, entry);
+	return true;
+}
+
+void PcmCache::Work()
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	while (true) {
+		this->wake.wait(guard, [this] {
+			return this->stopping || !this->queue.empty();
+		});
+		if (this->stopping) return;
+
+		auto job = this->queue.front();
+		this->queue.pop_front();
+
+		// Decoding the whole file takes a while, so let the loop thread
+		// get at the cache in the meantime.
+		guard.unlock();
+		Debug() << "pcm-cache: filling" << job.first << std::endl;
+		try {
+			auto source = job.second(job.first);
+			if (!this->Store(job.first, *source)) {
+				Debug() << "pcm-cache: couldn't cache" << job.first
+				        << std::endl;
+			}
+		} catch (Error &e) {
+			Debug() << "pcm-cache: couldn't decode" << job.first
+			        << ":" << e.Message() << std::endl;
+		}
+		guard.lock();
+
+		this->pending.erase(job.first);
+	}
+}
+
+void PcmCache::Scan()
+{
+	DIR *d = opendir(this->dir.c_str());
+	if (d == nullptr) {
+		throw ConfigError("can't read PCM cache directory: " + this->dir);
+	}
+
+	// Adopt the files oldest-first, so that the LRU order survives.
+	std::multimap<std::int64_t, std::pair<std::string, Entry>> found;
+
+	for (struct dirent *de = readdir(d); de != nullptr; de = readdir(d)) {
+		std::string name(de->d_name);
+		std::string file = this->dir + "/" + name;
+
+		auto dot = name.find_last_of('.');
+		if (dot == std::string::npos) continue;
+		if (name.substr(dot) == ".tmp") {
+			// Left over from a fill that was interrupted.
+			std::remove(file.c_str());
+			continue;
+		}
+		if (name.substr(dot) != ".pcm") continue;
+
+		RawAudioSource::Header header;
+		std::string path;
+		std::uint64_t bytes;
+		std::int64_t mtime;
+		// Files we can't adopt would otherwise sit there forever,
+		// outside the budget.
+		if (!RawAudioSource::ReadHeader(file, header, path) ||
+		    file != this->CacheFile(path) ||
+		    !PcmCache::Stat(file, bytes, mtime)) {
+			Debug() << "pcm-cache: removing stray file:" << file
+			        << std::endl;
+			std::remove(file.c_str());
+			continue;
+		}
+
+		Entry entry;
+		entry.file = file;
+		entry.bytes = bytes;
+		entry.source_size = header.source_size;
+		entry.source_mtime = header.source_mtime;
+		found.emplace(mtime, std::make_pair(path, entry));
+	}
+	closedir(d);
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (auto &f : found) this->Insert(f.second.first, f.second.second);
+}
+
+void PcmCache::Insert(const std::string &path, Entry entry)
+{
+	// Any entry already using this cache file (an older copy of this file,
+	// or another file whose name hashed the same) has just been
+	// overwritten, so forget about it without deleting the file.
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (it->second.file != entry.file) {
+			++it;
+			continue;
+		}
+		this->size -= it->second.bytes;
+		this->lru.erase(it->second.lru);
+		it = this->entries.erase(it);
+	}
+
+	entry.lru = this->lru.insert(this->lru.end(), path);
+	this->size += entry.bytes;
+	this->entries.emplace(path, entry);
+
+	// Make room by dropping the least recently used files.  This never
+	// drops the new file, as Store refuses to cache files over budget.
+	while (this->budget < this->size && this->lru.front() != path) {
+		this->Evict(this->lru.front());
+	}
+}
+
+bool PcmCache::IsRejected(const std::string &path) const
+{
+	auto it = this->rejected.find(path);
+	if (it == this->rejected.end()) return false;
+
+	// A file that has changed may well fit now.
+	std::uint64_t size;
+	std::int64_t mtime;
+	return PcmCache::Stat(path, size, mtime) && size == it->second.size &&
+	       mtime == it->second.mtime;
+}
+
+void PcmCache::Reject(const std::string &path, const Rejection &rejection)
+{
+	if (this->rejected.count(path) != 0) this->rejected_order.remove(path);
+	this->rejected[path] = rejection;
+	this->rejected_order.push_back(path);
+
+	while (MAX_REJECTED < this->rejected_order.size()) {
+		this->rejected.erase(this->rejected_order.front());
+		this->rejected_order.pop_front();
+	}
+}
+
+void PcmCache::Evict(const std::string &path)
+{
+	auto it = this->entries.find(path);
+	if (it == this->entries.end()) return;
+
+	Debug() << "pcm-cache: evicting" << path << std::endl;
+
+	// Any RawAudioSource still mapping the file keeps its data alive.
+	std::remove(it->second.file.c_str());
+
+	assert(it->second.bytes <= this->size);
+	this->size -= it->second.bytes;
+	this->lru.erase(it->second.lru);
+	this->entries.erase(it);
+}
+
+std::string PcmCache::CacheFile(const std::string &path) const
+{
+	// Cache files outlive the playd that wrote them, so the name has to
+	// come from a hash that doesn't change between builds, as
+	// std::hash may: this is 64-bit FNV-1a.
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	for (auto c : path) {
+		hash ^= static_cast<std::uint8_t>(c);
+		hash *= 0x100000001b3ULL;
+	}
+
+	std::ostringstream os;
+	os << this->dir << "/" << std::hex << hash << ".pcm";
+	return os.str();
+}
+
+/* static */ bool PcmCache::Stat(const std::string &path, std::uint64_t &size,
+                                 std::int64_t &mtime)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return false;
+
+	size = static_cast<std::uint64_t>(st.st_size);
+	mtime = static_cast<std::int64_t>(st.st_mtime);
+	return true;
+}
@@ -0,0 +1,217 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the PcmCache class.
+ * @see audio/pcm_cache.cpp
+ */
+
+#ifndef PLAYD_PCM_CACHE_HPP
+#define PLAYD_PCM_CACHE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "audio_source.hpp"
+
+/**
+ * An on-disk cache of fully decoded audio.
+ *
+ * The first time a file is loaded, the PcmCache decodes a second copy of it
+ * on a background thread and stores the resulting samples, as a raw PCM
+ * file, in its cache directory.  Subsequent loads of the same file are then
+ * served from a memory-mapped RawAudioSource, which costs next to nothing to
+ * decode and seeks exactly.
+ *
+ * The cache is bounded by a byte budget; the least recently used files are
+ * evicted to stay within it.  Cached files remember the size and modification
+ * time of the file they were decoded from, and are discarded if the original
+ * changes.  Files that decode to more than the whole budget are remembered,
+ * likewise until they change, so that they aren't decoded again on every
+ * load.
+ *
+ * @see RawAudioSource
+ * @see AudioSystem::SetCache
+ */
+class PcmCache
+{
+public:
+	/// Type for functions that construct the sources used to fill the cache.
+	using SourceBuilder =
+	        std::function<std::unique_ptr<AudioSource>(const std::string &)>;
+
+	/**
+	 * Constructs a PcmCache.
+	 * Any cache files already in @a dir are adopted by the new cache.
+	 * @param dir The directory in which cached files are kept.  This
+	 *   should be somewhere fast (a tmpfs, for example).
+	 * @param budget The maximum number of bytes of cached files to keep.
+	 * @exception ConfigError Thrown if @a dir cannot be used.
+	 */
+	PcmCache(const std::string &dir, std::uint64_t budget);
+
+	/// Destructs a PcmCache, abandoning any fill in progress.
+	~PcmCache();
+
+	/// Deleted copy constructor.
+	PcmCache(const PcmCache &) = delete;
+
+	/// Deleted copy-assignment.
+	PcmCache &operator=(const PcmCache &) = delete;
+
+	/**
+	 * Tries to get a source for a cached file.
+	 * @param path The path of the original audio file.
+	 * @return A source reading the cached samples, or nullptr if the file
+	 *   is not (or no longer) in the cache.
+	 */
+	std::unique_ptr<AudioSource> Lookup(const std::string &path);
+
+	/**
+	 * Queues a file to be decoded into the cache in the background.
+	 * This does nothing if the file is already cached or queued.
+	 * @param path The path of the original audio file.
+	 * @param builder The function used to build a decoder for the file.
+	 */
+	void Fill(const std::string &path, SourceBuilder builder);
+
+	/**
+	 * Decodes all of a source into the cache, on the calling thread.
+	 * @param path The path of the original audio file.
+	 * @param source A fresh source decoding @a path.
+	 * @return Whether the file was cached; this may fail if the decoded
+	 *   audio is larger than the whole budget.
+	 */
+	bool Store(const std::string &path, AudioSource &source);
+
+	/**
+	 * The total size of the cached files.
+	 * @return The number of bytes used by the cache, which is at most the
+	 *   budget given at construction.
+	 */
+	std::uint64_t Size();
+
+private:
+	/// The most oversized files the PcmCache remembers refusing.
+	static const size_t MAX_REJECTED;
+
+	/// The size and modification time of a file refused as too large.
+	struct Rejection {
+		std::uint64_t size;  ///< The size of the file.
+		std::int64_t mtime;  ///< The modification time of the file.
+	};
+
+	/// A file in the cache.
+	struct Entry {
+		std::string file;          ///< The path of the cache file.
+		std::uint64_t bytes;       ///< The size of the cache file.
+		std::uint64_t source_size; ///< The size of the original file.
+		std::int64_t source_mtime; ///< The original file's mtime.
+
+		/// This entry's position in the LRU list.
+		std::list<std::string>::iterator lru;
+	};
+
+	const std::string dir;      ///< The cache directory.
+	const std::uint64_t budget; ///< The maximum cache size, in bytes.
+
+	std::mutex lock; ///< Lock guarding everything below this point.
+
+	/// Map from original file paths to cache entries.
+	std::map<std::string, Entry> entries;
+
+	/// Original file paths, least recently used first.
+	std::list<std::string> lru;
+
+	/// The total size of the cached files.
+	std::uint64_t size;
+
+	/// Files waiting to be filled by the worker.
+	std::deque<std::pair<std::string, SourceBuilder>> queue;
+
+	/// Files that are queued or being filled.
+	std::set<std::string> pending;
+
+	/// Map from paths to files that decoded to more than the budget.
+	std::map<std::string, Rejection> rejected;
+
+	/// Rejected file paths, least recently rejected first.
+	std::list<std::string> rejected_order;
+
+	/// Signals the worker that the queue has changed.
+	std::condition_variable wake;
+
+	/// Whether the worker should give up and exit.
+	bool stopping;
+
+	/// The background thread that fills the cache.
+	std::thread worker;
+
+	/// The body of the worker thread.
+	void Work();
+
+	/// Adopts any cache files left in the cache directory.
+	void Scan();
+
+	/**
+	 * Adds an entry to the cache, evicting others if needed.
+	 * The cache lock must be held.
+	 * @param path The path of the original audio file.
+	 * @param entry The entry for the cache file.
+	 */
+	void Insert(const std::string &path, Entry entry);
+
+	/**
+	 * Checks whether a file was refused as too large since it last changed.
+	 * The cache lock must be held.
+	 * @param path The path of the original audio file.
+	 * @return Whether the file was refused.
+	 */
+	bool IsRejected(const std::string &path) const;
+
+	/**
+	 * Records that a file was refused as too large, forgetting the oldest
+	 * such file if need be.
+	 * The cache lock must be held.
+	 * @param path The path of the original audio file.
+	 * @param rejection The file's size and modification time.
+	 */
+	void Reject(const std::string &path, const Rejection &rejection);
+
+	/**
+	 * Removes an entry, and its cache file, from the cache.
+	 * The cache lock must be held.
+	 * @param path The path of the original audio file.
+	 */
+	void Evict(const std::string &path);
+
+	/**
+	 * Gets the name of the cache file for an original audio file.
+	 * @param path The path of the original audio file.
+	 * @return The path of the cache file.
+	 */
+	std::string CacheFile(const std::string &path) const;
+
+	/**
+	 * Gets the size and modification time of a file.
+	 * @param path The file to examine.
+	 * @param size Set to the size of the file.
+	 * @param mtime Set to the modification time of the file.
+	 * @return Whether the file could be examined.
+	 */
+	static bool Stat(const std::string &path, std::uint64_t &size,
+	                 std::int64_t &mtime);
+};
+
+#endif // PLAYD_PCM_CACHE_HPP
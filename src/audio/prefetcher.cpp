@@ -0,0 +1,204 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Prefetcher class.
+ * @see audio/prefetcher.hpp
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "../errors.hpp"
+#include "prefetcher.hpp"
+
+// Enough to cover a day or so of playout queued up ahead of time, while
+// keeping the list readable when emitted as a resource.
+const size_t Prefetcher::MAX_WARM = 64;
+
+Prefetcher::Prefetcher(std::uint64_t length) : length(length), stopping(false)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	if (this->worker.joinable()) this->worker.join();
+}
+
+void Prefetcher::Add(const std::string &path)
+{
+	Stamp stamp;
+	bool exists = Prefetcher::StampOf(path, stamp);
+
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (exists && this->IsWarmLocked(path, stamp)) return;
+		if (!this->pending.insert(path).second) return;
+		this->queue.push_back(path);
+
+		if (!this->worker.joinable()) {
+			this->worker = std::thread(&Prefetcher::Work, this);
+		}
+	}
+	this->wake.notify_one();
+}
+
+bool Prefetcher::IsWarm(const std::string &path)
+{
+	Stamp stamp;
+	if (!Prefetcher::StampOf(path, stamp)) return false;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->IsWarmLocked(path, stamp);
+}
+
+std::vector<std::string> Prefetcher::Warmed()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return std::vector<std::string>(this->order.begin(), this->order.end());
+}
+
+void Prefetcher::Clear()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	// Anything currently being prewarmed will still be marked warm when it
+	// finishes, which is true enough.
+	for (const auto &path : this->queue) this->pending.erase(path);
+	this->queue.clear();
+	this->warm.clear();
+	this->order.clear();
+}
+
+void Prefetcher::Work()
+{
+	Prefetcher::LowerPriority();
+
+	std::unique_lock<std::mutex> guard(this->lock);
+
+	while (true) {
+		this->wake.wait(guard, [this] {
+			return this->stopping || !this->queue.empty();
+		});
+		if (this->stopping) return;
+
+		auto path = this->queue.front();
+		this->queue.pop_front();
+
+		guard.unlock();
+		Debug() << "prefetch: warming" << path << std::endl;
+		Stamp stamp;
+		bool ok = Prefetcher::Prewarm(path, this->length, stamp);
+		if (!ok) Debug() << "prefetch: can't read" << path << std::endl;
+		guard.lock();
+
+		this->pending.erase(path);
+		if (ok) this->MarkWarm(path, stamp);
+	}
+}
+
+bool Prefetcher::IsWarmLocked(const std::string &path, const Stamp &stamp) const
+{
+	auto it = this->warm.find(path);
+	if (it == this->warm.end()) return false;
+
+	// If the file has changed, the pages we read are probably not the
+	// pages that will be decoded.
+	return it->second.size == stamp.size && it->second.mtime == stamp.mtime;
+}
+
+void Prefetcher::MarkWarm(const std::string &path, const Stamp &stamp)
+{
+	if (this->warm.count(path) != 0) {
+		this->order.remove(path);
+	}
+	this->warm[path] = stamp;
+	this->order.push_back(path);
+
+	// The page cache will have long since forgotten the oldest files
+	// anyway, so there's no point in us remembering them.
+	while (MAX_WARM < this->order.size()) {
+		this->warm.erase(this->order.front());
+		this->order.pop_front();
+	}
+}
+
+/* static */ bool Prefetcher::Prewarm(const std::string &path,
+                                      std::uint64_t length, Stamp &stamp)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	stamp.size = static_cast<std::uint64_t>(st.st_size);
+	stamp.mtime = static_cast<std::int64_t>(st.st_mtime);
+
+	auto bytes = static_cast<off_t>(std::min(length, stamp.size));
+	posix_fadvise(fd, 0, bytes, POSIX_FADV_WILLNEED);
+
+#ifdef __linux__
+	// Unlike the advice above, readahead only returns once the pages are
+	// in, which is what makes warming a guarantee rather than a hint.
+	readahead(fd, 0, static_cast<size_t>(bytes));
+#else
+	// Elsewhere, the only sure way of getting the pages in is to read them.
+	std::vector<char> buffer(65536);
+	for (off_t at = 0; at < bytes;) {
+		auto got = pread(fd, &buffer.front(), buffer.size(), at);
+		if (got <= 0) break;
+		at += got;
+	}
+#endif
+
+	close(fd);
+	return true;
+}
+
+/* static */ bool Prefetcher::StampOf(const std::string &path, Stamp &stamp)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return false;
+
+	stamp.size = static_cast<std::uint64_t>(st.st_size);
+	stamp.mtime = static_cast<std::int64_t>(st.st_mtime);
+	return true;
+}
+
+/* static */ void Prefetcher::LowerPriority()
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	// There's no glibc wrapper for ioprio_set, nor a header with these
+	// constants in userspace, so we have to spell them out ourselves.
+	const int IOPRIO_WHO_PROCESS = 1;
+	const int IOPRIO_CLASS_IDLE = 3;
+	const int IOPRIO_CLASS_SHIFT = 13;
+
+	// A 'process' ID of 0 means the calling thread.
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+	            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+		Debug() << "prefetch: can't lower I/O priority" << std::endl;
+	}
+#endif
+}
@@ -0,0 +1,158 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Prefetcher class.
+ * @see audio/prefetcher.cpp
+ */
+
+#ifndef PLAYD_PREFETCHER_HPP
+#define PLAYD_PREFETCHER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A Prefetcher pulls the starts of upcoming audio files into the page cache.
+ *
+ * Paths are queued with Add, and read ahead on a background thread running
+ * at idle I/O priority (where the OS supports it), so that a later Load of
+ * the file doesn't stall its first decodes waiting for the disk.
+ *
+ * The Prefetcher remembers which files it has prewarmed, along with their
+ * size and modification time at the time, so it can tell whether a file
+ * still needs warming when it is loaded.
+ *
+ * @see AudioSystem::Prefetch
+ */
+class Prefetcher
+{
+public:
+	/**
+	 * Constructs a Prefetcher.
+	 * The background thread is only started once something is queued.
+	 * @param length The number of bytes to read ahead from the start of
+	 *   each file.
+	 */
+	Prefetcher(std::uint64_t length);
+
+	/// Destructs a Prefetcher, abandoning any queued files.
+	~Prefetcher();
+
+	/// Deleted copy constructor.
+	Prefetcher(const Prefetcher &) = delete;
+
+	/// Deleted copy-assignment.
+	Prefetcher &operator=(const Prefetcher &) = delete;
+
+	/**
+	 * Queues a file to be prewarmed in the background.
+	 * This does nothing if the file is already warm or queued.
+	 * @param path The path of the file.
+	 */
+	void Add(const std::string &path);
+
+	/**
+	 * Checks whether a file has been prewarmed since it last changed.
+	 * @param path The path of the file.
+	 * @return Whether the file is warm.
+	 */
+	bool IsWarm(const std::string &path);
+
+	/**
+	 * Lists the files that have been prewarmed.
+	 * @return The paths of the warm files, least recently warmed first.
+	 */
+	std::vector<std::string> Warmed();
+
+	/// Forgets about all warm and queued files.
+	void Clear();
+
+private:
+	/// The most files the Prefetcher remembers as warm.
+	static const size_t MAX_WARM;
+
+	/// The size and modification time of a file, when it was prewarmed.
+	struct Stamp {
+		std::uint64_t size;  ///< The size of the file.
+		std::int64_t mtime;  ///< The modification time of the file.
+	};
+
+	/// The number of bytes to read ahead from the start of each file.
+	const std::uint64_t length;
+
+	std::mutex lock; ///< Lock guarding everything below this point.
+
+	/// Map from warm file paths to their stamps.
+	std::map<std::string, Stamp> warm;
+
+	/// Warm file paths, least recently warmed first.
+	std::list<std::string> order;
+
+	/// Files waiting to be prewarmed by the worker.
+	std::deque<std::string> queue;
+
+	/// Files that are queued or being prewarmed.
+	std::set<std::string> pending;
+
+	/// Signals the worker that the queue has changed.
+	std::condition_variable wake;
+
+	/// Whether the worker should give up and exit.
+	bool stopping;
+
+	/// The background thread that prewarms files.
+	std::thread worker;
+
+	/// The body of the worker thread.
+	void Work();
+
+	/**
+	 * Checks whether a file is warm.
+	 * The lock must be held.
+	 * @param path The path of the file.
+	 * @param stamp The file's current stamp.
+	 * @return Whether the file is warm.
+	 */
+	bool IsWarmLocked(const std::string &path, const Stamp &stamp) const;
+
+	/**
+	 * Records that a file is warm, forgetting the oldest if need be.
+	 * The lock must be held.
+	 * @param path The path of the file.
+	 * @param stamp The file's stamp when it was prewarmed.
+	 */
+	void MarkWarm(const std::string &path, const Stamp &stamp);
+
+	/**
+	 * Reads the start of a file into the page cache.
+	 * @param path The path of the file.
+	 * @param length The number of bytes to read ahead.
+	 * @param stamp Set to the file's stamp.
+	 * @return Whether the file could be read.
+	 */
+	static bool Prewarm(const std::string &path, std::uint64_t length,
+	                    Stamp &stamp);
+
+	/**
+	 * Gets the stamp of a file.
+	 * @param path The path of the file.
+	 * @param stamp Set to the file's stamp.
+	 * @return Whether the file could be examined.
+	 */
+	static bool StampOf(const std::string &path, Stamp &stamp);
+
+	/// Lowers the I/O priority of the calling thread, if possible.
+	static void LowerPriority();
+};
+
+#endif // PLAYD_PREFETCHER_HPP
@@ -0,0 +1,169 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the RealTime and RealTimeScope classes.
+ * @see realtime.hpp
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "realtime.hpp"
+
+/// How deeply the current thread is nested in RealTimeScopes.
+static thread_local int realtime_depth = 0;
+
+/// How many times the current thread has called operator new.
+static thread_local std::uint64_t allocations = 0;
+
+//
+// RealTime
+//
+
+#ifdef _WIN32
+
+/* static */ void *RealTime::Allocate(size_t length)
+{
+	// Nothing is ever pinned here, so there are no pages to keep apart.
+	void *p = std::malloc(length == 0 ? 1 : length);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+/* static */ void RealTime::Free(void *start)
+{
+	std::free(start);
+}
+
+/* static */ bool RealTime::Pin(const void *, size_t)
+{
+	return false;
+}
+
+/* static */ void RealTime::Unpin(const void *, size_t)
+{
+}
+
+#else
+
+/* static */ void *RealTime::Allocate(size_t length)
+{
+	auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+	// Rounding up to whole pages keeps the allocator from putting anything
+	// else on the last one.
+	auto rounded = (length + page - 1) / page * page;
+	void *p = nullptr;
+	if (posix_memalign(&p, page, rounded == 0 ? page : rounded) != 0) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+/* static */ void RealTime::Free(void *start)
+{
+	std::free(start);
+}
+
+/* static */ bool RealTime::Pin(const void *start, size_t length)
+{
+	return mlock(start, length) == 0;
+}
+
+/* static */ void RealTime::Unpin(const void *start, size_t length)
+{
+	munlock(start, length);
+}
+
+#endif // _WIN32
+
+//
+// RealTimeScope
+//
+
+RealTimeScope::RealTimeScope()
+{
+	realtime_depth++;
+}
+
+RealTimeScope::~RealTimeScope()
+{
+	assert(0 < realtime_depth);
+	realtime_depth--;
+}
+
+/* static */ bool RealTimeScope::Active()
+{
+	return 0 < realtime_depth;
+}
+
+/* static */ std::uint64_t RealTimeScope::Allocations()
+{
+	return allocations;
+}
+
+//
+// Debug allocation checks
+//
+
+#ifndef NDEBUG
+
+void *operator new(size_t size)
+{
+	assert(!RealTimeScope::Active() && "allocation in real-time code");
+	allocations++;
+
+	// malloc(0) may return nullptr, but new must return a unique pointer.
+	void *p = std::malloc(size == 0 ? 1 : size);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	assert(!RealTimeScope::Active() && "allocation in real-time code");
+	allocations++;
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+#endif // NDEBUG
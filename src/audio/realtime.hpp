@@ -0,0 +1,100 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the RealTime and RealTimeScope classes.
+ * @see realtime.cpp
+ */
+
+#ifndef PLAYD_AUDIO_REALTIME_HPP
+#define PLAYD_AUDIO_REALTIME_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Helpers for keeping the audio callback's memory resident.
+ *
+ * A page fault in the callback stalls the audio thread for as long as the
+ * kernel takes to bring the page back in, which can be long enough to
+ * underrun.  Locking the callback's memory into RAM rules that out.
+ *
+ * Memory is locked a whole page at a time, and locks don't nest, so
+ * unlocking one object would unlock any other that shares its pages.  Only
+ * memory from Allocate, which shares its pages with nothing else, should
+ * be pinned.
+ */
+class RealTime
+{
+public:
+	/**
+	 * Allocates memory on pages of its own, fit for Pin.
+	 * @param length The length of the region, in bytes.
+	 * @return The start of the region, which is page-aligned.
+	 * @exception std::bad_alloc Thrown if the memory can't be allocated.
+	 */
+	static void *Allocate(size_t length);
+
+	/**
+	 * Frees memory from Allocate.
+	 * @param start The start of the region; nullptr is ignored.
+	 */
+	static void Free(void *start);
+
+	/**
+	 * Locks a region of memory from Allocate into RAM.
+	 * This needs enough RLIMIT_MEMLOCK (or privilege) to succeed.
+	 * @param start The start of the region.
+	 * @param length The length of the region, in bytes.
+	 * @return Whether the region was locked.
+	 */
+	static bool Pin(const void *start, size_t length);
+
+	/**
+	 * Unlocks a region of memory locked with Pin.
+	 * This must happen before the region is freed.
+	 * @param start The start of the region.
+	 * @param length The length of the region, in bytes.
+	 */
+	static void Unpin(const void *start, size_t length);
+};
+
+/**
+ * Marks the current thread as running real-time code while in scope.
+ *
+ * In debug builds (those without NDEBUG), playd replaces the global
+ * operator new, and asserts that no thread allocates while inside a
+ * RealTimeScope: an allocation can take the allocator's lock, or fault in
+ * fresh pages, and so stall the audio thread.
+ */
+class RealTimeScope
+{
+public:
+	/// Enters a real-time scope.
+	RealTimeScope();
+
+	/// Leaves the real-time scope.
+	~RealTimeScope();
+
+	/// Deleted copy constructor.
+	RealTimeScope(const RealTimeScope &) = delete;
+
+	/// Deleted copy-assignment.
+	RealTimeScope &operator=(const RealTimeScope &) = delete;
+
+	/**
+	 * Checks whether the current thread is in a real-time scope.
+	 * @return Whether the current thread must not allocate or lock.
+	 */
+	static bool Active();
+
+	/**
+	 * Counts the current thread's allocations through operator new.
+	 * Only debug builds count; in others, this is always 0.
+	 * @return The number of allocations the thread has made so far.
+	 */
+	static std::uint64_t Allocations();
+};
+
+#endif // PLAYD_AUDIO_REALTIME_HPP
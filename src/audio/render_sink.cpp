@@ -0,0 +1,252 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the RenderFile and RenderAudioSink classes.
+ * @see audio/render_sink.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../errors.hpp"
+#include "audio.hpp"
+#include "audio_sink.hpp"
+#include "audio_source.hpp"
+#include "render_sink.hpp"
+#include "sample_formats.hpp"
+
+/// The size of the WAV header RenderFile writes, in bytes.
+static const std::uint32_t WAV_HEADER_SIZE = 44;
+
+/**
+ * Appends a little-endian integer to a byte string.
+ * @param out The string to which the integer is appended.
+ * @param value The integer.
+ * @param size The size of the integer, in bytes.
+ */
+static void PutLE(std::string &out, std::uint32_t value, int size)
+{
+	for (int i = 0; i < size; i++) {
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+	}
+}
+
+//
+// RenderFile
+//
+
+RenderFile::RenderFile(const std::string &path)
+    : path(path),
+      out(path, std::ios::out | std::ios::binary | std::ios::trunc),
+      bound(false),
+      rate(0),
+      channels(0),
+      format(SampleFormat::PACKED_SIGNED_INT_16),
+      bytes(0)
+{
+	if (!this->out) throw FileError("can't create render file " + path);
+
+	auto dot = path.find_last_of('.');
+	auto ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) {
+		return static_cast<char>(std::tolower(c));
+	});
+	this->wav = ext == "wav";
+}
+
+RenderFile::~RenderFile()
+{
+	try {
+		this->Flush();
+	} catch (FileError &e) {
+		Debug() << e.Message() << std::endl;
+	}
+}
+
+void RenderFile::Bind(const AudioSource &source)
+{
+	auto rate = source.SampleRate();
+	auto channels = source.ChannelCount();
+	auto format = source.OutputSampleFormat();
+
+	if (!this->bound) {
+		this->rate = rate;
+		this->channels = channels;
+		this->format = format;
+		this->bound = true;
+
+		// The header goes in now, so the samples land after it.
+		if (this->wav) this->WriteHeader();
+		return;
+	}
+
+	if (rate != this->rate || channels != this->channels ||
+	    format != this->format) {
+		throw FileError("can't render " + source.Path() + " into " +
+		                this->path + ": its rate, channels or sample "
+		                "format differ from the first file's");
+	}
+}
+
+void RenderFile::Write(const std::uint8_t *start, size_t bytes)
+{
+	assert(this->bound);
+
+	if (this->wav && this->format == SampleFormat::PACKED_SIGNED_INT_8) {
+		std::vector<std::uint8_t> flipped(start, start + bytes);
+		for (auto &b : flipped) b ^= 0x80;
+		this->out.write(reinterpret_cast<const char *>(flipped.data()),
+		                static_cast<std::streamsize>(bytes));
+	} else {
+		this->out.write(reinterpret_cast<const char *>(start),
+		                static_cast<std::streamsize>(bytes));
+	}
+
+	if (!this->out) throw FileError("can't write to " + this->path);
+	this->bytes += bytes;
+}
+
+void RenderFile::Flush()
+{
+	if (this->wav && this->bound) {
+		auto end = this->out.tellp();
+		this->out.seekp(0);
+		this->WriteHeader();
+		this->out.seekp(end);
+	}
+
+	this->out.flush();
+	if (!this->out) throw FileError("can't write to " + this->path);
+}
+
+std::uint64_t RenderFile::Bytes() const
+{
+	return this->bytes;
+}
+
+void RenderFile::WriteHeader()
+{
+	auto bps = static_cast<std::uint32_t>(
+	        SAMPLE_FORMAT_BPS[static_cast<int>(this->format)]);
+	auto align = bps * this->channels;
+	bool is_float = this->format == SampleFormat::PACKED_FLOAT_32;
+
+	// Past 4GiB, the sizes saturate; most readers then read to the end.
+	auto limit = std::uint64_t(UINT32_MAX) - WAV_HEADER_SIZE;
+	auto data = static_cast<std::uint32_t>(std::min(this->bytes, limit));
+
+	std::string header = "RIFF";
+	PutLE(header, data + WAV_HEADER_SIZE - 8, 4);
+	header += "WAVEfmt ";
+	PutLE(header, 16, 4);               // fmt chunk size
+	PutLE(header, is_float ? 3 : 1, 2); // IEEE float, or integer PCM
+	PutLE(header, this->channels, 2);
+	PutLE(header, this->rate, 4);
+	PutLE(header, this->rate * align, 4); // bytes per second
+	PutLE(header, align, 2);
+	PutLE(header, bps * 8, 2); // bits per sample
+	header += "data";
+	PutLE(header, data, 4);
+	assert(header.size() == WAV_HEADER_SIZE);
+
+	this->out.write(header.data(), header.size());
+}
+
+//
+// RenderAudioSink
+//
+
+/* static */ std::unique_ptr<AudioSink> RenderAudioSink::Build(
+        const AudioSource &source, std::shared_ptr<RenderFile> file)
+{
+	return std::unique_ptr<AudioSink>(
+	        new RenderAudioSink(source, std::move(file)));
+}
+
+RenderAudioSink::RenderAudioSink(const AudioSource &source,
+                                 std::shared_ptr<RenderFile> file)
+    : file(std::move(file)),
+      bytes_per_sample(source.BytesPerSample()),
+      state(Audio::State::STOPPED),
+      position(0),
+      source_out(false)
+{
+	assert(this->file != nullptr);
+	this->file->Bind(source);
+}
+
+RenderAudioSink::~RenderAudioSink()
+{
+	try {
+		this->file->Flush();
+	} catch (FileError &e) {
+		Debug() << e.Message() << std::endl;
+	}
+}
+
+void RenderAudioSink::Start()
+{
+	if (this->state != Audio::State::STOPPED) return;
+	this->state = Audio::State::PLAYING;
+}
+
+void RenderAudioSink::Stop()
+{
+	this->state = Audio::State::STOPPED;
+}
+
+Audio::State RenderAudioSink::State()
+{
+	// Everything taken has already been 'heard', so once the source is
+	// out, so are we.
+	if (this->source_out && this->state == Audio::State::PLAYING) {
+		this->state = Audio::State::AT_END;
+		this->file->Flush();
+	}
+	return this->state;
+}
+
+std::uint64_t RenderAudioSink::Position()
+{
+	return this->position;
+}
+
+void RenderAudioSink::SetPosition(std::uint64_t samples)
+{
+	this->position = samples;
+	this->source_out = false;
+}
+
+bool RenderAudioSink::IsRealTime() const
+{
+	return false;
+}
+
+void RenderAudioSink::SourceOut()
+{
+	this->source_out = true;
+}
+
+void RenderAudioSink::Transfer(TransferIterator &start,
+                               const TransferIterator &end)
+{
+	assert(start <= end);
+	if (this->state != Audio::State::PLAYING) return;
+
+	// Decoders only ever hand over whole samples.
+	auto bytes = static_cast<size_t>(end - start);
+	assert(bytes % this->bytes_per_sample == 0);
+	if (bytes == 0) return;
+
+	this->file->Write(&*start, bytes);
+	this->position += bytes / this->bytes_per_sample;
+	start = end;
+}
@@ -0,0 +1,149 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the RenderFile and RenderAudioSink classes.
+ * @see audio/render_sink.cpp
+ */
+
+#ifndef PLAYD_AUDIO_RENDER_SINK_HPP
+#define PLAYD_AUDIO_RENDER_SINK_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "audio.hpp"
+#include "audio_sink.hpp"
+#include "audio_source.hpp"
+#include "sample_formats.hpp"
+
+/**
+ * A file into which playd renders its output, instead of playing it.
+ *
+ * Every file played while rendering goes into the same RenderFile, one
+ * after another, so they must all share a sample rate, channel count and
+ * sample format: the first file played decides them.
+ *
+ * Files whose names end in .wav get a WAV header, which is brought up to
+ * date whenever a file stops rendering; anything else is raw,
+ * native-endian, packed samples, exactly as they would have gone to SDL.
+ * WAV has no signed 8-bit format, so signed 8-bit samples are made
+ * unsigned in WAV files.
+ */
+class RenderFile
+{
+public:
+	/**
+	 * Creates, or truncates, a RenderFile.
+	 * @param path The path of the file.
+	 * @exception FileError Thrown if the file can't be created.
+	 */
+	explicit RenderFile(const std::string &path);
+
+	/// Brings the header up to date, and closes the file.
+	~RenderFile();
+
+	/// Deleted copy constructor.
+	RenderFile(const RenderFile &) = delete;
+
+	/// Deleted copy-assignment.
+	RenderFile &operator=(const RenderFile &) = delete;
+
+	/**
+	 * Checks that a source can be rendered into the file.
+	 * The first source checked fixes the file's format.
+	 * @param source The source.
+	 * @exception FileError Thrown if the source's format differs from the
+	 *   file's.
+	 */
+	void Bind(const AudioSource &source);
+
+	/**
+	 * Appends samples to the file.
+	 * @param start The first byte of the samples.
+	 * @param bytes The number of bytes, a whole number of samples.
+	 * @exception FileError Thrown if the samples can't be written.
+	 */
+	void Write(const std::uint8_t *start, size_t bytes);
+
+	/**
+	 * Brings the header up to date, and flushes the file.
+	 * @exception FileError Thrown if the file can't be written.
+	 */
+	void Flush();
+
+	/**
+	 * Gets the number of sample bytes rendered so far.
+	 * @return The count.
+	 */
+	std::uint64_t Bytes() const;
+
+private:
+	std::string path;       ///< The path of the file.
+	std::ofstream out;      ///< The file.
+	bool wav;               ///< Whether the file has a WAV header.
+	bool bound;             ///< Whether the format is fixed yet.
+	std::uint32_t rate;     ///< The sample rate, in Hz, once bound.
+	std::uint8_t channels;  ///< The channel count, once bound.
+	SampleFormat format;    ///< The sample format, once bound.
+	std::uint64_t bytes;    ///< The number of sample bytes written.
+
+	/// Writes, or rewrites, the WAV header.
+	void WriteHeader();
+};
+
+/**
+ * An AudioSink that renders into a RenderFile, as fast as it is given
+ * audio, rather than playing out in real time.
+ *
+ * While playing, it takes everything it is given at once, and its position
+ * is simply the number of samples it has taken.  While stopped, it takes
+ * nothing, just as nothing would be heard.
+ */
+class RenderAudioSink : public AudioSink
+{
+public:
+	/**
+	 * Helper function for creating uniquely pointed-to AudioSinks.
+	 * @param source The source from which this sink will receive audio.
+	 * @param file The file into which the sink renders.
+	 * @return A unique pointer to an AudioSink.
+	 * @exception FileError Thrown if @a source can't go into @a file.
+	 */
+	static std::unique_ptr<AudioSink> Build(
+	        const AudioSource &source, std::shared_ptr<RenderFile> file);
+
+	/**
+	 * Constructs a RenderAudioSink.
+	 * @param source The source from which this sink will receive audio.
+	 * @param file The file into which the sink renders.
+	 * @exception FileError Thrown if @a source can't go into @a file.
+	 */
+	RenderAudioSink(const AudioSource &source,
+	                std::shared_ptr<RenderFile> file);
+
+	/// Destructs a RenderAudioSink, bringing its file up to date.
+	~RenderAudioSink() override;
+
+	void Start() override;
+	void Stop() override;
+	Audio::State State() override;
+	std::uint64_t Position() override;
+	void SetPosition(std::uint64_t samples) override;
+	bool IsRealTime() const override;
+	void SourceOut() override;
+	void Transfer(TransferIterator &start,
+	              const TransferIterator &end) override;
+
+private:
+	std::shared_ptr<RenderFile> file; ///< The file rendered into.
+	size_t bytes_per_sample;          ///< Bytes per sample, all channels.
+	Audio::State state;               ///< The state of the sink.
+	std::uint64_t position;           ///< The position, in samples.
+	bool source_out;                  ///< Whether the source has run out.
+};
+
+#endif // PLAYD_AUDIO_RENDER_SINK_HPP
@@ -7,6 +7,8 @@
  */
 
 #include <cassert>
+#include <cstring>
+#include <new>
 
 extern "C" {
 #include "../contrib/pa_ringbuffer/pa_ringbuffer.h"
@@ -14,15 +16,28 @@ extern "C" {
 
 #include "../errors.hpp"
 #include "../messages.h"
+#include "realtime.hpp"
 #include "ringbuffer.hpp"
 
-RingBuffer::RingBuffer(int power, int size)
+RingBuffer::RingBuffer(int power, int size) : pinned(false)
 {
 	assert(0 < power);
 	assert(0 < size);
 
-	this->rb = new PaUtilRingBuffer;
-	this->buffer = new char[(1 << power) * size];
+	this->bytes = static_cast<size_t>(1 << power) * size;
+
+	// The samples and the PortAudio ring buffer share one allocation, on
+	// pages of its own, so that Pin can lock both without touching any
+	// other object's pages.
+	auto align = alignof(PaUtilRingBuffer);
+	auto rb_offset = (this->bytes + align - 1) / align * align;
+	this->allocated = rb_offset + sizeof(PaUtilRingBuffer);
+	this->buffer = static_cast<char *>(RealTime::Allocate(this->allocated));
+
+	// Touch every page now, so the audio callback never takes the page
+	// fault for the first read of a fresh page.
+	std::memset(this->buffer, 0, this->allocated);
+	this->rb = new (this->buffer + rb_offset) PaUtilRingBuffer;
 
 	if (PaUtil_InitializeRingBuffer(
 	            this->rb, size, static_cast<ring_buffer_size_t>(1 << power),
@@ -36,11 +51,11 @@ RingBuffer::RingBuffer(int power, int size)
 
 RingBuffer::~RingBuffer()
 {
-	assert(this->rb != nullptr);
-	delete this->rb;
+	if (this->pinned) RealTime::Unpin(this->buffer, this->allocated);
 
+	// rb lives inside buffer, and needs no destructing.
 	assert(this->buffer != nullptr);
-	delete[] this->buffer;
+	RealTime::Free(this->buffer);
 }
 
 unsigned long RingBuffer::WriteCapacity() const
@@ -77,6 +92,14 @@ void RingBuffer::Flush()
 	assert(this->ReadCapacity() == 0);
 }
 
+bool RingBuffer::Pin()
+{
+	if (this->pinned) return true;
+
+	this->pinned = RealTime::Pin(this->buffer, this->allocated);
+	return this->pinned;
+}
+
 /* static */ unsigned long RingBuffer::CountCast(ring_buffer_size_t count)
 {
 	return static_cast<unsigned long>(count);
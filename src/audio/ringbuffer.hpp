@@ -107,9 +107,19 @@ public:
 	/// Empties the ring buffer.
 	void Flush();
 
+	/**
+	 * Locks the ring buffer's memory into RAM, until it is destroyed.
+	 * @return Whether the memory was locked.
+	 * @see RealTime::Pin
+	 */
+	bool Pin();
+
 private:
 	char *buffer;         ///< The array used by the ringbuffer.
+	size_t bytes;         ///< The size of buffer's samples, in bytes.
+	size_t allocated;     ///< The size of buffer, rb included, in bytes.
 	PaUtilRingBuffer *rb; ///< The internal PortAudio ringbuffer.
+	bool pinned;          ///< Whether Pin has locked the memory.
 
 	/**
 	 * Converts a ring buffer size into an external size.
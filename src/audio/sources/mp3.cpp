@@ -23,6 +23,7 @@
 #include "../../errors.hpp"
 #include "../../messages.h"
 #include "../audio_source.hpp"
+#include "../file_reader.hpp"
 #include "../sample_formats.hpp"
 #include "mp3.hpp"
 
@@ -30,6 +31,32 @@
 // used by ffmpeg, so it's probably sensible.
 const size_t Mp3AudioSource::BUFFER_SIZE = 16384;
 
+/**
+ * The mpg123 read callback.
+ * @param handle The FileReader for the file.
+ * @param buf The buffer to read into.
+ * @param count The number of bytes to read.
+ * @return The number of bytes read, or -1 on error.
+ */
+static ssize_t Mp3Read(void *handle, void *buf, size_t count)
+{
+	auto reader = static_cast<FileReader *>(handle);
+	return static_cast<ssize_t>(reader->Read(buf, count));
+}
+
+/**
+ * The mpg123 seek callback.
+ * @param handle The FileReader for the file.
+ * @param offset The offset to seek to, relative to @a whence.
+ * @param whence One of SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return The new position, or -1 on error.
+ */
+static off_t Mp3Seek(void *handle, off_t offset, int whence)
+{
+	auto reader = static_cast<FileReader *>(handle);
+	return static_cast<off_t>(reader->Seek(offset, whence));
+}
+
 /* static */ std::unique_ptr<AudioSource> Mp3AudioSource::Build(
         const std::string &path)
 {
@@ -37,7 +64,10 @@ const size_t Mp3AudioSource::BUFFER_SIZE = 16384;
 }
 
 Mp3AudioSource::Mp3AudioSource(const std::string &path)
-    : AudioSource(path), buffer(BUFFER_SIZE), context(nullptr)
+    : AudioSource(path),
+      buffer(BUFFER_SIZE),
+      reader(new FileReader(path)),
+      context(nullptr)
 {
 	this->context = mpg123_new(nullptr, nullptr);
 	mpg123_format_none(this->context);
@@ -51,7 +81,13 @@ Mp3AudioSource::Mp3AudioSource(const std::string &path)
 		AddFormat(rates[r]);
 	}
 
-	if (mpg123_open(this->context, path.c_str()) == MPG123_ERR) {
+	// Reading through our own reader keeps the disk access off the
+	// decoding path; the FileReader outlives the context, so there's
+	// nothing for mpg123 to clean up.
+	mpg123_replace_reader_handle(this->context, &Mp3Read, &Mp3Seek,
+	                             nullptr);
+	if (mpg123_open_handle(this->context, this->reader.get()) ==
+	    MPG123_ERR) {
 		throw FileError("mp3: can't open " + path + ": " +
 		                mpg123_strerror(this->context));
 	}
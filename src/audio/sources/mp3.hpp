@@ -12,6 +12,7 @@
 #ifdef WITH_MP3
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,6 +26,7 @@ typedef ptrdiff_t ssize_t;
 }
 
 #include "../audio_source.hpp"
+#include "../file_reader.hpp"
 #include "../sample_formats.hpp"
 
 /// AudioSource for use on MP3 files.
@@ -62,6 +64,9 @@ private:
 
 	std::vector<std::uint8_t> buffer; ///< The decoding buffer.
 
+	/// The reader through which mpg123 reads the file.
+	std::unique_ptr<FileReader> reader;
+
 	/// Pointer to the mpg123 context associated with this source.
 	mpg123_handle *context;
 
@@ -0,0 +1,155 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the RawAudioSource class.
+ * @see audio/sources/raw.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../errors.hpp"
+#include "../../messages.h"
+#include "../audio_source.hpp"
+#include "../sample_formats.hpp"
+#include "raw.hpp"
+
+const char RawAudioSource::MAGIC[8] = {'P', 'L', 'A', 'Y', 'D', 'P', 'C', 'M'};
+
+// This matches the mp3 decoder's buffer, so the sink sees similarly sized
+// frames whichever source is in use.
+const size_t RawAudioSource::BUFFER_SIZE = 16384;
+
+RawAudioSource::RawAudioSource(const std::string &path,
+                               const std::string &raw_path)
+    : AudioSource(path), map(nullptr), map_size(0), data(nullptr), cursor(0)
+{
+	std::string raw_source;
+	if (!ReadHeader(raw_path, this->header, raw_source) ||
+	    raw_source != path) {
+		throw FileError("raw: not a cache file for " + path);
+	}
+
+	int fd = open(raw_path.c_str(), O_RDONLY);
+	if (fd < 0) throw FileError("raw: can't open " + raw_path);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw FileError("raw: can't stat " + raw_path);
+	}
+	this->map_size = static_cast<size_t>(st.st_size);
+
+	size_t offset = sizeof(Header) + this->header.path_length;
+	size_t expected = offset + this->header.samples * this->BytesPerSample();
+	if (this->map_size < expected) {
+		close(fd);
+		throw FileError("raw: truncated cache file " + raw_path);
+	}
+
+	void *m = mmap(nullptr, this->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the file alive, even if the cache evicts it.
+	close(fd);
+	if (m == MAP_FAILED) throw FileError("raw: can't map " + raw_path);
+
+	this->map = static_cast<std::uint8_t *>(m);
+	this->data = this->map + offset;
+
+	// We read the file front to back, so tell the kernel to read ahead.
+	madvise(m, this->map_size, MADV_SEQUENTIAL);
+}
+
+RawAudioSource::~RawAudioSource()
+{
+	if (this->map != nullptr) munmap(this->map, this->map_size);
+}
+
+/* static */ bool RawAudioSource::ReadHeader(const std::string &raw_path,
+                                             Header &header,
+                                             std::string &path)
+{
+	std::ifstream is(raw_path, std::ios::in | std::ios::binary);
+	if (!is) return false;
+
+	is.read(reinterpret_cast<char *>(&header), sizeof(header));
+	if (!is) return false;
+	if (!std::equal(MAGIC, MAGIC + sizeof(MAGIC), header.magic)) {
+		return false;
+	}
+	if (header.channels == 0 || header.rate == 0) return false;
+	if (sizeof(SAMPLE_FORMAT_BPS) / sizeof(*SAMPLE_FORMAT_BPS) <=
+	    header.format) {
+		return false;
+	}
+
+	path.resize(header.path_length);
+	if (!path.empty()) is.read(&path[0], header.path_length);
+	return static_cast<bool>(is);
+}
+
+/* static */ void RawAudioSource::WriteHeader(std::ostream &os, Header header,
+                                              const std::string &path)
+{
+	std::copy(MAGIC, MAGIC + sizeof(MAGIC), header.magic);
+	header.path_length = static_cast<std::uint16_t>(path.size());
+
+	os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	os.write(path.data(), path.size());
+}
+
+RawAudioSource::DecodeResult RawAudioSource::Decode()
+{
+	assert(this->cursor <= this->header.samples);
+
+	auto bps = this->BytesPerSample();
+	std::uint64_t remaining = this->header.samples - this->cursor;
+	if (remaining == 0) {
+		return std::make_pair(DecodeState::END_OF_FILE, DecodeVector());
+	}
+
+	std::uint64_t count = std::min<std::uint64_t>(remaining, BUFFER_SIZE / bps);
+	auto begin = this->data + (this->cursor * bps);
+	auto end = begin + (count * bps);
+	this->cursor += count;
+
+	return std::make_pair(DecodeState::DECODING, DecodeVector(begin, end));
+}
+
+std::uint64_t RawAudioSource::Seek(std::uint64_t in_samples)
+{
+	if (this->header.samples < in_samples) {
+		Debug() << "raw: seek at" << in_samples << "past EOF at"
+		        << this->header.samples << std::endl;
+		throw SeekError(MSG_SEEK_FAIL);
+	}
+
+	// Unlike the decoders, we always land exactly where we were asked.
+	this->cursor = in_samples;
+	return this->cursor;
+}
+
+std::uint8_t RawAudioSource::ChannelCount() const
+{
+	return this->header.channels;
+}
+
+std::uint32_t RawAudioSource::SampleRate() const
+{
+	return this->header.rate;
+}
+
+SampleFormat RawAudioSource::OutputSampleFormat() const
+{
+	return static_cast<SampleFormat>(this->header.format);
+}
@@ -0,0 +1,103 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the RawAudioSource class.
+ * @see audio/sources/raw.cpp
+ */
+
+#ifndef PLAYD_AUDIO_SOURCE_RAW_HPP
+#define PLAYD_AUDIO_SOURCE_RAW_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "../audio_source.hpp"
+#include "../sample_formats.hpp"
+
+/**
+ * AudioSource for raw PCM files written by the PcmCache.
+ *
+ * A raw PCM file is a fixed header, followed by the path of the file it was
+ * decoded from, followed by packed samples exactly as another AudioSource
+ * decoded them.  The file is memory-mapped, so decoding is just copying.
+ *
+ * @see PcmCache
+ */
+class RawAudioSource : public AudioSource
+{
+public:
+	/// The fixed part of a raw PCM file's header.
+	struct Header {
+		char magic[8];             ///< Always MAGIC.
+		std::uint32_t rate;        ///< The sample rate, in Hz.
+		std::uint8_t channels;     ///< The channel count.
+		std::uint8_t format;       ///< The SampleFormat, as an integer.
+		std::uint16_t path_length; ///< Length of the following path.
+		std::uint64_t samples;     ///< Number of samples in the file.
+		std::uint64_t source_size; ///< Size of the original file.
+		std::int64_t source_mtime; ///< Modification time of the original.
+	};
+
+	/// The magic string at the start of every raw PCM file.
+	static const char MAGIC[8];
+
+	/**
+	 * Constructs a RawAudioSource.
+	 * @param path The path of the file that was decoded into @a raw_path.
+	 * @param raw_path The path of the raw PCM file.
+	 * @exception FileError Thrown if @a raw_path isn't a valid raw PCM
+	 *   file for @a path.
+	 */
+	RawAudioSource(const std::string &path, const std::string &raw_path);
+
+	/// Destructs a RawAudioSource, unmapping its file.
+	~RawAudioSource();
+
+	/// Deleted copy constructor.
+	RawAudioSource(const RawAudioSource &) = delete;
+
+	/// Deleted copy-assignment.
+	RawAudioSource &operator=(const RawAudioSource &) = delete;
+
+	DecodeResult Decode() override;
+	std::uint64_t Seek(std::uint64_t position) override;
+
+	std::uint8_t ChannelCount() const override;
+	std::uint32_t SampleRate() const override;
+	SampleFormat OutputSampleFormat() const override;
+
+	/**
+	 * Reads the header of a raw PCM file.
+	 * @param raw_path The path of the raw PCM file.
+	 * @param header The header to fill in.
+	 * @param path Set to the path of the original file.
+	 * @return Whether a valid header was read.
+	 */
+	static bool ReadHeader(const std::string &raw_path, Header &header,
+	                       std::string &path);
+
+	/**
+	 * Writes the header of a raw PCM file.
+	 * @param os The stream to write to, positioned at its start.
+	 * @param header The header to write.  The magic is filled in here.
+	 * @param path The path of the original file.
+	 */
+	static void WriteHeader(std::ostream &os, Header header,
+	                        const std::string &path);
+
+private:
+	/// The number of bytes handed out per Decode.
+	static const size_t BUFFER_SIZE;
+
+	Header header; ///< The file's header.
+
+	std::uint8_t *map;    ///< The start of the file mapping.
+	size_t map_size;      ///< The size of the file mapping.
+	std::uint8_t *data;   ///< The first sample in the mapping.
+	std::uint64_t cursor; ///< The next sample to decode.
+};
+
+#endif // PLAYD_AUDIO_SOURCE_RAW_HPP
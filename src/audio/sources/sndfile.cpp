@@ -22,8 +22,69 @@
 #include "../../messages.h"
 #include "../sample_formats.hpp"
 #include "../audio_source.hpp"
+#include "../file_reader.hpp"
 #include "sndfile.hpp"
 
+/**
+ * The libsndfile callback for getting the length of a file.
+ * @param user_data The FileReader for the file.
+ * @return The length of the file.
+ */
+static sf_count_t SndfileLength(void *user_data)
+{
+	return static_cast<FileReader *>(user_data)->Length();
+}
+
+/**
+ * The libsndfile seek callback.
+ * @param offset The offset to seek to, relative to @a whence.
+ * @param whence One of SEEK_SET, SEEK_CUR or SEEK_END.
+ * @param user_data The FileReader for the file.
+ * @return The new position, or -1 on error.
+ */
+static sf_count_t SndfileSeek(sf_count_t offset, int whence, void *user_data)
+{
+	return static_cast<FileReader *>(user_data)->Seek(offset, whence);
+}
+
+/**
+ * The libsndfile read callback.
+ * @param ptr The buffer to read into.
+ * @param count The number of bytes to read.
+ * @param user_data The FileReader for the file.
+ * @return The number of bytes read.
+ */
+static sf_count_t SndfileRead(void *ptr, sf_count_t count, void *user_data)
+{
+	auto read = static_cast<FileReader *>(user_data)->Read(ptr, count);
+
+	// libsndfile has no notion of a failed read, only a short one.
+	return read < 0 ? 0 : read;
+}
+
+/**
+ * The libsndfile write callback, which refuses to write anything.
+ * @return 0, always.
+ */
+static sf_count_t SndfileWrite(const void *, sf_count_t, void *)
+{
+	return 0;
+}
+
+/**
+ * The libsndfile callback for getting the position in a file.
+ * @param user_data The FileReader for the file.
+ * @return The current position.
+ */
+static sf_count_t SndfileTell(void *user_data)
+{
+	return static_cast<FileReader *>(user_data)->Tell();
+}
+
+SF_VIRTUAL_IO SndfileAudioSource::VIRTUAL_IO = {&SndfileLength, &SndfileSeek,
+                                                &SndfileRead, &SndfileWrite,
+                                                &SndfileTell};
+
 /* static */ std::unique_ptr<AudioSource> SndfileAudioSource::Build(
         const std::string &path)
 {
@@ -31,11 +92,17 @@
 }
 
 SndfileAudioSource::SndfileAudioSource(const std::string &path)
-    : AudioSource(path), file(nullptr), buffer()
+    : AudioSource(path),
+      reader(new FileReader(path)),
+      file(nullptr),
+      buffer()
 {
 	this->info.format = 0;
 
-	this->file = sf_open(path.c_str(), SFM_READ, &this->info);
+	// Reading through our own reader keeps the disk access off the
+	// decoding path.
+	this->file = sf_open_virtual(&VIRTUAL_IO, SFM_READ, &this->info,
+	                             this->reader.get());
 	if (this->file == nullptr) {
 		throw FileError("sndfile: can't open " + path + ": " +
 		                sf_strerror(nullptr));
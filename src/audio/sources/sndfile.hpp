@@ -12,12 +12,14 @@
 #ifdef WITH_SNDFILE
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <sndfile.h>
 
 #include "../audio_source.hpp"
+#include "../file_reader.hpp"
 #include "../sample_formats.hpp"
 
 /// AudioSource for use on files supported by libsndfile.
@@ -52,6 +54,12 @@ public:
 	SampleFormat OutputSampleFormat() const override;
 
 private:
+	/// The libsndfile callbacks for reading through a FileReader.
+	static SF_VIRTUAL_IO VIRTUAL_IO;
+
+	/// The reader through which libsndfile reads the file.
+	std::unique_ptr<FileReader> reader;
+
 	SF_INFO info;  ///< The libsndfile info structure.
 	SNDFILE *file; ///< The libsndfile file structure.
 
@@ -0,0 +1,140 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the UnderrunMonitor class.
+ * @see audio/underrun.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "underrun.hpp"
+
+const size_t UnderrunMonitor::HISTORY;
+
+UnderrunMonitor::UnderrunMonitor(std::uint64_t watermark)
+    : watermark(watermark),
+      primed(false),
+      rebuffering(false),
+      starved(false),
+      start(0),
+      count(0),
+      total(0),
+      started(0),
+      finished(0),
+      taken(0)
+{
+	for (size_t i = 0; i < HISTORY; i++) {
+		this->stamps[i] = 0;
+		this->durations[i] = 0;
+	}
+}
+
+std::uint64_t UnderrunMonitor::Playable(std::uint64_t avail,
+                                        std::uint64_t wanted, bool source_out,
+                                        std::int64_t now)
+{
+	// Running dry at the end of the file is what's supposed to happen.
+	if (source_out) {
+		if (this->starved) this->Finish(now);
+		this->rebuffering = false;
+		return std::min(avail, wanted);
+	}
+
+	// Until something has played, we're still filling up after a load,
+	// seek or stop, and an empty buffer isn't news.
+	if (!this->primed) {
+		if (avail == 0) return 0;
+		this->primed = true;
+	}
+
+	if (this->rebuffering) {
+		if (avail < this->watermark) return 0;
+		this->rebuffering = false;
+	}
+
+	auto samples = std::min(avail, wanted);
+	if (samples < wanted) {
+		if (!this->starved) {
+			this->starved = true;
+			this->start = now;
+			this->count.fetch_add(1, std::memory_order_relaxed);
+		}
+		this->rebuffering = 0 < this->watermark;
+	} else if (this->starved) {
+		this->Finish(now);
+	}
+
+	return samples;
+}
+
+void UnderrunMonitor::Reset(std::int64_t now)
+{
+	if (this->starved) this->Finish(now);
+	this->primed = false;
+	this->rebuffering = false;
+}
+
+std::uint64_t UnderrunMonitor::Count() const
+{
+	return this->count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t UnderrunMonitor::Total() const
+{
+	return this->total.load(std::memory_order_relaxed);
+}
+
+std::vector<Underrun> UnderrunMonitor::Take()
+{
+	std::vector<Underrun> underruns;
+
+	auto done = this->finished.load(std::memory_order_acquire);
+	if (done == this->taken) return underruns;
+
+	auto first = std::max<std::uint64_t>(this->taken,
+	                                     HISTORY < done ? done - HISTORY : 0);
+	for (auto i = first; i < done; i++) {
+		auto slot = i % HISTORY;
+		underruns.push_back(
+		        {this->stamps[slot].load(std::memory_order_relaxed),
+		         this->durations[slot].load(std::memory_order_relaxed)});
+	}
+	this->taken = done;
+
+	// If the writer lapped us while we copied, the oldest slots may be
+	// torn; drop them.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	auto begun = this->started.load(std::memory_order_relaxed);
+	if (HISTORY < begun && first < begun - HISTORY) {
+		auto torn = std::min<std::uint64_t>(begun - HISTORY - first,
+		                                    underruns.size());
+		underruns.erase(underruns.begin(), underruns.begin() + torn);
+	}
+
+	return underruns;
+}
+
+void UnderrunMonitor::Finish(std::int64_t now)
+{
+	this->starved = false;
+
+	auto duration = static_cast<std::uint64_t>(
+	                        std::max<std::int64_t>(0, now - this->start)) /
+	                1000;
+	this->total.fetch_add(duration, std::memory_order_relaxed);
+
+	auto n = this->started.load(std::memory_order_relaxed);
+	this->started.store(n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	this->stamps[n % HISTORY].store(this->start / 1000,
+	                                std::memory_order_relaxed);
+	this->durations[n % HISTORY].store(duration,
+	                                   std::memory_order_relaxed);
+	this->finished.store(n + 1, std::memory_order_release);
+}
@@ -0,0 +1,145 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the UnderrunMonitor class, and associated types.
+ * @see audio/underrun.cpp
+ */
+
+#ifndef PLAYD_AUDIO_UNDERRUN_HPP
+#define PLAYD_AUDIO_UNDERRUN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A stretch of time for which the output device was starved of audio.
+struct Underrun {
+	/// The monotonic time at which the underrun began, in microseconds,
+	/// on the same clock as /player/time/anchor.
+	std::int64_t stamp;
+
+	/// How long the underrun lasted, in microseconds.
+	std::uint64_t duration;
+};
+
+/**
+ * Detects, counts, and recovers from, underruns in an audio callback.
+ *
+ * The callback asks Playable how much of the buffered audio to hand to the
+ * device.  If there is less than the device wants, and the source hasn't run
+ * out, the device goes to air with silence: that is an underrun.  It lasts
+ * until the device next gets all it wants.
+ *
+ * The recovery policy is set by a watermark.  With a watermark of 0, the
+ * callback plays whatever audio it has as soon as it has it.  Otherwise,
+ * once an underrun begins, the callback plays silence until the watermark
+ * has been buffered again, trading one longer gap for a stutter of short
+ * ones.
+ *
+ * Only the callback thread, or another thread while the callback cannot
+ * run, may call Playable and Reset; this never allocates or blocks.  Any
+ * one other thread may read the count and take finished underruns.
+ */
+class UnderrunMonitor
+{
+public:
+	/// The number of finished underruns kept until Take is called.
+	static const size_t HISTORY = 16;
+
+	/**
+	 * Constructs an UnderrunMonitor.
+	 * @param watermark The number of samples to buffer again after an
+	 *   underrun before playing resumes, or 0 to resume at once.
+	 */
+	explicit UnderrunMonitor(std::uint64_t watermark = 0);
+
+	/// Deleted copy constructor.
+	UnderrunMonitor(const UnderrunMonitor &) = delete;
+
+	/// Deleted copy-assignment.
+	UnderrunMonitor &operator=(const UnderrunMonitor &) = delete;
+
+	/**
+	 * Decides how many samples the callback should play, noting any
+	 * underrun.
+	 * @param avail The number of samples buffered.
+	 * @param wanted The number of samples the device wants.
+	 * @param source_out Whether the source has run out, in which case
+	 *   running short is the end of the file, not an underrun.
+	 * @param now The monotonic time, in nanoseconds.
+	 * @return The number of samples to play, at most @a avail and
+	 *   @a wanted.
+	 */
+	std::uint64_t Playable(std::uint64_t avail, std::uint64_t wanted,
+	                       bool source_out, std::int64_t now);
+
+	/**
+	 * Ends any underrun in progress, and waits for audio to be buffered
+	 * again before counting any more.
+	 * Call this when playback stops, or the buffer is flushed.
+	 * @param now The monotonic time, in nanoseconds.
+	 */
+	void Reset(std::int64_t now);
+
+	/**
+	 * Gets the number of underruns so far, including any in progress.
+	 * @return The count.
+	 */
+	std::uint64_t Count() const;
+
+	/**
+	 * Gets the total length of the underruns finished so far.
+	 * @return The total, in microseconds.
+	 */
+	std::uint64_t Total() const;
+
+	/**
+	 * Takes the underruns that have finished since the last Take.
+	 * If more than HISTORY finished in between, only the last HISTORY
+	 * are returned; Count and Total still cover them all.
+	 * @return The underruns, oldest first.
+	 */
+	std::vector<Underrun> Take();
+
+private:
+	/// Samples to buffer again after an underrun; 0 to resume at once.
+	std::uint64_t watermark;
+
+	//
+	// Only the callback (or whoever is standing in for it) touches these.
+	//
+
+	bool primed;       ///< Whether audio has been played since Reset.
+	bool rebuffering;  ///< Whether we are waiting for the watermark.
+	bool starved;      ///< Whether an underrun is in progress.
+	std::int64_t start; ///< When the underrun in progress began, in ns.
+
+	//
+	// These are shared with the thread calling Count, Total and Take.
+	// Finished underruns go into a ring of HISTORY slots: the writer bumps
+	// started before it overwrites a slot, and finished after, so Take
+	// can tell which slots it may have caught mid-write.
+	//
+
+	std::atomic<std::uint64_t> count;    ///< See Count.
+	std::atomic<std::uint64_t> total;    ///< See Total.
+	std::atomic<std::uint64_t> started;  ///< Slot writes begun.
+	std::atomic<std::uint64_t> finished; ///< Slot writes finished.
+
+	std::atomic<std::int64_t> stamps[HISTORY];     ///< Underrun::stamp.
+	std::atomic<std::uint64_t> durations[HISTORY]; ///< Underrun::duration.
+
+	/// The number of finished underruns taken so far.
+	std::uint64_t taken;
+
+	/**
+	 * Finishes the underrun in progress.
+	 * @param now The monotonic time, in nanoseconds.
+	 */
+	void Finish(std::int64_t now);
+};
+
+#endif // PLAYD_AUDIO_UNDERRUN_HPP
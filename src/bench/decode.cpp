@@ -0,0 +1,406 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Benchmark of decode-to-sink throughput.
+ *
+ * This drives PipeAudio::Update as fast as it will go, into a sink that
+ * just counts what it is given, so neither SDL nor the clock hold it back.
+ * Each input is decoded, over and over, for at least a second.
+ *
+ * The inputs are a synthetic source of silence in each sample format, which
+ * measures the transfer loop on its own, and then any audio files given:
+ * usage: decode [FILE...].  The results go to standard output as JSON, one
+ * object per input, for regression tracking:
+ *
+ *     {"benchmark": "decode", "results": [{"input": ..., "format": ...,
+ *      "sample_format": ..., "frames_per_sec": ..., "samples_per_sec": ...,
+ *      "bytes_per_sec": ..., "allocations_per_frame": ...,
+ *      "decode_ns": {"p50": ..., "p90": ..., "p99": ..., "p999": ...,
+ *      "max": ...}}, ...]}
+ *
+ * A frame here is what PipeAudio calls a frame: the block of samples that
+ * one AudioSource::Decode returns.  Allocations are only counted in debug
+ * builds, and are null otherwise.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_sink.hpp"
+#include "../audio/audio_source.hpp"
+#include "../audio/realtime.hpp"
+#include "../audio/sample_formats.hpp"
+#include "../errors.hpp"
+#include "../metrics.hpp"
+
+#ifdef WITH_MP3
+#include "../audio/sources/mp3.hpp"
+#endif // WITH_MP3
+#ifdef WITH_SNDFILE
+#include "../audio/sources/sndfile.hpp"
+#endif // WITH_SNDFILE
+
+/// The shortest time for which each input is decoded.
+static const std::chrono::seconds MIN_TIME(1);
+
+/// The sample rate of the synthetic inputs, in Hz.
+static const std::uint32_t SYNTHETIC_RATE = 44100;
+
+/// The length of each synthetic input, in samples.
+static const std::uint64_t SYNTHETIC_SAMPLES = SYNTHETIC_RATE * 60;
+
+/// The number of samples each synthetic decode returns.
+static const std::uint64_t SYNTHETIC_FRAME = 4096;
+
+/// The names of the SampleFormats, as they appear in the results.
+static const char *SAMPLE_FORMAT_NAMES[] = {"u8", "s8", "s16", "s24", "s32",
+                                            "f32"};
+
+/// Type of functions that construct sources for files.
+using SourceBuilder =
+        std::function<std::unique_ptr<AudioSource>(const std::string &)>;
+
+/// An AudioSink that takes everything it is given at once, and counts it.
+class CountingSink : public AudioSink
+{
+public:
+	/// Constructs a stopped CountingSink.
+	CountingSink() : state(Audio::State::STOPPED), position(0), bytes(0)
+	{
+	}
+
+	void Start() override
+	{
+		this->state = Audio::State::PLAYING;
+	}
+
+	void Stop() override
+	{
+		this->state = Audio::State::STOPPED;
+	}
+
+	Audio::State State() override
+	{
+		return this->state;
+	}
+
+	std::uint64_t Position() override
+	{
+		return this->position;
+	}
+
+	void SetPosition(std::uint64_t samples) override
+	{
+		this->position = samples;
+	}
+
+	void SourceOut() override
+	{
+		this->state = Audio::State::AT_END;
+	}
+
+	void Transfer(TransferIterator &start,
+	              const TransferIterator &end) override
+	{
+		this->bytes += static_cast<std::uint64_t>(end - start);
+		start = end;
+	}
+
+	Audio::State state;     ///< The state of the sink.
+	std::uint64_t position; ///< The position, in samples.
+	std::uint64_t bytes;    ///< The number of bytes transferred.
+};
+
+/// An AudioSource that wraps another, timing each of its decodes.
+class TimedSource : public AudioSource
+{
+public:
+	/**
+	 * Constructs a TimedSource.
+	 * @param inner The source to time.
+	 * @param times The histogram into which decode times, in
+	 *   nanoseconds, are recorded.
+	 * @param frames Incremented for each decode that returns samples.
+	 */
+	TimedSource(std::unique_ptr<AudioSource> inner, Histogram &times,
+	            std::uint64_t &frames)
+	    : AudioSource(inner->Path()),
+	      inner(std::move(inner)),
+	      times(times),
+	      frames(frames)
+	{
+	}
+
+	DecodeResult Decode() override
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto result = this->inner->Decode();
+		auto taken = std::chrono::steady_clock::now() - start;
+
+		this->times.Record(static_cast<std::uint64_t>(
+		        std::chrono::duration_cast<std::chrono::nanoseconds>(
+		                taken).count()));
+		if (!result.second.empty()) this->frames++;
+		return result;
+	}
+
+	std::uint8_t ChannelCount() const override
+	{
+		return this->inner->ChannelCount();
+	}
+
+	std::uint32_t SampleRate() const override
+	{
+		return this->inner->SampleRate();
+	}
+
+	SampleFormat OutputSampleFormat() const override
+	{
+		return this->inner->OutputSampleFormat();
+	}
+
+	std::uint64_t Seek(std::uint64_t position) override
+	{
+		return this->inner->Seek(position);
+	}
+
+private:
+	std::unique_ptr<AudioSource> inner; ///< The source being timed.
+	Histogram &times;                   ///< Decode times, in ns.
+	std::uint64_t &frames;              ///< Decodes returning samples.
+};
+
+/// An AudioSource that decodes a minute of stereo silence.
+class SyntheticSource : public AudioSource
+{
+public:
+	/**
+	 * Constructs a SyntheticSource.
+	 * @param format The sample format in which to 'decode'.
+	 */
+	explicit SyntheticSource(SampleFormat format)
+	    : AudioSource("synthetic"), format(format), position(0)
+	{
+	}
+
+	DecodeResult Decode() override
+	{
+		if (SYNTHETIC_SAMPLES <= this->position) {
+			return std::make_pair(DecodeState::END_OF_FILE,
+			                      DecodeVector());
+		}
+
+		// Like a real decoder, this makes a fresh vector each time.
+		auto samples = std::min(SYNTHETIC_FRAME,
+		                        SYNTHETIC_SAMPLES - this->position);
+		this->position += samples;
+		auto bytes = static_cast<size_t>(samples) * this->BytesPerSample();
+		return std::make_pair(DecodeState::DECODING, DecodeVector(bytes));
+	}
+
+	std::uint8_t ChannelCount() const override
+	{
+		return 2;
+	}
+
+	std::uint32_t SampleRate() const override
+	{
+		return SYNTHETIC_RATE;
+	}
+
+	SampleFormat OutputSampleFormat() const override
+	{
+		return this->format;
+	}
+
+	std::uint64_t Seek(std::uint64_t position) override
+	{
+		this->position = std::min(position, SYNTHETIC_SAMPLES);
+		return this->position;
+	}
+
+private:
+	SampleFormat format;    ///< The sample format.
+	std::uint64_t position; ///< The position, in samples.
+};
+
+/**
+ * Quotes a string for JSON.
+ * @param str The string.
+ * @return @a str, escaped and in double quotes.
+ */
+static std::string Json(const std::string &str)
+{
+	std::string out = "\"";
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+/**
+ * Decodes an input over and over, for at least MIN_TIME, and appends its
+ * results to the JSON output.
+ * @param out The string to which the results are appended.
+ * @param input The name of the input.
+ * @param format The name of the input's file format.
+ * @param build A function that builds a fresh source for the input.
+ */
+static void Bench(std::string &out, const std::string &input,
+                  const std::string &format,
+                  std::function<std::unique_ptr<AudioSource>()> build)
+{
+	Histogram times("decode times, in nanoseconds");
+	std::uint64_t frames = 0;
+	std::uint64_t bytes = 0;
+	std::uint64_t samples = 0;
+	std::uint64_t allocations = 0;
+	std::string sample_format;
+
+	std::chrono::duration<double> taken(0);
+	while (taken < MIN_TIME) {
+		std::unique_ptr<AudioSource> src(
+		        new TimedSource(build(), times, frames));
+		sample_format = SAMPLE_FORMAT_NAMES[static_cast<int>(
+		        src->OutputSampleFormat())];
+		auto bps = src->BytesPerSample();
+
+		auto sink = new CountingSink;
+		PipeAudio audio(std::move(src), std::unique_ptr<AudioSink>(sink));
+		audio.SetPlaying(true);
+
+		auto allocated = RealTimeScope::Allocations();
+		auto start = std::chrono::steady_clock::now();
+		while (audio.Update() != Audio::State::AT_END) {
+		}
+		taken += std::chrono::steady_clock::now() - start;
+		allocations += RealTimeScope::Allocations() - allocated;
+
+		// An empty input would otherwise spin for ever.
+		if (sink->bytes == 0) break;
+		bytes += sink->bytes;
+		samples += sink->bytes / bps;
+	}
+
+	auto secs = std::max(taken.count(), 1e-9);
+	auto per_frame = frames == 0 ? 0.0 : double(allocations) / frames;
+
+	char buf[512];
+	std::snprintf(buf, sizeof(buf),
+	              "\"frames_per_sec\": %.0f, \"samples_per_sec\": %.0f, "
+	              "\"bytes_per_sec\": %.0f, \"allocations_per_frame\": ",
+	              frames / secs, samples / secs, bytes / secs);
+
+	if (out.back() == '}') out += ",";
+	out += "\n\t{\"input\": " + Json(input) + ", \"format\": " +
+	       Json(format) + ", \"sample_format\": " + Json(sample_format) +
+	       ", " + buf;
+#ifdef NDEBUG
+	(void)per_frame;
+	out += "null";
+#else
+	std::snprintf(buf, sizeof(buf), "%.3f", per_frame);
+	out += buf;
+#endif // NDEBUG
+	out += ", \"decode_ns\": {\"p50\": " +
+	       std::to_string(times.Quantile(0.5)) + ", \"p90\": " +
+	       std::to_string(times.Quantile(0.9)) + ", \"p99\": " +
+	       std::to_string(times.Quantile(0.99)) + ", \"p999\": " +
+	       std::to_string(times.Quantile(0.999)) + ", \"max\": " +
+	       std::to_string(times.Max()) + "}}";
+
+	std::cerr << input << " (" << format << ", " << sample_format
+	          << "): " << static_cast<std::uint64_t>(samples / secs)
+	          << " samples/s" << std::endl;
+}
+
+/**
+ * Gets the lowercased extension of a path.
+ * @param path The path.
+ * @return The text after the last '.' in @a path, in lowercase.
+ */
+static std::string Extension(const std::string &path)
+{
+	auto dot = path.find_last_of('.');
+	auto ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) {
+		return static_cast<char>(std::tolower(c));
+	});
+	return ext;
+}
+
+/**
+ * The benchmark's main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+	std::map<std::string, SourceBuilder> sources;
+#ifdef WITH_MP3
+	sources["mp3"] = &Mp3AudioSource::Build;
+#endif // WITH_MP3
+#ifdef WITH_SNDFILE
+	sources["flac"] = &SndfileAudioSource::Build;
+	sources["ogg"] = &SndfileAudioSource::Build;
+	sources["wav"] = &SndfileAudioSource::Build;
+#endif // WITH_SNDFILE
+
+	std::string out = "{\"benchmark\": \"decode\", \"results\": [";
+
+	for (int f = 0; f < 6; f++) {
+		auto format = static_cast<SampleFormat>(f);
+		Bench(out, "synthetic", "none", [format] {
+			return std::unique_ptr<AudioSource>(
+			        new SyntheticSource(format));
+		});
+	}
+
+	for (int i = 1; i < argc; i++) {
+		std::string path = argv[i];
+		auto format = Extension(path);
+		auto source = sources.find(format);
+		if (source == sources.end()) {
+			std::cerr << path << ": no decoder for '" << format
+			          << "' in this build" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		try {
+			auto build = source->second;
+			Bench(out, path, format, [build, &path] {
+				return build(path);
+			});
+		} catch (Error &e) {
+			std::cerr << path << ": " << e.Message() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	out += "\n]}\n";
+	std::cout << out;
+	return EXIT_SUCCESS;
+}
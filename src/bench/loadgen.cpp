@@ -0,0 +1,801 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Protocol load generator: how much client traffic can playd take before
+ * its audio suffers?
+ *
+ * This opens a number of client connections to playd, some of which send
+ * commands drawn from a weighted mix, and some of which just listen, as
+ * most of a broadcast studio's clients do.  It measures:
+ *
+ * - how long each command waits for its ACK;
+ * - how long a broadcast takes to reach every connection, by having one
+ *   more connection send a probe command every so often, and timing each
+ *   connection's receipt of the broadcast that follows;
+ * - how much CPU the server uses, if its process ID is known;
+ * - the underruns the server reports, while all of this goes on.
+ *
+ * Usage: loadgen [--name=value...], with these options:
+ *
+ * - `--clients=N`: connections sending commands (8);
+ * - `--listeners=N`: connections just listening (8);
+ * - `--rate=N`: commands each client sends a second, or 0 to send the next
+ *   as soon as an ACK comes back (0);
+ * - `--depth=N`: the most commands each client has waiting on ACKs (1);
+ * - `--duration=N`: the length of the run, in seconds (10);
+ * - `--mix=FILE`: the command mix, as lines of `WEIGHT COMMAND...`, where
+ *   the command has no tag (`read /control/state`, say), and lines starting
+ *   with # are ignored; the default is a mix of harmless reads and deletes;
+ * - `--probe=COMMAND`: the broadcast probe, again without a tag;
+ * - `--probe-ms=N`: the time between probes, in milliseconds (100);
+ * - `--host=HOST`, `--port=PORT`: a playd to load over TCP;
+ * - `--socket=PATH`: a playd to load over its Unix domain socket;
+ * - `--pid=PID`: the process ID of that playd, for its CPU usage.
+ *
+ * Without a port or socket, a playd with no audio loaded is started in a
+ * child process, and loaded over a Unix domain socket.  The probe then
+ * ejects (a no-op), rather than the default of setting the state to
+ * Playing.  Writes to the probe's resource in the mix make broadcast lag
+ * look shorter than it is.
+ *
+ * Underruns are placed in time by their stamps, which only line up with
+ * the load generator's clock on the same machine.  The results go to
+ * standard output as JSON, with a record for every second of the run, so
+ * that latency and CPU can be set against underruns:
+ *
+ *     {"benchmark": "loadgen", "clients": ..., "listeners": ...,
+ *      "rate": ..., "depth": ..., "duration": ..., "windows": [{"t": ...,
+ *      "sent": ..., "acked": ..., "failed": ..., "ack_us": {...},
+ *      "lag_us": {...}, "server_cpu": ..., "underruns": ...,
+ *      "underrun_us": ...}, ...], "summary": {...}}
+ *
+ * Latencies are microseconds, as p50/p99/max in windows, and
+ * p50/p90/p99/p999/max in the summary.  CPU is the fraction of one core,
+ * or null if the server's process ID isn't known.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../audio/audio_system.hpp"
+#include "../errors.hpp"
+#include "../io.hpp"
+#include "../metrics.hpp"
+#include "../player.hpp"
+#include "../tokeniser.hpp"
+
+/// The clock against which everything is timed.
+using Clock = std::chrono::steady_clock;
+
+/// The length of each window of results.
+static const std::chrono::seconds WINDOW(1);
+
+/// How long to wait for stragglers once the run is over.
+static const std::chrono::seconds DRAIN(1);
+
+/// The default command mix, in the format of a --mix file.
+static const char *DEFAULT_MIX = "40 read /control/state\n"
+                                 "30 read /player/time/elapsed\n"
+                                 "15 read /audio/stats/underruns\n"
+                                 "10 read /\n"
+                                 "5 delete /player/prefetch\n";
+
+/// A command in the mix.
+struct MixEntry {
+	std::uint64_t weight;           ///< The relative frequency.
+	std::vector<std::string> words; ///< The command, less its tag.
+	std::string rest;               ///< The command after its first word,
+	                                ///< as written, quotes and all.
+};
+
+/// Where to find playd.
+struct Target {
+	sockaddr_storage addr; ///< The address.
+	socklen_t len;         ///< The length of the address.
+};
+
+/// The results for one window of the run.
+struct Window {
+	/// Constructs an empty Window.
+	Window()
+	    : sent(0),
+	      acked(0),
+	      failed(0),
+	      ack_us(new Histogram("ACK latency, in microseconds")),
+	      lag_us(new Histogram("broadcast lag, in microseconds")),
+	      cpu(-1),
+	      underruns(0),
+	      underrun_us(0)
+	{
+	}
+
+	std::uint64_t sent;                ///< Commands sent.
+	std::uint64_t acked;               ///< ACKs received.
+	std::uint64_t failed;              ///< ACKs other than OK.
+	std::unique_ptr<Histogram> ack_us; ///< ACK latencies.
+	std::unique_ptr<Histogram> lag_us; ///< Broadcast lags.
+	double cpu;                        ///< Server CPU, or -1 if unknown.
+	std::uint64_t underruns;           ///< Underruns starting here.
+	std::uint64_t underrun_us;         ///< Their total length.
+};
+
+/**
+ * Gives up on the load generator.
+ * @param why The reason.
+ */
+[[noreturn]] static void Fail(const std::string &why)
+{
+	std::cerr << "loadgen: " << why << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+/// A non-blocking client connection to playd.
+class Client
+{
+public:
+	/// The jobs a Client can do.
+	enum class Role {
+		COMMANDS, ///< Sends commands from the mix.
+		LISTENER, ///< Just listens.
+		PROBE     ///< Sends broadcast probes.
+	};
+
+	/**
+	 * Connects to playd, retrying until it is listening.
+	 * @param target Where to find playd.
+	 * @param role The Client's job.
+	 */
+	Client(const Target &target, Role role)
+	    : fd(-1), role(role), sent(0), probes_seen(0)
+	{
+		for (int tries = 0; tries < 100; tries++) {
+			this->fd = socket(target.addr.ss_family, SOCK_STREAM, 0);
+			auto addr = reinterpret_cast<const sockaddr *>(&target.addr);
+			if (connect(this->fd, addr, target.len) == 0) break;
+			close(this->fd);
+			this->fd = -1;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (this->fd < 0) Fail("could not connect to playd");
+
+		auto flags = fcntl(this->fd, F_GETFL, 0);
+		fcntl(this->fd, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	/// Disconnects from playd.
+	~Client()
+	{
+		if (0 <= this->fd) close(this->fd);
+	}
+
+	/// Deleted copy constructor.
+	Client(const Client &) = delete;
+
+	/// Deleted copy-assignment.
+	Client &operator=(const Client &) = delete;
+
+	/**
+	 * Queues a command, tagging it so its ACK can be found.
+	 * @param command The command.
+	 * @param now The time at which the command is sent.
+	 */
+	void Send(const MixEntry &command, Clock::time_point now)
+	{
+		auto tag = "lg" + std::to_string(this->fd) + "_" +
+		           std::to_string(this->sent++);
+		this->out += command.words[0] + " " + tag + command.rest + "\n";
+		this->pending[tag] = now;
+	}
+
+	/**
+	 * Writes as much queued output as the socket will take.
+	 */
+	void Flush()
+	{
+		while (!this->out.empty()) {
+			auto n = send(this->fd, this->out.data(), this->out.size(),
+			              MSG_NOSIGNAL);
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+			if (n <= 0) Fail("lost connection to playd");
+			this->out.erase(0, static_cast<size_t>(n));
+		}
+	}
+
+	/**
+	 * Reads whatever has arrived.
+	 * @return The complete response lines read, tokenised.
+	 */
+	std::vector<std::vector<std::string>> Receive()
+	{
+		char buf[65536];
+		auto n = read(this->fd, buf, sizeof(buf));
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return std::vector<std::vector<std::string>>();
+		}
+		if (n <= 0) Fail("lost connection to playd");
+		return this->tokeniser.Feed(std::string(buf, static_cast<size_t>(n)));
+	}
+
+	int fd;    ///< The socket.
+	Role role; ///< The Client's job.
+
+	/// Output not yet written.
+	std::string out;
+
+	/// The number of commands sent.
+	std::uint64_t sent;
+
+	/// When each command still waiting for its ACK was sent, by tag.
+	std::map<std::string, Clock::time_point> pending;
+
+	/// When the next command is due, if sending at a fixed rate.
+	Clock::time_point next;
+
+	/// The number of probes whose broadcasts have arrived.
+	std::uint64_t probes_seen;
+
+private:
+	Tokeniser tokeniser; ///< Splits what arrives into responses.
+};
+
+/**
+ * Reads a command mix.
+ * @param text The mix, as lines of `WEIGHT COMMAND...`.
+ * @return The mix.
+ */
+static std::vector<MixEntry> ParseMix(const std::string &text)
+{
+	std::vector<MixEntry> mix;
+
+	std::istringstream is(text);
+	std::string line;
+	while (std::getline(is, line)) {
+		Tokeniser tokeniser;
+		auto lines = tokeniser.Feed(line + "\n");
+		if (lines.empty() || lines[0].empty()) continue;
+		auto &words = lines[0];
+		if (words[0][0] == '#') continue;
+
+		MixEntry entry;
+		entry.weight = std::strtoull(words[0].c_str(), nullptr, 10);
+		entry.words.assign(words.begin() + 1, words.end());
+
+		// The tag goes after the command word, so the rest is kept
+		// as written.
+		auto spaces = " \t";
+		auto pos = line.find_first_not_of(spaces);
+		pos = line.find_first_of(spaces, pos);
+		pos = line.find_first_not_of(spaces, pos);
+		pos = line.find_first_of(spaces, pos);
+		entry.rest = pos == std::string::npos ? "" : line.substr(pos);
+
+		auto &w = entry.words;
+		bool ok = (w.size() == 2 && (w[0] == "read" || w[0] == "delete")) ||
+		          (w.size() == 3 && w[0] == "write");
+		if (!ok || entry.weight == 0) {
+			Fail("bad mix line: " + words[0] + " " +
+			     (w.empty() ? "" : w[0]) + "...");
+		}
+		mix.push_back(entry);
+	}
+
+	if (mix.empty()) Fail("empty command mix");
+	return mix;
+}
+
+/**
+ * Gets the CPU time a process has used.
+ * @param pid The process ID, or 0 for none.
+ * @return The time, in seconds, or -1 if it can't be read.
+ */
+static double CpuSeconds(pid_t pid)
+{
+	if (pid == 0) return -1;
+
+	std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+	std::string stat((std::istreambuf_iterator<char>(f)),
+	                 std::istreambuf_iterator<char>());
+
+	// The command name, in brackets, may itself contain spaces.
+	auto paren = stat.find_last_of(')');
+	if (paren == std::string::npos) return -1;
+
+	// After the name come the state, then ten more fields, then the
+	// user and system time.
+	std::istringstream is(stat.substr(paren + 1));
+	std::string field;
+	for (int i = 0; i < 11; i++) is >> field;
+	std::uint64_t user = 0;
+	std::uint64_t system = 0;
+	if (!(is >> user >> system)) return -1;
+
+	return double(user + system) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Runs a playd with no audio loaded, until it is told to quit.
+ * This is the body of the child process in self-hosted runs.
+ * @param path The path of the Unix domain socket on which it listens.
+ */
+[[noreturn]] static void Serve(const std::string &path)
+{
+	AudioSystem audio(0);
+	Player player(audio);
+	IoCore io(player);
+	player.SetSink(io);
+
+	try {
+		// The TCP port is the kernel's choice, and goes unused.
+		io.Run("127.0.0.1", "0", path);
+	} catch (NetError &e) {
+		std::cerr << "could not start playd: " << e.Message()
+		          << std::endl;
+		_exit(EXIT_FAILURE);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+/**
+ * Appends the quantiles of a Histogram to JSON output.
+ * @param out The string to which the quantiles are appended.
+ * @param h The histogram.
+ * @param full Whether to include p90 and p999.
+ */
+static void Quantiles(std::string &out, const Histogram &h, bool full)
+{
+	out += "{\"p50\": " + std::to_string(h.Quantile(0.5));
+	if (full) out += ", \"p90\": " + std::to_string(h.Quantile(0.9));
+	out += ", \"p99\": " + std::to_string(h.Quantile(0.99));
+	if (full) out += ", \"p999\": " + std::to_string(h.Quantile(0.999));
+	out += ", \"max\": " + std::to_string(h.Max()) + "}";
+}
+
+/**
+ * Formats a number for JSON, or null if it is negative.
+ * @param v The number.
+ * @return The JSON.
+ */
+static std::string JsonOrNull(double v)
+{
+	if (v < 0) return "null";
+
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.3f", v);
+	return buf;
+}
+
+/**
+ * Gets a numeric option.
+ * @param options The options given.
+ * @param name The name of the option.
+ * @param def The value to use if the option was not given.
+ * @return The value of the option.
+ */
+static std::uint64_t Number(const std::map<std::string, std::string> &options,
+                            const std::string &name, std::uint64_t def)
+{
+	auto it = options.find(name);
+	if (it == options.end()) return def;
+
+	char *end = nullptr;
+	auto value = std::strtoull(it->second.c_str(), &end, 10);
+	if (it->second.empty() || *end != '\0') {
+		Fail("--" + name + " needs a number");
+	}
+	return value;
+}
+
+/**
+ * The load generator's main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+	static const char *KNOWN[] = {"clients", "depth",    "duration",
+	                              "host",    "listeners", "mix",
+	                              "pid",     "port",      "probe",
+	                              "probe-ms", "rate",     "socket"};
+
+	std::map<std::string, std::string> options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto eq = arg.find('=');
+		auto name = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+		bool known = std::find(std::begin(KNOWN), std::end(KNOWN), name) !=
+		             std::end(KNOWN);
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos ||
+		    !known) {
+			Fail("bad option: " + arg);
+		}
+		options[name] = arg.substr(eq + 1);
+	}
+
+	auto clients = Number(options, "clients", 8);
+	auto listeners = Number(options, "listeners", 8);
+	auto rate = Number(options, "rate", 0);
+	auto depth = std::max<std::uint64_t>(Number(options, "depth", 1), 1);
+	auto duration = std::max<std::uint64_t>(Number(options, "duration", 10), 1);
+	auto probe_ms = std::max<std::uint64_t>(Number(options, "probe-ms", 100), 1);
+	auto pid = static_cast<pid_t>(Number(options, "pid", 0));
+
+	std::string mix_text = DEFAULT_MIX;
+	if (options.count("mix") != 0) {
+		std::ifstream f(options["mix"]);
+		if (!f) Fail("can't read " + options["mix"]);
+		std::stringstream ss;
+		ss << f.rdbuf();
+		mix_text = ss.str();
+	}
+	auto mix = ParseMix(mix_text);
+	std::uint64_t total_weight = 0;
+	for (const auto &entry : mix) total_weight += entry.weight;
+
+	//
+	// Find, or start, playd.
+	//
+
+	Target target{};
+	bool self_hosted = false;
+	pid_t child = 0;
+	std::string path;
+
+	if (options.count("port") != 0) {
+		auto host = options.count("host") ? options["host"] : "127.0.0.1";
+		auto &in = reinterpret_cast<sockaddr_in &>(target.addr);
+		in.sin_family = AF_INET;
+		in.sin_port = htons(static_cast<std::uint16_t>(
+		        Number(options, "port", 0)));
+		if (inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1) {
+			Fail("bad IPv4 address: " + host);
+		}
+		target.len = sizeof(sockaddr_in);
+	} else {
+		if (options.count("socket") != 0) {
+			path = options["socket"];
+		} else {
+			self_hosted = true;
+			path = "/tmp/playd_loadgen_" + std::to_string(getpid()) +
+			       ".sock";
+
+			// This happens before any threads start, so the child
+			// gets a clean copy of everything.
+			child = fork();
+			if (child < 0) Fail("could not start playd");
+			if (child == 0) Serve(path);
+			pid = child;
+		}
+
+		auto &un = reinterpret_cast<sockaddr_un &>(target.addr);
+		un.sun_family = AF_UNIX;
+		path.copy(un.sun_path, sizeof(un.sun_path) - 1);
+		target.len = sizeof(sockaddr_un);
+	}
+
+	std::string probe_text = self_hosted ? "write /control/state Ejected"
+	                                     : "write /control/state Playing";
+	if (options.count("probe") != 0) probe_text = options["probe"];
+	auto probe = ParseMix("1 " + probe_text).front();
+	auto underrun_stats = ParseMix("1 read /audio/stats/underruns").front();
+	auto quit = ParseMix("1 delete /control/state").front();
+
+	//
+	// Connect everyone.
+	//
+
+	std::vector<std::unique_ptr<Client>> conns;
+	for (std::uint64_t i = 0; i < clients; i++) {
+		conns.emplace_back(new Client(target, Client::Role::COMMANDS));
+	}
+	for (std::uint64_t i = 0; i < listeners; i++) {
+		conns.emplace_back(new Client(target, Client::Role::LISTENER));
+	}
+	conns.emplace_back(new Client(target, Client::Role::PROBE));
+	auto &prober = *conns.back();
+
+	// Broadcast lag is measured at the listeners, if there are any.
+	auto lag_role = listeners == 0 ? Client::Role::COMMANDS
+	                               : Client::Role::LISTENER;
+
+	std::cerr << "loadgen: " << clients << " clients, " << listeners
+	          << " listeners, for " << duration << "s" << std::endl;
+
+	//
+	// Run.
+	//
+
+	std::mt19937_64 random(42);
+	std::vector<Window> windows(duration);
+	Window summary;
+	std::uint64_t probes_sent = 0;
+	Clock::time_point probe_time;
+	std::int64_t underruns_before = -1;
+	std::int64_t underruns_after = -1;
+	std::int64_t underrun_us_before = 0;
+	std::int64_t underrun_us_after = 0;
+	std::uint64_t underruns_outside = 0;
+
+	auto start = Clock::now();
+	auto end = start + std::chrono::seconds(duration);
+	Clock::duration interval(0);
+	if (rate != 0) {
+		interval = std::chrono::duration_cast<Clock::duration>(
+		        std::chrono::seconds(1)) / static_cast<long>(rate);
+	}
+	auto start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+	        start.time_since_epoch()).count();
+
+	for (auto &c : conns) c->next = start;
+	auto next_probe = start;
+	auto next_window = start + WINDOW;
+	size_t window = 0;
+	auto cpu_last = CpuSeconds(pid);
+
+	prober.Send(underrun_stats, start);
+
+	auto window_at = [&](Clock::time_point t) -> Window & {
+		auto i = static_cast<size_t>((t - start) / WINDOW);
+		return windows[std::min(i, windows.size() - 1)];
+	};
+
+	auto handle = [&](Client &c, const std::vector<std::string> &words,
+	                  Clock::time_point now, bool running) {
+		if (words.empty()) return;
+
+		if (words[0] == "ACK" && 5 <= words.size()) {
+			auto it = c.pending.find(words[4]);
+			if (it == c.pending.end()) return;
+
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+			        now - it->second).count();
+			c.pending.erase(it);
+			if (c.role != Client::Role::COMMANDS) return;
+
+			auto &w = window_at(now);
+			for (auto *into : {&w, &summary}) {
+				into->acked++;
+				if (words[1] != "OK") into->failed++;
+				into->ack_us->Record(static_cast<std::uint64_t>(us));
+			}
+			return;
+		}
+
+		if (words[0] == "UNDERRUN" && 3 <= words.size() &&
+		    c.role == Client::Role::PROBE) {
+			auto stamp = std::strtoll(words[1].c_str(), nullptr, 10);
+			auto length = std::strtoull(words[2].c_str(), nullptr, 10);
+			auto i = (stamp - start_us) / 1000000;
+			if (stamp < start_us || windows.size() <= size_t(i)) {
+				underruns_outside++;
+				return;
+			}
+			windows[i].underruns++;
+			windows[i].underrun_us += length;
+			return;
+		}
+
+		if (words[0] == "RES" && 5 <= words.size() &&
+		    words[1] == "/audio/stats/underruns" &&
+		    c.role == Client::Role::PROBE) {
+			auto count = std::strtoll(words[3].c_str(), nullptr, 10);
+			auto total = std::strtoll(words[4].c_str(), nullptr, 10);
+			if (underruns_before < 0) {
+				underruns_before = count;
+				underrun_us_before = total;
+			} else if (!running) {
+				underruns_after = count;
+				underrun_us_after = total;
+			}
+			return;
+		}
+
+		// Only the first broadcast each connection sees after a probe
+		// counts towards that probe.
+		bool probed = c.role == lag_role && c.probes_seen < probes_sent &&
+		              2 <= words.size() && words[0] == "RES" &&
+		              words[1] == probe.words[1];
+		if (probed) {
+			c.probes_seen = probes_sent;
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+			        now - probe_time).count();
+			window_at(now).lag_us->Record(static_cast<std::uint64_t>(us));
+			summary.lag_us->Record(static_cast<std::uint64_t>(us));
+		}
+	};
+
+	std::vector<pollfd> fds(conns.size());
+	auto poll_once = [&](Clock::time_point now, Clock::time_point until,
+	                     bool running) {
+		for (size_t i = 0; i < conns.size(); i++) {
+			conns[i]->Flush();
+			fds[i].fd = conns[i]->fd;
+			fds[i].events = POLLIN;
+			if (!conns[i]->out.empty()) fds[i].events |= POLLOUT;
+			fds[i].revents = 0;
+		}
+
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+		        until - now).count();
+		wait = std::max<long long>(0, std::min<long long>(wait, 10));
+		if (poll(fds.data(), fds.size(), static_cast<int>(wait)) < 0 &&
+		    errno != EINTR) {
+			Fail("poll failed");
+		}
+
+		auto got = Clock::now();
+		for (size_t i = 0; i < conns.size(); i++) {
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+				continue;
+			}
+			for (auto &words : conns[i]->Receive()) {
+				handle(*conns[i], words, got, running);
+			}
+		}
+	};
+
+	auto now = start;
+	while (now < end) {
+		auto due = end;
+
+		for (auto &c : conns) {
+			if (c->role != Client::Role::COMMANDS) continue;
+
+			while (c->pending.size() < depth && c->next <= now) {
+				auto pick = random() % total_weight;
+				auto entry = mix.begin();
+				while (entry->weight <= pick) pick -= (entry++)->weight;
+
+				c->Send(*entry, now);
+				window_at(now).sent++;
+				summary.sent++;
+
+				// Open loop: if the client is backed up, the
+				// commands it should have sent are just lost.
+				if (rate != 0) c->next = std::max(c->next + interval, now);
+			}
+			if (rate != 0) due = std::min(due, c->next);
+		}
+
+		if (next_probe <= now) {
+			prober.Send(probe, now);
+			probes_sent++;
+			probe_time = now;
+			next_probe += std::chrono::milliseconds(probe_ms);
+		}
+		due = std::min({due, next_probe, next_window});
+
+		poll_once(now, due, true);
+		now = Clock::now();
+
+		while (next_window <= now && window < windows.size()) {
+			auto cpu = CpuSeconds(pid);
+			if (0 <= cpu && 0 <= cpu_last) {
+				std::chrono::duration<double> secs = WINDOW;
+				windows[window].cpu = (cpu - cpu_last) / secs.count();
+			}
+			cpu_last = cpu;
+
+			auto &w = windows[window];
+			std::cerr << "loadgen: t=" << window + 1 << "s sent "
+			          << w.sent << ", ACK p99 "
+			          << w.ack_us->Quantile(0.99) << "us, lag p99 "
+			          << w.lag_us->Quantile(0.99) << "us" << std::endl;
+
+			window++;
+			next_window += WINDOW;
+		}
+	}
+
+	// Give the last ACKs, and any underruns that ended late, time to
+	// come in, then see how many underruns the server counted.
+	prober.Send(underrun_stats, now);
+	auto drained = now + DRAIN;
+	while (now < drained && underruns_after < 0) {
+		poll_once(now, drained, false);
+		now = Clock::now();
+	}
+
+	if (self_hosted) {
+		prober.Send(quit, now);
+		prober.Flush();
+		conns.clear();
+		int status = 0;
+		waitpid(child, &status, 0);
+		unlink(path.c_str());
+	}
+
+	//
+	// Report.
+	//
+
+	std::uint64_t worst_with = 0;
+	std::uint64_t worst_without = 0;
+	std::string out = "{\"benchmark\": \"loadgen\", \"clients\": " +
+	                  std::to_string(clients) + ", \"listeners\": " +
+	                  std::to_string(listeners) + ", \"rate\": " +
+	                  std::to_string(rate) + ", \"depth\": " +
+	                  std::to_string(depth) + ", \"duration\": " +
+	                  std::to_string(duration) + ", \"windows\": [";
+	for (size_t i = 0; i < windows.size(); i++) {
+		auto &w = windows[i];
+		auto p99 = w.ack_us->Quantile(0.99);
+		auto &worst = w.underruns == 0 ? worst_without : worst_with;
+		worst = std::max(worst, p99);
+
+		out += i == 0 ? "\n\t" : ",\n\t";
+		out += "{\"t\": " + std::to_string(i + 1) + ", \"sent\": " +
+		       std::to_string(w.sent) + ", \"acked\": " +
+		       std::to_string(w.acked) + ", \"failed\": " +
+		       std::to_string(w.failed) + ", \"ack_us\": ";
+		Quantiles(out, *w.ack_us, false);
+		out += ", \"lag_us\": ";
+		Quantiles(out, *w.lag_us, false);
+		out += ", \"server_cpu\": " + JsonOrNull(w.cpu) +
+		       ", \"underruns\": " + std::to_string(w.underruns) +
+		       ", \"underrun_us\": " + std::to_string(w.underrun_us) +
+		       "}";
+	}
+
+	std::chrono::duration<double> run = end - start;
+	double cpu = -1;
+	std::uint64_t timed = 0;
+	double cpu_total = 0;
+	for (auto &w : windows) {
+		if (w.cpu < 0) continue;
+		cpu_total += w.cpu;
+		timed++;
+	}
+	if (0 < timed) cpu = cpu_total / timed;
+
+	bool counted = 0 <= underruns_before && 0 <= underruns_after;
+	out += "\n], \"summary\": {\"sent\": " + std::to_string(summary.sent) +
+	       ", \"acked\": " + std::to_string(summary.acked) +
+	       ", \"failed\": " + std::to_string(summary.failed) +
+	       ", \"commands_per_sec\": " +
+	       JsonOrNull(summary.acked / run.count()) + ", \"ack_us\": ";
+	Quantiles(out, *summary.ack_us, true);
+	out += ", \"lag_us\": ";
+	Quantiles(out, *summary.lag_us, true);
+	out += ", \"probes\": " + std::to_string(probes_sent) +
+	       ", \"server_cpu\": " + JsonOrNull(cpu) + ", \"underruns\": " +
+	       (counted ? std::to_string(underruns_after - underruns_before)
+	                : "null") +
+	       ", \"underrun_us\": " +
+	       (counted ? std::to_string(underrun_us_after - underrun_us_before)
+	                : "null") +
+	       ", \"underruns_unplaced\": " + std::to_string(underruns_outside) +
+	       ", \"worst_ack_p99_us_with_underruns\": " +
+	       std::to_string(worst_with) +
+	       ", \"worst_ack_p99_us_without_underruns\": " +
+	       std::to_string(worst_without) + "}}\n";
+
+	std::cout << out;
+	return EXIT_SUCCESS;
+}
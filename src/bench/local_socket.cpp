@@ -0,0 +1,176 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Benchmark of command round trips over TCP loopback and Unix sockets.
+ *
+ * This runs a real IoCore and Player (with no audio loaded) on a second
+ * thread, listening both on a loopback TCP port and on a Unix domain
+ * socket, and times how long a client waits for each command's ACK over
+ * each.  Usage: local_socket [PORT], where PORT defaults to 17350.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../audio/audio_system.hpp"
+#include "../errors.hpp"
+#include "../io.hpp"
+#include "../player.hpp"
+
+/// The number of round trips timed over each kind of socket.
+static const int ROUND_TRIPS = 2000;
+
+/// The port used if none is given.
+static const char *DEFAULT_PORT = "17350";
+
+/// A blocking client connection to playd.
+class Client
+{
+public:
+	/**
+	 * Connects to playd, retrying until it is listening.
+	 * @param family The address family of the socket.
+	 * @param addr The address of playd.
+	 * @param len The length of @a addr.
+	 */
+	Client(int family, const sockaddr *addr, socklen_t len) : fd(-1)
+	{
+		for (int tries = 0; tries < 100; tries++) {
+			this->fd = socket(family, SOCK_STREAM, 0);
+			if (connect(this->fd, addr, len) == 0) return;
+			close(this->fd);
+			this->fd = -1;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		std::cerr << "could not connect to playd" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	/// Disconnects from playd.
+	~Client()
+	{
+		if (0 <= this->fd) close(this->fd);
+	}
+
+	/**
+	 * Sends a command, and waits for its ACK.
+	 * @param command The command line, without its newline.
+	 */
+	void RoundTrip(const std::string &command)
+	{
+		auto line = command + "\n";
+		if (write(this->fd, line.data(), line.size()) < 0) Fail();
+
+		while (true) {
+			auto nl = this->pending.find('\n');
+			if (nl == std::string::npos) {
+				char buf[4096];
+				auto n = read(this->fd, buf, sizeof(buf));
+				if (n <= 0) Fail();
+				this->pending.append(buf, n);
+				continue;
+			}
+
+			bool ack = this->pending.compare(0, 4, "ACK ") == 0;
+			this->pending.erase(0, nl + 1);
+			if (ack) return;
+		}
+	}
+
+private:
+	/// Gives up on the benchmark after a socket error.
+	static void Fail()
+	{
+		std::cerr << "lost connection to playd" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	int fd;              ///< The socket.
+	std::string pending; ///< Data read, but not yet split into lines.
+};
+
+/**
+ * Times a number of round trips.
+ * @param client The client to use.
+ * @return The mean time per round trip, in microseconds.
+ */
+static double Time(Client &client)
+{
+	// The first round trip also waits out the welcome.
+	client.RoundTrip("read warmup /control/state");
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		client.RoundTrip("read bench /control/state");
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::micro> taken = end - start;
+	return taken.count() / ROUND_TRIPS;
+}
+
+/**
+ * The benchmark's main entry point.
+ * @param argc Program argument count.
+ * @param argv Program argument vector.
+ * @return The exit code.
+ */
+int main(int argc, char *argv[])
+{
+	std::string port = 1 < argc ? argv[1] : DEFAULT_PORT;
+	auto path = "/tmp/playd_bench_" + std::to_string(getpid()) + ".sock";
+
+	AudioSystem audio(0);
+	Player player(audio);
+	IoCore io(player);
+	player.SetSink(io);
+	std::thread server([&io, &port, &path] {
+		try {
+			io.Run("127.0.0.1", port, path);
+		} catch (NetError &e) {
+			std::cerr << "could not start playd: " << e.Message()
+			          << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	});
+
+	sockaddr_in tcp_addr{};
+	tcp_addr.sin_family = AF_INET;
+	tcp_addr.sin_port = htons(static_cast<std::uint16_t>(std::stoi(port)));
+	tcp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sockaddr_un local_addr{};
+	local_addr.sun_family = AF_UNIX;
+	path.copy(local_addr.sun_path, sizeof(local_addr.sun_path) - 1);
+
+	std::cout << "command round trip, mean of " << ROUND_TRIPS
+	          << " commands:" << std::endl;
+	{
+		Client tcp(AF_INET, (const sockaddr *)&tcp_addr,
+		           sizeof(tcp_addr));
+		std::cout << "\tTCP loopback: " << Time(tcp) << " us"
+		          << std::endl;
+
+		Client local(AF_UNIX, (const sockaddr *)&local_addr,
+		             sizeof(local_addr));
+		std::cout << "\tUnix socket:  " << Time(local) << " us"
+		          << std::endl;
+
+		// Asking playd to quit disconnects everyone and stops the loop.
+		local.RoundTrip("delete quit /control/state");
+	}
+	server.join();
+
+	return EXIT_SUCCESS;
+}
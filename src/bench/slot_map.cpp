@@ -0,0 +1,133 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Benchmark of broadcasting over the connection pool.
+ *
+ * This compares the SlotMap IoCore now uses for its connections against the
+ * vector of shared pointers, with holes, that it used to use.  The
+ * connections are simulated, so only the cost of the pool itself (and of
+ * packing each response) is measured, not that of the network.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../response.hpp"
+#include "../slot_map.hpp"
+
+/// The number of live simulated connections.
+static const size_t CONNECTIONS = 10000;
+
+/// The number of broadcasts timed for each pool.
+static const int BROADCASTS = 1000;
+
+/// A stand-in for a Connection, which just counts what it would send.
+class SimulatedConnection
+{
+public:
+	/// Constructs a SimulatedConnection.
+	SimulatedConnection() : bytes(0)
+	{
+	}
+
+	/**
+	 * Pretends to send a response.
+	 * @param response The response.
+	 */
+	void Respond(const Response &response)
+	{
+		this->bytes += response.Pack().size() + 1;
+	}
+
+	std::uint64_t bytes; ///< The number of bytes 'sent'.
+};
+
+/**
+ * Times a number of broadcasts.
+ * @param broadcast A function broadcasting one response.
+ * @return The mean time per broadcast, in microseconds.
+ */
+template <typename F>
+static double Time(F broadcast)
+{
+	auto response = Response::Res("Entry", "/player/time/elapsed", "1000000");
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BROADCASTS; i++) broadcast(*response);
+	auto end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::micro> taken = end - start;
+	return taken.count() / BROADCASTS;
+}
+
+/**
+ * Benchmarks the old pool: a vector of shared pointers, where disconnected
+ * clients leave holes.
+ * @return The mean time per broadcast, in microseconds.
+ */
+static double BenchSharedPool()
+{
+	// Simulate churn by having as many clients again come and go.
+	std::vector<std::shared_ptr<SimulatedConnection>> pool;
+	for (size_t i = 0; i < CONNECTIONS * 2; i++) {
+		pool.emplace_back(i % 2 == 0 ? new SimulatedConnection
+		                             : nullptr);
+	}
+
+	// This mirrors the old IoCore::Broadcast and TryRespond, down to the
+	// copies of each pointer.
+	auto try_respond = [](const std::shared_ptr<SimulatedConnection> c,
+	                      const Response &r) {
+		if (c) c->Respond(r);
+	};
+	return Time([&pool, &try_respond](const Response &r) {
+		for (size_t i = 0; i < pool.size(); i++) {
+			auto c = pool[i];
+			try_respond(c, r);
+		}
+	});
+}
+
+/**
+ * Benchmarks the new pool: a SlotMap of unique pointers.
+ * @return The mean time per broadcast, in microseconds.
+ */
+static double BenchSlotMap()
+{
+	SlotMap<std::unique_ptr<SimulatedConnection>> pool;
+	std::vector<size_t> ids;
+	for (size_t i = 0; i < CONNECTIONS * 2; i++) {
+		ids.push_back(pool.Insert(std::unique_ptr<SimulatedConnection>(
+		        new SimulatedConnection)));
+	}
+	for (size_t i = 1; i < ids.size(); i += 2) pool.Erase(ids[i]);
+
+	return Time([&pool](const Response &r) {
+		for (const auto &c : pool) c->Respond(r);
+	});
+}
+
+/**
+ * The benchmark's main entry point.
+ * @return The exit code.
+ */
+int main()
+{
+	std::cout << "broadcast to " << CONNECTIONS << " connections, mean of "
+	          << BROADCASTS << " broadcasts:" << std::endl;
+
+	auto shared = BenchSharedPool();
+	std::cout << "\tshared_ptr vector: " << shared << " us" << std::endl;
+
+	auto slots = BenchSlotMap();
+	std::cout << "\tslot map:          " << slots << " us" << std::endl;
+
+	return EXIT_SUCCESS;
+}
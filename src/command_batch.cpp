@@ -0,0 +1,94 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the CommandBatch class.
+ * @see command_batch.hpp
+ */
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cmd_result.hpp"
+#include "held_broadcasts.hpp"
+#include "player.hpp"
+#include "response.hpp"
+#include "trace.hpp"
+
+#include "command_batch.hpp"
+
+CommandBatch::CommandBatch(Player &player, ResponseSink &out)
+    : player(player), out(out), held(out)
+{
+}
+
+void CommandBatch::Add(const std::vector<std::string> &cmd, size_t id)
+{
+	this->queue.push_back(Queued{cmd, id, false});
+}
+
+void CommandBatch::Forget(size_t id)
+{
+	// A client that leaves with nothing queued can be forgotten now.
+	if (this->queue.empty()) {
+		this->player.ByeClient(id);
+		return;
+	}
+	this->queue.push_back(Queued{std::vector<std::string>(), id, true});
+}
+
+bool CommandBatch::Empty() const
+{
+	return this->queue.empty();
+}
+
+size_t CommandBatch::Run()
+{
+	if (this->queue.empty()) return 0;
+	TraceSpan span("CommandBatch::Run");
+
+	// Commands that arrive while this batch runs belong to the next one.
+	std::vector<Queued> batch;
+	std::swap(batch, this->queue);
+
+	std::vector<CommandResult> results;
+	results.reserve(batch.size());
+
+	this->player.SetSink(this->held);
+	try {
+		for (const auto &q : batch) {
+			if (q.bye) {
+				this->player.ByeClient(q.id);
+				results.push_back(CommandResult::Success());
+			} else {
+				results.push_back(this->player.RunCommand(q.cmd, q.id));
+			}
+		}
+	} catch (...) {
+		// Whatever becomes of the error, the player mustn't be left
+		// talking to a batch that's gone.
+		this->player.SetSink(this->out);
+		throw;
+	}
+	this->player.SetSink(this->out);
+
+	// As when each command ran alone, a command's broadcasts reach its
+	// client before its ACK does.
+	this->held.Release();
+
+	size_t run = 0;
+	for (size_t i = 0; i < batch.size(); i++) {
+		if (batch[i].bye) continue;
+		results[i].Emit(this->out, batch[i].cmd, batch[i].id);
+		run++;
+	}
+	return run;
+}
+
+std::uint64_t CommandBatch::Superseded() const
+{
+	return this->held.Superseded();
+}
@@ -0,0 +1,100 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the CommandBatch class.
+ * @see command_batch.cpp
+ */
+
+#ifndef PLAYD_COMMAND_BATCH_HPP
+#define PLAYD_COMMAND_BATCH_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "held_broadcasts.hpp"
+#include "player.hpp"
+#include "response.hpp"
+
+/**
+ * A batch of client commands, run on the Player together.
+ *
+ * Commands from every connection are queued as they arrive, and run once
+ * per pass of the I/O loop.  While a batch runs, the Player's broadcasts
+ * are held back, so that each resource the batch changes is announced
+ * once, with its final value, however many of the batch's commands touched
+ * it.  Fifty loads in a burst therefore cost one dump of the tree, not
+ * fifty.  The held resources go out before any of the batch's ACKs.
+ *
+ * @see HeldBroadcasts
+ */
+class CommandBatch
+{
+public:
+	/**
+	 * Constructs a CommandBatch.
+	 * @param player The player on which to run commands.
+	 * @param out The sink to which responses go; this must be the
+	 *   Player's sink outside of Run.
+	 */
+	CommandBatch(Player &player, ResponseSink &out);
+
+	/// Deleted copy constructor.
+	CommandBatch(const CommandBatch &) = delete;
+
+	/// Deleted copy-assignment.
+	CommandBatch &operator=(const CommandBatch &) = delete;
+
+	/**
+	 * Queues a client's command for the next Run.
+	 * @param cmd The command.
+	 * @param id The ID of the client's connection.
+	 */
+	void Add(const std::vector<std::string> &cmd, size_t id);
+
+	/**
+	 * Queues a client's departure for the next Run.
+	 * The Player forgets the client once the client's queued commands
+	 * have run.
+	 * @param id The ID of the client's connection.
+	 * @see Player::ByeClient
+	 */
+	void Forget(size_t id);
+
+	/**
+	 * Checks whether any commands are queued.
+	 * @return Whether the batch is empty.
+	 */
+	bool Empty() const;
+
+	/**
+	 * Runs every queued command, in the order they were queued.
+	 * Afterwards, the coalesced broadcasts, then each command's ACK, are
+	 * sent to the output sink.
+	 * @return The number of commands run.
+	 */
+	size_t Run();
+
+	/**
+	 * Gets the number of broadcasts coalesced away so far.
+	 * @return The count.
+	 */
+	std::uint64_t Superseded() const;
+
+private:
+	/// A queued command.
+	struct Queued {
+		std::vector<std::string> cmd; ///< The command, if any.
+		size_t id;                    ///< The ID of its connection.
+		bool bye;                     ///< Whether the client has left.
+	};
+
+	Player &player;            ///< The player on which to run commands.
+	ResponseSink &out;         ///< The sink to which responses go.
+	HeldBroadcasts held;       ///< The broadcasts of the running batch.
+	std::vector<Queued> queue; ///< The commands waiting for Run.
+};
+
+#endif // PLAYD_COMMAND_BATCH_HPP
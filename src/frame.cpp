@@ -0,0 +1,180 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the FrameEncoder and FrameDecoder classes.
+ * @see frame.hpp
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frame.hpp"
+#include "response.hpp"
+
+const std::uint8_t FrameEncoder::DEFINE;
+
+// Commands are a few short words; anything much bigger is a mistake.
+const std::uint64_t FrameDecoder::MAX_FRAME = 64 * 1024;
+
+//
+// FrameEncoder
+//
+
+FrameEncoder::FrameEncoder()
+{
+}
+
+std::string FrameEncoder::Encode(const Response &response)
+{
+	std::string out;
+	std::string payload;
+	payload.push_back(static_cast<char>(response.Command()));
+
+	auto &args = response.Args();
+	auto first = args.begin();
+	if (response.Command() == Response::Code::RES && first != args.end()) {
+		auto it = this->paths.find(*first);
+		if (it == this->paths.end()) {
+			auto id = static_cast<std::uint64_t>(this->paths.size());
+			it = this->paths.emplace(*first, id).first;
+
+			std::string define(1, static_cast<char>(DEFINE));
+			PutVarint(define, id);
+			define += *first;
+			PutFrame(out, define);
+		}
+
+		PutVarint(payload, it->second);
+		++first;
+	}
+
+	for (auto arg = first; arg != args.end(); ++arg) PutArg(payload, *arg);
+	PutFrame(out, payload);
+	return out;
+}
+
+/* static */ void FrameEncoder::PutVarint(std::string &out,
+                                          std::uint64_t value)
+{
+	while (0x80 <= value) {
+		out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+/* static */ bool FrameEncoder::GetVarint(const std::string &in, size_t &pos,
+                                          std::uint64_t &value)
+{
+	std::uint64_t result = 0;
+
+	// Ten bytes of seven bits each covers 64 bits.
+	size_t i = pos;
+	for (unsigned shift = 0; shift < 70; shift += 7, i++) {
+		if (in.size() <= i) return false;
+
+		auto byte = static_cast<std::uint8_t>(in[i]);
+		result |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			pos = i + 1;
+			value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* static */ void FrameEncoder::PutArg(std::string &out, const std::string &arg)
+{
+	// Only canonical decimals are numbers, so the client can always turn
+	// the number back into exactly the same string.
+	bool negative = !arg.empty() && arg[0] == '-';
+	auto digits = arg.substr(negative ? 1 : 0);
+	bool number = !digits.empty() && digits.size() <= 18 &&
+	              (digits[0] != '0' || (digits.size() == 1 && !negative));
+	for (char c : digits) number = number && '0' <= c && c <= '9';
+
+	if (!number) {
+		out.push_back(static_cast<char>(Tag::STRING));
+		PutVarint(out, arg.size());
+		out += arg;
+		return;
+	}
+
+	// Eighteen digits always fit into 63 bits, so this can't overflow.
+	std::uint64_t magnitude = std::stoull(digits);
+	if (negative) {
+		// Zigzag: -1 is 1, -2 is 3, and so on.
+		out.push_back(static_cast<char>(Tag::SIGNED));
+		PutVarint(out, magnitude * 2 - 1);
+	} else {
+		out.push_back(static_cast<char>(Tag::UNSIGNED));
+		PutVarint(out, magnitude);
+	}
+}
+
+/* static */ void FrameEncoder::PutFrame(std::string &out,
+                                         const std::string &payload)
+{
+	PutVarint(out, payload.size());
+	out += payload;
+}
+
+//
+// FrameDecoder
+//
+
+FrameDecoder::FrameDecoder() : broken(false)
+{
+}
+
+std::vector<std::vector<std::string>> FrameDecoder::Feed(const std::string &raw)
+{
+	std::vector<std::vector<std::string>> commands;
+	if (this->broken) return commands;
+
+	this->pending += raw;
+
+	size_t pos = 0;
+	while (pos < this->pending.size()) {
+		size_t start = pos;
+		std::uint64_t length;
+		if (!FrameEncoder::GetVarint(this->pending, start, length)) {
+			// A varint this long was never going to fit MAX_FRAME.
+			if (10 <= this->pending.size() - pos) this->broken = true;
+			break;
+		}
+		if (MAX_FRAME < length) {
+			this->broken = true;
+			break;
+		}
+		if (this->pending.size() - start < length) break;
+
+		auto end = start + static_cast<size_t>(length);
+		std::vector<std::string> words;
+		while (start < end) {
+			std::uint64_t size;
+			bool ok = FrameEncoder::GetVarint(this->pending, start, size);
+			if (!ok || end < start || end - start < size) {
+				this->broken = true;
+				return commands;
+			}
+			words.push_back(this->pending.substr(start, size));
+			start += static_cast<size_t>(size);
+		}
+
+		commands.push_back(std::move(words));
+		pos = end;
+	}
+
+	this->pending.erase(0, pos);
+	return commands;
+}
+
+bool FrameDecoder::Broken() const
+{
+	return this->broken;
+}
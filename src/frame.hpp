@@ -0,0 +1,133 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the FrameEncoder and FrameDecoder classes.
+ * @see frame.cpp
+ */
+
+#ifndef PLAYD_FRAME_HPP
+#define PLAYD_FRAME_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "response.hpp"
+
+/**
+ * Encodes Responses into binary frames, for clients that ask for them.
+ *
+ * Each frame is a varint payload length, then the payload.  A response's
+ * payload is its Response::Code as one byte, then each argument as a tag
+ * byte (see Tag) and its value.  The first argument of a RES, its path,
+ * is instead a varint path ID.
+ *
+ * Path IDs are handed out per client: the first time a path is sent, it is
+ * preceded by a DEFINE frame (the byte DEFINE, the ID as a varint, then
+ * the path) binding the ID to it.
+ *
+ * Varints are unsigned LEB128: seven bits at a time, least significant
+ * first, with the top bit set on every byte but the last.
+ */
+class FrameEncoder
+{
+public:
+	/// The first byte of a payload that defines a path ID.
+	static const std::uint8_t DEFINE = 0xFF;
+
+	/// The ways a response argument can be encoded.
+	enum class Tag : std::uint8_t {
+		STRING = 0,  ///< A varint byte length, then the bytes.
+		UNSIGNED = 1, ///< A decimal natural number, as a varint.
+		SIGNED = 2    ///< A negative decimal number, zigzagged to a varint.
+	};
+
+	/// Constructs a FrameEncoder that has sent no paths yet.
+	FrameEncoder();
+
+	/**
+	 * Encodes a Response.
+	 * @param response The response to encode.
+	 * @return The frames to send, including any DEFINE frame.
+	 */
+	std::string Encode(const Response &response);
+
+	/**
+	 * Appends an unsigned varint to a string.
+	 * @param out The string to which the varint is appended.
+	 * @param value The value to encode.
+	 */
+	static void PutVarint(std::string &out, std::uint64_t value);
+
+	/**
+	 * Reads an unsigned varint from a string.
+	 * @param in The string from which to read.
+	 * @param pos The position of the varint, advanced past it on success.
+	 * @param value Set to the decoded value on success.
+	 * @return False if @a in ends before the varint does, or the varint is
+	 *   too long; true otherwise.
+	 */
+	static bool GetVarint(const std::string &in, size_t &pos,
+	                      std::uint64_t &value);
+
+private:
+	/// Map from paths sent so far to their IDs.
+	std::map<std::string, std::uint64_t> paths;
+
+	/**
+	 * Appends an argument, encoded as a number if it looks like one.
+	 * @param out The payload to which the argument is appended.
+	 * @param arg The argument.
+	 */
+	static void PutArg(std::string &out, const std::string &arg);
+
+	/**
+	 * Appends a length-prefixed frame to a string.
+	 * @param out The string to which the frame is appended.
+	 * @param payload The frame's payload.
+	 */
+	static void PutFrame(std::string &out, const std::string &payload);
+};
+
+/**
+ * Splits binary frames from a client into command words.
+ *
+ * Each frame is a varint payload length, then the payload; each word of the
+ * command is a varint byte length, then the bytes.  This does the job of the
+ * Tokeniser for clients in binary mode.
+ */
+class FrameDecoder
+{
+public:
+	/// The largest frame a client may send, in bytes.
+	static const std::uint64_t MAX_FRAME;
+
+	/// Constructs a FrameDecoder with nothing pending.
+	FrameDecoder();
+
+	/**
+	 * Feeds data into the FrameDecoder.
+	 * @param raw The data, which need not hold complete frames.
+	 * @return The commands in each complete frame.
+	 */
+	std::vector<std::vector<std::string>> Feed(const std::string &raw);
+
+	/**
+	 * Checks whether the client has sent something that isn't a frame.
+	 * Once this is true, the client should be disconnected.
+	 * @return Whether a frame was malformed or over MAX_FRAME.
+	 */
+	bool Broken() const;
+
+private:
+	/// Data fed in but not yet made into frames.
+	std::string pending;
+
+	/// Whether a frame was malformed or too long.
+	bool broken;
+};
+
+#endif // PLAYD_FRAME_HPP
@@ -0,0 +1,57 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the HeldBroadcasts class.
+ * @see held_broadcasts.hpp
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "response.hpp"
+
+#include "held_broadcasts.hpp"
+
+HeldBroadcasts::HeldBroadcasts(const ResponseSink &out)
+    : out(out), superseded(0)
+{
+}
+
+void HeldBroadcasts::Respond(const Response &response, size_t id) const
+{
+	auto path = response.Path();
+	if (id != 0 || path.empty()) {
+		// Anything that isn't a resource has no later value to wait
+		// for, but mustn't overtake the resources held before it.
+		if (id == 0) this->Release();
+		this->out.Respond(response, id);
+		return;
+	}
+
+	auto it = this->held.find(path);
+	if (it == this->held.end()) {
+		this->held.emplace(path, response);
+		return;
+	}
+
+	it->second = response;
+	this->superseded++;
+}
+
+void HeldBroadcasts::Sample(const Response &response) const
+{
+	this->out.Sample(response);
+}
+
+void HeldBroadcasts::Release() const
+{
+	for (const auto &h : this->held) this->out.Respond(h.second, 0);
+	this->held.clear();
+}
+
+std::uint64_t HeldBroadcasts::Superseded() const
+{
+	return this->superseded;
+}
@@ -0,0 +1,66 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the HeldBroadcasts class.
+ * @see held_broadcasts.cpp
+ */
+
+#ifndef PLAYD_HELD_BROADCASTS_HPP
+#define PLAYD_HELD_BROADCASTS_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "response.hpp"
+
+/**
+ * A ResponseSink that holds back resource broadcasts until released.
+ *
+ * While held, each resource keeps only its latest value, so a resource
+ * broadcast many times is announced once on Release, in path order, as
+ * those of an Outbox are.  Responses to a single client, and broadcasts
+ * that aren't resources (END and the like), go straight through, though
+ * the latter release everything held first, so as not to overtake it.
+ */
+class HeldBroadcasts : public ResponseSink
+{
+public:
+	/**
+	 * Constructs a HeldBroadcasts.
+	 * @param out The sink to which responses are passed on.
+	 */
+	explicit HeldBroadcasts(const ResponseSink &out);
+
+	/// Deleted copy constructor.
+	HeldBroadcasts(const HeldBroadcasts &) = delete;
+
+	/// Deleted copy-assignment.
+	HeldBroadcasts &operator=(const HeldBroadcasts &) = delete;
+
+	void Respond(const Response &response, size_t id = 0) const override;
+
+	void Sample(const Response &response) const override;
+
+	/// Passes on, and forgets, the held back broadcasts.
+	void Release() const;
+
+	/**
+	 * Gets the number of broadcasts replaced by later ones so far.
+	 * @return The count.
+	 */
+	std::uint64_t Superseded() const;
+
+private:
+	const ResponseSink &out; ///< The sink to which responses go.
+
+	/// Map from paths to the latest held back broadcasts.
+	mutable std::map<std::string, Response> held;
+
+	/// The number of broadcasts replaced by later ones so far.
+	mutable std::uint64_t superseded;
+};
+
+#endif // PLAYD_HELD_BROADCASTS_HPP
@@ -15,26 +15,86 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <climits>
 #include <csignal>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 // If UNICODE is defined on Windows, it'll select the wide-char gai_strerror.
 // We don't want this.
 #undef UNICODE
 #include <uv.h>
 
+#include "cmd_result.hpp"
+#include "command_batch.hpp"
 #include "errors.hpp"
 #include "messages.h"
+#include "metrics.hpp"
+#include "outbox.hpp"
 #include "player.hpp"
 #include "response.hpp"
+#include "slot_map.hpp"
+#include "spsc_queue.hpp"
+#include "subscriptions.hpp"
+#include "trace.hpp"
 
 #include "io.hpp"
 
 const std::uint16_t IoCore::PLAYER_UPDATE_PERIOD = 5; // ms
 
+// Many times the state dump a new client gets, but small enough that a
+// few hundred stalled clients won't trouble the heap.
+const size_t IoCore::DEFAULT_CLIENT_BUFFER = 64 * 1024; // bytes
+
+// This was the hard-coded backlog before it became an option.
+const int SocketOptions::DEFAULT_BACKLOG = 128;
+
+// playd's responses are small lines that a client is usually waiting on,
+// which is exactly what Nagle's algorithm is bad for, so it's off by default.
+SocketOptions::SocketOptions()
+    : backlog(DEFAULT_BACKLOG), nodelay(true), keepalive(0), send_buffer(0)
+{
+}
+
+/// How many commands each batch runs.
+static Histogram &batch_commands = Metrics::Global().AddHistogram(
+        "io/batch_commands", "Commands run in each batch");
+
+/// How many broadcasts batching saved.
+static Counter &batch_superseded = Metrics::Global().AddCounter(
+        "io/batch_superseded",
+        "Broadcasts coalesced into a later one in the same batch");
+
+/// How much output is queued for each client at each flush.
+static Histogram &write_queue_bytes = Metrics::Global().AddHistogram(
+        "io/write_queue_bytes",
+        "Bytes queued for each client when its updates are flushed");
+
+/**
+ * Gets the current monotonic time, in microseconds.
+ * This is the same clock as that of the /player/time/anchor resource.
+ * @return The time.
+ */
+static std::int64_t MonotonicMicros()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now)
+	        .count();
+}
+
 //
 // libuv callbacks
 //
@@ -91,7 +151,7 @@ void UvListenCallback(uv_stream_t *server, int status)
 	if (status < 0) return;
 	assert(server != nullptr);
 
-	IoCore *pool = static_cast<IoCore *>(server->data);
+	auto pool = static_cast<ConnectionPool *>(server->data);
 	assert(pool != nullptr);
 
 	pool->Accept(server);
@@ -116,6 +176,55 @@ void UvRespondCallback(uv_write_t *req, int status)
 	delete wr;
 }
 
+/// A Prometheus scrape in progress.
+struct MetricsScrape
+{
+	uv_tcp_t tcp;          ///< The client socket; must come first.
+	uv_write_t write;      ///< The write of the answer.
+	MetricsServer *server; ///< The server that accepted the scrape.
+	std::string request;   ///< The request read so far.
+	std::string answer;    ///< The answer, kept alive while written.
+};
+
+/// The callback fired when a Prometheus scrape connects.
+void UvMetricsListenCallback(uv_stream_t *server, int status)
+{
+	if (status < 0) return;
+	assert(server != nullptr);
+
+	auto metrics = static_cast<MetricsServer *>(server->data);
+	assert(metrics != nullptr);
+	metrics->Accept();
+}
+
+/// The callback fired when some bytes are read from a Prometheus scrape.
+void UvMetricsReadCallback(uv_stream_t *stream, ssize_t nread,
+                           const uv_buf_t *buf)
+{
+	assert(stream != nullptr);
+
+	auto scrape = static_cast<MetricsScrape *>(stream->data);
+	assert(scrape != nullptr);
+	scrape->server->Read(*scrape, nread, buf);
+}
+
+/// The callback fired when a Prometheus scrape has been answered.
+void UvMetricsWriteCallback(uv_write_t *req, int)
+{
+	assert(req != nullptr);
+
+	auto scrape = static_cast<MetricsScrape *>(req->data);
+	assert(scrape != nullptr);
+	scrape->server->Finish(*scrape);
+}
+
+/// The callback fired when a Prometheus scrape has hung up.
+void UvMetricsCloseCallback(uv_handle_t *handle)
+{
+	assert(handle != nullptr);
+	delete static_cast<MetricsScrape *>(handle->data);
+}
+
 /// The callback fired when the update timer fires.
 void UvUpdateTimerCallback(uv_timer_t *handle)
 {
@@ -126,101 +235,154 @@ void UvUpdateTimerCallback(uv_timer_t *handle)
 	io->UpdatePlayer();
 }
 
+/// The callback fired after each pass of the I/O loop, to run commands.
+void UvBatchCheckCallback(uv_check_t *handle)
+{
+	assert(handle != nullptr);
+
+	IoCore *io = static_cast<IoCore *>(handle->data);
+	assert(io != nullptr);
+	io->RunBatch();
+}
+
+/// The callback fired when playd is asked, by signal, to dump its trace.
+void UvTraceSignalCallback(uv_signal_t *handle, int)
+{
+	assert(handle != nullptr);
+
+	try {
+		Tracer::Global().Dump();
+	} catch (FileError &e) {
+		Debug() << "Could not dump trace:" << e.Message() << std::endl;
+	}
+}
+
+/// The callback fired when a connection pool is woken by its IoCore.
+void UvPoolWakeCallback(uv_async_t *handle)
+{
+	assert(handle != nullptr);
+
+	auto pool = static_cast<ConnectionPool *>(handle->data);
+	assert(pool != nullptr);
+	pool->Drain();
+}
+
+/// The callback fired when an IoCore is woken by its connection pools.
+void UvCoreWakeCallback(uv_async_t *handle)
+{
+	assert(handle != nullptr);
+
+	IoCore *io = static_cast<IoCore *>(handle->data);
+	assert(io != nullptr);
+	io->Drain();
+}
+
+/// The callback fired when a threaded connection pool's flush timer fires.
+void UvFlushTimerCallback(uv_timer_t *handle)
+{
+	assert(handle != nullptr);
+
+	auto pool = static_cast<ConnectionPool *>(handle->data);
+	assert(pool != nullptr);
+	pool->Flush();
+}
+
 //
 // IoCore
 //
 
-IoCore::IoCore(Player &player) : player(player)
+IoCore::IoCore(Player &player, size_t client_buffer, size_t threads)
+    : player(player),
+      batch(player, *this),
+      threaded(0 < threads),
+      awake(false),
+      dumping(false)
 {
+	assert(threads <= MAX_THREADS);
+
+	auto count = std::max<size_t>(threads, 1);
+	for (size_t i = 0; i < count; i++) {
+		this->pools.emplace_back(new ConnectionPool(
+		        *this, i, client_buffer, this->threaded));
+	}
 }
 
-void IoCore::Run(const std::string &host, const std::string &port)
+IoCore::~IoCore()
 {
-	this->InitAcceptor(host, port);
-	this->DoUpdateTimer();
-	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	// The pools' threads must be gone before the pools are.
+	for (auto &pool : this->pools) pool->Join();
 }
 
-void IoCore::Accept(uv_stream_t *server)
+void IoCore::Run(const std::string &host, const std::string &port,
+                 const std::string &local)
 {
-	assert(server != nullptr);
+	for (auto &pool : this->pools) pool->Listen(host, port);
 
-	auto client = new uv_tcp_t();
-	uv_tcp_init(uv_default_loop(), client);
+	// Local clients are few, so one pool is plenty for them.
+	if (!local.empty()) this->pools.front()->ListenLocal(local);
 
-	// libuv does the 'nonzero is error' thing here
-	if (uv_accept(server, (uv_stream_t *)client)) {
-		uv_close((uv_handle_t *)client, UvCloseCallback);
-		return;
+	if (!this->metrics_port.empty()) {
+		this->metrics.reset(new MetricsServer(uv_default_loop()));
+		this->metrics->Listen(this->metrics_port);
 	}
 
-	auto id = this->NextConnectionID();
-	auto conn = std::make_shared<Connection>(*this, client, this->player, id);
-	client->data = static_cast<void *>(conn.get());
-	this->pool[id - 1] = std::move(conn);
-
-	// The player will already have been told to send responses to the
-	// IoCore, so all it needs to know is the slot.
-	this->player.WelcomeClient(id);
+	if (this->threaded) {
+		uv_async_init(uv_default_loop(), &this->wake, UvCoreWakeCallback);
+		this->wake.data = static_cast<void *>(this);
+		std::lock_guard<std::mutex> guard(this->wake_lock);
+		this->awake = true;
+	}
 
-	uv_read_start((uv_stream_t *)client, UvAlloc, UvReadCallback);
-}
+#ifdef SIGUSR1
+	if (Tracer::Global().Enabled()) {
+		uv_signal_init(uv_default_loop(), &this->dumper);
+		uv_signal_start(&this->dumper, UvTraceSignalCallback, SIGUSR1);
+		this->dumping = true;
+	}
+#endif // SIGUSR1
+	Tracer::Global().NameThread("main");
 
-size_t IoCore::NextConnectionID()
-{
-	// We'll want to try and use an existing, empty ID in the connection
-	// pool.  If there aren't any (we've exceeded the maximum-so-far number
-	// of simultaneous connections), we expand the pool.
-	if (this->free_list.empty()) this->ExpandPool();
-	assert(!this->free_list.empty());
+	for (auto &pool : this->pools) pool->Start();
 
-	// Acquire some free ID, and ensure that the ID cannot be re-used until
-	// replaced onto the free list by the connection's removal.
-	size_t id = this->free_list.back();
-	this->free_list.pop_back();
+	// Check handles run once the loop has polled for I/O, so each batch
+	// holds whatever every client sent in that pass.
+	uv_check_init(uv_default_loop(), &this->batcher);
+	this->batcher.data = static_cast<void *>(this);
+	uv_check_start(&this->batcher, UvBatchCheckCallback);
 
-	// client_slot should be at least 1, because of the above.
-	assert(0 < id);
-	assert(id <= this->pool.size());
+	this->DoUpdateTimer();
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
 
-	return id;
+	for (auto &pool : this->pools) pool->Join();
 }
 
-void IoCore::ExpandPool()
+void IoCore::SetSocketOptions(const SocketOptions &options)
 {
-	// If we already have SIZE_MAX-1 simultaneous connections, we bail out.
-	// Since this is at least 65,534, and likely to be 2^32-2 or 2^64-2,
-	// this is incredibly unlikely to happen and probably means someone's
-	// trying to denial-of-service an audio player.
-	//
-	// Why -1?  Because slot 0 in the connection pool is reserved for
-	// broadcasts.
-	bool full = this->pool.size() == (SIZE_MAX - 1);
-	if (full) throw InternalError(MSG_TOO_MANY_CONNS);
-
-	this->pool.emplace_back(nullptr);
-	// This isn't an off-by-one error; slots index from 1.
-	this->free_list.push_back(this->pool.size());
+	this->options = options;
 }
 
-void IoCore::Remove(size_t slot)
+const SocketOptions &IoCore::Options() const
 {
-	assert(0 < slot && slot <= this->pool.size());
-
-	// Don't remove if it's already a nullptr, because we'd end up with the
-	// slot on the free list twice.
-	if (this->pool.at(slot - 1)) {
-		this->pool[slot - 1] = nullptr;
-		this->free_list.push_back(slot);
-	}
+	return this->options;
+}
 
-	assert(!this->pool.at(slot - 1));
+void IoCore::SetMetricsPort(const std::string &port)
+{
+	this->metrics_port = port;
 }
 
 void IoCore::UpdatePlayer()
 {
+	TraceSpan span("IoCore::UpdatePlayer");
+
 	bool running = this->player.Update();
-	if (!running) this->Shutdown();
+	if (!running) {
+		this->Shutdown();
+		return;
+	}
+
+	// Threaded pools flush on their own timers.
+	if (!this->threaded) this->pools.front()->Flush();
 }
 
 void IoCore::Shutdown()
@@ -229,63 +391,149 @@ void IoCore::Shutdown()
 	// in order to disconnect clients and stop the updating.
 	// We do this by stopping everything using the loop.
 
-	// First, the update timer:
+	// First, the update timer and the batches, as the player is done:
 	uv_timer_stop(&this->updater);
+	uv_check_stop(&this->batcher);
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->batcher), nullptr);
+
+	// Then, our end of the pools' queues, so the loop can finish.  The
+	// pools may still be trying to wake us, hence the lock.
+	if (this->threaded) {
+		std::lock_guard<std::mutex> guard(this->wake_lock);
+		this->awake = false;
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->wake), nullptr);
+	}
 
-	// Then, the TCP server (as far as we can tell, this does *not* close
-	// down the connections):
-	uv_close(reinterpret_cast<uv_handle_t *>(&this->server), nullptr);
+	// Prometheus can't scrape a playd that's going away.
+	if (this->metrics) this->metrics->Close();
 
-	// Finally, kill off all of the connections with 'fatal' responses.
-	for (const auto conn : this->pool) IoCore::TryShutdown(conn);
+	// The trace can still be dumped with a command until the end.
+	if (this->dumping) {
+		uv_signal_stop(&this->dumper);
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->dumper), nullptr);
+		this->dumping = false;
+	}
+
+	// Finally, the pools themselves, which close down the TCP servers and
+	// kill off all of the connections.
+	for (auto &pool : this->pools) pool->PostShutdown();
 }
 
-/* static */ void IoCore::TryShutdown(const std::shared_ptr<Connection> conn)
+void IoCore::Respond(const Response &response, size_t id) const
 {
-	if (!conn) return;
+	if (id == 0) {
+		Debug() << "broadcast:" << response.Pack() << std::endl;
+	} else {
+		Debug() << "unicast @" << std::to_string(id) << ":"
+		        << response.Pack() << std::endl;
+	}
 
-	auto response = Response(Response::Code::STATE).AddArg("Quitting");
+	// Without threads, there's no need to copy the response anywhere.
+	if (!this->threaded) {
+		this->pools.front()->Respond(response, id);
+		return;
+	}
+
+	// Broadcasts share the one copy between all of the pools.
+	auto shared = std::make_shared<const Response>(response);
+	if (id == 0) {
+		for (auto &pool : this->pools) pool->Post(shared, 0);
+		return;
+	}
 
-	// The true at the end is for the 'fatal' argument to
-	// Connection::Respond, telling it to close itself after processing
-	// 'response'.
-	conn->Respond(response, true);
+	// The connection may have gone away since the ID was handed out, but
+	// its pool will notice that.
+	auto shard = ConnectionPool::ShardOf(id);
+	if (shard < this->pools.size()) this->pools[shard]->Post(shared, id);
 }
 
-/* static */ void IoCore::TryRespond(const std::shared_ptr<Connection> conn,
-                                     const Response &response)
+void IoCore::Sample(const Response &response) const
 {
-	if (conn) conn->Respond(response);
+	if (!this->threaded) {
+		this->pools.front()->Sample(response);
+		return;
+	}
+
+	auto shared = std::make_shared<const Response>(response);
+	for (auto &pool : this->pools) pool->PostSample(shared);
 }
 
-void IoCore::Respond(const Response &response, size_t id) const
+void IoCore::WelcomeClient(size_t id)
 {
-	if (this->pool.empty()) return;
+	// The player will already have been told to send responses to the
+	// IoCore, so all it needs to know is the ID.
+	this->player.WelcomeClient(id);
+}
 
-	if (id == 0) {
-		this->Broadcast(response);
-	} else {
-		this->Unicast(response, id);
-	}
+void IoCore::ByeClient(size_t id)
+{
+	this->batch.Forget(id);
 }
 
-void IoCore::Broadcast(const Response &response) const
+void IoCore::RunCommand(const std::vector<std::string> &cmd, size_t id)
 {
-	Debug() << "broadcast:" << response.Pack() << std::endl;
+	this->batch.Add(cmd, id);
+}
 
-	// Copy the connection by value, so that there's at least one
-	// active reference to it throughout.
-	for (const auto c : this->pool) IoCore::TryRespond(c, response);
+void IoCore::RunBatch()
+{
+	auto before = this->batch.Superseded();
+	auto run = this->batch.Run();
+	if (run == 0) return;
+
+	batch_commands.Record(run);
+	batch_superseded.Add(this->batch.Superseded() - before);
+}
+
+void IoCore::Wake()
+{
+	std::lock_guard<std::mutex> guard(this->wake_lock);
+	if (this->awake) uv_async_send(&this->wake);
+}
+
+void IoCore::Drain()
+{
+	for (auto &pool : this->pools) pool->DrainToCore();
+}
+
+/* static */ bool IoCore::IsIoResource(const std::string &path)
+{
+	return path == "/io" || path.compare(0, 4, "/io/") == 0;
 }
 
-void IoCore::Unicast(const Response &response, size_t id) const
+CommandResult IoCore::ReadIo(const std::string &path, Connection &conn) const
 {
-	assert(0 < id && id <= this->pool.size());
+	std::uint64_t queued = 0;
+	std::uint64_t superseded = 0;
+	std::uint64_t dropped = 0;
+	for (const auto &pool : this->pools) {
+		queued += pool->Queued();
+		superseded += pool->Superseded();
+		dropped += pool->Dropped();
+	}
 
-	Debug() << "unicast @" << std::to_string(id) << ":" << response.Pack()
-	        << std::endl;
+	std::map<std::string, std::uint64_t> entries = {
+	        {"/io/dropped", dropped},
+	        {"/io/queued", queued},
+	        {"/io/superseded", superseded}};
+
+	if (path == "/io") {
+		auto dir = Response::Res("Directory", path,
+		                         std::to_string(entries.size()));
+		conn.Respond(*dir);
+		for (const auto &e : entries) {
+			auto entry = Response::Res("Entry", e.first,
+			                           std::to_string(e.second));
+			conn.Respond(*entry);
+		}
+		return CommandResult::Success();
+	}
+
+	auto it = entries.find(path);
+	if (it == entries.end()) return CommandResult::Failure(MSG_NOT_FOUND);
 
-	IoCore::TryRespond(this->pool.at(id - 1), response);
+	conn.Respond(*Response::Res("Entry", path, std::to_string(it->second)));
+	return CommandResult::Success();
 }
 
 void IoCore::DoUpdateTimer()
@@ -296,19 +544,127 @@ void IoCore::DoUpdateTimer()
 	               PLAYER_UPDATE_PERIOD);
 }
 
-void IoCore::InitAcceptor(const std::string &address, const std::string &port)
+//
+// ConnectionPool
+//
+
+// Connection IDs are the IDs of the connections in their pools' SlotMaps,
+// with the pool's index squeezed in at the bottom.  SlotMap keeps its slot
+// index in the low half of the ID, so that's where the room is made; the
+// generation, in the high half, is left alone.
+
+/// The number of bits of a connection ID holding its pool's index.
+static const unsigned SHARD_BITS = 8;
+
+/// The number of bits in half a connection ID.
+static const unsigned HALF_BITS = sizeof(size_t) * CHAR_BIT / 2;
+
+/// Mask for the low half of a connection ID.
+static const size_t LOW_MASK = (size_t(1) << HALF_BITS) - 1;
+
+const size_t IoCore::MAX_THREADS = size_t(1) << SHARD_BITS;
+
+// SlotMap indices start from 1, and the index after the last must still fit.
+const size_t ConnectionPool::MAX_CONNECTIONS =
+        (size_t(1) << (HALF_BITS - SHARD_BITS)) - 2;
+
+/// The period between flushes of a threaded pool, in milliseconds.
+static const std::uint16_t POOL_FLUSH_PERIOD = 5;
+
+ConnectionPool::ConnectionPool(IoCore &core, size_t shard,
+                               size_t client_buffer, bool threaded)
+    : core(core),
+      shard(shard),
+      client_buffer(client_buffer),
+      threaded(threaded),
+      closing(false),
+      loop(threaded ? new uv_loop_t : uv_default_loop()),
+      has_local(false),
+      queued(0),
+      superseded(0),
+      dropped(0)
+{
+	if (!this->threaded) return;
+
+	uv_loop_init(this->loop);
+
+	uv_async_init(this->loop, &this->wake, UvPoolWakeCallback);
+	this->wake.data = static_cast<void *>(this);
+
+	uv_timer_init(this->loop, &this->flusher);
+	this->flusher.data = static_cast<void *>(this);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	this->Join();
+
+	// Connections only outlive a clean shutdown if the loop never ran,
+	// in which case their handles still need closing on it.
+	while (!this->connections.Empty()) {
+		this->Remove((*this->connections.begin())->ID());
+	}
+
+	if (this->threaded) {
+		uv_run(this->loop, UV_RUN_NOWAIT);
+		uv_loop_close(this->loop);
+		delete this->loop;
+	}
+}
+
+/* static */ size_t ConnectionPool::ShardOf(size_t id)
+{
+	return id & ((size_t(1) << SHARD_BITS) - 1);
+}
+
+size_t ConnectionPool::Globalise(size_t local) const
+{
+	auto low = (local & LOW_MASK) << SHARD_BITS;
+	return (local & ~LOW_MASK) | (low & LOW_MASK) | this->shard;
+}
+
+/* static */ size_t ConnectionPool::Localise(size_t id)
+{
+	auto low = (id & LOW_MASK) >> SHARD_BITS;
+	return (id & ~LOW_MASK) | low;
+}
+
+void ConnectionPool::Listen(const std::string &address, const std::string &port)
 {
 	int uport = std::stoi(port);
 
-	uv_tcp_init(uv_default_loop(), &this->server);
+	uv_tcp_init(this->loop, &this->server);
 	this->server.data = static_cast<void *>(this);
 	assert(this->server.data != nullptr);
 
 	struct sockaddr_in bind_addr;
 	uv_ip4_addr(address.c_str(), uport, &bind_addr);
+
+	if (this->threaded) {
+#ifdef SO_REUSEPORT
+		// Every pool binds its own socket to the same port, and the
+		// kernel shares incoming connections out between them.  libuv
+		// can't set the option itself, so we make the socket for it.
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		bool ok = 0 <= fd &&
+		          setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on,
+		                     sizeof(on)) == 0 &&
+		          uv_tcp_open(&this->server, fd) == 0;
+		if (!ok) {
+			if (0 <= fd) close(fd);
+			throw NetError("Could not share " + address + ":" +
+			               port + " between I/O threads");
+		}
+#else
+		throw NetError("I/O threads are not supported on this system");
+#endif
+	}
+
 	uv_tcp_bind(&this->server, (const sockaddr *)&bind_addr, 0);
 
-	int r = uv_listen((uv_stream_t *)&this->server, 128, UvListenCallback);
+	int r = uv_listen((uv_stream_t *)&this->server,
+	                  this->core.Options().backlog, UvListenCallback);
 	if (r) {
 		throw NetError("Could not listen on " + address + ":" + port +
 		               " (" + std::string(uv_err_name(r)) + ")");
@@ -317,12 +673,335 @@ void IoCore::InitAcceptor(const std::string &address, const std::string &port)
 	Debug() << "Listening at" << address << "on" << port << std::endl;
 }
 
+void ConnectionPool::ListenLocal(const std::string &path)
+{
+	uv_pipe_init(this->loop, &this->local, 0);
+	this->local.data = static_cast<void *>(this);
+	this->has_local = true;
+
+	// libuv removes the socket file again when the server closes.
+	int r = uv_pipe_bind(&this->local, path.c_str());
+	if (r == 0) {
+		r = uv_listen((uv_stream_t *)&this->local,
+		              this->core.Options().backlog, UvListenCallback);
+	}
+	if (r) {
+		throw NetError("Could not listen on " + path + " (" +
+		               std::string(uv_err_name(r)) + ")");
+	}
+
+	Debug() << "Listening at" << path << std::endl;
+}
+
+void ConnectionPool::Start()
+{
+	if (!this->threaded) return;
+
+	uv_timer_start(&this->flusher, UvFlushTimerCallback, 0,
+	               POOL_FLUSH_PERIOD);
+	this->thread = std::thread([this] {
+		Tracer::Global().NameThread("io");
+		uv_run(this->loop, UV_RUN_DEFAULT);
+	});
+}
+
+void ConnectionPool::Join()
+{
+	if (this->thread.joinable()) this->thread.join();
+}
+
+void ConnectionPool::Post(std::shared_ptr<const Response> response, size_t id)
+{
+	assert(this->threaded);
+	if (this->closing) return;
+
+	PoolMessage message;
+	message.kind = PoolMessage::Kind::RESPOND;
+	message.id = id;
+	message.response = std::move(response);
+	this->inbox.Push(std::move(message));
+	uv_async_send(&this->wake);
+}
+
+void ConnectionPool::PostSample(std::shared_ptr<const Response> response)
+{
+	assert(this->threaded);
+	if (this->closing) return;
+
+	PoolMessage message;
+	message.kind = PoolMessage::Kind::SAMPLE;
+	message.id = 0;
+	message.response = std::move(response);
+	this->inbox.Push(std::move(message));
+	uv_async_send(&this->wake);
+}
+
+void ConnectionPool::PostShutdown()
+{
+	if (this->closing) return;
+	this->closing = true;
+
+	if (!this->threaded) {
+		this->Shutdown();
+		return;
+	}
+
+	// This is the last thing we ever send the pool, so it's safe for the
+	// pool to close its wake handle when it gets it.
+	PoolMessage message;
+	message.kind = PoolMessage::Kind::SHUTDOWN;
+	message.id = 0;
+	this->inbox.Push(std::move(message));
+	uv_async_send(&this->wake);
+}
+
+void ConnectionPool::DrainToCore()
+{
+	CoreMessage message;
+	while (this->outbox.Pop(message)) {
+		if (message.kind == CoreMessage::Kind::WELCOME) {
+			this->core.WelcomeClient(message.id);
+		} else if (message.kind == CoreMessage::Kind::BYE) {
+			this->core.ByeClient(message.id);
+		} else {
+			this->core.RunCommand(message.cmd, message.id);
+		}
+	}
+}
+
+std::uint64_t ConnectionPool::Queued() const
+{
+	return this->queued.load(std::memory_order_relaxed);
+}
+
+std::uint64_t ConnectionPool::Superseded() const
+{
+	return this->superseded.load(std::memory_order_relaxed);
+}
+
+std::uint64_t ConnectionPool::Dropped() const
+{
+	return this->dropped.load(std::memory_order_relaxed);
+}
+
+void ConnectionPool::Respond(const Response &response, size_t id) const
+{
+	if (id == 0) {
+		for (const auto &c : this->connections) c->Offer(response);
+		return;
+	}
+
+	// The connection may have gone away since the ID was handed out, in
+	// which case the ID is stale and finds nothing.
+	auto conn = this->connections.Find(ConnectionPool::Localise(id));
+	if (conn != nullptr) (*conn)->Respond(response);
+}
+
+void ConnectionPool::Sample(const Response &response) const
+{
+	for (const auto &c : this->connections) c->OfferSample(response);
+}
+
+void ConnectionPool::Accept(uv_stream_t *server)
+{
+	assert(server != nullptr);
+
+	uv_stream_t *client;
+	if (this->has_local && server == (uv_stream_t *)&this->local) {
+		auto pipe = new uv_pipe_t();
+		uv_pipe_init(this->loop, pipe, 0);
+		client = (uv_stream_t *)pipe;
+	} else {
+		auto tcp = new uv_tcp_t();
+		uv_tcp_init(this->loop, tcp);
+		client = (uv_stream_t *)tcp;
+	}
+
+	// libuv does the 'nonzero is error' thing here
+	if (uv_accept(server, client)) {
+		uv_close((uv_handle_t *)client, UvCloseCallback);
+		return;
+	}
+
+	// If we already have millions of simultaneous connections, this
+	// probably means someone's trying to denial-of-service an audio
+	// player, so we turn away any more.
+	bool full = this->connections.Full() ||
+	            MAX_CONNECTIONS <= this->connections.Size();
+	if (full) {
+		Debug() << MSG_TOO_MANY_CONNS << std::endl;
+		uv_close((uv_handle_t *)client, UvCloseCallback);
+		return;
+	}
+
+	this->Tune(client);
+
+	auto id = this->Globalise(this->connections.NextID());
+	auto conn = std::unique_ptr<Connection>(new Connection(*this, client, id));
+	client->data = static_cast<void *>(conn.get());
+	this->connections.Insert(std::move(conn));
+
+	if (this->threaded) {
+		CoreMessage message;
+		message.kind = CoreMessage::Kind::WELCOME;
+		message.id = id;
+		this->SendToCore(std::move(message));
+	} else {
+		this->core.WelcomeClient(id);
+	}
+
+	uv_read_start(client, UvAlloc, UvReadCallback);
+}
+
+void ConnectionPool::Remove(size_t id)
+{
+	// Once removed, the ID is stale, so removing twice is harmless.
+	if (!this->connections.Erase(ConnectionPool::Localise(id))) return;
+
+	// The player may be holding state for the client, such as an open
+	// transaction.
+	if (this->threaded) {
+		CoreMessage message;
+		message.kind = CoreMessage::Kind::BYE;
+		message.id = id;
+		this->SendToCore(std::move(message));
+	} else {
+		this->core.ByeClient(id);
+	}
+}
+
+void ConnectionPool::Flush()
+{
+	// Doing this once per update coalesces everything that changed since
+	// the last one.  Removing connections would disturb the iteration,
+	// so hopeless ones are dropped afterwards.
+	std::uint64_t total = 0;
+	std::vector<size_t> hopeless;
+	for (const auto &c : this->connections) {
+		if (c->Flush()) {
+			total += c->Queued();
+		} else {
+			hopeless.push_back(c->ID());
+		}
+	}
+
+	for (auto id : hopeless) this->Remove(id);
+	this->dropped.fetch_add(hopeless.size(), std::memory_order_relaxed);
+	this->queued.store(total, std::memory_order_relaxed);
+}
+
+void ConnectionPool::Drain()
+{
+	PoolMessage message;
+	while (this->inbox.Pop(message)) {
+		switch (message.kind) {
+			case PoolMessage::Kind::RESPOND:
+				this->Respond(*message.response, message.id);
+				break;
+			case PoolMessage::Kind::SAMPLE:
+				this->Sample(*message.response);
+				break;
+			case PoolMessage::Kind::SHUTDOWN:
+				this->Shutdown();
+				return;
+		}
+	}
+}
+
+void ConnectionPool::RunCommand(const std::vector<std::string> &cmd, size_t id)
+{
+	if (!this->threaded) {
+		this->core.RunCommand(cmd, id);
+		return;
+	}
+
+	CoreMessage message;
+	message.kind = CoreMessage::Kind::COMMAND;
+	message.id = id;
+	message.cmd = cmd;
+	this->SendToCore(std::move(message));
+}
+
+IoCore &ConnectionPool::Core() const
+{
+	return this->core;
+}
+
+size_t ConnectionPool::ClientBuffer() const
+{
+	return this->client_buffer;
+}
+
+void ConnectionPool::CountSuperseded()
+{
+	this->superseded.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ConnectionPool::Shutdown()
+{
+	// As far as we can tell, closing the TCP server does *not* close down
+	// the connections.
+	uv_close(reinterpret_cast<uv_handle_t *>(&this->server), nullptr);
+	if (this->has_local) {
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->local), nullptr);
+	}
+
+	if (this->threaded) {
+		uv_timer_stop(&this->flusher);
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->flusher), nullptr);
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->wake), nullptr);
+	}
+
+	// Kill off all of the connections with 'fatal' responses.  The true
+	// at the end is for the 'fatal' argument to Connection::Respond,
+	// telling it to close itself after processing the response.  Once
+	// they've all closed, the loop runs out of things to do and stops.
+	auto response = Response(Response::Code::STATE).AddArg("Quitting");
+	for (const auto &c : this->connections) c->Respond(response, true);
+}
+
+void ConnectionPool::Tune(uv_stream_t *client)
+{
+	auto &options = this->core.Options();
+
+	// None of these are worth dropping the client over if they fail.
+	int r = 0;
+	if (client->type == UV_TCP) {
+		auto tcp = (uv_tcp_t *)client;
+		if (options.nodelay) r = uv_tcp_nodelay(tcp, 1);
+		if (r == 0 && 0 < options.keepalive) {
+			r = uv_tcp_keepalive(tcp, 1, options.keepalive);
+		}
+	}
+	if (r == 0 && 0 < options.send_buffer) {
+		int size = options.send_buffer;
+		r = uv_send_buffer_size((uv_handle_t *)client, &size);
+	}
+
+	if (r) {
+		Debug() << "Could not set socket options:" << uv_err_name(r)
+		        << std::endl;
+	}
+}
+
+void ConnectionPool::SendToCore(CoreMessage message)
+{
+	this->outbox.Push(std::move(message));
+	this->core.Wake();
+}
+
 //
 // Connection
 //
 
-Connection::Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id)
-    : parent(parent), tcp(tcp), tokeniser(), player(player), id(id)
+Connection::Connection(ConnectionPool &parent, uv_stream_t *stream, size_t id)
+    : parent(parent),
+      stream(stream),
+      tokeniser(),
+      framed(false),
+      id(id),
+      outbox(parent.ClientBuffer()),
+      received(0)
 {
 	Debug() << "Opening connection from" << Name() << std::endl;
 }
@@ -330,32 +1009,88 @@ Connection::Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id)
 Connection::~Connection()
 {
 	Debug() << "Closing connection from" << Name() << std::endl;
-	uv_close((uv_handle_t *)this->tcp, UvCloseCallback);
+	uv_close((uv_handle_t *)this->stream, UvCloseCallback);
 }
 
 void Connection::Respond(const Response &response, bool fatal)
 {
-	auto string = response.Pack();
+	std::string string;
+	if (this->framed) {
+		string = this->encoder.Encode(response);
+	} else {
+		string = response.Pack();
+		string += '\n';
+	}
 
 	unsigned int l = string.length();
-	const char *s = string.c_str();
+	const char *s = string.data();
 	assert(s != nullptr);
 
 	auto req = new WriteReq;
 	req->conn = this;
 	req->fatal = fatal;
 
-	req->buf = uv_buf_init(new char[l + 1], l + 1);
+	req->buf = uv_buf_init(new char[l], l);
 	assert(req->buf.base != nullptr);
 	memcpy(req->buf.base, s, l);
-	req->buf.base[l] = '\n';
 
-	uv_write((uv_write_t *)req, (uv_stream_t *)this->tcp, &req->buf, 1,
+	uv_write((uv_write_t *)req, this->stream, &req->buf, 1,
 	         UvRespondCallback);
 }
 
+void Connection::Offer(const Response &response)
+{
+	if (this->subscriptions.Offer(response)) this->Send(response);
+}
+
+void Connection::Send(const Response &response)
+{
+	auto post = this->outbox.Offer(response, this->Queued());
+	if (post == Outbox::Post::FLUSH) {
+		for (const auto &r : this->outbox.Drain()) this->Respond(r);
+	}
+	if (post == Outbox::Post::SEND || post == Outbox::Post::FLUSH) {
+		this->Respond(response);
+	}
+	if (post == Outbox::Post::SUPERSEDED) this->parent.CountSuperseded();
+}
+
+void Connection::OfferSample(const Response &response)
+{
+	this->subscriptions.OfferSample(response);
+}
+
+bool Connection::Flush()
+{
+	auto now = Subscriptions::Clock::now();
+	for (const auto &r : this->subscriptions.Due(now)) this->Send(r);
+
+	auto queued = this->Queued();
+	write_queue_bytes.Record(queued);
+	if (this->outbox.Hopeless(queued, now)) {
+		Debug() << "Dropping" << Name() << "- not reading," << queued
+		        << "bytes queued" << std::endl;
+		return false;
+	}
+
+	for (const auto &r : this->outbox.Release(queued)) this->Respond(r);
+	return true;
+}
+
+size_t Connection::Queued() const
+{
+	// libuv tracks this for us, as everything Respond sends goes through
+	// the same stream.
+	return this->stream->write_queue_size;
+}
+
 std::string Connection::Name()
 {
+	auto id = std::to_string(this->id);
+
+	// Unix domain socket peers don't have names worth looking up.
+	if (this->stream->type == UV_NAMED_PIPE) return id + "!local";
+
 	// Warning: fairly low-level Berkeley sockets code ahead!
 	// (Thankfully, libuv makes sure the appropriate headers are included.)
 
@@ -367,7 +1102,8 @@ std::string Connection::Name()
 	// Turns out if you don't do this, Windows (and only Windows?) is upset.
 	socklen_t namelen = sizeof(s);
 
-	int pe = uv_tcp_getpeername(this->tcp, sp, (int *)&namelen);
+	int pe = uv_tcp_getpeername((uv_tcp_t *)this->stream, sp,
+	                            (int *)&namelen);
 	// These std::string()s are needed as, otherwise, the compiler would
 	// think we're trying to add const char*s together.  We need AT LEAST
 	// ONE of the sides of the first + to be a std::string.
@@ -385,12 +1121,13 @@ std::string Connection::Name()
 	// See comment for above error.
 	if (ne) return "<error@name: " + std::string(gai_strerror(ne)) + ">";
 
-	auto id = std::to_string(this->id);
 	return id + std::string("!") + host + std::string(":") + serv;
 }
 
 void Connection::Read(ssize_t nread, const uv_buf_t *buf)
 {
+	TraceSpan span("Connection::Read");
+
 	assert(buf != nullptr);
 
 	// Did the connection hang up?  If so, de-pool it.
@@ -415,9 +1152,20 @@ void Connection::Read(ssize_t nread, const uv_buf_t *buf)
 	if (chars == nullptr) return;
 
 	// Everything looks okay for reading.
-	auto cmds = this->tokeniser.Feed(std::string(chars, nread));
-	for (auto cmd : cmds) RunCommand(cmd);
+	this->received = MonotonicMicros();
+	auto raw = std::string(chars, nread);
 	delete[] chars;
+
+	auto cmds = this->framed ? this->decoder.Feed(raw)
+	                         : this->tokeniser.Feed(raw);
+	for (auto cmd : cmds) RunCommand(cmd);
+
+	// There's no resynchronising with a client that's lost track of its
+	// frames, so it has to go.
+	if (this->decoder.Broken()) {
+		Debug() << "Bad frame from" << Name() << std::endl;
+		this->Depool();
+	}
 }
 
 void Connection::RunCommand(const std::vector<std::string> &cmd)
@@ -428,11 +1176,192 @@ void Connection::RunCommand(const std::vector<std::string> &cmd)
 	for (const auto &word : cmd) std::cerr << ' ' << '"' << word << '"';
 	std::cerr << std::endl;
 
-	CommandResult res = this->player.RunCommand(cmd, this->id);
+	// Watches are a property of the connection, not the player, so we
+	// handle them here.  As with the player's commands, the first argument
+	// is a tag.
+	auto nargs = cmd.size() - 1;
+	bool watch = "watch" == cmd[0] && (nargs == 2 || nargs == 3);
+	bool unwatch = "unwatch" == cmd[0] && nargs == 2;
+	bool ping = "ping" == cmd[0] && nargs == 1;
+	bool binary = "binary" == cmd[0] && nargs == 1;
+
+	// Likewise, the /io resources describe the connections.
+	bool read_io = "read" == cmd[0] && nargs == 2 &&
+	               IoCore::IsIoResource(cmd[2]);
+
+	// Everything else goes to the player, which sends its own result.
+	// Player commands run in batches, so a command handled here can be
+	// answered before a player command sent ahead of it; clients should
+	// match ACKs by tag, not by order.
+	if (!(watch || unwatch || ping || binary || read_io)) {
+		this->parent.RunCommand(cmd, this->id);
+		return;
+	}
+
+	CommandResult res = CommandResult::Success();
+	if (watch) {
+		res = this->Watch(cmd[2], nargs == 3 ? cmd[3] : "");
+	} else if (unwatch) {
+		res = this->Unwatch(cmd[2]);
+	} else if (ping) {
+		res = this->Ping();
+	} else if (read_io) {
+		res = this->parent.Core().ReadIo(cmd[2], *this);
+	}
 	res.Emit(this->parent, cmd, this->id);
+
+	// The ACK is the last thing the client gets as text.
+	if (binary) this->framed = true;
+}
+
+CommandResult Connection::Ping()
+{
+	Response pong(Response::Code::PONG);
+	pong.AddArg(std::to_string(this->received));
+	pong.AddArg(std::to_string(MonotonicMicros()));
+	this->Respond(pong);
+	return CommandResult::Success();
+}
+
+CommandResult Connection::Watch(const std::string &path,
+                                const std::string &interval)
+{
+	if (path.empty() || path[0] != '/') {
+		return CommandResult::Invalid(MSG_WATCH_INVALID_PATH);
+	}
+
+	std::chrono::milliseconds ms(0);
+	bool ok = interval.empty() || Subscriptions::ParseInterval(interval, ms);
+	if (!ok) return CommandResult::Invalid(MSG_WATCH_INVALID_INTERVAL);
+
+	this->subscriptions.Watch(path, ms);
+	return CommandResult::Success();
+}
+
+CommandResult Connection::Unwatch(const std::string &path)
+{
+	if (!this->subscriptions.Unwatch(path)) {
+		return CommandResult::Failure(MSG_WATCH_NOT_WATCHING);
+	}
+	return CommandResult::Success();
+}
+
+size_t Connection::ID() const
+{
+	return this->id;
 }
 
 void Connection::Depool()
 {
 	this->parent.Remove(this->id);
 }
+
+//
+// MetricsServer
+//
+
+// Prometheus sends a request line and a few headers.
+const size_t MetricsServer::MAX_REQUEST = 8 * 1024;
+
+MetricsServer::MetricsServer(uv_loop_t *loop) : loop(loop), listening(false)
+{
+}
+
+void MetricsServer::Listen(const std::string &port)
+{
+	uv_tcp_init(this->loop, &this->server);
+	this->server.data = static_cast<void *>(this);
+	this->listening = true;
+
+	struct sockaddr_in bind_addr;
+	uv_ip4_addr("127.0.0.1", std::stoi(port), &bind_addr);
+	uv_tcp_bind(&this->server, (const sockaddr *)&bind_addr, 0);
+
+	int r = uv_listen((uv_stream_t *)&this->server, SOMAXCONN,
+	                  UvMetricsListenCallback);
+	if (r) {
+		throw NetError("Could not serve metrics on 127.0.0.1:" + port +
+		               " (" + std::string(uv_err_name(r)) + ")");
+	}
+
+	Debug() << "Serving metrics at 127.0.0.1 on" << port << std::endl;
+}
+
+void MetricsServer::Accept()
+{
+	auto scrape = new MetricsScrape;
+	scrape->server = this;
+	uv_tcp_init(this->loop, &scrape->tcp);
+	scrape->tcp.data = static_cast<void *>(scrape);
+
+	auto stream = (uv_stream_t *)&scrape->tcp;
+	if (uv_accept((uv_stream_t *)&this->server, stream)) {
+		uv_close((uv_handle_t *)stream, UvMetricsCloseCallback);
+		return;
+	}
+
+	this->scrapes.insert(scrape);
+	uv_read_start(stream, UvAlloc, UvMetricsReadCallback);
+}
+
+void MetricsServer::Read(MetricsScrape &scrape, ssize_t nread,
+                         const uv_buf_t *buf)
+{
+	assert(buf != nullptr);
+
+	if (0 < nread) scrape.request.append(buf->base, nread);
+	delete[] buf->base;
+
+	if (nread < 0) {
+		this->Finish(scrape);
+		return;
+	}
+
+	// We don't care what was asked for, only that the asking is over.
+	bool done = scrape.request.find("\r\n\r\n") != std::string::npos ||
+	            MAX_REQUEST <= scrape.request.size();
+	if (!done) return;
+
+	uv_read_stop((uv_stream_t *)&scrape.tcp);
+	this->Answer(scrape);
+}
+
+void MetricsServer::Answer(MetricsScrape &scrape)
+{
+	auto body = Metrics::Global().Prometheus();
+
+	scrape.answer = "HTTP/1.0 200 OK\r\n"
+	                "Content-Type: text/plain; version=0.0.4\r\n"
+	                "Content-Length: " +
+	                std::to_string(body.size()) +
+	                "\r\n"
+	                "Connection: close\r\n"
+	                "\r\n" +
+	                body;
+
+	auto buf = uv_buf_init(&scrape.answer[0], scrape.answer.size());
+	scrape.write.data = static_cast<void *>(&scrape);
+	uv_write(&scrape.write, (uv_stream_t *)&scrape.tcp, &buf, 1,
+	         UvMetricsWriteCallback);
+}
+
+void MetricsServer::Finish(MetricsScrape &scrape)
+{
+	auto handle = (uv_handle_t *)&scrape.tcp;
+	if (uv_is_closing(handle)) return;
+
+	this->scrapes.erase(&scrape);
+	uv_close(handle, UvMetricsCloseCallback);
+}
+
+void MetricsServer::Close()
+{
+	if (this->listening) {
+		uv_close(reinterpret_cast<uv_handle_t *>(&this->server), nullptr);
+		this->listening = false;
+	}
+
+	// Finishing a scrape takes it out of the set.
+	auto scrapes = this->scrapes;
+	for (auto scrape : scrapes) this->Finish(*scrape);
+}
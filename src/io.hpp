@@ -10,35 +10,124 @@
 #ifndef PLAYD_IO_CORE_HPP
 #define PLAYD_IO_CORE_HPP
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include <uv.h>
 
+#include "cmd_result.hpp"
+#include "command_batch.hpp"
+#include "frame.hpp"
+#include "outbox.hpp"
 #include "player.hpp"
 #include "response.hpp"
+#include "slot_map.hpp"
+#include "spsc_queue.hpp"
+#include "subscriptions.hpp"
 #include "tokeniser.hpp"
 
 class Player;
 class Connection;
+class ConnectionPool;
+class MetricsServer;
+
+/**
+ * Options for the sockets on which an IoCore listens for, and serves,
+ * clients.
+ */
+struct SocketOptions {
+	/// The default listen backlog.
+	static const int DEFAULT_BACKLOG;
+
+	/// Constructs SocketOptions with the defaults.
+	SocketOptions();
+
+	/// The number of connections that may wait to be accepted.
+	int backlog;
+
+	/// Whether TCP clients are sent small writes immediately, rather than
+	/// having them held back by Nagle's algorithm.
+	bool nodelay;
+
+	/// The idle time, in seconds, before TCP keepalive probes begin, or 0
+	/// for no keepalive.
+	unsigned int keepalive;
+
+	/// The size of each client's socket send buffer, in bytes, or 0 for
+	/// the system's default.
+	int send_buffer;
+};
 
 /**
  * The IO core, which services input, routes responses, and executes the
  * Player update routine periodically.
  *
- * The IO core also maintains a pool of connections which can be sent responses
- * via their IDs inside the pool.  It ensures that each connection is given an
- * ID that is unique up until the removal of said connection.
+ * Connections are held in one or more ConnectionPools.  By default, there is
+ * one pool, served on the same loop (and thread) as the Player.  Optionally,
+ * there may instead be several pools, each with its own loop and thread, so
+ * that reading, writing and formatting for many clients is spread across
+ * cores.  The Player only ever runs on the IoCore's own thread; commands are
+ * passed to it, and responses passed back out, through lock-free queues.
+ *
+ * Each connection is given an ID that is unique, and the IDs of removed
+ * connections find nothing.
  */
 class IoCore : public ResponseSink
 {
 public:
+	/// The default outbound budget of each connection, in bytes.
+	static const size_t DEFAULT_CLIENT_BUFFER;
+
+	/// The most I/O threads the IoCore can run.
+	static const size_t MAX_THREADS;
+
+	/// The period between player updates, in milliseconds.
+	static const uint16_t PLAYER_UPDATE_PERIOD;
+
 	/**
 	 * Constructs an IoCore.
 	 * @param player The player to which update requests, commands, and new
 	 *   connection state dump requests shall be sent.
+	 * @param client_buffer The number of bytes that may be queued to a
+	 *   connection before its updates are held back.
+	 * @param threads The number of threads serving connections, or 0 to
+	 *   serve them on the Player's thread.  At most MAX_THREADS.
+	 * @see Outbox
 	 */
-	explicit IoCore(Player &player);
+	explicit IoCore(Player &player,
+	                size_t client_buffer = DEFAULT_CLIENT_BUFFER,
+	                size_t threads = 0);
+
+	/// Destructs an IoCore.
+	~IoCore();
+
+	/**
+	 * Sets the options for the IoCore's sockets.
+	 * This must be called before Run, if at all.
+	 * @param options The socket options.
+	 */
+	void SetSocketOptions(const SocketOptions &options);
+
+	/**
+	 * Gets the options for the IoCore's sockets.
+	 * @return The socket options.
+	 */
+	const SocketOptions &Options() const;
+
+	/**
+	 * Sets the loopback port on which the IoCore serves its metrics to
+	 * Prometheus.
+	 * This must be called before Run, if at all.
+	 * @param port The TCP port, or the empty string for none.
+	 * @see MetricsServer
+	 */
+	void SetMetricsPort(const std::string &port);
 
 	/// Deleted copy constructor.
 	IoCore(const IoCore &) = delete;
@@ -51,142 +140,401 @@ public:
 	 * It will block until it terminates.
 	 * @param host The IP host to which IoCore will bind.
 	 * @param port The TCP port to which IoCore will bind.
-	 * @exception NetError Thrown if IoCore cannot bind to @a host or @a
-	 *   port.
+	 * @param local The path of a Unix domain socket on which IoCore will
+	 *   also listen, or the empty string for none.
+	 * @exception NetError Thrown if IoCore cannot bind to @a host, @a
+	 *   port, @a local, or the metrics port.
+	 */
+	void Run(const std::string &host, const std::string &port,
+	         const std::string &local = "");
+
+	/**
+	 * Performs a player update cycle.
+	 * If the player is closing, IoCore will announce this fact to
+	 * all current connections, close them, and end the I/O loop.
+	 * Otherwise, any responses connections have held back for their
+	 * watches are delivered, if due.
 	 */
-	void Run(const std::string &host, const std::string &port);
+	void UpdatePlayer();
+
+	void Respond(const Response &response, size_t id = 0) const override;
+
+	void Sample(const Response &response) const override;
 
 	//
-	// Connection API
+	// Connection pool API
 	//
 
 	/**
-	 * Accepts a new connection.
-	 *
-	 * This accepts the connection, and adds it to this IoCore's
-	 * connection pool.
-	 *
-	 * This should be called with a server that has just received a new
-	 * connection.
-	 *
-	 * @param server Pointer to the libuv server accepting connections.
+	 * Sends welcome information to a new client.
+	 * This must be called on the IoCore's thread.
+	 * @param id The ID of the client's connection.
 	 */
-	void Accept(uv_stream_t *server);
+	void WelcomeClient(size_t id);
 
 	/**
-	 * Removes a connection.
-	 * As the IoCore owns the Connection, it will be destroyed by this
-	 * operation.
-	 * @param id The ID of the connection to remove.
+	 * Tells the player a client has gone away.
+	 * This happens in turn with the client's queued commands.
+	 * This must be called on the IoCore's thread.
+	 * @param id The ID of the client's connection.
 	 */
-	void Remove(size_t id);
+	void ByeClient(size_t id);
 
 	/**
-	 * Performs a player update cycle.
-	 * If the player is closing, IoCore will announce this fact to
-	 * all current connections, close them, and end the I/O loop.
+	 * Queues a client's command to run on the Player.
+	 * Commands are run in batches, once per pass of the I/O loop, so
+	 * the command's ACK will follow shortly rather than at once.
+	 * This must be called on the IoCore's thread.
+	 * @param cmd The command.
+	 * @param id The ID of the client's connection.
+	 * @see CommandBatch
 	 */
-	void UpdatePlayer();
+	void RunCommand(const std::vector<std::string> &cmd, size_t id);
 
-	void Respond(const Response &response, size_t id = 0) const override;
+	/**
+	 * Runs the commands queued since the last batch.
+	 * This is called on the IoCore's thread after each pass of the I/O
+	 * loop has read what it can from the clients.
+	 */
+	void RunBatch();
 
-private:
-	/// The period between player updates.
-	static const uint16_t PLAYER_UPDATE_PERIOD;
+	/**
+	 * Wakes the IoCore to take commands from its connection pools.
+	 * This may be called from any thread.
+	 */
+	void Wake();
 
-	uv_tcp_t server;    ///< The libuv handle for the TCP server.
+	/**
+	 * Takes and runs any commands waiting in the connection pools.
+	 * This is called on the IoCore's thread when it is woken.
+	 */
+	void Drain();
+
+	/**
+	 * Checks whether a resource belongs to the IoCore, not the Player.
+	 * @param path The path of the resource.
+	 * @return Whether the resource is in the /io subtree.
+	 */
+	static bool IsIoResource(const std::string &path);
+
+	/**
+	 * Reads an /io resource, sending it to one connection.
+	 * This may be called from any connection pool's thread.
+	 * @param path The path of the resource.
+	 * @param conn The connection to receive the resource.
+	 * @return The result of reading.
+	 */
+	CommandResult ReadIo(const std::string &path, Connection &conn) const;
+
+private:
 	uv_timer_t updater; ///< The libuv handle for the update timer.
+	uv_async_t wake;    ///< The libuv handle for waking the IoCore.
+	uv_signal_t dumper; ///< The libuv handle for trace dump signals.
+	uv_check_t batcher; ///< The libuv handle for running command batches.
 	Player &player;     ///< The player.
 
-	/// The set of connections inside this IoCore.
-	std::vector<std::shared_ptr<Connection>> pool;
+	/// The commands waiting to run on the player.
+	CommandBatch batch;
 
-	/// A list of free 1-indexed slots inside pool.
-	/// These slots may be re-used instead of creating a new slot.
-	std::vector<size_t> free_list;
+	/// Whether the connection pools run on their own threads.
+	const bool threaded;
 
-	/**
-	 * Initialises a TCP acceptor on the given address and port.
-	 *
-	 * @param address The IPv4 address on which the TCP server should
-	 *   listen.
-	 * @param port The TCP port on which the TCP server should listen.
-	 */
-	void InitAcceptor(const std::string &address, const std::string &port);
+	/// The options for the IoCore's sockets.
+	SocketOptions options;
+
+	/// Lock guarding the opening and closing of wake.
+	std::mutex wake_lock;
+
+	/// Whether wake may be used; guarded by wake_lock.
+	bool awake;
+
+	/// Whether dumper is listening for signals.
+	bool dumping;
+
+	/// The connection pools.
+	std::vector<std::unique_ptr<ConnectionPool>> pools;
+
+	/// The loopback port for Prometheus, or the empty string for none.
+	std::string metrics_port;
+
+	/// The server for Prometheus, if it is listening.
+	std::unique_ptr<MetricsServer> metrics;
 
 	/// Sets up a periodic timer to run the playd update loop.
 	void DoUpdateTimer();
 
 	/// Shuts down the IoCore by terminating all IO loop tasks.
 	void Shutdown();
+};
+
+/**
+ * A set of client connections, all served from the same libuv loop.
+ *
+ * A ConnectionPool may either share the IoCore's loop, in which case it is
+ * driven directly by the IoCore, or have a loop and thread of its own.  In
+ * the latter case, everything the IoCore sends it goes through a lock-free
+ * queue, as does everything it sends the IoCore, and each side wakes the
+ * other with a uv_async_t.
+ *
+ * The ConnectionPool is a ResponseSink for responses to its connections,
+ * but only from its own thread; the IoCore uses Post and friends instead.
+ */
+class ConnectionPool : public ResponseSink
+{
+public:
+	/// The most connections one ConnectionPool can hold.
+	static const size_t MAX_CONNECTIONS;
+
+	/**
+	 * Constructs a ConnectionPool.
+	 * @param core The IoCore to which commands should be sent.
+	 * @param shard The index of this pool in its IoCore.
+	 * @param client_buffer The outbound budget of each connection.
+	 * @param threaded Whether this pool runs on its own loop and thread.
+	 */
+	ConnectionPool(IoCore &core, size_t shard, size_t client_buffer,
+	               bool threaded);
+
+	/// Destructs a ConnectionPool, and its loop if it has its own.
+	~ConnectionPool();
+
+	/// Deleted copy constructor.
+	ConnectionPool(const ConnectionPool &) = delete;
+
+	/// Deleted copy-assignment.
+	ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+	/**
+	 * Gets the connection pool to which a connection ID belongs.
+	 * @param id The connection ID.
+	 * @return The index of the connection's pool in its IoCore.
+	 */
+	static size_t ShardOf(size_t id);
 
 	//
-	// Connection pool handling
+	// IoCore thread API
 	//
 
 	/**
-	 * Acquires the next available connection ID.
-	 * This ID may have been assigned to a connection in the past, but is
-	 * guaranteed not to match any currently assigned IDs.
-	 * @return size_t A fresh ID for use.
+	 * Starts listening for connections.
+	 * Threaded pools all listen on the same port, with SO_REUSEPORT, and
+	 * the operating system shares connections between them.
+	 * @param address The IPv4 address on which to listen.
+	 * @param port The TCP port on which to listen.
+	 * @exception NetError Thrown if the pool cannot listen.
+	 */
+	void Listen(const std::string &address, const std::string &port);
+
+	/**
+	 * Starts listening for connections on a Unix domain socket.
+	 * Local clients skip the TCP stack altogether, but are otherwise
+	 * served just like TCP ones.
+	 * @param path The path of the socket, which must not already exist.
+	 * @exception NetError Thrown if the pool cannot listen.
+	 */
+	void ListenLocal(const std::string &path);
+
+	/// Starts the pool's thread, if it has its own.
+	void Start();
+
+	/// Waits for the pool's thread, if it has its own, to finish.
+	void Join();
+
+	/**
+	 * Posts a response to the pool's connections.
+	 * @param response The response to post.
+	 * @param id The ID of the recipient connection, or 0 for all.
+	 */
+	void Post(std::shared_ptr<const Response> response, size_t id);
+
+	/**
+	 * Posts a sample to the pool's connections.
+	 * @param response The sampled response.
+	 * @see ResponseSink::Sample
+	 */
+	void PostSample(std::shared_ptr<const Response> response);
+
+	/**
+	 * Tells the pool to disconnect its clients and stop.
+	 * Nothing may be posted to the pool afterwards.
+	 */
+	void PostShutdown();
+
+	/**
+	 * Takes and runs any commands this pool has sent the IoCore.
+	 * @see IoCore::Drain
+	 */
+	void DrainToCore();
+
+	/**
+	 * Gets the total bytes queued to this pool's connections, as of the
+	 * last flush.
+	 * @return The number of bytes queued.
+	 */
+	std::uint64_t Queued() const;
+
+	/**
+	 * Gets the number of held back updates superseded by newer ones.
+	 * @return The number of superseded updates.
 	 */
-	size_t NextConnectionID();
+	std::uint64_t Superseded() const;
 
 	/**
-	 * Adds a new connection slot to the connection pool.
-	 * This is called by NextConnectionID when the number of currently
-	 * running connections is larger than the number of existing pool
-	 * slots, and will eventually fail (when the number of simultaneous
-	 * connections reaches absurd proportions).
+	 * Gets the number of connections dropped for falling too far behind.
+	 * @return The number of dropped connections.
 	 */
-	void ExpandPool();
+	std::uint64_t Dropped() const;
 
 	//
-	// Response dispatch
+	// Pool thread API
 	//
 
+	void Respond(const Response &response, size_t id = 0) const override;
+
+	void Sample(const Response &response) const override;
+
 	/**
-	 * Sends a normal response to the given connection.
-	 * The difference between this and conn->Respond is that TryRespond
-	 * checks the shared pointer for emptiness.
-	 * @param conn The connection to receive the response.  May be empty,
-	 *   in which case no response is sent.
-	 * @see TryShutdown
+	 * Accepts a new connection.
+	 * This should be called with a server that has just received a new
+	 * connection.
+	 * @param server Pointer to the libuv server accepting connections.
 	 */
-	static void TryRespond(const std::shared_ptr<Connection> conn,
-	                       const Response &response);
+	void Accept(uv_stream_t *server);
 
 	/**
-	 * Sends a 'this server is shutting down' response to the given
-	 * connection.
-	 * The difference between this and conn->Respond is that TryShutdown
-	 * checks the shared pointer for emptiness.
-	 * @param conn The connection to receive the response.  May be empty,
-	 *   in which case no response is sent.
-	 * @see TryRespond
+	 * Removes a connection.
+	 * As the pool owns the Connection, it will be destroyed by this
+	 * operation.
+	 * @param id The ID of the connection to remove.
+	 */
+	void Remove(size_t id);
+
+	/**
+	 * Sends any held back responses that are due, and drops hopeless
+	 * connections.
+	 */
+	void Flush();
+
+	/// Takes and acts on anything the IoCore has posted.
+	void Drain();
+
+	/**
+	 * Sends a client's command to the IoCore.
+	 * @param cmd The command.
+	 * @param id The ID of the client's connection.
+	 */
+	void RunCommand(const std::vector<std::string> &cmd, size_t id);
+
+	/**
+	 * Gets the IoCore to which this pool belongs.
+	 * @return The IoCore.
+	 */
+	IoCore &Core() const;
+
+	/**
+	 * Gets the outbound budget of each connection.
+	 * @return The number of bytes that may be queued to a connection
+	 *   before its updates are held back.
+	 */
+	size_t ClientBuffer() const;
+
+	/// Records that a held back update was superseded by a newer one.
+	void CountSuperseded();
+
+private:
+	/// A message from the IoCore to a threaded pool.
+	struct PoolMessage {
+		/// The kinds of message.
+		enum class Kind : std::uint8_t {
+			RESPOND, ///< Send the response to the connection.
+			SAMPLE,  ///< Offer the sample to all connections.
+			SHUTDOWN ///< Disconnect everyone and stop.
+		};
+
+		Kind kind; ///< The kind of message.
+		size_t id; ///< The connection ID, or 0 for all.
+
+		/// The response, shared between pools when broadcast.
+		std::shared_ptr<const Response> response;
+	};
+
+	/// A message from a threaded pool to the IoCore.
+	struct CoreMessage {
+		/// The kinds of message.
+		enum class Kind : std::uint8_t {
+			WELCOME, ///< Welcome the new connection.
+			COMMAND, ///< Run the command.
+			BYE      ///< Forget the departed connection.
+		};
+
+		Kind kind;                    ///< The kind of message.
+		size_t id;                    ///< The connection ID.
+		std::vector<std::string> cmd; ///< The command, if any.
+	};
+
+	IoCore &core;              ///< The IoCore.
+	const size_t shard;        ///< The pool's index in the IoCore.
+	const size_t client_buffer; ///< The outbound budget of each connection.
+	const bool threaded;       ///< Whether the pool has its own thread.
+	bool closing;              ///< Whether PostShutdown has been called.
+
+	uv_loop_t *loop;    ///< The loop serving the pool.
+	uv_tcp_t server;    ///< The libuv handle for the TCP server.
+	uv_pipe_t local;    ///< The libuv handle for the local server, if any.
+	bool has_local;     ///< Whether the pool is listening on local.
+	uv_timer_t flusher; ///< The flush timer, if threaded.
+	uv_async_t wake;    ///< The handle for waking the pool, if threaded.
+	std::thread thread; ///< The pool's thread, if threaded.
+
+	/// Messages from the IoCore to the pool.
+	SpscQueue<PoolMessage> inbox;
+
+	/// Messages from the pool to the IoCore.
+	SpscQueue<CoreMessage> outbox;
+
+	/// The connections, keyed by their local IDs.
+	SlotMap<std::unique_ptr<Connection>> connections;
+
+	std::atomic<std::uint64_t> queued;     ///< See Queued.
+	std::atomic<std::uint64_t> superseded; ///< See Superseded.
+	std::atomic<std::uint64_t> dropped;    ///< See Dropped.
+
+	/// Disconnects every client, and stops the pool's loop.
+	void Shutdown();
+
+	/**
+	 * Applies the IoCore's socket options to a newly accepted client.
+	 * @param client The client's stream.
+	 */
+	void Tune(uv_stream_t *client);
+
+	/**
+	 * Sends a message to the IoCore, and wakes it.
+	 * @param message The message.
 	 */
-	static void TryShutdown(const std::shared_ptr<Connection> conn);
+	void SendToCore(CoreMessage message);
 
 	/**
-	 * Sends the given response to all connections.
-	 * @param response The response to broadcast.
+	 * Converts a local connection ID into a global one.
+	 * @param local The ID in this pool's SlotMap.
+	 * @return The global ID.
 	 */
-	void Broadcast(const Response &response) const;
+	size_t Globalise(size_t local) const;
 
 	/**
-	 * Sends the given response to the identified connection.
-	 * @param response The response to broadcast.
-	 * @param id The ID of the recipient connection.
+	 * Converts a global connection ID into a local one.
+	 * @param id The global ID.
+	 * @return The ID in its pool's SlotMap.
 	 */
-	void Unicast(const Response &response, size_t id) const;
+	static size_t Localise(size_t id);
 };
 
 /**
- * A TCP connection from a client.
+ * A TCP or Unix domain socket connection from a client.
  *
- * This class wraps a libuv TCP stream representing a client connection,
+ * This class wraps a libuv stream representing a client connection,
  * allowing it to be sent responses (directly, or via a broadcast), removed
- * from its IoCore, and queried for its name.
+ * from its ConnectionPool, and queried for its name.
  */
 class Connection
 {
@@ -194,15 +542,14 @@ public:
 	/**
 	 * Constructs a Connection.
 	 * @param parent The connection pool to which this Connection belongs.
-	 * @param tcp The underlying libuv TCP stream.
-	 * @param player The player to which read commands should be sent.
+	 * @param stream The underlying libuv TCP or pipe stream.
 	 * @param id The ID of this Connection in the IoCore.
 	 */
-	Connection(IoCore &parent, uv_tcp_t *tcp, Player &player, size_t id);
+	Connection(ConnectionPool &parent, uv_stream_t *stream, size_t id);
 
 	/**
 	 * Destructs a Connection.
-	 * This causes libuv to close and free the libuv TCP stream.
+	 * This causes libuv to close and free the libuv stream.
 	 */
 	~Connection();
 
@@ -220,6 +567,34 @@ public:
 	 */
 	void Respond(const Response &response, bool fatal = false);
 
+	/**
+	 * Offers a broadcast Response to this Connection.
+	 * The response is sent, held back, or dropped, depending on what the
+	 * client is watching.
+	 * @param response The response to offer.
+	 */
+	void Offer(const Response &response);
+
+	/**
+	 * Offers a sampled Response to this Connection.
+	 * @param response The response to offer.
+	 * @see ResponseSink::Sample
+	 */
+	void OfferSample(const Response &response);
+
+	/**
+	 * Sends any held back responses that are now due.
+	 * @return False if the client has fallen hopelessly behind, and
+	 *   should be removed; true otherwise.
+	 */
+	bool Flush();
+
+	/**
+	 * Gets the number of bytes waiting to be sent on this connection.
+	 * @return The number of bytes queued.
+	 */
+	size_t Queued() const;
+
 	/**
 	 * Processes a data read on this connection.
 	 * @param nread The number of bytes read.
@@ -229,39 +604,164 @@ public:
 
 	/**
 	 * Removes this connection from its connection pool.
-	 * Since the pool may contain a shared reference to this connection,
-	 * calling this can result in the connection being destructed.
+	 * Since the pool owns this connection, calling this results in the
+	 * connection being destructed.
 	 */
 	void Depool();
 
 	/**
 	 * Retrieves a name for this connection.
-	 * This will be of the form "HOST:PORT", unless errors occur.
+	 * This will be of the form "ID!HOST:PORT", or "ID!local" for Unix
+	 * domain socket clients, unless errors occur.
 	 * @return The Connection's name.
 	 */
 	std::string Name();
 
+	/**
+	 * Retrieves this connection's ID in its connection pool.
+	 * @return The Connection's ID.
+	 */
+	size_t ID() const;
+
 private:
 	/// The pool on which this connection is running.
-	IoCore &parent;
+	ConnectionPool &parent;
 
-	/// The libuv handle for the TCP connection.
-	uv_tcp_t *tcp;
+	/// The libuv handle for the connection.
+	uv_stream_t *stream;
 
 	/// The Tokeniser to which data read on this connection should be sent.
 	Tokeniser tokeniser;
 
-	/// The Player to which finished commands should be sent.
-	Player &player;
+	/// Whether the client has switched to binary frames.
+	bool framed;
+
+	/// The encoder for responses, once the client is framed.
+	FrameEncoder encoder;
+
+	/// The decoder for commands, once the client is framed.
+	FrameDecoder decoder;
 
 	/// The Connection's ID in the connection pool.
 	size_t id;
 
+	/// The resource subtrees the client is watching.
+	Subscriptions subscriptions;
+
+	/// The client's outbound budget.
+	Outbox outbox;
+
+	/// When the last data was read from the client, in monotonic
+	/// microseconds.
+	std::int64_t received;
+
 	/**
 	 * Handles a tokenised command line.
 	 * @param msg A vector of command words representing a command line.
 	 */
 	void RunCommand(const std::vector<std::string> &msg);
+
+	/**
+	 * Starts watching a resource subtree.
+	 * @param path The root of the subtree.
+	 * @param interval The delivery interval, or the empty string to
+	 *   deliver changes as they happen.
+	 * @return The result of watching.
+	 */
+	CommandResult Watch(const std::string &path, const std::string &interval);
+
+	/**
+	 * Stops watching a resource subtree.
+	 * @param path The root of the subtree.
+	 * @return The result of unwatching.
+	 */
+	CommandResult Unwatch(const std::string &path);
+
+	/**
+	 * Answers a ping with a PONG carrying the times at which the ping was
+	 * received and answered, so clients can split a round trip into time
+	 * spent in transit and time spent in playd.
+	 * @return The result of pinging.
+	 */
+	CommandResult Ping();
+
+	/**
+	 * Sends a broadcast Response, unless the client is over budget.
+	 * @param response The response to send.
+	 * @see Outbox
+	 */
+	void Send(const Response &response);
+};
+
+/// A Prometheus scrape in progress, as seen by libuv.
+struct MetricsScrape;
+
+/**
+ * A minimal HTTP server for Prometheus.
+ *
+ * It answers every request, whatever its method or path, with the Metrics
+ * registry in the Prometheus text format, then hangs up.  It listens only
+ * on loopback, and runs on the IoCore's loop: scrapes are rare, and
+ * reading the metrics never blocks anything that updates them.
+ */
+class MetricsServer
+{
+public:
+	/**
+	 * Constructs a MetricsServer.
+	 * @param loop The loop on which the server will run.
+	 */
+	explicit MetricsServer(uv_loop_t *loop);
+
+	/// Deleted copy constructor.
+	MetricsServer(const MetricsServer &) = delete;
+
+	/// Deleted copy-assignment.
+	MetricsServer &operator=(const MetricsServer &) = delete;
+
+	/**
+	 * Starts listening on loopback.
+	 * @param port The TCP port on which to listen.
+	 * @exception NetError Thrown if the server cannot listen on @a port.
+	 */
+	void Listen(const std::string &port);
+
+	/// Accepts a new scrape.
+	void Accept();
+
+	/**
+	 * Handles data read from a scrape.
+	 * @param scrape The scrape.
+	 * @param nread The number of bytes read, or a libuv error.
+	 * @param buf The buffer holding the bytes read.
+	 */
+	void Read(MetricsScrape &scrape, ssize_t nread, const uv_buf_t *buf);
+
+	/**
+	 * Hangs up on a scrape, if it isn't already being hung up on.
+	 * @param scrape The scrape.
+	 */
+	void Finish(MetricsScrape &scrape);
+
+	/// Stops listening, and hangs up on any scrapes in progress.
+	void Close();
+
+private:
+	/// The largest request read before answering anyway.
+	static const size_t MAX_REQUEST;
+
+	uv_loop_t *loop;   ///< The loop on which the server runs.
+	uv_tcp_t server;   ///< The listening socket.
+	bool listening;    ///< Whether server is open.
+
+	/// The scrapes in progress.
+	std::set<MetricsScrape *> scrapes;
+
+	/**
+	 * Sends the metrics to a scrape, which is finished once they've gone.
+	 * @param scrape The scrape.
+	 */
+	void Answer(MetricsScrape &scrape);
 };
 
 #endif // PLAYD_IO_CORE_HPP
@@ -8,14 +8,25 @@
  */
 
 #include <algorithm>
+#include <climits>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <tuple>
 
 #include "audio/audio_system.hpp"
+#include "audio/pcm_cache.hpp"
+#include "audio/prefetcher.hpp"
+#include "audio/render_sink.hpp"
+#include "errors.hpp"
 #include "io.hpp"
+#include "outbox.hpp"
 #include "response.hpp"
 #include "player.hpp"
+#include "status_page.hpp"
+#include "trace.hpp"
 #include "messages.h"
 
 #ifdef WITH_MP3
@@ -31,6 +42,62 @@ static const std::string DEFAULT_HOST = "0.0.0.0";
 /// The default TCP port on which playd will bind.
 static const std::string DEFAULT_PORT = "1350";
 
+/// The default size of the decoded audio cache, in MiB.
+static const std::uint64_t DEFAULT_PCM_CACHE_SIZE = 1024;
+
+/// The default amount of each file to prefetch, in MiB.
+static const std::uint64_t DEFAULT_PREFETCH_SIZE = 8;
+
+/// Map from the names of `--name=value` options to their descriptions.
+static const std::map<std::string, std::string> OPTIONS = {
+        {"backlog",
+         "N: connections that may wait to be accepted (default: " +
+                 std::to_string(SocketOptions::DEFAULT_BACKLOG) + ")"},
+        {"buffer-ms", "MS: length of the audio buffer (default: " +
+                              std::to_string(SdlAudioSink::DEFAULT_BUFFER_MS) +
+                              ")"},
+        {"client-buffer",
+         "KIB: output queued to a client before updates are held back "
+         "(default: " +
+                 std::to_string(IoCore::DEFAULT_CLIENT_BUFFER / 1024) + ")"},
+        {"io-threads",
+         "N: serve clients from N threads (default: 0, the main thread)"},
+        {"metrics-port",
+         "PORT: serve metrics to Prometheus on 127.0.0.1:PORT"},
+        {"period-ms", "MS: audio device period (default: chosen by SDL)"},
+        {"pcm-cache", "DIR: cache decoded audio in DIR"},
+        {"pcm-cache-size",
+         "MIB: maximum size of the decoded audio cache (default: " +
+                 std::to_string(DEFAULT_PCM_CACHE_SIZE) + ")"},
+        {"prefetch-manifest",
+         "FILE: prefetch the files listed, one per line, in FILE"},
+        {"prefetch-size", "MIB: amount of each file to prefetch (default: " +
+                                  std::to_string(DEFAULT_PREFETCH_SIZE) +
+                                  ")"},
+        {"realtime",
+         "1: lock audio buffers into RAM and ask for a real-time audio "
+         "thread (default: 0)"},
+        {"rebuffer-ms",
+         "MS: after an underrun, buffer MS of audio before resuming "
+         "(default: 0, resume at once)"},
+        {"render",
+         "FILE: render to FILE (WAV if it ends in .wav, otherwise raw), "
+         "as fast as possible, instead of playing"},
+        {"send-buffer",
+         "KIB: socket send buffer of each client (default: chosen by the "
+         "system)"},
+        {"socket", "PATH: also listen for local clients on the Unix socket "
+                   "PATH"},
+        {"status-page",
+         "NAME: publish status to the shared memory page NAME (eg /playd)"},
+        {"tcp-keepalive",
+         "S: idle seconds before probing TCP clients (default: 0, never)"},
+        {"tcp-nodelay",
+         "0/1: send small writes to TCP clients at once (default: 1)"},
+        {"trace",
+         "FILE: record a timeline of playd's threads, dumped to FILE on "
+         "SIGUSR1 or 'write TAG /control/trace Dump'"}};
+
 /**
  * Creates a vector of strings from a C-style argument vector.
  * @param argc Program argument count.
@@ -44,12 +111,70 @@ std::vector<std::string> MakeArgVector(int argc, char *argv[])
 	return args;
 }
 
+/**
+ * Separates `--name=value` options from the other program arguments.
+ * @param args The program argument vector.  Options are removed from it.
+ * @return A map from option names (without the `--`) to their values.
+ * @exception ConfigError Thrown if an option is unknown or malformed.
+ */
+std::map<std::string, std::string> TakeOptions(std::vector<std::string> &args)
+{
+	std::map<std::string, std::string> options;
+
+	auto is_option = [](const std::string &arg) {
+		return arg.compare(0, 2, "--") == 0;
+	};
+
+	for (const auto &arg : args) {
+		if (!is_option(arg)) continue;
+
+		auto eq = arg.find('=');
+		auto name = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+		if (OPTIONS.count(name) == 0 || eq == std::string::npos) {
+			throw ConfigError("bad option: " + arg);
+		}
+		options[name] = arg.substr(eq + 1);
+	}
+
+	args.erase(std::remove_if(args.begin(), args.end(), is_option),
+	           args.end());
+	return options;
+}
+
+/**
+ * Gets a numeric option.
+ * @param options The map of options given to playd.
+ * @param name The name of the option.
+ * @param def The value to use if the option was not given.
+ * @return The value of the option.
+ * @exception ConfigError Thrown if the option is not a number.
+ */
+std::uint64_t GetNumberOption(const std::map<std::string, std::string> &options,
+                              const std::string &name, std::uint64_t def)
+{
+	auto it = options.find(name);
+	if (it == options.end()) return def;
+
+	size_t end = 0;
+	std::uint64_t value = 0;
+	try {
+		value = std::stoull(it->second, &end);
+	} catch (...) {
+		end = 0;
+	}
+	if (end == 0 || end != it->second.size()) {
+		throw ConfigError("option '" + name + "' needs a number");
+	}
+	return value;
+}
+
 /**
  * Tries to get the output device ID from program arguments.
  * @param args The program argument vector.
+ * @param check Whether to check that the ID is an SDL output device.
  * @return The device ID, -1 if invalid selection (or none).
  */
-int GetDeviceID(const std::vector<std::string> &args)
+int GetDeviceID(const std::vector<std::string> &args, bool check)
 {
 	// Did the user provide an ID at all?
 	if (args.size() < 2) return -1;
@@ -64,18 +189,145 @@ int GetDeviceID(const std::vector<std::string> &args)
 	}
 
 	// Only allow valid, outputtable devices; reject input-only devices.
-	if (!SdlAudioSink::IsOutputDevice(id)) return -1;
+	if (check && !SdlAudioSink::IsOutputDevice(id)) return -1;
 
 	return id;
 }
 
+/**
+ * Gets the socket options from the options given to playd.
+ * @param options The map of options given to playd.
+ * @return The socket options.
+ */
+SocketOptions GetSocketOptions(const std::map<std::string, std::string> &options)
+{
+	SocketOptions socket_options;
+
+	auto backlog = GetNumberOption(options, "backlog",
+	                               SocketOptions::DEFAULT_BACKLOG);
+	if (backlog == 0 || INT_MAX < backlog) {
+		throw ConfigError("backlog must be between 1 and " +
+		                  std::to_string(INT_MAX));
+	}
+	socket_options.backlog = static_cast<int>(backlog);
+
+	auto nodelay = GetNumberOption(options, "tcp-nodelay", 1);
+	if (1 < nodelay) throw ConfigError("tcp-nodelay must be 0 or 1");
+	socket_options.nodelay = nodelay == 1;
+
+	auto keepalive = GetNumberOption(options, "tcp-keepalive", 0);
+	if (UINT_MAX < keepalive) throw ConfigError("tcp-keepalive is too long");
+	socket_options.keepalive = static_cast<unsigned int>(keepalive);
+
+	auto send_buffer = GetNumberOption(options, "send-buffer", 0);
+	if (INT_MAX / 1024 < send_buffer) {
+		throw ConfigError("send-buffer is too large");
+	}
+	socket_options.send_buffer = static_cast<int>(send_buffer * 1024);
+
+	return socket_options;
+}
+
+/**
+ * Opens the status page, if one was asked for.
+ * @param options The map of options given to playd.
+ * @return The status page, or nullptr if none was asked for.
+ */
+std::unique_ptr<StatusPage> OpenStatusPage(
+        const std::map<std::string, std::string> &options)
+{
+	auto name = options.find("status-page");
+	if (name == options.end()) return nullptr;
+
+	try {
+		return std::unique_ptr<StatusPage>(new StatusPage(name->second));
+	} catch (FileError &e) {
+		throw ConfigError(e.Message());
+	}
+}
+
 /**
  * Sets up the audio system with the desired sources and sinks.
  * @param audio The audio system to configure.
+ * @param options The map of options given to playd.
+ * @param status The status page to which sinks publish, if any.
  */
-void SetupAudioSystem(AudioSystem &audio)
+void SetupAudioSystem(AudioSystem &audio,
+                      const std::map<std::string, std::string> &options,
+                      StatusPage *status)
 {
-	audio.SetSink(&SdlAudioSink::Build);
+	// The sink clamps these to something sensible; we just need them to
+	// fit into its parameters.
+	auto buffer_ms = static_cast<std::uint32_t>(std::min<std::uint64_t>(
+	        UINT32_MAX, GetNumberOption(options, "buffer-ms",
+	                                    SdlAudioSink::DEFAULT_BUFFER_MS)));
+	auto period_ms = static_cast<std::uint32_t>(std::min<std::uint64_t>(
+	        UINT32_MAX, GetNumberOption(options, "period-ms",
+	                                    SdlAudioSink::DEFAULT_PERIOD_MS)));
+	auto rebuffer_ms = static_cast<std::uint32_t>(std::min<std::uint64_t>(
+	        UINT32_MAX, GetNumberOption(options, "rebuffer-ms", 0)));
+	if (buffer_ms == 0) throw ConfigError("buffer-ms must be positive");
+
+	auto realtime = GetNumberOption(options, "realtime", 0);
+	if (1 < realtime) throw ConfigError("realtime must be 0 or 1");
+	SdlAudioSink::SetRealTime(realtime == 1);
+
+	auto render = options.find("render");
+	if (render != options.end()) {
+		std::shared_ptr<RenderFile> file;
+		try {
+			file = std::make_shared<RenderFile>(render->second);
+		} catch (FileError &e) {
+			throw ConfigError(e.Message());
+		}
+		audio.SetSink([file](const AudioSource &source, int) {
+			return RenderAudioSink::Build(source, file);
+		});
+	} else {
+		audio.SetSink([buffer_ms, period_ms, rebuffer_ms, status](
+		        const AudioSource &source, int device_id) {
+			return SdlAudioSink::Build(source, device_id, buffer_ms,
+			                           period_ms, rebuffer_ms,
+			                           status);
+		});
+	}
+
+	auto cache_dir = options.find("pcm-cache");
+	if (cache_dir != options.end()) {
+		auto mib = GetNumberOption(options, "pcm-cache-size",
+		                           DEFAULT_PCM_CACHE_SIZE);
+		auto max_mib = UINT64_MAX / 1024 / 1024;
+		if (mib == 0 || max_mib < mib) {
+			throw ConfigError("pcm-cache-size must be between 1 and " +
+			                  std::to_string(max_mib));
+		}
+		audio.SetCache(std::unique_ptr<PcmCache>(
+		        new PcmCache(cache_dir->second, mib * 1024 * 1024)));
+	}
+
+	auto prefetch_mib = GetNumberOption(options, "prefetch-size",
+	                                    DEFAULT_PREFETCH_SIZE);
+	auto max_prefetch_mib = UINT64_MAX / 1024 / 1024;
+	if (prefetch_mib == 0 || max_prefetch_mib < prefetch_mib) {
+		throw ConfigError("prefetch-size must be between 1 and " +
+		                  std::to_string(max_prefetch_mib));
+	}
+	audio.SetPrefetcher(std::unique_ptr<Prefetcher>(
+	        new Prefetcher(prefetch_mib * 1024 * 1024)));
+
+	auto manifest = options.find("prefetch-manifest");
+	if (manifest != options.end()) {
+		std::ifstream file(manifest->second);
+		if (!file) {
+			throw ConfigError("can't read prefetch manifest: " +
+			                  manifest->second);
+		}
+
+		std::string path;
+		while (std::getline(file, path)) {
+			if (!path.empty()) audio.Prefetch(path);
+		}
+	}
 
 // Now set up the available sources.
 #ifdef WITH_MP3
@@ -97,7 +349,7 @@ void SetupAudioSystem(AudioSystem &audio)
  */
 void ExitWithUsage(const std::string &progname)
 {
-	std::cerr << "usage: " << progname << " ID [HOST] [PORT]\n";
+	std::cerr << "usage: " << progname << " [OPTIONS] ID [HOST] [PORT]\n";
 	std::cerr << "where ID is one of the following numbers:\n";
 
 	// Show the user the valid device IDs they can use.
@@ -110,6 +362,12 @@ void ExitWithUsage(const std::string &progname)
 	std::cerr << "default HOST: " << DEFAULT_HOST << "\n";
 	std::cerr << "default PORT: " << DEFAULT_PORT << "\n";
 
+	std::cerr << "where OPTIONS are any of:\n";
+	for (const auto &option : OPTIONS) {
+		std::cerr << "\t--" << option.first << "=" << option.second
+		          << "\n";
+	}
+
 	exit(EXIT_FAILURE);
 }
 
@@ -131,13 +389,26 @@ std::pair<std::string, std::string> GetHostAndPort(
  * Exits with an error message for a network error.
  * @param host The IP host to which playd tried to bind.
  * @param port The TCP port to which playd tried to bind.
+ * @param local The Unix socket to which playd tried to bind, if any.
  * @param msg The exception's error message.
  */
 void ExitWithNetError(const std::string &host, const std::string &port,
-                      const std::string &msg)
+                      const std::string &local, const std::string &msg)
 {
 	std::cerr << "Network error: " << msg << "\n";
-	std::cerr << "Is " << host << ":" << port << " available?\n";
+	std::cerr << "Is " << host << ":" << port;
+	if (!local.empty()) std::cerr << " (or " << local << ")";
+	std::cerr << " available?\n";
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Exits with an error message for a configuration error.
+ * @param msg The exception's error message.
+ */
+void ExitWithConfigError(const std::string &msg)
+{
+	std::cerr << "Configuration error: " << msg << std::endl;
 	exit(EXIT_FAILURE);
 }
 
@@ -166,22 +437,86 @@ int main(int argc, char *argv[])
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	// This call needs to happen before GetDeviceID, otherwise no device
-	// IDs will be recognised.  (This is why it's here, and not in
+	auto args = MakeArgVector(argc, argv);
+
+	std::map<std::string, std::string> options;
+	std::string bad_options;
+	try {
+		options = TakeOptions(args);
+	} catch (ConfigError &e) {
+		bad_options = e.Message();
+	}
+
+	// Rendering to a file needs neither SDL nor a sound device.
+	bool rendering = 0 < options.count("render");
+
+	// Otherwise, this call needs to happen before GetDeviceID, or no
+	// device IDs will be recognised.  (This is why it's here, and not in
 	// SetupAudioSystem.)
-	SdlAudioSink::InitLibrary();
-	atexit(SdlAudioSink::CleanupLibrary);
+	if (!rendering || !bad_options.empty()) {
+		SdlAudioSink::InitLibrary();
+		atexit(SdlAudioSink::CleanupLibrary);
+	}
 
-	auto args = MakeArgVector(argc, argv);
+	if (!bad_options.empty()) {
+		std::cerr << bad_options << "\n";
+		ExitWithUsage(args.at(0));
+	}
 
-	auto device_id = GetDeviceID(args);
+	auto device_id = GetDeviceID(args, !rendering);
 	if (device_id < 0) ExitWithUsage(args.at(0));
 
+	// Tracing must be on before any of playd's threads start.
+	auto trace = options.find("trace");
+	if (trace != options.end()) Tracer::Global().Enable(trace->second);
+
 	// Set up all of the components of playd in one fell swoop.
 	AudioSystem audio(device_id);
-	SetupAudioSystem(audio);
+	std::unique_ptr<StatusPage> status;
+	try {
+		status = OpenStatusPage(options);
+		SetupAudioSystem(audio, options, status.get());
+	} catch (ConfigError &e) {
+		ExitWithConfigError(e.Message());
+	}
 	Player player(audio);
-	IoCore io(player);
+	if (status) player.SetStatusPage(*status);
+
+	std::uint64_t client_buffer = 0;
+	std::uint64_t io_threads = 0;
+	try {
+		client_buffer = GetNumberOption(options, "client-buffer",
+		                                IoCore::DEFAULT_CLIENT_BUFFER / 1024);
+		// Outboxes multiply the budget when deciding who's hopeless.
+		auto max_client_buffer =
+		        SIZE_MAX / 1024 / Outbox::HOPELESS_FACTOR;
+		if (client_buffer == 0 || max_client_buffer < client_buffer) {
+			throw ConfigError("client-buffer must be between 1 and " +
+			                  std::to_string(max_client_buffer));
+		}
+		io_threads = GetNumberOption(options, "io-threads", 0);
+		if (IoCore::MAX_THREADS < io_threads) {
+			throw ConfigError("io-threads must be at most " +
+			                  std::to_string(IoCore::MAX_THREADS));
+		}
+	} catch (ConfigError &e) {
+		ExitWithConfigError(e.Message());
+	}
+	IoCore io(player, static_cast<size_t>(client_buffer * 1024),
+	          static_cast<size_t>(io_threads));
+	try {
+		io.SetSocketOptions(GetSocketOptions(options));
+
+		auto metrics_port = GetNumberOption(options, "metrics-port", 0);
+		if (65535 < metrics_port) {
+			throw ConfigError("metrics-port must be at most 65535");
+		}
+		if (0 < metrics_port) {
+			io.SetMetricsPort(std::to_string(metrics_port));
+		}
+	} catch (ConfigError &e) {
+		ExitWithConfigError(e.Message());
+	}
 
 	// Make sure the player broadcasts its responses back to the IoCore.
 	player.SetSink(io);
@@ -190,10 +525,12 @@ int main(int argc, char *argv[])
 	std::string host;
 	std::string port;
 	std::tie(host, port) = GetHostAndPort(args);
+	auto it = options.find("socket");
+	auto local = it == options.end() ? "" : it->second;
 	try {
-		io.Run(host, port);
+		io.Run(host, port, local);
 	} catch (NetError &e) {
-		ExitWithNetError(host, port, e.Message());
+		ExitWithNetError(host, port, local, e.Message());
 	} catch (Error &e) {
 		ExitWithError(e.Message());
 	}
@@ -103,6 +103,38 @@ const std::string MSG_INVALID_PAYLOAD = "cannot write this value";
 /// Message shown when we try to write/delete to something we can't.
 const std::string MSG_INVALID_ACTION = "cannot perform this action";
 
+//
+// Transactions
+//
+
+/// Message shown when a command is held back until its transaction commits.
+const std::string MSG_TXN_QUEUED = "queued until commit";
+
+/// Message shown when beginning a transaction while one is already open.
+const std::string MSG_TXN_ALREADY_OPEN = "transaction already open";
+
+/// Message shown when committing or aborting without an open transaction.
+const std::string MSG_TXN_NOT_OPEN = "no transaction open";
+
+/// Message shown when a transaction already holds as many commands as it may.
+const std::string MSG_TXN_TOO_LONG = "too many commands in transaction";
+
+/// Message shown when quitting inside a transaction.
+const std::string MSG_TXN_NO_QUIT = "can't quit inside a transaction";
+
+//
+// Watch failures
+//
+
+/// Message shown when a watch is given a path outside the resource tree.
+const std::string MSG_WATCH_INVALID_PATH = "Invalid path: must start with /";
+
+/// Message shown when a watch has an invalid interval.
+const std::string MSG_WATCH_INVALID_INTERVAL = "Invalid interval: try e.g. 50ms";
+
+/// Message shown when unwatching something that wasn't being watched.
+const std::string MSG_WATCH_NOT_WATCHING = "not watching this path";
+
 //
 // IO failures
 //
@@ -0,0 +1,329 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Metrics registry and the metrics it holds.
+ * @see metrics.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "metrics.hpp"
+
+//
+// Metric
+//
+
+Metric::Metric(const std::string &help) : help(help)
+{
+}
+
+const std::string &Metric::Help() const
+{
+	return this->help;
+}
+
+/**
+ * Appends the HELP and TYPE lines of a Prometheus metric.
+ * @param out The string to which the lines are appended.
+ * @param name The metric's Prometheus name.
+ * @param help The metric's description.
+ * @param type The metric's Prometheus type.
+ */
+static void PrometheusHeader(std::string &out, const std::string &name,
+                             const std::string &help, const char *type)
+{
+	out += "# HELP " + name + " " + help + "\n";
+	out += "# TYPE " + name + " " + type + "\n";
+}
+
+//
+// Counter
+//
+
+Counter::Counter(const std::string &help) : Metric(help), value(0)
+{
+}
+
+void Counter::Add(std::uint64_t n)
+{
+	this->value.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t Counter::Get() const
+{
+	return this->value.load(std::memory_order_relaxed);
+}
+
+const char *Counter::Type() const
+{
+	return "Counter";
+}
+
+std::vector<std::string> Counter::Values() const
+{
+	return {std::to_string(this->Get())};
+}
+
+void Counter::Prometheus(std::string &out, const std::string &name) const
+{
+	// Prometheus expects counters to be named as totals.
+	PrometheusHeader(out, name + "_total", this->Help(), "counter");
+	out += name + "_total " + std::to_string(this->Get()) + "\n";
+}
+
+//
+// Gauge
+//
+
+Gauge::Gauge(const std::string &help) : Metric(help), value(0)
+{
+}
+
+void Gauge::Set(std::int64_t v)
+{
+	this->value.store(v, std::memory_order_relaxed);
+}
+
+std::int64_t Gauge::Get() const
+{
+	return this->value.load(std::memory_order_relaxed);
+}
+
+const char *Gauge::Type() const
+{
+	return "Gauge";
+}
+
+std::vector<std::string> Gauge::Values() const
+{
+	return {std::to_string(this->Get())};
+}
+
+void Gauge::Prometheus(std::string &out, const std::string &name) const
+{
+	PrometheusHeader(out, name, this->Help(), "gauge");
+	out += name + " " + std::to_string(this->Get()) + "\n";
+}
+
+//
+// Histogram
+//
+
+const std::uint64_t Histogram::SUB_BUCKETS;
+const size_t Histogram::BUCKETS;
+const double Histogram::QUANTILES[4] = {0.5, 0.9, 0.99, 0.999};
+
+/// log2 of Histogram::SUB_BUCKETS.
+static const unsigned SUB_BITS = 4;
+
+static_assert(Histogram::SUB_BUCKETS == 1u << SUB_BITS,
+              "SUB_BITS must match SUB_BUCKETS");
+static_assert(Histogram::BUCKETS ==
+                      Histogram::SUB_BUCKETS * (65 - SUB_BITS),
+              "BUCKETS must cover every 64-bit value");
+
+/**
+ * Finds the most significant set bit of a value.
+ * @param v The value, which must not be 0.
+ * @return The index of the bit, from 0 (least significant) to 63.
+ */
+static unsigned MostSignificantBit(std::uint64_t v)
+{
+	assert(v != 0);
+#ifdef __GNUC__
+	return 63 - static_cast<unsigned>(__builtin_clzll(v));
+#else
+	unsigned bit = 0;
+	while (v >>= 1) bit++;
+	return bit;
+#endif
+}
+
+Histogram::Histogram(const std::string &help)
+    : Metric(help), count(0), sum(0), max(0)
+{
+	for (auto &bucket : this->buckets) bucket = 0;
+}
+
+void Histogram::Record(std::uint64_t v)
+{
+	this->buckets[BucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+	this->count.fetch_add(1, std::memory_order_relaxed);
+	this->sum.fetch_add(v, std::memory_order_relaxed);
+
+	auto old = this->max.load(std::memory_order_relaxed);
+	while (old < v && !this->max.compare_exchange_weak(
+	                          old, v, std::memory_order_relaxed)) {
+	}
+}
+
+std::uint64_t Histogram::Count() const
+{
+	return this->count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Sum() const
+{
+	return this->sum.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Max() const
+{
+	return this->max.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Histogram::Quantile(double q) const
+{
+	// The buckets may move on while we count them, so count them up
+	// first, rather than trusting Count.
+	std::uint64_t counts[BUCKETS];
+	std::uint64_t total = 0;
+	for (size_t i = 0; i < BUCKETS; i++) {
+		counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if (total == 0) return 0;
+
+	q = std::min(std::max(q, 0.0), 1.0);
+	auto rank = std::max<std::uint64_t>(
+	        1, static_cast<std::uint64_t>(q * total + 0.5));
+
+	std::uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKETS; i++) {
+		seen += counts[i];
+		if (rank <= seen) return std::min(BucketTop(i), this->Max());
+	}
+	return this->Max();
+}
+
+/* static */ size_t Histogram::BucketOf(std::uint64_t v)
+{
+	// Below SUB_BUCKETS, each value gets a bucket to itself.
+	if (v < SUB_BUCKETS) return static_cast<size_t>(v);
+
+	auto msb = MostSignificantBit(v);
+	auto shift = msb - SUB_BITS;
+	auto sub = (v >> shift) - SUB_BUCKETS;
+	return static_cast<size_t>(SUB_BUCKETS * (shift + 1) + sub);
+}
+
+/* static */ std::uint64_t Histogram::BucketTop(size_t bucket)
+{
+	assert(bucket < BUCKETS);
+	if (bucket < SUB_BUCKETS) return bucket;
+
+	auto shift = bucket / SUB_BUCKETS - 1;
+	auto sub = bucket % SUB_BUCKETS;
+	auto bottom = (SUB_BUCKETS + sub) << shift;
+	return bottom + ((std::uint64_t(1) << shift) - 1);
+}
+
+const char *Histogram::Type() const
+{
+	return "Histogram";
+}
+
+std::vector<std::string> Histogram::Values() const
+{
+	std::vector<std::string> values{std::to_string(this->Count()),
+	                                std::to_string(this->Sum()),
+	                                std::to_string(this->Max())};
+	for (auto q : QUANTILES) {
+		values.push_back(std::to_string(this->Quantile(q)));
+	}
+	return values;
+}
+
+void Histogram::Prometheus(std::string &out, const std::string &name) const
+{
+	// Prometheus histograms want a handful of fixed buckets; a summary of
+	// the quantiles says more with less.
+	PrometheusHeader(out, name, this->Help(), "summary");
+	for (auto q : QUANTILES) {
+		std::ostringstream quantile;
+		quantile << q;
+		out += name + "{quantile=\"" + quantile.str() + "\"} " +
+		       std::to_string(this->Quantile(q)) + "\n";
+	}
+	out += name + "_sum " + std::to_string(this->Sum()) + "\n";
+	out += name + "_count " + std::to_string(this->Count()) + "\n";
+}
+
+//
+// Metrics
+//
+
+/* static */ Metrics &Metrics::Global()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Counter &Metrics::AddCounter(const std::string &name, const std::string &help)
+{
+	std::unique_ptr<Metric> metric(new Counter(help));
+	return static_cast<Counter &>(this->Add(name, std::move(metric)));
+}
+
+Gauge &Metrics::AddGauge(const std::string &name, const std::string &help)
+{
+	std::unique_ptr<Metric> metric(new Gauge(help));
+	return static_cast<Gauge &>(this->Add(name, std::move(metric)));
+}
+
+Histogram &Metrics::AddHistogram(const std::string &name,
+                                 const std::string &help)
+{
+	std::unique_ptr<Metric> metric(new Histogram(help));
+	return static_cast<Histogram &>(this->Add(name, std::move(metric)));
+}
+
+std::vector<std::string> Metrics::Names() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	std::vector<std::string> names;
+	for (const auto &m : this->metrics) names.push_back(m.first);
+	return names;
+}
+
+const Metric *Metrics::Find(const std::string &name) const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	auto it = this->metrics.find(name);
+	return it == this->metrics.end() ? nullptr : it->second.get();
+}
+
+std::string Metrics::Prometheus() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	std::string out;
+	for (const auto &m : this->metrics) {
+		auto name = "playd_" + m.first;
+		std::replace(name.begin(), name.end(), '/', '_');
+		m.second->Prometheus(out, name);
+	}
+	return out;
+}
+
+Metric &Metrics::Add(const std::string &name, std::unique_ptr<Metric> metric)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	assert(this->metrics.count(name) == 0);
+	auto &slot = this->metrics[name];
+	slot = std::move(metric);
+	return *slot;
+}
@@ -0,0 +1,306 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Metrics registry and the metrics it holds.
+ * @see metrics.cpp
+ */
+
+#ifndef PLAYD_METRICS_HPP
+#define PLAYD_METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * A metric, as seen by the things that report it.
+ *
+ * Metrics are updated from hot paths, including the audio callback, so all
+ * updates are relaxed atomic operations: they never allocate, lock or wait.
+ * Readers may see one metric slightly ahead of another.
+ */
+class Metric
+{
+public:
+	/**
+	 * Constructs a Metric.
+	 * @param help A one-line description of the metric.
+	 */
+	explicit Metric(const std::string &help);
+
+	/// Virtual, empty destructor for Metric.
+	virtual ~Metric() = default;
+
+	/// Deleted copy constructor.
+	Metric(const Metric &) = delete;
+
+	/// Deleted copy-assignment.
+	Metric &operator=(const Metric &) = delete;
+
+	/**
+	 * Gets the kind of metric, as used in the /stats resources.
+	 * @return "Counter", "Gauge" or "Histogram".
+	 */
+	virtual const char *Type() const = 0;
+
+	/**
+	 * Gets the metric's current value(s), as the arguments of its
+	 * resource.
+	 * @return The values.
+	 */
+	virtual std::vector<std::string> Values() const = 0;
+
+	/**
+	 * Appends the metric in the Prometheus text format.
+	 * @param out The string to which the metric is appended.
+	 * @param name The metric's Prometheus name.
+	 */
+	virtual void Prometheus(std::string &out,
+	                        const std::string &name) const = 0;
+
+	/**
+	 * Gets the metric's description.
+	 * @return The description.
+	 */
+	const std::string &Help() const;
+
+private:
+	std::string help; ///< A one-line description of the metric.
+};
+
+/// A metric that only ever goes up.
+class Counter : public Metric
+{
+public:
+	/**
+	 * Constructs a Counter at zero.
+	 * @param help A one-line description of the counter.
+	 */
+	explicit Counter(const std::string &help);
+
+	/**
+	 * Adds to the counter.
+	 * @param n The amount to add.
+	 */
+	void Add(std::uint64_t n = 1);
+
+	/**
+	 * Gets the counter's value.
+	 * @return The value.
+	 */
+	std::uint64_t Get() const;
+
+	const char *Type() const override;
+	std::vector<std::string> Values() const override;
+	void Prometheus(std::string &out,
+	                const std::string &name) const override;
+
+private:
+	std::atomic<std::uint64_t> value; ///< The value.
+};
+
+/// A metric that is set to the latest value of something.
+class Gauge : public Metric
+{
+public:
+	/**
+	 * Constructs a Gauge at zero.
+	 * @param help A one-line description of the gauge.
+	 */
+	explicit Gauge(const std::string &help);
+
+	/**
+	 * Sets the gauge.
+	 * @param v The new value.
+	 */
+	void Set(std::int64_t v);
+
+	/**
+	 * Gets the gauge's value.
+	 * @return The value.
+	 */
+	std::int64_t Get() const;
+
+	const char *Type() const override;
+	std::vector<std::string> Values() const override;
+	void Prometheus(std::string &out,
+	                const std::string &name) const override;
+
+private:
+	std::atomic<std::int64_t> value; ///< The value.
+};
+
+/**
+ * A metric recording the distribution of some quantity.
+ *
+ * Values are counted in log-linear buckets, as in HdrHistogram: each power
+ * of two is split into SUB_BUCKETS equal buckets, so any value is known to
+ * within 1 part in SUB_BUCKETS, whatever its size, in a fixed amount of
+ * memory.
+ */
+class Histogram : public Metric
+{
+public:
+	/// The number of buckets each power of two is split into.
+	static const std::uint64_t SUB_BUCKETS = 16;
+
+	/// The total number of buckets, covering all 64-bit values.
+	static const size_t BUCKETS = 976;
+
+	/// The quantiles reported in the /stats resources.
+	static const double QUANTILES[4];
+
+	/**
+	 * Constructs an empty Histogram.
+	 * @param help A one-line description of the histogram.
+	 */
+	explicit Histogram(const std::string &help);
+
+	/**
+	 * Records a value.
+	 * @param v The value.
+	 */
+	void Record(std::uint64_t v);
+
+	/**
+	 * Gets the number of values recorded.
+	 * @return The count.
+	 */
+	std::uint64_t Count() const;
+
+	/**
+	 * Gets the sum of the values recorded.
+	 * @return The sum.
+	 */
+	std::uint64_t Sum() const;
+
+	/**
+	 * Gets the largest value recorded.
+	 * @return The largest value, or 0 if none.
+	 */
+	std::uint64_t Max() const;
+
+	/**
+	 * Estimates a quantile of the values recorded.
+	 * @param q The quantile, from 0 to 1.
+	 * @return The largest value that falls into the same bucket as the
+	 *   quantile (but no more than Max), or 0 if nothing was recorded.
+	 */
+	std::uint64_t Quantile(double q) const;
+
+	/**
+	 * Works out which bucket a value falls into.
+	 * @param v The value.
+	 * @return The bucket's index.
+	 */
+	static size_t BucketOf(std::uint64_t v);
+
+	/**
+	 * Works out the largest value that falls into a bucket.
+	 * @param bucket The bucket's index.
+	 * @return The value.
+	 */
+	static std::uint64_t BucketTop(size_t bucket);
+
+	const char *Type() const override;
+	std::vector<std::string> Values() const override;
+	void Prometheus(std::string &out,
+	                const std::string &name) const override;
+
+private:
+	std::atomic<std::uint64_t> buckets[BUCKETS]; ///< Per-bucket counts.
+	std::atomic<std::uint64_t> count;            ///< See Count.
+	std::atomic<std::uint64_t> sum;              ///< See Sum.
+	std::atomic<std::uint64_t> max;              ///< See Max.
+};
+
+/**
+ * The registry of every metric playd keeps.
+ *
+ * Metrics are registered once, usually during static initialisation, by
+ * whatever code updates them; that code keeps the reference it gets back,
+ * so updating a metric never touches the registry.  Metric names are
+ * slash-separated paths, such as "audio/decode_us", which appear under
+ * /stats in the resource tree.
+ */
+class Metrics
+{
+public:
+	/**
+	 * Gets the registry.
+	 * @return The one registry.
+	 */
+	static Metrics &Global();
+
+	/**
+	 * Registers a Counter.
+	 * @param name The counter's name.
+	 * @param help A one-line description of the counter.
+	 * @return The counter, which lives as long as the registry.
+	 */
+	Counter &AddCounter(const std::string &name, const std::string &help);
+
+	/**
+	 * Registers a Gauge.
+	 * @param name The gauge's name.
+	 * @param help A one-line description of the gauge.
+	 * @return The gauge, which lives as long as the registry.
+	 */
+	Gauge &AddGauge(const std::string &name, const std::string &help);
+
+	/**
+	 * Registers a Histogram.
+	 * @param name The histogram's name.
+	 * @param help A one-line description of the histogram.
+	 * @return The histogram, which lives as long as the registry.
+	 */
+	Histogram &AddHistogram(const std::string &name,
+	                        const std::string &help);
+
+	/**
+	 * Gets the names of every metric, in order.
+	 * @return The names.
+	 */
+	std::vector<std::string> Names() const;
+
+	/**
+	 * Finds a metric by name.
+	 * @param name The metric's name.
+	 * @return The metric, or nullptr if there is none by that name.
+	 */
+	const Metric *Find(const std::string &name) const;
+
+	/**
+	 * Dumps every metric in the Prometheus text exposition format.
+	 * Each name is prefixed with "playd_", and has its slashes turned
+	 * into underscores.
+	 * @return The dump.
+	 */
+	std::string Prometheus() const;
+
+private:
+	/// Constructs an empty registry.
+	Metrics() = default;
+
+	/**
+	 * Registers a metric.
+	 * @param name The metric's name, which must not already be taken.
+	 * @param metric The metric.
+	 * @return The metric.
+	 */
+	Metric &Add(const std::string &name, std::unique_ptr<Metric> metric);
+
+	/// Guards the map, but never the metrics themselves.
+	mutable std::mutex lock;
+
+	/// Map from names to metrics.
+	std::map<std::string, std::unique_ptr<Metric>> metrics;
+};
+
+#endif // PLAYD_METRICS_HPP
@@ -0,0 +1,74 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Outbox class.
+ * @see outbox.hpp
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "outbox.hpp"
+#include "response.hpp"
+
+// Long enough to ride out a busy network, short enough that a frozen
+// client is gone before it's missed more than a track's worth of updates.
+const Outbox::Clock::duration Outbox::STALL_LIMIT = std::chrono::seconds(10);
+
+const size_t Outbox::HOPELESS_FACTOR = 16;
+
+Outbox::Outbox(size_t budget) : budget(budget), stalled(false)
+{
+}
+
+Outbox::Post Outbox::Offer(const Response &response, size_t queued)
+{
+	auto path = response.Path();
+	if (path.empty()) return this->held.empty() ? Post::SEND : Post::FLUSH;
+
+	// Once anything is held, everything for the same client has to be, or
+	// a newer value could overtake an older one.
+	if (this->held.empty() && queued <= this->budget) return Post::SEND;
+
+	auto it = this->held.find(path);
+	if (it == this->held.end()) {
+		this->held.emplace(path, response);
+		return Post::HELD;
+	}
+
+	it->second = response;
+	return Post::SUPERSEDED;
+}
+
+std::vector<Response> Outbox::Release(size_t queued)
+{
+	if (this->budget < queued) return std::vector<Response>();
+	return this->Drain();
+}
+
+std::vector<Response> Outbox::Drain()
+{
+	std::vector<Response> released;
+	for (const auto &h : this->held) released.push_back(h.second);
+	this->held.clear();
+	return released;
+}
+
+bool Outbox::Hopeless(size_t queued, Clock::time_point now)
+{
+	if (queued <= this->budget) {
+		this->stalled = false;
+		return false;
+	}
+
+	if (!this->stalled) {
+		this->stalled = true;
+		this->stalled_since = now;
+	}
+
+	if (this->budget * HOPELESS_FACTOR < queued) return true;
+	return STALL_LIMIT < now - this->stalled_since;
+}
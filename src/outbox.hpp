@@ -0,0 +1,110 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Outbox class.
+ * @see outbox.cpp
+ */
+
+#ifndef PLAYD_OUTBOX_HPP
+#define PLAYD_OUTBOX_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "response.hpp"
+
+/**
+ * The outbound budget of a single client.
+ *
+ * Responses to a client queue up in memory for as long as the client isn't
+ * reading them.  The Outbox keeps that queue from growing without bound:
+ * once more than the budget is queued, resource updates are held back
+ * instead, keeping only the latest value of each resource, and released
+ * once the client catches up.  Anything that isn't a resource is never
+ * held back, but the held resources go out ahead of it, so that it can't
+ * overtake them.
+ *
+ * Clients that stay over budget for too long, or get hopelessly far over
+ * it, should be disconnected; Hopeless says when.
+ */
+class Outbox
+{
+public:
+	/// The clock used to time stalls.
+	using Clock = std::chrono::steady_clock;
+
+	/// The results of posting a Response to the Outbox.
+	enum class Post : std::uint8_t {
+		SEND,      ///< The response should be sent now.
+		FLUSH,     ///< Drain, then the response, should be sent now.
+		HELD,      ///< The response has been held back.
+		SUPERSEDED ///< The response replaced an older held back one.
+	};
+
+	/// How long a client may stay over budget before it is hopeless.
+	static const Clock::duration STALL_LIMIT;
+
+	/// How many budgets' worth of queue makes a client hopeless at once.
+	static const size_t HOPELESS_FACTOR;
+
+	/**
+	 * Constructs an Outbox.
+	 * @param budget The number of queued bytes past which updates are
+	 *   held back.
+	 */
+	explicit Outbox(size_t budget);
+
+	/**
+	 * Posts a Response to the Outbox.
+	 * Only resources are ever held back; anything else must be sent,
+	 * after anything already held back if the result is FLUSH.
+	 * @param response The response to post.
+	 * @param queued The number of bytes currently queued to the client.
+	 * @return What became of the response.
+	 */
+	Post Offer(const Response &response, size_t queued);
+
+	/**
+	 * Takes the held back responses, if the client has caught up.
+	 * @param queued The number of bytes currently queued to the client.
+	 * @return The responses to send, in path order.
+	 */
+	std::vector<Response> Release(size_t queued);
+
+	/**
+	 * Takes the held back responses, whether or not the client has
+	 * caught up.
+	 * @return The responses to send, in path order.
+	 */
+	std::vector<Response> Drain();
+
+	/**
+	 * Decides whether the client is too far behind to keep.
+	 * This should be called regularly, as it times how long the client
+	 * has been over budget.
+	 * @param queued The number of bytes currently queued to the client.
+	 * @param now The current time.
+	 * @return Whether the client should be disconnected.
+	 */
+	bool Hopeless(size_t queued, Clock::time_point now);
+
+private:
+	/// The number of queued bytes past which updates are held back.
+	size_t budget;
+
+	/// Map from resource paths to held back responses.
+	std::map<std::string, Response> held;
+
+	/// Whether the client was over budget when last checked.
+	bool stalled;
+
+	/// When the client went over budget.
+	Clock::time_point stalled_since;
+};
+
+#endif // PLAYD_OUTBOX_HPP
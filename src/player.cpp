@@ -9,6 +9,7 @@
 
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -18,15 +19,26 @@
 #include "audio/audio.hpp"
 #include "cmd_result.hpp"
 #include "errors.hpp"
+#include "held_broadcasts.hpp"
+#include "metrics.hpp"
 #include "response.hpp"
 #include "messages.h"
 #include "player.hpp"
+#include "trace.hpp"
 
 const std::vector<std::string> Player::FEATURES{"End", "FileLoad", "PlayStop",
                                                 "Seek", "TimeReport"};
 
+// Enough for any sensible load-seek-play script, but not so many that a
+// client can pile up commands without end.
+const size_t Player::MAX_TRANSACTION_COMMANDS = 64;
+
 Player::Player(AudioSystem &audio)
-    : audio(audio), file(audio.Null()), is_running(true), sink(nullptr)
+    : audio(audio),
+      file(audio.Null()),
+      is_running(true),
+      sink(nullptr),
+      status(nullptr)
 {
 }
 
@@ -35,6 +47,11 @@ void Player::SetSink(ResponseSink &sink)
 	this->sink = &sink;
 }
 
+void Player::SetStatusPage(StatusPage &page)
+{
+	this->status = &page;
+}
+
 bool Player::Update()
 {
 	assert(this->file != nullptr);
@@ -45,11 +62,39 @@ bool Player::Update()
 		// Since the audio is currently playing, the position may have
 		// advanced since last update.  So we need to update it.
 		this->Read("/player/time/elapsed", 0);
+
+		// Clients that asked for the time more often than it is
+		// broadcast take it from samples instead.
+		this->Sample("/player/time/elapsed");
+
+		// The anchor only goes out if the position has drifted away
+		// from where clients would expect it to be.
+		this->Read("/player/time/anchor", 0);
 	}
 
+	this->AnnounceUnderruns();
+
+	// While playing, the sink publishes the position more often than
+	// this, but only we see loads, ejects and seeks.
+	if (this->status != nullptr) this->file->Publish(*this->status);
+
 	return this->is_running;
 }
 
+void Player::AnnounceUnderruns()
+{
+	auto underruns = this->file->TakeUnderruns();
+	if (underruns.empty() || this->sink == nullptr) return;
+
+	for (const auto &underrun : underruns) {
+		auto response = Response(Response::Code::UNDERRUN);
+		response.AddArg(std::to_string(underrun.stamp));
+		response.AddArg(std::to_string(underrun.duration));
+		this->sink->Respond(response);
+	}
+	this->Read("/audio/stats/underruns", 0);
+}
+
 void Player::WelcomeClient(size_t id) const
 {
 	this->sink->Respond(Response(Response::Code::OHAI).AddArg(MSG_OHAI), id);
@@ -61,6 +106,11 @@ void Player::WelcomeClient(size_t id) const
 	this->Read("/", id);
 }
 
+void Player::ByeClient(size_t id)
+{
+	this->transactions.erase(id);
+}
+
 void Player::End()
 {
 	this->SetPlaying(false);
@@ -82,6 +132,8 @@ void Player::End()
 
 CommandResult Player::RunCommand(const std::vector<std::string> &cmd, size_t id)
 {
+	TraceSpan span("Player::RunCommand");
+
 	if (!this->is_running) {
 		// Refuse any and all commands when not running.
 		// This is mainly to prevent the internal state from
@@ -99,6 +151,21 @@ CommandResult Player::RunCommand(const std::vector<std::string> &cmd, size_t id)
 	// This is because the first argument is a 'tag', emitted with the
 	// command result to allow it to be identified, but otherwise
 	// unused.
+	if (nargs == 1 && "begin" == word) return this->Begin(id);
+	if (nargs == 1 && "commit" == word) return this->Commit(id);
+	if (nargs == 1 && "abort" == word) return this->Abort(id);
+
+	auto txn = this->transactions.find(id);
+	if (txn != this->transactions.end()) return this->Enqueue(txn->second, cmd);
+
+	return this->Dispatch(cmd, id);
+}
+
+CommandResult Player::Dispatch(const std::vector<std::string> &cmd, size_t id)
+{
+	auto word = cmd[0];
+	auto nargs = cmd.size() - 1;
+
 	if (nargs == 2 && "read" == word) return this->Read(cmd[2], id);
 	if (nargs == 2 && "delete" == word) return this->Delete(cmd[2]);
 	if (nargs == 3 && "write" == word) return this->Write(cmd[2], cmd[3]);
@@ -106,6 +173,139 @@ CommandResult Player::RunCommand(const std::vector<std::string> &cmd, size_t id)
 	return CommandResult::Invalid(MSG_CMD_INVALID);
 }
 
+//
+// Transactions
+//
+
+CommandResult Player::Begin(size_t id)
+{
+	if (0 < this->transactions.count(id)) {
+		return CommandResult::Invalid(MSG_TXN_ALREADY_OPEN);
+	}
+
+	this->transactions.emplace(id, std::vector<std::vector<std::string>>());
+	return CommandResult::Success();
+}
+
+CommandResult Player::Enqueue(std::vector<std::vector<std::string>> &commands,
+                              const std::vector<std::string> &cmd)
+{
+	// Malformed commands are refused now, rather than failing the
+	// commit later.
+	auto nargs = cmd.size() - 1;
+	bool valid = (nargs == 2 && ("read" == cmd[0] || "delete" == cmd[0])) ||
+	             (nargs == 3 && "write" == cmd[0]);
+	if (!valid) return CommandResult::Invalid(MSG_CMD_INVALID);
+
+	// A quit can't be rolled back, so it has no place in a transaction.
+	bool quit = "/control/state" == cmd[2] &&
+	            ("delete" == cmd[0] ||
+	             ("write" == cmd[0] && "Quitting" == cmd[3]));
+	if (quit) return CommandResult::Invalid(MSG_TXN_NO_QUIT);
+
+	if (MAX_TRANSACTION_COMMANDS <= commands.size()) {
+		return CommandResult::Invalid(MSG_TXN_TOO_LONG);
+	}
+
+	commands.push_back(cmd);
+	return CommandResult(CommandResult::Code::OK, MSG_TXN_QUEUED);
+}
+
+CommandResult Player::Commit(size_t id)
+{
+	auto txn = this->transactions.find(id);
+	if (txn == this->transactions.end()) {
+		return CommandResult::Invalid(MSG_TXN_NOT_OPEN);
+	}
+
+	auto commands = std::move(txn->second);
+	this->transactions.erase(txn);
+
+	TraceSpan span("Player::Commit");
+	auto before = this->Save();
+
+	// Nothing the transaction changes goes out until it's done, so
+	// clients never see it half-applied.
+	auto outer = this->sink;
+	std::unique_ptr<HeldBroadcasts> held;
+	if (outer != nullptr) {
+		held.reset(new HeldBroadcasts(*outer));
+		this->sink = held.get();
+	}
+
+	auto result = CommandResult::Success();
+	try {
+		for (const auto &cmd : commands) {
+			result = this->Dispatch(cmd, id);
+			if (result.IsSuccess()) continue;
+
+			Debug() << "Transaction failed, rolling back" << std::endl;
+			this->Restore(before);
+			break;
+		}
+	} catch (...) {
+		this->sink = outer;
+		if (held) held->Release();
+		throw;
+	}
+
+	this->sink = outer;
+	if (held) held->Release();
+	return result;
+}
+
+CommandResult Player::Abort(size_t id)
+{
+	if (this->transactions.erase(id) == 0) {
+		return CommandResult::Invalid(MSG_TXN_NOT_OPEN);
+	}
+	return CommandResult::Success();
+}
+
+Player::Snapshot Player::Save() const
+{
+	Snapshot snapshot;
+	snapshot.playing = false;
+	snapshot.position = 0;
+
+	// Emitting as if to a single client leaves the broadcast rate limits
+	// alone.
+	auto file = this->file->Emit("/player/file", false);
+	if (!file) return snapshot;
+	snapshot.file = file->Args().back();
+
+	auto state = this->file->Emit("/control/state", false);
+	snapshot.playing = state && state->Args().back() == "Playing";
+	snapshot.position = this->file->Position();
+	return snapshot;
+}
+
+void Player::Restore(const Snapshot &snapshot)
+{
+	if (this->Save().file != snapshot.file) {
+		if (snapshot.file.empty()) {
+			this->Eject();
+			return;
+		}
+
+		// Load ejects by itself if the file has since gone away.
+		if (!this->Load(snapshot.file).IsSuccess()) return;
+	}
+	if (snapshot.file.empty()) return;
+
+	try {
+		this->SeekRaw(snapshot.position);
+	} catch (Error &e) {
+		Debug() << "Could not restore position:" << e.Message()
+		        << std::endl;
+	}
+	this->SetPlaying(snapshot.playing);
+}
+
+//
+// Playback control
+//
+
 CommandResult Player::Eject()
 {
 	assert(this->file != nullptr);
@@ -163,6 +363,7 @@ CommandResult Player::SetPlaying(bool playing)
 	}
 
 	this->Read("/control/state", 0);
+	this->Read("/player/time/anchor", 0);
 
 	return CommandResult::Success();
 }
@@ -233,19 +434,35 @@ void Player::SeekRaw(std::uint64_t pos)
 
 	this->file->Seek(pos);
 	this->Read("/player/time/elapsed", 0);
+	this->Read("/player/time/anchor", 0);
 }
 
 // Any resource with the single child "" (empty string) is an entry.
 // These need to be looked up via Audio, not handled by Player.
 const std::multimap<std::string, std::string> Player::RESOURCES = {
+	{"/", "/audio"},
 	{"/", "/control"},
 	{"/", "/player"},
+	{"/audio", "/audio/latency"},
+	{"/audio", "/audio/stats"},
+	{"/audio/latency", "/audio/latency/buffer"},
+	{"/audio/latency", "/audio/latency/period"},
+	{"/audio/latency/buffer", ""},
+	{"/audio/latency/period", ""},
+	{"/audio/stats", "/audio/stats/underruns"},
+	{"/audio/stats/underruns", ""},
 	{"/control", "/control/state"},
+	{"/control", "/control/trace"},
 	{"/control/state", ""},
+	{"/control/trace", ""},
 	{"/player", "/player/file"},
+	{"/player", "/player/prefetch"},
 	{"/player", "/player/time"},
 	{"/player/file", ""},
+	{"/player/prefetch", ""},
+	{"/player/time", "/player/time/anchor"},
 	{"/player/time", "/player/time/elapsed"},
+	{"/player/time/anchor", ""},
 	{"/player/time/elapsed", ""}
 };
 
@@ -258,6 +475,12 @@ CommandResult Player::Read(const std::string &path, size_t id) const
 	if (0 < count) {
 		auto range = Player::RESOURCES.equal_range(path);
 
+		// The prefetch list belongs to the AudioSystem, not the file.
+		if ("/player/prefetch" == path) return this->ReadPrefetch(id);
+
+		// As does the trace belong to the Tracer.
+		if ("/control/trace" == path) return this->ReadTrace(id);
+
 		// Is this an entry?  If so, delegate it to Audio to work on.
 		if (1 == count && "" == range.first->second) {
 			// The entry might be currently empty, in which case
@@ -283,10 +506,121 @@ CommandResult Player::Read(const std::string &path, size_t id) const
 		return CommandResult::Success();
 	}
 
+	// The statistics come and go with the metrics registered.
+	if (IsStatsResource(path)) return this->ReadStats(path, id);
+
 	// If we get here, the resource doesn't exist and never will do.
 	return CommandResult::Failure(MSG_NOT_FOUND);
 }
 
+/* static */ bool Player::IsStatsResource(const std::string &path)
+{
+	return path == "/stats" || path.compare(0, 7, "/stats/") == 0;
+}
+
+/* static */ std::string Player::StatsName(const std::string &path)
+{
+	// Metric names are paths relative to /stats.
+	return path.size() <= 7 ? "" : path.substr(7);
+}
+
+/* static */ bool Player::StatsExist(const std::string &path)
+{
+	auto &metrics = Metrics::Global();
+
+	auto name = StatsName(path);
+	if (name.empty() || metrics.Find(name) != nullptr) return true;
+
+	auto prefix = name + "/";
+	for (const auto &n : metrics.Names()) {
+		if (n.compare(0, prefix.size(), prefix) == 0) return true;
+	}
+	return false;
+}
+
+CommandResult Player::ReadStats(const std::string &path, size_t id) const
+{
+	auto &metrics = Metrics::Global();
+
+	auto name = StatsName(path);
+
+	auto metric = metrics.Find(name);
+	if (metric != nullptr) {
+		auto res = Response(Response::Code::RES);
+		res.AddArg(path).AddArg(metric->Type());
+		for (const auto &value : metric->Values()) res.AddArg(value);
+		if (this->sink != nullptr) this->sink->Respond(res, id);
+		return CommandResult::Success();
+	}
+
+	// Otherwise, it might be a directory of metrics.  Its children are
+	// the distinct next components of the names under it.
+	auto prefix = name.empty() ? "" : name + "/";
+	std::vector<std::string> children;
+	for (const auto &n : metrics.Names()) {
+		if (n.compare(0, prefix.size(), prefix) != 0) continue;
+
+		auto child = n.substr(0, n.find('/', prefix.size()));
+		if (children.empty() || children.back() != child) {
+			children.push_back(child);
+		}
+	}
+	if (children.empty()) return CommandResult::Failure(MSG_NOT_FOUND);
+
+	auto dir = Response::Res("Directory", path,
+	                         std::to_string(children.size()));
+	if (this->sink != nullptr) this->sink->Respond(*dir, id);
+	for (const auto &child : children) this->ReadStats("/stats/" + child, id);
+
+	return CommandResult::Success();
+}
+
+void Player::Sample(const std::string &path) const
+{
+	if (this->sink == nullptr) return;
+
+	// Emitting as if to a single client skips the broadcast rate limit.
+	auto response = this->file->Emit(path, false);
+	if (response) this->sink->Sample(*response);
+}
+
+CommandResult Player::ReadPrefetch(size_t id) const
+{
+	auto res = Response(Response::Code::RES);
+	res.AddArg("/player/prefetch").AddArg("List");
+	for (const auto &path : this->audio.Prefetched()) res.AddArg(path);
+
+	if (this->sink != nullptr) this->sink->Respond(res, id);
+	return CommandResult::Success();
+}
+
+CommandResult Player::ReadTrace(size_t id) const
+{
+	auto enabled = Tracer::Global().Enabled();
+	auto res = Response::Res("Entry", "/control/trace",
+	                         enabled ? "Enabled" : "Disabled");
+	if (this->sink != nullptr) this->sink->Respond(*res, id);
+	return CommandResult::Success();
+}
+
+CommandResult Player::DumpTrace()
+{
+	try {
+		Tracer::Global().Dump();
+	} catch (FileError &e) {
+		return CommandResult::Failure(e.Message());
+	}
+	return CommandResult::Success();
+}
+
+CommandResult Player::Prefetch(const std::string &path)
+{
+	if (path.empty()) return CommandResult::Invalid(MSG_LOAD_EMPTY_PATH);
+
+	this->audio.Prefetch(path);
+	return CommandResult::Success();
+}
+
 CommandResult Player::Write(const std::string &path, const std::string &payload)
 {
 	if ("/control/state" == path) {
@@ -297,7 +631,13 @@ CommandResult Player::Write(const std::string &path, const std::string &payload)
 		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
 	}
 
+	if ("/control/trace" == path) {
+		if ("Dump" == payload) return this->DumpTrace();
+		return CommandResult::Invalid(MSG_INVALID_PAYLOAD);
+	}
+
 	if ("/player/file" == path) return this->Load(payload);
+	if ("/player/prefetch" == path) return this->Prefetch(payload);
 	if ("/player/time/elapsed" == path) return this->Seek(payload);
 
 	return this->ResourceFailure(path);
@@ -307,6 +647,10 @@ CommandResult Player::Delete(const std::string &path)
 {
 	if ("/control/state" == path) return this->Quit();
 	if ("/player/file" == path) return this->Eject();
+	if ("/player/prefetch" == path) {
+		this->audio.ClearPrefetched();
+		return CommandResult::Success();
+	}
 	if ("/player/time/elapsed" == path) return this->Seek("0");
 
 	return this->ResourceFailure(path);
@@ -315,7 +659,9 @@ CommandResult Player::Delete(const std::string &path)
 CommandResult Player::ResourceFailure(const std::string &path) {
 	// In this case, we've either got a resource that exists but can't
 	// be written, or a resource that doesn't.  Let's find out which:
-	if (0 < this->RESOURCES.count(path)) {
+	bool exists = 0 < this->RESOURCES.count(path) ||
+	              (IsStatsResource(path) && StatsExist(path));
+	if (exists) {
 		// The resource is valid, but can't be written to.
 		return CommandResult::Failure(MSG_INVALID_ACTION);
 	}
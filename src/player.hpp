@@ -21,6 +21,7 @@
 #include "audio/audio.hpp"
 #include "response.hpp"
 #include "cmd_result.hpp"
+#include "status_page.hpp"
 
 /**
  * A Player contains a loaded audio file and a command API for manipulating it.
@@ -42,8 +43,22 @@ public:
 	/// Deleted copy-assignment constructor.
 	Player &operator=(const Player &) = delete;
 
+	/// The most commands a single transaction may hold.
+	static const size_t MAX_TRANSACTION_COMMANDS;
+
 	/**
 	 * Handles a command line.
+	 *
+	 * A client may group commands into a transaction by sending `begin`,
+	 * then the commands, then `commit`, each with a tag.  Until the
+	 * commit, the commands are only queued.  On commit, they run
+	 * together, and the resources they change are broadcast once, with
+	 * their final values.  If any of them fails, the rest don't run,
+	 * the file, position and state are put back as they were, and the
+	 * commit fails with that command's result.  `abort` discards the
+	 * queued commands instead.  A quit can't be undone, so it is refused
+	 * inside a transaction.
+	 *
 	 * @param words A reference to the list of words in the command.
 	 * @param id If present, the ID of the client requesting the
 	 *   command, and, thus, the target of any unicast responses
@@ -61,6 +76,12 @@ public:
 	 */
 	void SetSink(ResponseSink &sink);
 
+	/**
+	 * Sets the status page to which this Player publishes on each update.
+	 * @param page The status page.
+	 */
+	void SetStatusPage(StatusPage &page);
+
 	/**
 	 * Instructs the Player to perform a cycle of work.
 	 * This includes decoding the next frame and responding to commands.
@@ -75,11 +96,19 @@ public:
 	 */
 	void WelcomeClient(size_t id) const;
 
+	/**
+	 * Forgets a client that has gone away, with any transaction it left
+	 * open.
+	 * @param id The ID of the client inside the IO system.
+	 */
+	void ByeClient(size_t id);
+
 private:
 	AudioSystem &audio;          ///< The system used for loading audio.
 	std::unique_ptr<Audio> file; ///< The currently loaded audio file.
 	bool is_running;             ///< Whether the Player is running.
 	const ResponseSink *sink;    ///< The sink for audio responses.
+	StatusPage *status;          ///< The status page, if any.
 
 	/// The set of features playd implements.
 	const static std::vector<std::string> FEATURES;
@@ -87,6 +116,73 @@ private:
 	/// The resource tree playd exposes.
 	const static std::multimap<std::string, std::string> RESOURCES;
 
+	/// The playback state a failed transaction puts back.
+	struct Snapshot {
+		std::string file;       ///< The loaded file, or empty if none.
+		bool playing;           ///< Whether the file was playing.
+		std::uint64_t position; ///< The position, in microseconds.
+	};
+
+	/// Map from client IDs to the commands of their open transactions.
+	std::map<size_t, std::vector<std::vector<std::string>>> transactions;
+
+	/**
+	 * Runs a read, write or delete command.
+	 * @param cmd The command.
+	 * @param id The ID of the client requesting the command.
+	 * @return Whether the command succeeded.
+	 */
+	CommandResult Dispatch(const std::vector<std::string> &cmd, size_t id);
+
+	//
+	// Transactions
+	//
+
+	/**
+	 * Opens a transaction for a client.
+	 * @param id The ID of the client.
+	 * @return Whether the transaction could be opened.
+	 */
+	CommandResult Begin(size_t id);
+
+	/**
+	 * Queues a command in a client's open transaction.
+	 * @param commands The commands queued so far.
+	 * @param cmd The command.
+	 * @return Whether the command could be queued.
+	 */
+	CommandResult Enqueue(std::vector<std::vector<std::string>> &commands,
+	                      const std::vector<std::string> &cmd);
+
+	/**
+	 * Runs, and closes, a client's open transaction.
+	 * @param id The ID of the client.
+	 * @return Whether every command in the transaction succeeded; if
+	 *   not, the result of the one that failed.
+	 */
+	CommandResult Commit(size_t id);
+
+	/**
+	 * Closes a client's open transaction without running it.
+	 * @param id The ID of the client.
+	 * @return Whether there was a transaction to close.
+	 */
+	CommandResult Abort(size_t id);
+
+	/**
+	 * Takes a snapshot of the playback state, for a transaction.
+	 * @return The snapshot.
+	 */
+	Snapshot Save() const;
+
+	/**
+	 * Puts the playback state back as a snapshot found it.
+	 * This is best-effort: a file that can no longer be loaded stays
+	 * ejected.
+	 * @param snapshot The snapshot.
+	 */
+	void Restore(const Snapshot &snapshot);
+
 	//
 	// Playback control
 	//
@@ -115,6 +211,42 @@ private:
 	/// Handles ending a file (stopping and rewinding).
 	void End();
 
+	/// Broadcasts any underruns the current file has finished suffering.
+	void AnnounceUnderruns();
+
+	/**
+	 * Queues a track to be prewarmed, ready for a later Load.
+	 * @param path The absolute path to the track.
+	 * @return Whether the track could be queued.
+	 */
+	CommandResult Prefetch(const std::string &path);
+
+	/**
+	 * Emits the list of prewarmed tracks.
+	 * @param id The ID of the connection to which the Player should
+	 *   route the response.  May be 0, for all (broadcast).
+	 * @return The result of reading, which is always a success.
+	 */
+	CommandResult ReadPrefetch(size_t id) const;
+
+	//
+	// Tracing
+	//
+
+	/**
+	 * Emits whether the Tracer is recording.
+	 * @param id The ID of the connection to which the Player should
+	 *   route the response.  May be 0, for all (broadcast).
+	 * @return The result of reading, which is always a success.
+	 */
+	CommandResult ReadTrace(size_t id) const;
+
+	/**
+	 * Dumps the Tracer's spans to its file.
+	 * @return Whether the trace could be dumped.
+	 */
+	CommandResult DumpTrace();
+
 	//
 	// Seeking
 	//
@@ -173,6 +305,51 @@ private:
 	 */
 	virtual CommandResult Read(const std::string &path, size_t id) const;
 
+	/**
+	 * Checks whether a path names one of the /stats resources.
+	 * @param path The path.
+	 * @return Whether the path is /stats, or under it.
+	 */
+	static bool IsStatsResource(const std::string &path);
+
+	/**
+	 * Gets the name of the metric, or directory of metrics, a /stats
+	 * resource stands for.
+	 * @param path The path, which must be /stats or under it.
+	 * @return The name, which is empty for /stats itself.
+	 */
+	static std::string StatsName(const std::string &path);
+
+	/**
+	 * Checks whether a /stats resource exists, as a metric or as a
+	 * directory of metrics.
+	 * @param path The path, which must be /stats or under it.
+	 * @return Whether the resource exists.
+	 */
+	static bool StatsExist(const std::string &path);
+
+	/**
+	 * Reads from and emits the requested /stats resource.
+	 * These are the metrics in the Metrics registry, each a resource
+	 * of type Counter, Gauge or Histogram; a Histogram's values are its
+	 * count, sum, maximum and quantiles.
+	 * @param path The path of the resource, which must be /stats or
+	 *   under it.
+	 * @param id The ID of the connection to which the Player should
+	 *   route the response.  May be 0, for all (broadcast).
+	 * @return The result of reading, which may be a failure if there is
+	 *   no such metric or directory of metrics.
+	 */
+	CommandResult ReadStats(const std::string &path, size_t id) const;
+
+	/**
+	 * Samples the requested entry resource for the sink.
+	 * Unlike a broadcast Read, this isn't rate-limited.
+	 * @param path The path of the entry to sample.
+	 * @see ResponseSink::Sample
+	 */
+	void Sample(const std::string &path) const;
+
 	/**
 	 * Writes to the requested resource.
 	 *
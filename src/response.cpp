@@ -23,7 +23,9 @@ const std::string Response::STRINGS[] = {
         "FEATURES", // Code::FEATURES
         "END",      // Code::END
         "ACK",      // Code::ACK
-        "RES"       // Code::RES
+        "RES",      // Code::RES
+        "PONG",     // Code::PONG
+        "UNDERRUN"  // Code::UNDERRUN
 };
 
 // Pre-made responses.
@@ -38,13 +40,18 @@ std::unique_ptr<Response> Response::Res(const std::string &type,
 	return res;
 }
 
-Response::Response(Response::Code code)
+Response::Response(Response::Code code) : code(code)
 {
 	this->string = Response::STRINGS[static_cast<int>(code)];
 }
 
 Response &Response::AddArg(const std::string &arg)
 {
+	// The first argument of a RES is always its path.
+	bool first = this->args.empty();
+	if (this->code == Response::Code::RES && first) this->path = arg;
+	this->args.push_back(arg);
+
 	this->string += " " + Response::EscapeArg(arg);
 	return *this;
 }
@@ -54,6 +61,21 @@ std::string Response::Pack() const
 	return this->string;
 }
 
+std::string Response::Path() const
+{
+	return this->path;
+}
+
+Response::Code Response::Command() const
+{
+	return this->code;
+}
+
+const std::vector<std::string> &Response::Args() const
+{
+	return this->args;
+}
+
 /* static */ std::string Response::EscapeArg(const std::string &arg)
 {
 	bool escaping = false;
@@ -87,3 +109,8 @@ void ResponseSink::Respond(const Response &, size_t) const
 {
 	// By default, do nothing.
 }
+
+void ResponseSink::Sample(const Response &) const
+{
+	// By default, do nothing.
+}
@@ -37,7 +37,9 @@ public:
 		FEATURES, ///< Server sending feature list.
 		END,      ///< The loaded file just ended on its own.
 		ACK,      ///< Command result.
-		RES       ///< Resource.
+		RES,      ///< Resource.
+		PONG,     ///< Answer to a ping.
+		UNDERRUN  ///< The output device was starved of audio.
 	};
 
 	/**
@@ -70,6 +72,25 @@ public:
 	 */
 	std::string Pack() const;
 
+	/**
+	 * Gets the path of the resource this Response carries.
+	 * @return The resource path, if this is a RES response, or the empty
+	 *   string otherwise.
+	 */
+	std::string Path() const;
+
+	/**
+	 * Gets the code of this Response.
+	 * @return The Response::Code representing the response command.
+	 */
+	Response::Code Command() const;
+
+	/**
+	 * Gets the arguments of this Response, unescaped.
+	 * @return The arguments, in the order they were added.
+	 */
+	const std::vector<std::string> &Args() const;
+
 private:
 	/**
 	 * A map from Response::Code codes to their string equivalents.
@@ -84,6 +105,17 @@ private:
 	 */
 	static std::string EscapeArg(const std::string &arg);
 
+	/// The response code.
+	Response::Code code;
+
+	/// The arguments added so far, unescaped.
+	/// @see Args
+	std::vector<std::string> args;
+
+	/// The resource path, if this is a RES response.
+	/// @see Path
+	std::string path;
+
 	/// The current packed form of the response.
 	/// @see Pack
 	std::string string;
@@ -106,6 +138,17 @@ public:
 	 *   entire sub-component should receive the Response.  Defaults to 0.
 	 */
 	virtual void Respond(const Response &response, size_t id = 0) const;
+
+	/**
+	 * Offers a sample of a rapidly changing resource.
+	 *
+	 * Samples are taken every update, far more often than the resource is
+	 * broadcast.  They are only of interest to sinks that deliver
+	 * resources at rates of their own choosing; others can ignore them.
+	 *
+	 * @param response The RES Response holding the sample.
+	 */
+	virtual void Sample(const Response &response) const;
 };
 
 #endif // PLAYD_IO_RESPONSE_HPP
@@ -0,0 +1,256 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration and implementation of the SlotMap class template.
+ */
+
+#ifndef PLAYD_SLOT_MAP_HPP
+#define PLAYD_SLOT_MAP_HPP
+
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * A container that hands out stable IDs for its values, while keeping the
+ * values themselves packed densely together.
+ *
+ * Iterating over a SlotMap touches only live values, with no holes to skip.
+ * Removing a value moves the last value into its place, so values should be
+ * cheap to move (pointers, for example).
+ *
+ * IDs combine a slot index with a generation that changes whenever the slot
+ * is reused, so an ID held after its value is removed never finds another
+ * value.  ID 0 is never handed out, so it can be used to mean 'none' (or,
+ * in IoCore's case, 'everyone').
+ *
+ * @tparam T The type of value stored.
+ */
+template <typename T>
+class SlotMap
+{
+public:
+	/// Iterator over the values in a SlotMap.
+	using iterator = typename std::vector<T>::iterator;
+
+	/// Constant iterator over the values in a SlotMap.
+	using const_iterator = typename std::vector<T>::const_iterator;
+
+	/**
+	 * Gets the ID the next Insert will return.
+	 * This is useful when a value needs to know its own ID on creation.
+	 * @return The next ID.
+	 */
+	size_t NextID() const
+	{
+		if (this->free.empty()) {
+			return SlotMap::MakeID(this->slots.size(), 0);
+		}
+
+		auto index = this->free.back();
+		return SlotMap::MakeID(index, this->slots[index].generation);
+	}
+
+	/**
+	 * Checks whether the SlotMap has run out of IDs.
+	 * @return Whether Insert may no longer be called.
+	 */
+	bool Full() const
+	{
+		return this->free.empty() && this->slots.size() == MAX_SLOTS;
+	}
+
+	/**
+	 * Inserts a value.
+	 * The SlotMap must not be Full.
+	 * @param value The value to insert.
+	 * @return The ID of the value.
+	 */
+	size_t Insert(T value)
+	{
+		assert(!this->Full());
+
+		auto id = this->NextID();
+		auto index = SlotMap::IndexOf(id);
+		if (this->free.empty()) {
+			this->slots.push_back(Slot{0, 0});
+		} else {
+			this->free.pop_back();
+		}
+
+		this->slots[index].dense = this->values.size();
+		this->values.push_back(std::move(value));
+		this->ids.push_back(id);
+		return id;
+	}
+
+	/**
+	 * Finds the value with the given ID.
+	 * @param id The ID of the value.
+	 * @return A pointer to the value, or nullptr if the ID is stale or
+	 *   was never handed out.
+	 */
+	T *Find(size_t id)
+	{
+		auto dense = this->DenseIndexOf(id);
+		return dense < this->values.size() ? &this->values[dense] : nullptr;
+	}
+
+	/**
+	 * Finds the value with the given ID.
+	 * @param id The ID of the value.
+	 * @return A pointer to the value, or nullptr if the ID is stale or
+	 *   was never handed out.
+	 */
+	const T *Find(size_t id) const
+	{
+		auto dense = this->DenseIndexOf(id);
+		return dense < this->values.size() ? &this->values[dense] : nullptr;
+	}
+
+	/**
+	 * Removes the value with the given ID.
+	 * This invalidates iterators, and pointers from Find.
+	 * @param id The ID of the value.
+	 * @return Whether there was a value to remove.
+	 */
+	bool Erase(size_t id)
+	{
+		auto dense = this->DenseIndexOf(id);
+		if (this->values.size() <= dense) return false;
+
+		// Fill the hole with the last value, so the values stay packed.
+		auto last = this->values.size() - 1;
+		if (dense != last) {
+			this->values[dense] = std::move(this->values[last]);
+			this->ids[dense] = this->ids[last];
+			this->slots[SlotMap::IndexOf(this->ids[dense])].dense = dense;
+		}
+		this->values.pop_back();
+		this->ids.pop_back();
+
+		// Bumping the generation is what makes the old ID stale.
+		auto index = SlotMap::IndexOf(id);
+		auto &slot = this->slots[index];
+		slot.generation = (slot.generation + 1) & GENERATION_MASK;
+		this->free.push_back(index);
+		return true;
+	}
+
+	/**
+	 * Gets the number of values in the SlotMap.
+	 * @return The number of values.
+	 */
+	size_t Size() const
+	{
+		return this->values.size();
+	}
+
+	/**
+	 * Checks whether the SlotMap is empty.
+	 * @return Whether there are no values.
+	 */
+	bool Empty() const
+	{
+		return this->values.empty();
+	}
+
+	/// @return An iterator to the first value.
+	iterator begin()
+	{
+		return this->values.begin();
+	}
+
+	/// @return An iterator past the last value.
+	iterator end()
+	{
+		return this->values.end();
+	}
+
+	/// @return A constant iterator to the first value.
+	const_iterator begin() const
+	{
+		return this->values.begin();
+	}
+
+	/// @return A constant iterator past the last value.
+	const_iterator end() const
+	{
+		return this->values.end();
+	}
+
+private:
+	/// The number of bits of an ID holding the slot index.
+	static const unsigned INDEX_BITS = sizeof(size_t) * CHAR_BIT / 2;
+
+	/// Mask for the slot index part of an ID.
+	static const size_t INDEX_MASK = (size_t(1) << INDEX_BITS) - 1;
+
+	/// Mask for a generation, before it is shifted into an ID.
+	static const size_t GENERATION_MASK = INDEX_MASK;
+
+	/// The most slots a SlotMap can have.
+	/// The top index is lost to keeping ID 0 free.
+	static const size_t MAX_SLOTS = INDEX_MASK;
+
+	/// A slot, through which IDs find their values.
+	struct Slot {
+		size_t generation; ///< The generation of the slot's current ID.
+		size_t dense;      ///< The index of the slot's value.
+	};
+
+	std::vector<Slot> slots;   ///< The slots, indexed by ID.
+	std::vector<size_t> free;  ///< Indices of unused slots.
+	std::vector<T> values;     ///< The values, densely packed.
+	std::vector<size_t> ids;   ///< The IDs of each value in values.
+
+	/**
+	 * Makes an ID.
+	 * @param index The slot index.
+	 * @param generation The generation of the slot.
+	 * @return The ID.
+	 */
+	static size_t MakeID(size_t index, size_t generation)
+	{
+		// Adding one keeps 0 free.
+		return (generation << INDEX_BITS) | (index + 1);
+	}
+
+	/**
+	 * Gets the slot index of an ID.
+	 * @param id The ID.
+	 * @return The slot index, which may be out of range for bad IDs.
+	 */
+	static size_t IndexOf(size_t id)
+	{
+		return (id & INDEX_MASK) - 1;
+	}
+
+	/**
+	 * Looks up the dense index of the value with the given ID.
+	 * @param id The ID.
+	 * @return The dense index, or values.size() if there is no value.
+	 */
+	size_t DenseIndexOf(size_t id) const
+	{
+		auto index = SlotMap::IndexOf(id);
+		auto none = this->values.size();
+		if (id == 0 || this->slots.size() <= index) return none;
+
+		auto &slot = this->slots[index];
+		auto generation = id >> INDEX_BITS;
+		if (slot.generation != generation) return none;
+
+		// A free slot keeps the generation its next ID will have, so
+		// also make sure the slot really points back at this ID.
+		auto dense = slot.dense;
+		if (none <= dense || this->ids[dense] != id) return none;
+		return dense;
+	}
+};
+
+#endif // PLAYD_SLOT_MAP_HPP
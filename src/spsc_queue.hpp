@@ -0,0 +1,106 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration and implementation of the SpscQueue class template.
+ */
+
+#ifndef PLAYD_SPSC_QUEUE_HPP
+#define PLAYD_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+/**
+ * An unbounded, lock-free queue between exactly one producer thread and
+ * exactly one consumer thread.
+ *
+ * The queue is a singly linked list.  The producer only ever touches the
+ * tail, and the consumer only ever touches the head, so the only point of
+ * contact is the atomic link between the last two nodes.  Neither side ever
+ * waits for the other; a consumer that finds the queue empty should go and
+ * wait on something else (a uv_async_t, say) until the producer wakes it.
+ *
+ * @tparam T The type of value queued.  Must be default-constructible.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	/// Constructs an empty SpscQueue.
+	SpscQueue() : head(new Node), tail(head)
+	{
+	}
+
+	/// Destructs an SpscQueue, along with anything still queued.
+	~SpscQueue()
+	{
+		while (this->head != nullptr) {
+			auto next = this->head->next.load(std::memory_order_relaxed);
+			delete this->head;
+			this->head = next;
+		}
+	}
+
+	/// Deleted copy constructor.
+	SpscQueue(const SpscQueue &) = delete;
+
+	/// Deleted copy-assignment.
+	SpscQueue &operator=(const SpscQueue &) = delete;
+
+	/**
+	 * Adds a value to the back of the queue.
+	 * Only the producer thread may call this.
+	 * @param value The value to add.
+	 */
+	void Push(T value)
+	{
+		auto node = new Node;
+		node->value = std::move(value);
+
+		// The release pairs with the consumer's acquire, so the value
+		// is visible by the time the node is.
+		this->tail->next.store(node, std::memory_order_release);
+		this->tail = node;
+	}
+
+	/**
+	 * Takes the value at the front of the queue, if there is one.
+	 * Only the consumer thread may call this.
+	 * @param value Set to the value taken.
+	 * @return Whether there was a value to take.
+	 */
+	bool Pop(T &value)
+	{
+		auto next = this->head->next.load(std::memory_order_acquire);
+		if (next == nullptr) return false;
+
+		// The old head is a dummy; the node after it becomes the new
+		// dummy once its value has been moved out.
+		value = std::move(next->value);
+		delete this->head;
+		this->head = next;
+		return true;
+	}
+
+private:
+	/// A node in the queue.
+	struct Node {
+		/// Constructs an unlinked Node.
+		Node() : next(nullptr)
+		{
+		}
+
+		std::atomic<Node *> next; ///< The next node, if any.
+		T value;                  ///< The queued value.
+	};
+
+	/// The consumer's end: a dummy node before the first value.
+	Node *head;
+
+	/// The producer's end: the last node.
+	Node *tail;
+};
+
+#endif // PLAYD_SPSC_QUEUE_HPP
@@ -0,0 +1,194 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the StatusPage class.
+ * @see status_page.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "audio/audio.hpp"
+#include "audio/realtime.hpp"
+#include "errors.hpp"
+#include "status_page.hpp"
+
+// Readers in other processes can only trust the atomics if they don't
+// hide a lock in this process.
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "status pages need lock-free atomics");
+
+const size_t StatusPage::MAX_PATH;
+const std::uint32_t StatusPage::MAGIC;
+const std::uint32_t StatusPage::VERSION;
+
+#ifdef _WIN32
+
+StatusPage::StatusPage(const std::string &name) : name(name), page(nullptr)
+{
+	throw FileError("status pages are not supported on this system");
+}
+
+StatusPage::~StatusPage()
+{
+}
+
+#else
+
+StatusPage::StatusPage(const std::string &name) : name(name), page(nullptr)
+{
+	this->writing.clear();
+
+	// A page left over from a playd that crashed is fair game, so the
+	// page isn't created exclusively.
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		throw FileError("can't create status page " + name + ": " +
+		                std::strerror(errno));
+	}
+
+	void *addr = MAP_FAILED;
+	if (ftruncate(fd, sizeof(Layout)) == 0) {
+		addr = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE,
+		            MAP_SHARED, fd, 0);
+	}
+	auto err = errno;
+	close(fd);
+
+	if (addr == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		throw FileError("can't map status page " + name + ": " +
+		                std::strerror(err));
+	}
+
+	// Readers may already have a page left over mapped, so the header
+	// goes in last: they don't trust the page until then.
+	std::memset(addr, 0, sizeof(Layout));
+	this->page = new (addr) Layout;
+	this->Publish(Audio::State::NONE, "", 0, 0);
+	this->page->version = VERSION;
+	std::atomic_thread_fence(std::memory_order_release);
+	this->page->magic = MAGIC;
+}
+
+StatusPage::~StatusPage()
+{
+	munmap(static_cast<void *>(this->page), sizeof(Layout));
+	shm_unlink(this->name.c_str());
+}
+
+#endif // _WIN32
+
+void StatusPage::Publish(Audio::State state, const std::string &path,
+                         std::uint64_t position, std::uint32_t rate)
+{
+	// The callback only ever holds the flag for a few stores.  This does
+	// wait, though, so the callback itself must use PublishPosition.
+	assert(!RealTimeScope::Active());
+	while (this->writing.test_and_set(std::memory_order_acquire)) {
+	}
+
+	this->BeginWrite();
+	this->page->state.store(static_cast<std::uint32_t>(state),
+	                        std::memory_order_relaxed);
+	this->page->position.store(position, std::memory_order_relaxed);
+	this->page->stamp.store(StatusPage::Now(), std::memory_order_relaxed);
+	this->page->rate.store(rate, std::memory_order_relaxed);
+	this->page->playing.store(state == Audio::State::PLAYING,
+	                          std::memory_order_relaxed);
+
+	if (path != this->path) {
+		auto n = std::min(path.size(), MAX_PATH - 1);
+		std::memcpy(this->page->path, path.data(), n);
+		this->page->path[n] = '\0';
+		this->path = path;
+	}
+	this->EndWrite();
+
+	this->writing.clear(std::memory_order_release);
+}
+
+bool StatusPage::PublishPosition(std::uint64_t position, std::int64_t stamp)
+{
+	if (this->writing.test_and_set(std::memory_order_acquire)) return false;
+
+	this->BeginWrite();
+	this->page->position.store(position, std::memory_order_relaxed);
+	this->page->stamp.store(stamp, std::memory_order_relaxed);
+	this->EndWrite();
+
+	this->writing.clear(std::memory_order_release);
+	return true;
+}
+
+const StatusPage::Layout &StatusPage::Page() const
+{
+	assert(this->page != nullptr);
+	return *this->page;
+}
+
+/* static */ StatusPage::Snapshot StatusPage::Read(const Layout &page)
+{
+	Snapshot snap;
+	char path[MAX_PATH];
+
+	while (true) {
+		auto before = page.sequence.load(std::memory_order_acquire);
+		if (before % 2 == 1) continue;
+
+		auto state = page.state.load(std::memory_order_relaxed);
+		snap.state = static_cast<Audio::State>(state);
+		snap.counter = page.counter.load(std::memory_order_relaxed);
+		snap.position = page.position.load(std::memory_order_relaxed);
+		snap.stamp = page.stamp.load(std::memory_order_relaxed);
+		snap.rate = page.rate.load(std::memory_order_relaxed);
+		snap.playing = page.playing.load(std::memory_order_relaxed) != 0;
+		std::memcpy(path, page.path, MAX_PATH);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto after = page.sequence.load(std::memory_order_relaxed);
+		if (before == after) break;
+	}
+
+	path[MAX_PATH - 1] = '\0';
+	snap.path = path;
+	return snap;
+}
+
+/* static */ std::int64_t StatusPage::Now()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>(now)
+	        .count();
+}
+
+void StatusPage::BeginWrite()
+{
+	auto seq = this->page->sequence.load(std::memory_order_relaxed);
+	this->page->sequence.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void StatusPage::EndWrite()
+{
+	this->page->counter.fetch_add(1, std::memory_order_relaxed);
+
+	auto seq = this->page->sequence.load(std::memory_order_relaxed);
+	this->page->sequence.store(seq + 1, std::memory_order_release);
+}
@@ -0,0 +1,166 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the StatusPage class.
+ * @see status_page.cpp
+ */
+
+#ifndef PLAYD_STATUS_PAGE_HPP
+#define PLAYD_STATUS_PAGE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "audio/audio.hpp"
+
+/**
+ * A page of shared memory through which playd publishes its status.
+ *
+ * Local readers (dashboards, on-air lights, and so on) can map the page
+ * and read playd's state, file and position without going through the
+ * IoCore at all.  The page is protected by a seqlock: playd makes the
+ * sequence number odd while it writes, so readers copy the page out, and
+ * retry if the sequence number was odd or changed while they did.
+ *
+ * There are two writers: the Player, which publishes everything on each
+ * update, and the audio sink, which publishes just the position from its
+ * callback.  The callback never waits for the Player; if the Player is
+ * mid-write, the callback skips its update.
+ */
+class StatusPage
+{
+public:
+	/// The longest file path the page holds, including the terminator.
+	static const size_t MAX_PATH = 4096;
+
+	/// The value of Layout::magic, spelling "PLYD" in little-endian.
+	static const std::uint32_t MAGIC = 0x44594c50;
+
+	/// The value of Layout::version for this layout.
+	static const std::uint32_t VERSION = 1;
+
+	/**
+	 * The layout of the page, as seen by readers.
+	 * Everything is native-endian; readers should check magic and
+	 * version before anything else.
+	 */
+	struct Layout {
+		std::uint32_t magic;   ///< Always MAGIC.
+		std::uint32_t version; ///< Always VERSION.
+
+		/// The seqlock sequence number; odd while playd is writing.
+		std::atomic<std::uint32_t> sequence;
+
+		/// The Audio::State of the player, as a number.
+		std::atomic<std::uint32_t> state;
+
+		/// The number of times the page has been written.
+		std::atomic<std::uint64_t> counter;
+
+		/// The position, in samples, heard at stamp.
+		std::atomic<std::uint64_t> position;
+
+		/// The monotonic time of position, in microseconds, on the same
+		/// clock as /player/time/anchor.
+		std::atomic<std::int64_t> stamp;
+
+		/// The sample rate of the loaded file, in Hz, or 0 if none.
+		std::atomic<std::uint32_t> rate;
+
+		/// Whether position is advancing.
+		std::atomic<std::uint32_t> playing;
+
+		/// The loaded file's path, NUL-terminated and possibly
+		/// truncated, or empty if none.
+		char path[MAX_PATH];
+	};
+
+	/// A consistent copy of the page, taken by Read.
+	struct Snapshot {
+		Audio::State state;     ///< The state of the player.
+		std::uint64_t counter;  ///< See Layout::counter.
+		std::uint64_t position; ///< See Layout::position.
+		std::int64_t stamp;     ///< See Layout::stamp.
+		std::uint32_t rate;     ///< See Layout::rate.
+		bool playing;           ///< See Layout::playing.
+		std::string path;       ///< See Layout::path.
+	};
+
+	/**
+	 * Creates, and maps, a status page.
+	 * The page is removed again when the StatusPage is destroyed.
+	 * @param name The shared memory name of the page, such as "/playd".
+	 * @exception FileError Thrown if the page cannot be created.
+	 */
+	explicit StatusPage(const std::string &name);
+
+	/// Unmaps, and removes, the status page.
+	~StatusPage();
+
+	/// Deleted copy constructor.
+	StatusPage(const StatusPage &) = delete;
+
+	/// Deleted copy-assignment.
+	StatusPage &operator=(const StatusPage &) = delete;
+
+	/**
+	 * Publishes the player's whole status.
+	 * Only the Player's thread may call this.
+	 * @param state The state of the player.
+	 * @param path The path of the loaded file, or empty if none.
+	 * @param position The position, in samples.
+	 * @param rate The sample rate, in Hz, or 0 if nothing is loaded.
+	 */
+	void Publish(Audio::State state, const std::string &path,
+	             std::uint64_t position, std::uint32_t rate);
+
+	/**
+	 * Publishes a new position, if nobody else is publishing.
+	 * This never waits, so is safe to call from the audio callback.
+	 * @param position The position, in samples.
+	 * @param stamp The monotonic time of @a position, in microseconds.
+	 * @return Whether the position was published.
+	 */
+	bool PublishPosition(std::uint64_t position, std::int64_t stamp);
+
+	/**
+	 * Gets the page as mapped.
+	 * @return The page.
+	 */
+	const Layout &Page() const;
+
+	/**
+	 * Takes a consistent copy of a page.
+	 * This is what readers in other processes should do, too.
+	 * @param page The page.
+	 * @return The copy.
+	 */
+	static Snapshot Read(const Layout &page);
+
+	/**
+	 * Gets the current monotonic time, in microseconds.
+	 * @return The time.
+	 */
+	static std::int64_t Now();
+
+private:
+	std::string name; ///< The shared memory name of the page.
+	Layout *page;     ///< The mapped page.
+
+	/// Held by whichever of the two writers is writing.
+	std::atomic_flag writing;
+
+	/// The path last published, to save rewriting it every update.
+	std::string path;
+
+	/// Marks the start of a write.
+	void BeginWrite();
+
+	/// Marks the end of a write.
+	void EndWrite();
+};
+
+#endif // PLAYD_STATUS_PAGE_HPP
@@ -0,0 +1,127 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Subscriptions class.
+ * @see subscriptions.hpp
+ */
+
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "response.hpp"
+#include "subscriptions.hpp"
+
+/* static */ bool Subscriptions::ParseInterval(
+        const std::string &str, std::chrono::milliseconds &interval)
+{
+	size_t digits = 0;
+	while (digits < str.size() && isdigit(str[digits])) digits++;
+
+	// Nine digits is over a week in milliseconds, which is plenty, and
+	// keeps us well clear of overflow.
+	if (digits == 0 || 9 < digits) return false;
+	auto count = std::stoll(str.substr(0, digits));
+
+	auto unit = str.substr(digits);
+	if (unit.empty() || unit == "ms") {
+		interval = std::chrono::milliseconds(count);
+	} else if (unit == "s") {
+		interval = std::chrono::seconds(count);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+void Subscriptions::Watch(const std::string &path,
+                          std::chrono::milliseconds interval)
+{
+	// Anything already held back for an old watch on this path is lost,
+	// but the next update will make up for it.
+	Watched watched;
+	watched.interval = interval;
+	watched.last = Clock::time_point();
+	this->watches[path] = watched;
+}
+
+bool Subscriptions::Unwatch(const std::string &path)
+{
+	return this->watches.erase(path) != 0;
+}
+
+bool Subscriptions::Offer(const Response &response)
+{
+	if (this->watches.empty()) return true;
+
+	// Things like END aren't resources, so can't be watched, and are rare
+	// and important enough that everyone should get them.
+	auto path = response.Path();
+	if (path.empty()) return true;
+
+	auto watched = this->Find(path);
+	if (watched == nullptr) return false;
+	if (watched->interval.count() == 0) return true;
+
+	Subscriptions::Hold(*watched, response);
+	return false;
+}
+
+void Subscriptions::OfferSample(const Response &response)
+{
+	auto watched = this->Find(response.Path());
+	if (watched == nullptr || watched->interval.count() == 0) return;
+
+	Subscriptions::Hold(*watched, response);
+}
+
+std::vector<Response> Subscriptions::Due(Clock::time_point now)
+{
+	std::vector<Response> due;
+
+	for (auto &w : this->watches) {
+		auto &watched = w.second;
+		if (watched.held.empty()) continue;
+		if (now - watched.last < watched.interval) continue;
+
+		for (const auto &h : watched.held) due.push_back(h.second);
+		watched.held.clear();
+		watched.last = now;
+	}
+
+	return due;
+}
+
+Subscriptions::Watched *Subscriptions::Find(const std::string &path)
+{
+	if (path.empty()) return nullptr;
+
+	// Walk up the tree from the resource itself, so that the innermost
+	// watch wins.
+	auto p = path;
+	while (true) {
+		auto it = this->watches.find(p);
+		if (it != this->watches.end()) return &it->second;
+
+		auto slash = p.rfind('/');
+		if (p == "/" || slash == std::string::npos) return nullptr;
+		p = (slash == 0) ? "/" : p.substr(0, slash);
+	}
+}
+
+/* static */ void Subscriptions::Hold(Watched &watched,
+                                      const Response &response)
+{
+	// Only the latest value of each resource is worth delivering.
+	auto path = response.Path();
+	auto it = watched.held.find(path);
+	if (it == watched.held.end()) {
+		watched.held.emplace(path, response);
+	} else {
+		it->second = response;
+	}
+}
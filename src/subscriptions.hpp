@@ -0,0 +1,119 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Subscriptions class.
+ * @see subscriptions.cpp
+ */
+
+#ifndef PLAYD_SUBSCRIPTIONS_HPP
+#define PLAYD_SUBSCRIPTIONS_HPP
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "response.hpp"
+
+/**
+ * The set of resource subtrees a client has asked to watch.
+ *
+ * A client that watches nothing gets every broadcast, as before watches
+ * existed.  Once it watches something, it only gets broadcasts of resources
+ * inside the subtrees it watches, plus any non-resource broadcasts (END and
+ * the like), which aren't part of the tree.
+ *
+ * Each watch may have an interval.  Without one, resources are delivered as
+ * they are broadcast.  With one, resources (and samples) are held back and
+ * coalesced, so that at most the latest value of each resource is delivered
+ * once per interval.
+ */
+class Subscriptions
+{
+public:
+	/// The clock used to time intervals.
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * Parses a watch interval.
+	 * Intervals are whole numbers of milliseconds, with an optional 'ms'
+	 * suffix, or whole numbers of seconds with an 's' suffix.
+	 * @param str The string to parse.
+	 * @param interval Set to the parsed interval.
+	 * @return Whether @a str was a valid interval.
+	 */
+	static bool ParseInterval(const std::string &str,
+	                          std::chrono::milliseconds &interval);
+
+	/**
+	 * Watches a subtree, replacing any existing watch on it.
+	 * @param path The root of the subtree.
+	 * @param interval The delivery interval, or zero to deliver
+	 *   immediately.
+	 */
+	void Watch(const std::string &path, std::chrono::milliseconds interval);
+
+	/**
+	 * Stops watching a subtree.
+	 * @param path The root of the subtree, as given to Watch.
+	 * @return Whether the subtree was being watched.
+	 */
+	bool Unwatch(const std::string &path);
+
+	/**
+	 * Offers a broadcast to these Subscriptions.
+	 * @param response The broadcast response.
+	 * @return Whether the response should be delivered now.  If false, the
+	 *   response is either unwanted or has been held back for Due.
+	 */
+	bool Offer(const Response &response);
+
+	/**
+	 * Offers a sample to these Subscriptions.
+	 * Samples are only held back for watches with intervals, and are never
+	 * to be delivered straight away.
+	 * @param response The sampled response.
+	 */
+	void OfferSample(const Response &response);
+
+	/**
+	 * Takes the held back responses that are due for delivery.
+	 * @param now The current time.
+	 * @return The responses to deliver, in order.
+	 */
+	std::vector<Response> Due(Clock::time_point now);
+
+private:
+	/// A watch on a single subtree.
+	struct Watched {
+		/// The delivery interval, or zero to deliver immediately.
+		std::chrono::milliseconds interval;
+
+		/// The last time held back responses were delivered.
+		Clock::time_point last;
+
+		/// Map from paths to the latest held back responses.
+		std::map<std::string, Response> held;
+	};
+
+	/// Map from subtree roots to their watches.
+	std::map<std::string, Watched> watches;
+
+	/**
+	 * Finds the innermost watch covering a resource.
+	 * @param path The path of the resource.
+	 * @return The watch, or nullptr if there isn't one.
+	 */
+	Watched *Find(const std::string &path);
+
+	/**
+	 * Holds back a response until its watch is next due.
+	 * @param watched The watch.
+	 * @param response The response.
+	 */
+	static void Hold(Watched &watched, const Response &response);
+};
+
+#endif // PLAYD_SUBSCRIPTIONS_HPP
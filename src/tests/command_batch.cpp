@@ -0,0 +1,140 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the CommandBatch class.
+ */
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio_system.hpp"
+#include "../command_batch.hpp"
+#include "../player.hpp"
+#include "../response.hpp"
+#include "dummy_audio_sink.hpp"
+#include "dummy_audio_source.hpp"
+
+/// A ResponseSink that keeps every response it is sent, with its ID.
+class IdRecordingSink : public ResponseSink
+{
+public:
+	void Respond(const Response &response, size_t id = 0) const override
+	{
+		this->sent.emplace_back(id, response.Pack());
+	}
+
+	/**
+	 * Counts the responses sent with a given prefix.
+	 * @param prefix The prefix.
+	 * @return The count.
+	 */
+	size_t Count(const std::string &prefix) const
+	{
+		size_t count = 0;
+		for (const auto &s : this->sent) {
+			if (s.second.compare(0, prefix.size(), prefix) == 0) count++;
+		}
+		return count;
+	}
+
+	/**
+	 * Finds the first response sent with a given prefix.
+	 * @param prefix The prefix.
+	 * @return Its index, or the number of responses if there is none.
+	 */
+	size_t Find(const std::string &prefix) const
+	{
+		for (size_t i = 0; i < this->sent.size(); i++) {
+			if (this->sent[i].second.compare(0, prefix.size(), prefix) == 0) return i;
+		}
+		return this->sent.size();
+	}
+
+	/// The responses sent so far, with the IDs they were sent to.
+	mutable std::vector<std::pair<size_t, std::string>> sent;
+};
+
+SCENARIO("CommandBatch announces each changed resource once per batch", "[command-batch]") {
+	GIVEN("a Player whose sink is a CommandBatch's output") {
+		AudioSystem ds(0);
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+
+		Player p(ds);
+		IdRecordingSink out;
+		p.SetSink(out);
+
+		CommandBatch batch(p, out);
+
+		WHEN("nothing is queued") {
+			THEN("running the batch does nothing") {
+				REQUIRE(batch.Empty());
+				REQUIRE(batch.Run() == 0);
+				REQUIRE(out.sent.empty());
+			}
+		}
+
+		WHEN("a burst of loads and plays is queued from two clients") {
+			batch.Add({"write", "a", "/player/file", "one.mp3"}, 1);
+			batch.Add({"write", "b", "/player/file", "two.mp3"}, 2);
+			batch.Add({"write", "c", "/control/state", "Playing"}, 1);
+			batch.Add({"write", "d", "/control/state", "Stopped"}, 2);
+			batch.Add({"write", "e", "/control/state", "Playing"}, 1);
+			REQUIRE_FALSE(batch.Empty());
+
+			auto run = batch.Run();
+
+			THEN("every command ran, and was acknowledged to its client, in order") {
+				REQUIRE(run == 5);
+				REQUIRE(batch.Empty());
+
+				auto a = out.Find("ACK OK success write a ");
+				auto e = out.Find("ACK OK success write e ");
+				REQUIRE(a < e);
+				REQUIRE(e < out.sent.size());
+				REQUIRE(out.sent[a].first == 1);
+				REQUIRE(out.sent[out.Find("ACK OK success write b ")].first == 2);
+			}
+
+			THEN("each resource was broadcast once, with its final value, before the ACKs") {
+				REQUIRE(out.Count("RES /player/file ") == 1);
+				REQUIRE(out.Count("RES /control/state ") == 1);
+				REQUIRE(out.Count("RES / Directory") == 1);
+
+				auto file = out.Find("RES /player/file ");
+				REQUIRE(out.sent[file].second == "RES /player/file Entry two.mp3");
+				REQUIRE(out.sent[file].first == 0);
+
+				auto state = out.Find("RES /control/state ");
+				REQUIRE(out.sent[state].second == "RES /control/state Entry Playing");
+				REQUIRE(state < out.Find("ACK "));
+
+				REQUIRE(0 < batch.Superseded());
+			}
+
+			THEN("the player's broadcasts go straight to the output again") {
+				out.sent.clear();
+				REQUIRE(p.RunCommand(std::vector<std::string>{"write", "f", "/control/state", "Stopped"}).IsSuccess());
+				REQUIRE(out.Count("RES /control/state Entry Stopped") == 1);
+			}
+		}
+
+		WHEN("a read is queued behind a change") {
+			batch.Add({"write", "a", "/player/file", "one.mp3"}, 1);
+			batch.Add({"read", "b", "/player/file"}, 2);
+			batch.Run();
+
+			THEN("the reader is answered at once, and the change is still broadcast") {
+				auto read = out.Find("RES /player/file ");
+				REQUIRE(out.sent[read].first == 2);
+				REQUIRE(out.sent[read].second == "RES /player/file Entry one.mp3");
+				REQUIRE(out.Count("RES /player/file ") == 2);
+			}
+		}
+	}
+}
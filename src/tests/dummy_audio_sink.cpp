@@ -20,6 +20,11 @@
 	return std::unique_ptr<AudioSink>(new DummyAudioSink());
 }
 
+UnderrunMonitor *DummyAudioSink::Underruns()
+{
+	return &this->underruns;
+}
+
 void DummyAudioSink::Start()
 {
 	this->state = Audio::State::PLAYING;
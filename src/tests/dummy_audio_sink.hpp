@@ -31,6 +31,7 @@ public:
 	Audio::State State() override;
 	std::uint64_t Position() override;
 	void SetPosition(std::uint64_t samples) override;
+	UnderrunMonitor *Underruns() override;
 	void SourceOut() override;
 	void Transfer(AudioSink::TransferIterator &start, const AudioSink::TransferIterator &end) override;
 
@@ -39,4 +40,7 @@ public:
 
 	/// The current position, in samples.
 	uint64_t position = 0;
+
+	/// The underrun monitor, which tests drive by hand.
+	UnderrunMonitor underruns;
 };
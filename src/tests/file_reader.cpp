@@ -0,0 +1,135 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the FileReader class.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/file_reader.hpp"
+#include "../errors.hpp"
+
+/**
+ * The byte at a given offset in the test file.
+ * The period is prime, so that it never lines up with the reader's blocks.
+ */
+static std::uint8_t ByteAt(std::int64_t offset)
+{
+	return static_cast<std::uint8_t>(offset % 251);
+}
+
+/**
+ * Checks that a buffer holds the test file's bytes from a given offset.
+ * @param buf The buffer.
+ * @param offset The offset in the file of the first byte in @a buf.
+ * @return Whether every byte matches.
+ */
+static bool Matches(const std::vector<std::uint8_t> &buf, std::int64_t offset)
+{
+	for (size_t i = 0; i < buf.size(); i++) {
+		if (buf[i] != ByteAt(offset + i)) return false;
+	}
+	return true;
+}
+
+SCENARIO("FileReader reads files like read(2) would", "[file-reader]") {
+	GIVEN("a file several read-ahead blocks long") {
+		const std::int64_t length = 1000 * 1000;
+		std::string path = "playd_test_file_reader.bin";
+		{
+			std::ofstream f(path, std::ios::out | std::ios::binary |
+			                              std::ios::trunc);
+			for (std::int64_t i = 0; i < length; i++) {
+				f.put(static_cast<char>(ByteAt(i)));
+			}
+		}
+
+		FileReader reader(path);
+
+		WHEN("the FileReader is fresh") {
+			THEN("it is at the start of the file, and knows its length") {
+				REQUIRE(reader.Tell() == 0);
+				REQUIRE(reader.Length() == length);
+			}
+		}
+
+		WHEN("the whole file is read in odd-sized pieces") {
+			std::vector<std::uint8_t> buf(12345);
+			std::int64_t offset = 0;
+			bool ok = true;
+
+			while (true) {
+				auto n = reader.Read(&buf[0], buf.size());
+				if (n <= 0) break;
+				buf.resize(static_cast<size_t>(n));
+				ok = ok && Matches(buf, offset);
+				offset += n;
+				buf.resize(12345);
+			}
+
+			THEN("every byte is read, in order") {
+				REQUIRE(ok);
+				REQUIRE(offset == length);
+				REQUIRE(reader.Tell() == length);
+			}
+
+			THEN("further reads return 0") {
+				REQUIRE(reader.Read(&buf[0], buf.size()) == 0);
+			}
+		}
+
+		WHEN("the FileReader seeks from the start") {
+			REQUIRE(reader.Seek(500000, SEEK_SET) == 500000);
+
+			THEN("reads start from the new position") {
+				std::vector<std::uint8_t> buf(100000);
+				REQUIRE(reader.Read(&buf[0], buf.size()) == 100000);
+				REQUIRE(Matches(buf, 500000));
+			}
+
+			AND_WHEN("it seeks relative to that") {
+				REQUIRE(reader.Seek(-1000, SEEK_CUR) == 499000);
+
+				THEN("reads start from the new position") {
+					std::vector<std::uint8_t> buf(10);
+					REQUIRE(reader.Read(&buf[0], buf.size()) == 10);
+					REQUIRE(Matches(buf, 499000));
+				}
+			}
+		}
+
+		WHEN("the FileReader seeks near the end") {
+			REQUIRE(reader.Seek(-10, SEEK_END) == length - 10);
+
+			THEN("reads are cut short at the end of the file") {
+				std::vector<std::uint8_t> buf(100);
+				REQUIRE(reader.Read(&buf[0], buf.size()) == 10);
+				buf.resize(10);
+				REQUIRE(Matches(buf, length - 10));
+			}
+		}
+
+		WHEN("the FileReader seeks before the start") {
+			THEN("the seek fails, and the position is unchanged") {
+				REQUIRE(reader.Seek(-1, SEEK_SET) == -1);
+				REQUIRE(reader.Tell() == 0);
+			}
+		}
+
+		std::remove(path.c_str());
+	}
+
+	GIVEN("a file that doesn't exist") {
+		THEN("constructing a FileReader throws FileError") {
+			REQUIRE_THROWS_AS(FileReader("playd_test_nonexistent.bin"), FileError);
+		}
+	}
+}
@@ -0,0 +1,175 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the FrameEncoder and FrameDecoder classes.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../frame.hpp"
+#include "../response.hpp"
+
+/// Makes a frame from command words, as a client would.
+static std::string ClientFrame(const std::vector<std::string> &words)
+{
+	std::string payload;
+	for (const auto &w : words) {
+		FrameEncoder::PutVarint(payload, w.size());
+		payload += w;
+	}
+
+	std::string frame;
+	FrameEncoder::PutVarint(frame, payload.size());
+	return frame + payload;
+}
+
+SCENARIO("Varints round-trip", "[frame]") {
+	GIVEN("some values") {
+		std::vector<std::uint64_t> values{0, 1, 127, 128, 300, UINT64_MAX};
+
+		WHEN("they are encoded") {
+			std::string out;
+			for (auto v : values) FrameEncoder::PutVarint(out, v);
+
+			THEN("small values take one byte") {
+				REQUIRE(out[0] == 0);
+				REQUIRE(out[1] == 1);
+				REQUIRE(out[2] == 127);
+			}
+
+			THEN("they decode to the same values") {
+				size_t pos = 0;
+				for (auto v : values) {
+					std::uint64_t got;
+					REQUIRE(FrameEncoder::GetVarint(out, pos, got));
+					REQUIRE(got == v);
+				}
+				REQUIRE(pos == out.size());
+			}
+
+			THEN("a truncated varint doesn't decode") {
+				// UINT64_MAX takes the last ten bytes.
+				auto cut = out.substr(0, out.size() - 1);
+				size_t pos = cut.size() - 9;
+				std::uint64_t got;
+				REQUIRE_FALSE(FrameEncoder::GetVarint(cut, pos, got));
+				REQUIRE(pos == cut.size() - 9);
+			}
+		}
+	}
+}
+
+SCENARIO("FrameEncoder interns resource paths", "[frame]") {
+	GIVEN("a fresh FrameEncoder") {
+		FrameEncoder e;
+		auto res = Response::Res("Entry", "/player/time/elapsed", "300");
+
+		WHEN("a resource is encoded for the first time") {
+			auto out = e.Encode(*res);
+
+			THEN("the path is defined first") {
+				// Length, DEFINE, ID 0, then the path.
+				std::string path = "/player/time/elapsed";
+				REQUIRE(static_cast<size_t>(out[0]) == path.size() + 2);
+				REQUIRE(static_cast<std::uint8_t>(out[1]) ==
+				        FrameEncoder::DEFINE);
+				REQUIRE(out[2] == 0);
+				REQUIRE(out.substr(3, path.size()) == path);
+			}
+
+			AND_WHEN("it is encoded again") {
+				auto again = e.Encode(*res);
+
+				THEN("only the ID is sent, and numbers are varints") {
+					auto code = static_cast<char>(Response::Code::RES);
+					std::string expected{
+					        12,                           // length
+					        code,                         // RES
+					        0,                            // path ID
+					        0, 5, 'E', 'n', 't', 'r', 'y', // "Entry"
+					        1, '\xAC', '\x02'             // 300
+					};
+					REQUIRE(again == expected);
+				}
+			}
+		}
+
+		WHEN("a response with awkward arguments is encoded") {
+			Response r(Response::Code::ACK);
+			r.AddArg("-12").AddArg("007").AddArg("-0").AddArg("a b");
+			auto out = e.Encode(r);
+
+			THEN("only canonical numbers become varints") {
+				size_t pos = 2;
+				REQUIRE(out[pos] == 2); // SIGNED
+				REQUIRE(out[pos + 1] == 23);
+				REQUIRE(out[pos + 2] == 0); // STRING "007"
+				REQUIRE(out.substr(pos + 4, 3) == "007");
+				REQUIRE(out[pos + 7] == 0); // STRING "-0"
+				REQUIRE(out[pos + 11] == 0); // STRING "a b"
+				REQUIRE(out.substr(pos + 13) == "a b");
+			}
+		}
+	}
+}
+
+SCENARIO("FrameDecoder splits frames into commands", "[frame]") {
+	GIVEN("a fresh FrameDecoder") {
+		FrameDecoder d;
+
+		WHEN("it is fed two frames in one go") {
+			auto cmds = d.Feed(ClientFrame({"play", "t1"}) +
+			                   ClientFrame({"load", "t2", "/a b.mp3"}));
+
+			THEN("both commands come out, words intact") {
+				std::vector<std::string> play{"play", "t1"};
+				std::vector<std::string> load{"load", "t2", "/a b.mp3"};
+				REQUIRE(cmds.size() == 2);
+				REQUIRE(cmds[0] == play);
+				REQUIRE(cmds[1] == load);
+				REQUIRE_FALSE(d.Broken());
+			}
+		}
+
+		WHEN("it is fed a frame a byte at a time") {
+			auto frame = ClientFrame({"stop", "t3"});
+			std::vector<std::vector<std::string>> cmds;
+			for (char c : frame) {
+				REQUIRE(cmds.empty());
+				cmds = d.Feed(std::string(1, c));
+			}
+
+			THEN("the command comes out at the end") {
+				std::vector<std::string> stop{"stop", "t3"};
+				REQUIRE(cmds.size() == 1);
+				REQUIRE(cmds[0] == stop);
+			}
+		}
+
+		WHEN("it is fed a word that overruns its frame") {
+			std::string bad{3, 5, 'a', 'b'};
+			auto cmds = d.Feed(bad + "cde");
+
+			THEN("it is broken") {
+				REQUIRE(cmds.empty());
+				REQUIRE(d.Broken());
+			}
+		}
+
+		WHEN("it is fed an oversized frame") {
+			std::string big;
+			FrameEncoder::PutVarint(big, FrameDecoder::MAX_FRAME + 1);
+			d.Feed(big);
+
+			THEN("it is broken") {
+				REQUIRE(d.Broken());
+			}
+		}
+	}
+}
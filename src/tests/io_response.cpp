@@ -86,3 +86,21 @@ SCENARIO("Responses correctly escape arguments with single quotes", "[response]"
 		}
 	}
 }
+
+SCENARIO("Responses know the paths of the resources they carry", "[response]") {
+	WHEN("the Response is a RES") {
+		auto r = Response::Res("Entry", "/player/time/elapsed", "1000");
+
+		THEN("Path() is the resource's path") {
+			REQUIRE(r->Path() == "/player/time/elapsed");
+		}
+	}
+
+	WHEN("the Response is not a RES") {
+		auto r = Response(Response::Code::FILE).AddArg("/player/time/elapsed");
+
+		THEN("Path() is empty") {
+			REQUIRE(r.Path() == "");
+		}
+	}
+}
@@ -0,0 +1,149 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Metrics registry and its metrics.
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../metrics.hpp"
+
+SCENARIO("Counters and Gauges hold their values", "[metrics]") {
+	GIVEN("a fresh Counter and Gauge") {
+		Counter c("a counter");
+		Gauge g("a gauge");
+
+		THEN("both start at zero") {
+			REQUIRE(c.Get() == 0);
+			REQUIRE(g.Get() == 0);
+		}
+
+		WHEN("the counter is added to, and the gauge set") {
+			c.Add();
+			c.Add(41);
+			g.Set(-7);
+
+			THEN("their values reflect it") {
+				REQUIRE(c.Get() == 42);
+				REQUIRE(g.Get() == -7);
+				REQUIRE(c.Values() == std::vector<std::string>{"42"});
+				REQUIRE(g.Values() == std::vector<std::string>{"-7"});
+			}
+
+			THEN("they are dumped for Prometheus with their help") {
+				std::string out;
+				c.Prometheus(out, "playd_c");
+				g.Prometheus(out, "playd_g");
+				REQUIRE(out == "# HELP playd_c_total a counter\n"
+				               "# TYPE playd_c_total counter\n"
+				               "playd_c_total 42\n"
+				               "# HELP playd_g a gauge\n"
+				               "# TYPE playd_g gauge\n"
+				               "playd_g -7\n");
+			}
+		}
+	}
+}
+
+SCENARIO("Histogram buckets values log-linearly", "[metrics]") {
+	WHEN("values are small") {
+		THEN("each gets a bucket to itself") {
+			for (std::uint64_t v = 0; v < Histogram::SUB_BUCKETS; v++) {
+				REQUIRE(Histogram::BucketOf(v) == v);
+				REQUIRE(Histogram::BucketTop(v) == v);
+			}
+		}
+	}
+
+	WHEN("values are large") {
+		THEN("each bucket is within one part in SUB_BUCKETS") {
+			std::vector<std::uint64_t> values{16, 17, 31, 32, 33, 1000,
+			                                  123456789, UINT64_MAX};
+			for (auto v : values) {
+				auto top = Histogram::BucketTop(Histogram::BucketOf(v));
+				auto error = top - v;
+				REQUIRE(v <= top);
+				REQUIRE(error <= v / Histogram::SUB_BUCKETS);
+			}
+		}
+
+		THEN("the largest value falls into the last bucket") {
+			REQUIRE(Histogram::BucketOf(UINT64_MAX) ==
+			        Histogram::BUCKETS - 1);
+		}
+	}
+}
+
+SCENARIO("Histograms estimate quantiles", "[metrics]") {
+	GIVEN("a fresh Histogram") {
+		Histogram h("a histogram");
+
+		THEN("everything is zero") {
+			REQUIRE(h.Count() == 0);
+			REQUIRE(h.Max() == 0);
+			REQUIRE(h.Quantile(0.5) == 0);
+		}
+
+		WHEN("1 to 1000 are recorded") {
+			for (std::uint64_t v = 1; v <= 1000; v++) h.Record(v);
+
+			THEN("the count, sum and max are exact") {
+				REQUIRE(h.Count() == 1000);
+				REQUIRE(h.Sum() == 500500);
+				REQUIRE(h.Max() == 1000);
+			}
+
+			THEN("the quantiles are within a bucket") {
+				auto p50 = h.Quantile(0.5);
+				REQUIRE(500 <= p50);
+				REQUIRE(p50 <= 500 + 500 / Histogram::SUB_BUCKETS);
+
+				auto p99 = h.Quantile(0.99);
+				REQUIRE(990 <= p99);
+				REQUIRE(p99 <= 1000);
+				REQUIRE(h.Quantile(1) == 1000);
+			}
+
+			THEN("the values are the count, sum, max and quantiles") {
+				auto values = h.Values();
+				REQUIRE(values.size() == 7);
+				REQUIRE(values[0] == "1000");
+				REQUIRE(values[1] == "500500");
+				REQUIRE(values[2] == "1000");
+			}
+		}
+	}
+}
+
+SCENARIO("The Metrics registry finds and dumps metrics", "[metrics]") {
+	GIVEN("the registry, with a test counter registered") {
+		// Catch runs the GIVEN once per THEN, but names can only be
+		// registered once.
+		auto &metrics = Metrics::Global();
+		static auto &c = metrics.AddCounter("test/registry", "a test counter");
+		c.Add(3 - c.Get());
+
+		THEN("the counter can be found by name") {
+			REQUIRE(metrics.Find("test/registry") == &c);
+			REQUIRE(metrics.Find("test/nothing") == nullptr);
+		}
+
+		THEN("its name is listed") {
+			auto names = metrics.Names();
+			REQUIRE(std::find(names.begin(), names.end(),
+			                  "test/registry") != names.end());
+		}
+
+		THEN("the Prometheus dump has it, with slashes flattened") {
+			auto dump = metrics.Prometheus();
+			REQUIRE(dump.find("\nplayd_test_registry_total 3\n") !=
+			        std::string::npos);
+		}
+	}
+}
@@ -0,0 +1,106 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Outbox class.
+ */
+
+#include <chrono>
+#include <string>
+
+#include "catch.hpp"
+
+#include "../outbox.hpp"
+#include "../response.hpp"
+
+SCENARIO("Outbox holds back updates for clients over budget", "[outbox]") {
+	GIVEN("an Outbox with a budget of 100 bytes") {
+		Outbox o(100);
+		auto t1 = Response::Res("Entry", "/player/time/elapsed", "1");
+		auto t2 = Response::Res("Entry", "/player/time/elapsed", "2");
+		auto state = Response::Res("Entry", "/control/state", "Playing");
+		auto end = Response(Response::Code::END);
+
+		WHEN("the client is within budget") {
+			THEN("everything is sent") {
+				REQUIRE(o.Offer(*t1, 100) == Outbox::Post::SEND);
+				REQUIRE(o.Offer(end, 0) == Outbox::Post::SEND);
+			}
+		}
+
+		WHEN("the client is over budget") {
+			THEN("non-resources are still sent") {
+				REQUIRE(o.Offer(end, 101) == Outbox::Post::SEND);
+			}
+
+			THEN("resources are held back, and newer values supersede older ones") {
+				REQUIRE(o.Offer(*t1, 101) == Outbox::Post::HELD);
+				REQUIRE(o.Offer(*state, 101) == Outbox::Post::HELD);
+				REQUIRE(o.Offer(*t2, 101) == Outbox::Post::SUPERSEDED);
+
+				AND_THEN("nothing is released until the client catches up") {
+					REQUIRE(o.Release(101).empty());
+				}
+
+				AND_THEN("updates keep being held until the release") {
+					REQUIRE(o.Offer(*state, 0) == Outbox::Post::SUPERSEDED);
+				}
+
+				AND_THEN("non-resources flush the held values ahead of them") {
+					REQUIRE(o.Offer(end, 101) == Outbox::Post::FLUSH);
+
+					auto drained = o.Drain();
+					REQUIRE(drained.size() == 2);
+					REQUIRE(drained.at(0).Pack() == "RES /control/state Entry Playing");
+					REQUIRE(drained.at(1).Pack() == "RES /player/time/elapsed Entry 2");
+
+					REQUIRE(o.Offer(end, 101) == Outbox::Post::SEND);
+				}
+
+				AND_THEN("the latest values are released once the client catches up") {
+					auto released = o.Release(0);
+					REQUIRE(released.size() == 2);
+					REQUIRE(released.at(0).Pack() == "RES /control/state Entry Playing");
+					REQUIRE(released.at(1).Pack() == "RES /player/time/elapsed Entry 2");
+
+					REQUIRE(o.Offer(*t1, 0) == Outbox::Post::SEND);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Outbox gives up on clients that stay behind", "[outbox]") {
+	GIVEN("an Outbox with a budget of 100 bytes") {
+		Outbox o(100);
+		auto start = Outbox::Clock::now();
+
+		WHEN("the client is within budget") {
+			THEN("it is never hopeless") {
+				REQUIRE_FALSE(o.Hopeless(100, start));
+				REQUIRE_FALSE(o.Hopeless(100, start + Outbox::STALL_LIMIT * 2));
+			}
+		}
+
+		WHEN("the client goes over budget") {
+			REQUIRE_FALSE(o.Hopeless(101, start));
+
+			THEN("it becomes hopeless after the stall limit") {
+				REQUIRE_FALSE(o.Hopeless(101, start + Outbox::STALL_LIMIT));
+				REQUIRE(o.Hopeless(101, start + Outbox::STALL_LIMIT + std::chrono::seconds(1)));
+			}
+
+			THEN("catching up resets the stall") {
+				REQUIRE_FALSE(o.Hopeless(0, start + Outbox::STALL_LIMIT));
+				REQUIRE_FALSE(o.Hopeless(101, start + Outbox::STALL_LIMIT + std::chrono::seconds(1)));
+			}
+		}
+
+		WHEN("the client goes hopelessly over budget") {
+			THEN("it is hopeless at once") {
+				REQUIRE(o.Hopeless(100 * Outbox::HOPELESS_FACTOR + 1, start));
+			}
+		}
+	}
+}
@@ -0,0 +1,283 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the PcmCache and RawAudioSource classes.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "../audio/audio_source.hpp"
+#include "../audio/pcm_cache.hpp"
+#include "../audio/sources/raw.hpp"
+#include "../errors.hpp"
+
+/// An AudioSource that decodes a fixed number of counting samples.
+class CountingAudioSource : public AudioSource
+{
+public:
+	CountingAudioSource(const std::string &path, std::uint64_t samples)
+	    : AudioSource(path), samples(samples), position(0)
+	{
+	}
+
+	AudioSource::DecodeResult Decode() override
+	{
+		if (this->position == this->samples) {
+			return std::make_pair(DecodeState::END_OF_FILE,
+			                      DecodeVector());
+		}
+
+		// Two 16-bit channels, each holding the low bits of the
+		// sample index.
+		DecodeVector v;
+		for (int i = 0; i < 4; i++) {
+			v.push_back(static_cast<std::uint8_t>(this->position));
+		}
+		this->position++;
+		return std::make_pair(DecodeState::DECODING, v);
+	}
+
+	std::uint8_t ChannelCount() const override
+	{
+		return 2;
+	}
+
+	std::uint32_t SampleRate() const override
+	{
+		return 8000;
+	}
+
+	SampleFormat OutputSampleFormat() const override
+	{
+		return SampleFormat::PACKED_SIGNED_INT_16;
+	}
+
+	std::uint64_t Seek(std::uint64_t position) override
+	{
+		return this->position = position;
+	}
+
+private:
+	std::uint64_t samples;
+	std::uint64_t position;
+};
+
+/// A temporary directory, removed along with its files on destruction.
+class TempDir
+{
+public:
+	/// Constructs a TempDir, making a fresh directory.
+	TempDir()
+	{
+		char dir[] = "/tmp/playd_test_XXXXXX";
+		REQUIRE(mkdtemp(dir) != nullptr);
+		this->path = dir;
+	}
+
+	/// Destructs a TempDir, removing the directory.
+	~TempDir()
+	{
+		DIR *d = opendir(this->path.c_str());
+		if (d == nullptr) return;
+		for (struct dirent *de = readdir(d); de != nullptr; de = readdir(d)) {
+			std::remove((this->path + "/" + de->d_name).c_str());
+		}
+		closedir(d);
+		rmdir(this->path.c_str());
+	}
+
+	std::string path; ///< The path of the directory.
+};
+
+/**
+ * Writes a file with the given contents.
+ * @param path The file to write.
+ * @param contents The contents of the file.
+ */
+static void WriteFile(const std::string &path, const std::string &contents)
+{
+	std::ofstream f(path, std::ios::out | std::ios::trunc);
+	f << contents;
+}
+
+/**
+ * Finds the one cache file in a directory.
+ * @param dir The directory.
+ * @return The path of the cache file, or the empty string if there isn't one.
+ */
+static std::string FindCacheFile(const std::string &dir)
+{
+	std::string found;
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr) return found;
+	for (struct dirent *de = readdir(d); de != nullptr; de = readdir(d)) {
+		std::string name(de->d_name);
+		if (4 < name.size() && name.substr(name.size() - 4) == ".pcm") found = dir + "/" + name;
+	}
+	closedir(d);
+	return found;
+}
+
+SCENARIO("PcmCache serves decoded audio from the cache", "[pcm-cache]") {
+	GIVEN("a PcmCache with plenty of room, and an audio file") {
+		TempDir temp;
+		auto dir = temp.path;
+		auto path = dir + "/song.mp3";
+		WriteFile(path, "original");
+
+		PcmCache cache(dir, 1024 * 1024);
+
+		WHEN("nothing has been stored") {
+			THEN("Lookup() returns nothing") {
+				REQUIRE_FALSE(cache.Lookup(path));
+			}
+		}
+
+		WHEN("the file is stored") {
+			CountingAudioSource src(path, 100);
+			REQUIRE(cache.Store(path, src));
+
+			THEN("Lookup() returns a source with the same format") {
+				auto raw = cache.Lookup(path);
+				REQUIRE(raw);
+				REQUIRE(raw->Path() == path);
+				REQUIRE(raw->ChannelCount() == 2);
+				REQUIRE(raw->SampleRate() == 8000);
+				REQUIRE(raw->OutputSampleFormat() == SampleFormat::PACKED_SIGNED_INT_16);
+			}
+
+			THEN("the source decodes the same samples") {
+				auto raw = cache.Lookup(path);
+				REQUIRE(raw);
+
+				auto result = raw->Decode();
+				REQUIRE(result.first == AudioSource::DecodeState::DECODING);
+				REQUIRE(result.second.size() == 400);
+				REQUIRE(result.second.at(4 * 42) == 42);
+
+				result = raw->Decode();
+				REQUIRE(result.first == AudioSource::DecodeState::END_OF_FILE);
+			}
+
+			THEN("the source seeks exactly") {
+				auto raw = cache.Lookup(path);
+				REQUIRE(raw);
+
+				REQUIRE(raw->Seek(57) == 57);
+				auto result = raw->Decode();
+				REQUIRE(result.second.size() == 4 * (100 - 57));
+				REQUIRE(result.second.at(0) == 57);
+
+				REQUIRE_THROWS_AS(raw->Seek(101), SeekError);
+			}
+
+			THEN("a second PcmCache on the same directory adopts the file") {
+				PcmCache again(dir, 1024 * 1024);
+				REQUIRE(again.Lookup(path));
+				REQUIRE(again.Size() == cache.Size());
+			}
+
+			AND_WHEN("cache files it can't adopt are left in the directory") {
+				auto renamed = dir + "/0123456789abcdef.pcm";
+				auto garbage = dir + "/garbage.pcm";
+				{
+					std::ifstream in(FindCacheFile(dir), std::ios::binary);
+					std::ofstream out(renamed, std::ios::binary);
+					out << in.rdbuf();
+				}
+				WriteFile(garbage, "not a cache file");
+
+				THEN("a second PcmCache removes them, and adopts the rest") {
+					PcmCache again(dir, 1024 * 1024);
+					REQUIRE(access(renamed.c_str(), F_OK) != 0);
+					REQUIRE(access(garbage.c_str(), F_OK) != 0);
+					REQUIRE(again.Lookup(path));
+					REQUIRE(again.Size() == cache.Size());
+				}
+			}
+
+			AND_WHEN("the original file changes") {
+				WriteFile(path, "changed, and longer");
+
+				THEN("Lookup() returns nothing") {
+					REQUIRE_FALSE(cache.Lookup(path));
+					REQUIRE(cache.Size() == 0);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("PcmCache stays within its budget", "[pcm-cache]") {
+	GIVEN("a PcmCache with room for roughly one file, and two audio files") {
+		TempDir temp;
+		auto dir = temp.path;
+		auto first = dir + "/first.wav";
+		auto second = dir + "/second.wav";
+		WriteFile(first, "first");
+		WriteFile(second, "second");
+
+		PcmCache cache(dir, 6000);
+
+		WHEN("a file larger than the budget is stored") {
+			CountingAudioSource src(first, 2000);
+
+			THEN("the file is not cached") {
+				REQUIRE_FALSE(cache.Store(first, src));
+				REQUIRE_FALSE(cache.Lookup(first));
+				REQUIRE(cache.Size() == 0);
+			}
+
+			AND_WHEN("the file is queued for filling again") {
+				REQUIRE_FALSE(cache.Store(first, src));
+
+				std::atomic<int> builds(0);
+				auto builder = [&builds](const std::string &path) {
+					builds++;
+					return std::unique_ptr<AudioSource>(new CountingAudioSource(path, 2000));
+				};
+
+				THEN("it isn't decoded again, until it changes") {
+					cache.Fill(first, builder);
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+					REQUIRE(builds == 0);
+
+					WriteFile(first, "first, but longer");
+					cache.Fill(first, builder);
+					for (int i = 0; i < 200 && builds == 0; i++) {
+						std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					}
+					REQUIRE(builds == 1);
+				}
+			}
+		}
+
+		WHEN("both files are stored") {
+			CountingAudioSource src1(first, 1000);
+			CountingAudioSource src2(second, 1000);
+			REQUIRE(cache.Store(first, src1));
+			REQUIRE(cache.Store(second, src2));
+
+			THEN("the least recently used file has been evicted") {
+				REQUIRE_FALSE(cache.Lookup(first));
+				REQUIRE(cache.Lookup(second));
+				REQUIRE(cache.Size() <= 6000);
+			}
+		}
+	}
+}
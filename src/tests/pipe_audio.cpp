@@ -80,5 +80,92 @@ SCENARIO("PipeAudio responds to Emit calls with valid responses", "[pipe-audio]"
 			}
 		}
 
+		WHEN("the anchor is requested") {
+			THEN("the /player/time/anchor resource gives the position, rate, time and state") {
+				auto rs = pa.Emit("/player/time/anchor", false);
+				REQUIRE(rs);
+
+				auto packed = rs->Pack();
+				std::string prefix = "RES /player/time/anchor Anchor 0 44100 ";
+				std::string suffix = " Stopped";
+				REQUIRE(packed.compare(0, prefix.size(), prefix) == 0);
+				REQUIRE(packed.compare(packed.size() - suffix.size(), suffix.size(), suffix) == 0);
+			}
+
+			AND_WHEN("the anchor has been broadcast") {
+				REQUIRE(pa.Emit("/player/time/anchor", true));
+
+				THEN("it isn't broadcast again while nothing changes") {
+					REQUIRE_FALSE(pa.Emit("/player/time/anchor", true));
+				}
+
+				THEN("it is still sent to anyone who asks") {
+					REQUIRE(pa.Emit("/player/time/anchor", false));
+				}
+
+				THEN("it is broadcast again after playback starts") {
+					pa.SetPlaying(true);
+					auto rs = pa.Emit("/player/time/anchor", true);
+					REQUIRE(rs);
+
+					auto packed = rs->Pack();
+					std::string suffix = " Playing";
+					REQUIRE(packed.compare(packed.size() - suffix.size(), suffix.size(), suffix) == 0);
+				}
+
+				THEN("it is broadcast again after a seek") {
+					pa.Seek(0);
+					REQUIRE(pa.Emit("/player/time/anchor", true));
+				}
+			}
+		}
+
+		WHEN("the latency is requested") {
+			THEN("the /audio/latency resources report the sink's latency") {
+				// The DummyAudioSink doesn't know its latency.
+				auto rs = pa.Emit("/audio/latency/buffer", 0);
+				REQUIRE(rs);
+				REQUIRE(rs->Pack() == "RES /audio/latency/buffer Entry 0");
+
+				rs = pa.Emit("/audio/latency/period", 0);
+				REQUIRE(rs);
+				REQUIRE(rs->Pack() == "RES /audio/latency/period Entry 0");
+			}
+		}
+
+	}
+}
+
+SCENARIO("PipeAudio reports its sink's underruns", "[pipe-audio]") {
+	GIVEN("a PipeAudio whose sink has underrun once, for 2ms") {
+		auto sink = new DummyAudioSink();
+		PipeAudio pa(std::unique_ptr<AudioSource>(new DummyAudioSource("test")),
+		             std::unique_ptr<AudioSink>(sink));
+
+		sink->underruns.Playable(10, 10, false, 1000000);
+		sink->underruns.Playable(5, 10, false, 2000000);
+		sink->underruns.Playable(10, 10, false, 4000000);
+
+		WHEN("the underrun statistics are requested") {
+			THEN("/audio/stats/underruns gives the count and total length") {
+				auto rs = pa.Emit("/audio/stats/underruns", 0);
+				REQUIRE(rs);
+				REQUIRE(rs->Pack() == "RES /audio/stats/underruns Underruns 1 2000");
+			}
+		}
+
+		WHEN("the underruns are taken") {
+			auto underruns = pa.TakeUnderruns();
+
+			THEN("the underrun is there, with its start and length") {
+				REQUIRE(underruns.size() == 1);
+				REQUIRE(underruns[0].stamp == 2000);
+				REQUIRE(underruns[0].duration == 2000);
+			}
+
+			THEN("it isn't taken again") {
+				REQUIRE(pa.TakeUnderruns().empty());
+			}
+		}
 	}
 }
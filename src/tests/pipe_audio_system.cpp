@@ -6,6 +6,12 @@
  * Tests for AudioSystem.
  */
 
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
 #include "catch.hpp"
 
 #include "../audio/audio.hpp"
@@ -78,3 +84,144 @@ SCENARIO("AudioSystems fail to load audio with an unknown format", "[pipe-audio-
 		}
 	}
 }
+
+SCENARIO("AudioSystems match file extensions case-insensitively", "[pipe-audio-system]") {
+	GIVEN("an AudioSystem with a dummy sink and a source for 'bar'") {
+		AudioSystem sys(0);
+		sys.SetSink(&DummyAudioSink::Build);
+		sys.AddSource("bar", &DummyAudioSource::Build);
+
+		WHEN("a file with the extension 'BAR' is loaded") {
+			THEN("the 'bar' source is used") {
+				std::unique_ptr<Audio> au = sys.Load("FOO.BAR");
+				REQUIRE_FALSE(dynamic_cast<PipeAudio *>(au.get()) == nullptr);
+			}
+		}
+	}
+}
+
+SCENARIO("AudioSystem sniffs formats from file headers", "[pipe-audio-system]") {
+	using Bytes = std::vector<std::uint8_t>;
+
+	WHEN("the header is a FLAC stream marker") {
+		THEN("the format is 'flac'") {
+			REQUIRE(AudioSystem::SniffFormat(Bytes{'f', 'L', 'a', 'C', 0, 0}) == "flac");
+		}
+	}
+
+	WHEN("the header is an Ogg page") {
+		THEN("the format is 'ogg'") {
+			REQUIRE(AudioSystem::SniffFormat(Bytes{'O', 'g', 'g', 'S', 0}) == "ogg");
+		}
+	}
+
+	WHEN("the header is a RIFF WAVE chunk") {
+		THEN("the format is 'wav'") {
+			Bytes wav{'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E'};
+			REQUIRE(AudioSystem::SniffFormat(wav) == "wav");
+		}
+	}
+
+	WHEN("the header is a RIFF chunk that isn't WAVE") {
+		THEN("the format is not recognised") {
+			Bytes avi{'R', 'I', 'F', 'F', 0, 0, 0, 0, 'A', 'V', 'I', ' '};
+			REQUIRE(AudioSystem::SniffFormat(avi) == "");
+		}
+	}
+
+	WHEN("the header is an ID3v2 tag") {
+		THEN("the format is 'mp3'") {
+			Bytes id3{'I', 'D', '3', 4, 0, 0, 0, 0, 0x7F, 0x7F};
+			REQUIRE(AudioSystem::SniffFormat(id3) == "mp3");
+		}
+	}
+
+	WHEN("the header is an ID3v2 tag in front of a FLAC stream") {
+		THEN("the format is 'flac'") {
+			Bytes id3{'I', 'D', '3', 4, 0, 0, 0, 0, 0, 1, 0, 'f', 'L', 'a', 'C'};
+			REQUIRE(AudioSystem::SniffFormat(id3) == "flac");
+		}
+	}
+
+	WHEN("the header is an MPEG-1 Layer III frame") {
+		THEN("the format is 'mp3'") {
+			REQUIRE(AudioSystem::SniffFormat(Bytes{0xFF, 0xFB, 0x90, 0x64}) == "mp3");
+		}
+	}
+
+	WHEN("the header looks like a frame with reserved fields") {
+		THEN("the format is not recognised") {
+			REQUIRE(AudioSystem::SniffFormat(Bytes{0xFF, 0xFF, 0xF0, 0x00}) == "");
+		}
+	}
+
+	WHEN("the header is too short to tell") {
+		THEN("the format is not recognised") {
+			REQUIRE(AudioSystem::SniffFormat(Bytes{'f', 'L'}) == "");
+			REQUIRE(AudioSystem::SniffFormat(Bytes()) == "");
+		}
+	}
+}
+
+SCENARIO("AudioSystem prefers a file's contents to its extension", "[pipe-audio-system]") {
+	GIVEN("a FLAC-headed file with an MP3 extension, and sources for both") {
+		const std::string path = "playd_test_sniff.mp3";
+		{
+			std::ofstream f(path, std::ios::out | std::ios::binary);
+			f << "fLaC";
+		}
+
+		std::vector<std::string> built;
+		AudioSystem sys(0);
+		sys.SetSink(&DummyAudioSink::Build);
+		sys.AddSource("mp3", [&built](const std::string &p) {
+			built.push_back("mp3");
+			return DummyAudioSource::Build(p);
+		});
+		sys.AddSource("flac", [&built](const std::string &p) {
+			built.push_back("flac");
+			return DummyAudioSource::Build(p);
+		});
+
+		WHEN("the file is loaded") {
+			sys.Load(path);
+
+			THEN("the FLAC source is used") {
+				REQUIRE(built.size() == 1);
+				REQUIRE(built.at(0) == "flac");
+			}
+
+			AND_WHEN("the file is replaced and loaded again") {
+				{
+					std::ofstream f(path, std::ios::out | std::ios::binary | std::ios::trunc);
+					f << "OggS";
+				}
+				sys.Load(path);
+
+				THEN("the cached format is used without re-sniffing") {
+					REQUIRE(built.size() == 2);
+					REQUIRE(built.at(1) == "flac");
+				}
+			}
+
+			AND_WHEN("the file is replaced, other files push it out of the cache, and it is loaded again") {
+				{
+					std::ofstream f(path, std::ios::out | std::ios::binary | std::ios::trunc);
+					f << "ID3";
+				}
+				for (size_t i = 0; i < AudioSystem::MAX_FORMATS; i++) {
+					sys.Load("playd_test_missing_" + std::to_string(i) + ".flac");
+				}
+				built.clear();
+				sys.Load(path);
+
+				THEN("the file is sniffed afresh") {
+					REQUIRE(built.size() == 1);
+					REQUIRE(built.at(0) == "mp3");
+				}
+			}
+		}
+
+		std::remove(path.c_str());
+	}
+}
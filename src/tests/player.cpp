@@ -6,11 +6,17 @@
  * Tests for the Player class.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
+#include <thread>
 
 #include "catch.hpp"
 #include "../audio/audio_system.hpp"
 #include "../errors.hpp"
+#include "../metrics.hpp"
 #include "../player.hpp"
 #include "dummy_audio_sink.hpp"
 #include "dummy_audio_source.hpp"
@@ -129,3 +135,359 @@ SCENARIO("Player interacts correctly with a AudioSystem", "[player][dummy-audio-
 
 	}
 }
+
+/**
+ * Waits, for a while, for an AudioSystem to prewarm a file in the background.
+ * @param audio The AudioSystem to watch.
+ * @param path The path of the file.
+ * @return Whether the file became warm.
+ */
+static bool WaitForPrefetch(AudioSystem &audio, const std::string &path)
+{
+	for (int i = 0; i < 200; i++) {
+		auto warmed = audio.Prefetched();
+		if (std::find(warmed.begin(), warmed.end(), path) != warmed.end()) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+SCENARIO("Player exposes the AudioSystem's prefetched files", "[player][prefetch]") {
+	GIVEN("a fresh Player using AudioSystem, DummyAudioSink and DummyAudioSource, and a file") {
+		AudioSystem ds(0);
+		Player p(ds);
+
+		std::ostringstream os;
+		DummyResponseSink rs(os);
+		p.SetSink(rs);
+
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+
+		std::string path = "playd_test_player_prefetch.mp3";
+		{
+			std::ofstream f(path, std::ios::out | std::ios::trunc);
+			f << "some audio";
+		}
+
+		WHEN("nothing has been prefetched") {
+			THEN("reading /player/prefetch gives an empty list") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/prefetch"}).IsSuccess());
+				REQUIRE(os.str() == "RES /player/prefetch List\n");
+			}
+		}
+
+		WHEN("an empty path is prefetched") {
+			THEN("the write fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/prefetch", ""}).IsSuccess());
+			}
+		}
+
+		WHEN("a path is prefetched") {
+			auto res = p.RunCommand(std::vector<std::string>{"write", "tag", "/player/prefetch", path});
+			os.str("");
+
+			THEN("the write succeeds, and /player/prefetch lists it once warm") {
+				REQUIRE(res.IsSuccess());
+				REQUIRE(WaitForPrefetch(ds, path));
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/prefetch"}).IsSuccess());
+				REQUIRE(os.str() == "RES /player/prefetch List " + path + "\n");
+			}
+
+			AND_WHEN("/player/prefetch is deleted") {
+				REQUIRE(WaitForPrefetch(ds, path));
+				REQUIRE(p.RunCommand(std::vector<std::string>{"delete", "tag", "/player/prefetch"}).IsSuccess());
+
+				THEN("the list is empty again") {
+					p.RunCommand(std::vector<std::string>{"read", "tag", "/player/prefetch"});
+					REQUIRE(os.str() == "RES /player/prefetch List\n");
+				}
+			}
+		}
+
+		WHEN("the file is loaded without being prefetched") {
+			p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", path});
+			os.str("");
+
+			THEN("the load doesn't prefetch it") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/prefetch"}).IsSuccess());
+				REQUIRE(os.str() == "RES /player/prefetch List\n");
+			}
+		}
+
+		std::remove(path.c_str());
+	}
+}
+
+SCENARIO("Player exposes the metrics registry under /stats", "[player][metrics]") {
+	GIVEN("a fresh Player, and a test gauge") {
+		AudioSystem ds(0);
+		Player p(ds);
+
+		std::ostringstream os;
+		DummyResponseSink rs(os);
+		p.SetSink(rs);
+
+		static auto &g = Metrics::Global().AddGauge("test/player/gauge", "a test gauge");
+		g.Set(5);
+
+		WHEN("the gauge is read") {
+			THEN("its type and value are sent") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/stats/test/player/gauge"}).IsSuccess());
+				REQUIRE(os.str() == "RES /stats/test/player/gauge Gauge 5\n");
+			}
+		}
+
+		WHEN("a directory of metrics is read") {
+			THEN("it is listed, then its contents") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/stats/test/player"}).IsSuccess());
+				REQUIRE(os.str() == "RES /stats/test/player Directory 1\n"
+				                    "RES /stats/test/player/gauge Gauge 5\n");
+			}
+		}
+
+		WHEN("a metric that doesn't exist is read") {
+			THEN("the read fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"read", "tag", "/stats/test/nothing"}).IsSuccess());
+			}
+		}
+
+		WHEN("a metric is written") {
+			THEN("the write fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/stats/test/player/gauge", "1"}).IsSuccess());
+			}
+		}
+
+		WHEN("/stats itself is written or deleted") {
+			auto write = p.RunCommand(std::vector<std::string>{"write", "tag", "/stats", "1"});
+			auto del = p.RunCommand(std::vector<std::string>{"delete", "tag", "/stats"});
+
+			THEN("both fail, as the resource can't be changed") {
+				REQUIRE_FALSE(write.IsSuccess());
+				REQUIRE_FALSE(del.IsSuccess());
+
+				write.Emit(rs, std::vector<std::string>{"write"});
+				del.Emit(rs, std::vector<std::string>{"delete"});
+				REQUIRE(os.str() == "ACK FAIL 'cannot perform this action' write\n"
+				                    "ACK FAIL 'cannot perform this action' delete\n");
+			}
+		}
+
+		WHEN("a directory of metrics is written or deleted") {
+			auto write = p.RunCommand(std::vector<std::string>{"write", "tag", "/stats/test/player", "1"});
+			auto del = p.RunCommand(std::vector<std::string>{"delete", "tag", "/stats/test/player"});
+
+			THEN("both fail, as the resource can't be changed") {
+				REQUIRE_FALSE(write.IsSuccess());
+				REQUIRE_FALSE(del.IsSuccess());
+
+				write.Emit(rs, std::vector<std::string>{"write"});
+				REQUIRE(os.str() == "ACK FAIL 'cannot perform this action' write\n");
+			}
+		}
+
+		WHEN("a metric that doesn't exist is deleted") {
+			auto del = p.RunCommand(std::vector<std::string>{"delete", "tag", "/stats/test/nothing"});
+
+			THEN("the delete fails, as the resource isn't there") {
+				del.Emit(rs, std::vector<std::string>{"delete"});
+				REQUIRE(os.str() == "ACK FAIL 'not found' delete\n");
+			}
+		}
+	}
+}
+
+SCENARIO("Player exposes the Tracer under /control/trace", "[player][trace]") {
+	GIVEN("a fresh Player, and no tracing") {
+		AudioSystem ds(0);
+		Player p(ds);
+
+		std::ostringstream os;
+		DummyResponseSink rs(os);
+		p.SetSink(rs);
+
+		WHEN("the trace is read") {
+			THEN("it is disabled") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/control/trace"}).IsSuccess());
+				REQUIRE(os.str() == "RES /control/trace Entry Disabled\n");
+			}
+		}
+
+		WHEN("the trace is dumped") {
+			THEN("the dump fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/trace", "Dump"}).IsSuccess());
+			}
+		}
+
+		WHEN("something else is written to the trace") {
+			THEN("the write fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/trace", "Nonsense"}).IsSuccess());
+			}
+		}
+	}
+}
+
+/**
+ * Counts the lines of a response dump that start with a prefix.
+ * @param dump The dump, one response per line.
+ * @param prefix The prefix.
+ * @return The count.
+ */
+static size_t CountLines(const std::string &dump, const std::string &prefix)
+{
+	std::istringstream is(dump);
+	size_t count = 0;
+	for (std::string line; std::getline(is, line);) {
+		if (line.compare(0, prefix.size(), prefix) == 0) count++;
+	}
+	return count;
+}
+
+SCENARIO("Player runs transactions all at once, or not at all", "[player][transaction]") {
+	GIVEN("a Player playing one file") {
+		AudioSystem ds(0);
+		Player p(ds);
+
+		std::ostringstream os;
+		DummyResponseSink rs(os);
+		p.SetSink(rs);
+
+		ds.SetSink(&DummyAudioSink::Build);
+		ds.AddSource("mp3", &DummyAudioSource::Build);
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", "old.mp3"}, 1).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/time/elapsed", "1000000"}, 1).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Playing"}, 1).IsSuccess());
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"begin", "txn"}, 1).IsSuccess());
+		os.str("");
+
+		WHEN("a load, seek and stop are queued") {
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "a", "/player/file", "new.mp3"}, 1).IsSuccess());
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "b", "/player/time/elapsed", "2000000"}, 1).IsSuccess());
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "c", "/control/state", "Stopped"}, 1).IsSuccess());
+
+			THEN("nothing happens until the commit") {
+				REQUIRE(os.str() == "");
+			}
+
+			THEN("another client's commands still run at once") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/file"}, 2).IsSuccess());
+				REQUIRE(os.str() == "RES /player/file Entry old.mp3\n");
+			}
+
+			AND_WHEN("the transaction is committed") {
+				auto res = p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1);
+
+				THEN("it succeeds, and each change is announced once") {
+					REQUIRE(res.IsSuccess());
+					auto dump = os.str();
+					REQUIRE(CountLines(dump, "RES /player/file ") == 1);
+					REQUIRE(CountLines(dump, "RES /player/file Entry new.mp3") == 1);
+					REQUIRE(CountLines(dump, "RES /control/state ") == 1);
+					REQUIRE(CountLines(dump, "RES /control/state Entry Stopped") == 1);
+					REQUIRE(CountLines(dump, "RES /player/time/elapsed ") == 1);
+					REQUIRE(CountLines(dump, "RES /player/time/elapsed Entry 2000000") == 1);
+				}
+
+				THEN("the transaction is over") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1).IsSuccess());
+				}
+			}
+
+			AND_WHEN("the transaction is aborted") {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"abort", "txn"}, 1).IsSuccess());
+
+				THEN("nothing ran, and later commands run at once") {
+					REQUIRE(os.str() == "");
+					REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/file"}, 1).IsSuccess());
+					REQUIRE(os.str() == "RES /player/file Entry old.mp3\n");
+				}
+			}
+
+			AND_WHEN("the client goes away") {
+				p.ByeClient(1);
+
+				THEN("its transaction is forgotten") {
+					REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1).IsSuccess());
+					REQUIRE(os.str() == "");
+				}
+			}
+		}
+
+		WHEN("a command in the transaction fails") {
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "a", "/player/file", "new.mp3"}, 1).IsSuccess());
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "b", "/player/time/elapsed", "2000000"}, 1).IsSuccess());
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "c", "/control/state", "Nonsense"}, 1).IsSuccess());
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "d", "/control/state", "Stopped"}, 1).IsSuccess());
+			auto res = p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1);
+
+			THEN("the commit fails") {
+				REQUIRE_FALSE(res.IsSuccess());
+			}
+
+			THEN("the file, position and state are put back, and announced once") {
+				auto dump = os.str();
+				REQUIRE(CountLines(dump, "RES /player/file ") == 1);
+				REQUIRE(CountLines(dump, "RES /player/file Entry old.mp3") == 1);
+				REQUIRE(CountLines(dump, "RES /control/state ") == 1);
+				REQUIRE(CountLines(dump, "RES /control/state Entry Playing") == 1);
+				REQUIRE(CountLines(dump, "RES /player/time/elapsed Entry 1000000") == 1);
+			}
+		}
+
+		WHEN("a load in the transaction fails") {
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "a", "/player/file", "new.wav"}, 1).IsSuccess());
+			REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1).IsSuccess());
+
+			THEN("the old file is loaded again") {
+				os.str("");
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/file"}, 1).IsSuccess());
+				REQUIRE(os.str() == "RES /player/file Entry old.mp3\n");
+			}
+		}
+
+		WHEN("the transaction is begun again") {
+			THEN("the begin fails") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"begin", "txn"}, 1).IsSuccess());
+			}
+		}
+
+		WHEN("a malformed command is sent in the transaction") {
+			THEN("it is refused at once") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"write", "a", "/player/file"}, 1).IsSuccess());
+			}
+		}
+
+		WHEN("a quit, then a play, are sent in the transaction, and it is committed") {
+			auto quit = p.RunCommand(std::vector<std::string>{"write", "a", "/control/state", "Quitting"}, 1);
+			auto del = p.RunCommand(std::vector<std::string>{"delete", "b", "/control/state"}, 1);
+			auto play = p.RunCommand(std::vector<std::string>{"write", "c", "/control/state", "Playing"}, 1);
+			auto commit = p.RunCommand(std::vector<std::string>{"commit", "txn"}, 1);
+
+			THEN("the quits are refused at once, and the rest commits") {
+				REQUIRE_FALSE(quit.IsSuccess());
+				REQUIRE_FALSE(del.IsSuccess());
+				REQUIRE(play.IsSuccess());
+				REQUIRE(commit.IsSuccess());
+			}
+
+			THEN("the player keeps running, with its file loaded") {
+				os.str("");
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/player/file"}, 1).IsSuccess());
+				REQUIRE(os.str() == "RES /player/file Entry old.mp3\n");
+				REQUIRE(p.Update());
+			}
+		}
+
+		WHEN("the transaction is overfilled") {
+			for (size_t i = 0; i < Player::MAX_TRANSACTION_COMMANDS; i++) {
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "a", "/player/file"}, 1).IsSuccess());
+			}
+
+			THEN("the next command is refused") {
+				REQUIRE_FALSE(p.RunCommand(std::vector<std::string>{"read", "a", "/player/file"}, 1).IsSuccess());
+			}
+		}
+	}
+}
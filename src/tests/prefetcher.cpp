@@ -0,0 +1,96 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Prefetcher class.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../audio/prefetcher.hpp"
+
+/**
+ * Waits, for a while, for a Prefetcher to warm a file in the background.
+ * @param prefetcher The Prefetcher to watch.
+ * @param path The path of the file.
+ * @return Whether the file became warm.
+ */
+static bool WaitForWarm(Prefetcher &prefetcher, const std::string &path)
+{
+	for (int i = 0; i < 200; i++) {
+		if (prefetcher.IsWarm(path)) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+SCENARIO("Prefetcher tracks which files it has prewarmed", "[prefetcher]") {
+	GIVEN("a Prefetcher and a file") {
+		Prefetcher prefetcher(1024);
+
+		std::string path = "playd_test_prefetch.mp3";
+		{
+			std::ofstream f(path, std::ios::out | std::ios::trunc);
+			f << "some audio";
+		}
+
+		WHEN("nothing has been prewarmed") {
+			THEN("the file isn't warm") {
+				REQUIRE_FALSE(prefetcher.IsWarm(path));
+				REQUIRE(prefetcher.Warmed().empty());
+			}
+		}
+
+		WHEN("the file is prewarmed") {
+			prefetcher.Add(path);
+			bool warm = WaitForWarm(prefetcher, path);
+
+			THEN("it is warm, and listed once") {
+				REQUIRE(warm);
+				prefetcher.Add(path);
+				REQUIRE(prefetcher.Warmed().size() == 1);
+				REQUIRE(prefetcher.Warmed().at(0) == path);
+			}
+
+			AND_WHEN("the file changes") {
+				{
+					std::ofstream f(path, std::ios::out | std::ios::app);
+					f << ", and then some";
+				}
+
+				THEN("it is no longer warm") {
+					REQUIRE_FALSE(prefetcher.IsWarm(path));
+				}
+			}
+
+			AND_WHEN("the Prefetcher is cleared") {
+				prefetcher.Clear();
+
+				THEN("the file is no longer warm") {
+					REQUIRE_FALSE(prefetcher.IsWarm(path));
+					REQUIRE(prefetcher.Warmed().empty());
+				}
+			}
+		}
+
+		WHEN("a missing file is queued ahead of the file") {
+			prefetcher.Add("playd_test_nonexistent.mp3");
+			prefetcher.Add(path);
+
+			THEN("only the file becomes warm") {
+				REQUIRE(WaitForWarm(prefetcher, path));
+				REQUIRE_FALSE(prefetcher.IsWarm("playd_test_nonexistent.mp3"));
+				REQUIRE(prefetcher.Warmed().size() == 1);
+			}
+		}
+
+		std::remove(path.c_str());
+	}
+}
@@ -0,0 +1,105 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the RealTimeScope class.
+ */
+
+#include <cstdint>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "catch.hpp"
+
+#include "../audio/realtime.hpp"
+
+SCENARIO("RealTimeScope marks the current thread as real-time", "[realtime]") {
+	GIVEN("a thread outside any RealTimeScope") {
+		THEN("the thread is not real-time") {
+			REQUIRE_FALSE(RealTimeScope::Active());
+		}
+
+		WHEN("RealTimeScopes are nested") {
+			bool outer = false;
+			bool inner = false;
+			bool after_inner = false;
+			{
+				RealTimeScope a;
+				outer = RealTimeScope::Active();
+				{
+					RealTimeScope b;
+					inner = RealTimeScope::Active();
+				}
+				after_inner = RealTimeScope::Active();
+			}
+
+			THEN("the thread is real-time until the outermost ends") {
+				REQUIRE(outer);
+				REQUIRE(inner);
+				REQUIRE(after_inner);
+				REQUIRE_FALSE(RealTimeScope::Active());
+			}
+		}
+
+		WHEN("another thread is in a RealTimeScope") {
+			bool other = false;
+			bool here = true;
+			std::thread t([&other] {
+				RealTimeScope scope;
+				other = RealTimeScope::Active();
+			});
+			t.join();
+			here = RealTimeScope::Active();
+
+			THEN("only that thread is real-time") {
+				REQUIRE(other);
+				REQUIRE_FALSE(here);
+			}
+		}
+	}
+}
+
+#ifndef NDEBUG
+SCENARIO("RealTimeScope counts allocations in debug builds", "[realtime]") {
+	GIVEN("a thread") {
+		WHEN("the thread allocates twice") {
+			auto before = RealTimeScope::Allocations();
+			delete new int(1);
+			delete[] new char[16];
+			auto after = RealTimeScope::Allocations();
+
+			THEN("the count goes up by two") {
+				REQUIRE(after == before + 2);
+			}
+		}
+	}
+}
+#endif // NDEBUG
+
+#ifndef _WIN32
+SCENARIO("RealTime allocates memory on pages of its own", "[realtime]") {
+	GIVEN("two small allocations") {
+		auto a = static_cast<char *>(RealTime::Allocate(1));
+		auto b = static_cast<char *>(RealTime::Allocate(1));
+		auto page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+
+		THEN("each starts on a page boundary") {
+			auto a_offset = reinterpret_cast<std::uintptr_t>(a) % page;
+			auto b_offset = reinterpret_cast<std::uintptr_t>(b) % page;
+			REQUIRE(a_offset == 0);
+			REQUIRE(b_offset == 0);
+		}
+
+		THEN("they don't share a page") {
+			REQUIRE(a != b);
+		}
+
+		RealTime::Free(a);
+		RealTime::Free(b);
+	}
+}
+#endif // _WIN32
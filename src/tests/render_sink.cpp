@@ -0,0 +1,218 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the RenderFile and RenderAudioSink classes.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../audio/render_sink.hpp"
+#include "../errors.hpp"
+#include "dummy_audio_source.hpp"
+
+/// An AudioSource that decodes a few frames of counting bytes, then ends.
+class FiniteAudioSource : public DummyAudioSource
+{
+public:
+	/**
+	 * Constructs a FiniteAudioSource.
+	 * @param frames The number of frames to decode.
+	 */
+	explicit FiniteAudioSource(int frames)
+	    : DummyAudioSource("finite"), frames(frames)
+	{
+	}
+
+	AudioSource::DecodeResult Decode() override
+	{
+		if (this->frames == 0) {
+			return std::make_pair(DecodeState::END_OF_FILE, DecodeVector());
+		}
+		this->frames--;
+
+		// One frame is 4 samples of 2 channels of 32-bit samples.
+		DecodeVector frame(32);
+		for (size_t i = 0; i < frame.size(); i++) frame[i] = static_cast<std::uint8_t>(i);
+		return std::make_pair(DecodeState::DECODING, frame);
+	}
+
+	/// The number of frames still to decode.
+	int frames;
+};
+
+/**
+ * Reads a whole file.
+ * @param path The path of the file.
+ * @return The file's contents.
+ */
+static std::string Slurp(const std::string &path)
+{
+	std::ifstream f(path, std::ios::in | std::ios::binary);
+	std::stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+/**
+ * Reads a little-endian 32-bit integer from a string.
+ * @param s The string.
+ * @param pos The position of the integer.
+ * @return The integer.
+ */
+static std::uint32_t GetLE32(const std::string &s, size_t pos)
+{
+	std::uint32_t v = 0;
+	for (int i = 3; 0 <= i; i--) v = (v << 8) | static_cast<std::uint8_t>(s[pos + i]);
+	return v;
+}
+
+SCENARIO("RenderAudioSink writes what it is given while playing", "[render-sink]") {
+	GIVEN("a RenderAudioSink rendering to a raw file") {
+		auto path = "/tmp/playd_render_" + std::to_string(std::rand()) + ".raw";
+		DummyAudioSource src("dummy");
+		{
+			auto file = std::make_shared<RenderFile>(path);
+			RenderAudioSink sink(src, file);
+
+			AudioSource::DecodeVector samples(16, 7);
+
+			WHEN("samples are transferred while stopped") {
+				auto it = samples.begin();
+				sink.Transfer(it, samples.end());
+
+				THEN("none are taken") {
+					REQUIRE(it == samples.begin());
+					REQUIRE(sink.Position() == 0);
+				}
+			}
+
+			WHEN("samples are transferred while playing") {
+				sink.Start();
+				auto it = samples.begin();
+				sink.Transfer(it, samples.end());
+
+				THEN("all are taken, and the position advances") {
+					REQUIRE(it == samples.end());
+					REQUIRE(sink.Position() == 2);
+					REQUIRE(file->Bytes() == 16);
+					REQUIRE(sink.State() == Audio::State::PLAYING);
+				}
+
+				AND_WHEN("the source runs out") {
+					sink.SourceOut();
+
+					THEN("the sink is at the end at once") {
+						REQUIRE(sink.State() == Audio::State::AT_END);
+					}
+				}
+			}
+		}
+		std::remove(path.c_str());
+	}
+}
+
+SCENARIO("RenderFile writes WAV headers", "[render-sink]") {
+	GIVEN("a RenderAudioSink rendering to a WAV file") {
+		auto path = "/tmp/playd_render_" + std::to_string(std::rand()) + ".wav";
+		DummyAudioSource src("dummy");
+
+		WHEN("a frame is rendered, and the sink goes away") {
+			{
+				auto file = std::make_shared<RenderFile>(path);
+				RenderAudioSink sink(src, file);
+				sink.Start();
+
+				AudioSource::DecodeVector samples(24, 1);
+				auto it = samples.begin();
+				sink.Transfer(it, samples.end());
+			}
+			auto wav = Slurp(path);
+
+			THEN("the file is a complete 32-bit stereo WAV") {
+				REQUIRE(wav.size() == 44 + 24);
+				REQUIRE(wav.compare(0, 4, "RIFF") == 0);
+				REQUIRE(GetLE32(wav, 4) == 36 + 24);
+				REQUIRE(wav.compare(8, 8, "WAVEfmt ") == 0);
+				REQUIRE(GetLE32(wav, 24) == 44100);
+				REQUIRE(GetLE32(wav, 28) == 44100 * 8);
+				REQUIRE(wav.compare(36, 4, "data") == 0);
+				REQUIRE(GetLE32(wav, 40) == 24);
+				REQUIRE(wav[44] == 1);
+			}
+			std::remove(path.c_str());
+		}
+	}
+}
+
+SCENARIO("PipeAudio renders as fast as it can decode", "[render-sink]") {
+	GIVEN("a PipeAudio with a finite source and a RenderAudioSink") {
+		auto path = "/tmp/playd_render_" + std::to_string(std::rand()) + ".raw";
+		{
+			std::unique_ptr<AudioSource> src(new FiniteAudioSource(100));
+			auto file = std::make_shared<RenderFile>(path);
+			auto sink = RenderAudioSink::Build(*src, file);
+			PipeAudio pa(std::move(src), std::move(sink));
+
+			WHEN("the audio is played, and updated once") {
+				pa.SetPlaying(true);
+				auto state = pa.Update();
+
+				THEN("the whole source is rendered") {
+					REQUIRE(state == Audio::State::AT_END);
+					REQUIRE(file->Bytes() == 100 * 32);
+					// 400 samples, in microseconds.
+					REQUIRE(pa.Position() == 400 * 1000000 / 44100);
+				}
+			}
+
+			WHEN("the audio is updated, but not played") {
+				auto state = pa.Update();
+
+				THEN("nothing is rendered") {
+					REQUIRE(state == Audio::State::STOPPED);
+					REQUIRE(file->Bytes() == 0);
+				}
+			}
+		}
+		std::remove(path.c_str());
+	}
+}
+
+SCENARIO("RenderFile refuses sources of a different format", "[render-sink]") {
+	GIVEN("a RenderFile bound to one source") {
+		auto path = "/tmp/playd_render_" + std::to_string(std::rand()) + ".raw";
+		{
+			RenderFile file(path);
+			DummyAudioSource src("dummy");
+			file.Bind(src);
+
+			WHEN("a source with another sample format is bound") {
+				class Other : public DummyAudioSource
+				{
+				public:
+					Other() : DummyAudioSource("other") {}
+					SampleFormat OutputSampleFormat() const override
+					{
+						return SampleFormat::PACKED_SIGNED_INT_16;
+					}
+				} other;
+
+				THEN("the bind fails") {
+					REQUIRE_THROWS_AS(file.Bind(other), FileError);
+				}
+			}
+		}
+		std::remove(path.c_str());
+	}
+}
@@ -0,0 +1,113 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the SdlAudioSink buffer and clock calculations.
+ */
+
+#include <cstdint>
+
+#include "catch.hpp"
+
+#include "../audio/audio_sink.hpp"
+
+SCENARIO("SdlAudioSink sizes its ring buffer to meet the requested latency", "[sdl-audio-sink]") {
+	WHEN("the default buffer length is requested at common sample rates") {
+		THEN("the ring buffer holds 2^16 samples") {
+			REQUIRE(SdlAudioSink::RingPower(44100, SdlAudioSink::DEFAULT_BUFFER_MS, 0) == 16);
+			REQUIRE(SdlAudioSink::RingPower(48000, SdlAudioSink::DEFAULT_BUFFER_MS, 0) == 16);
+		}
+	}
+
+	WHEN("a buffer length is requested") {
+		THEN("the ring buffer is the smallest power of two holding that much audio") {
+			// 20ms at 48kHz is 960 samples.
+			REQUIRE(SdlAudioSink::RingPower(48000, 20, 0) == 10);
+			// 3s at 44.1kHz is 132300 samples.
+			REQUIRE(SdlAudioSink::RingPower(44100, 3000, 0) == 18);
+			// Exactly 2^12 samples needs no rounding.
+			REQUIRE(SdlAudioSink::RingPower(4096, 1000, 0) == 12);
+		}
+	}
+
+	WHEN("the buffer length is shorter than two device periods") {
+		THEN("the ring buffer holds two periods") {
+			REQUIRE(SdlAudioSink::RingPower(48000, 20, 2048) == 12);
+		}
+	}
+
+	WHEN("an absurd buffer length is requested") {
+		THEN("the ring buffer size is clamped") {
+			REQUIRE(SdlAudioSink::RingPower(48000, 1, 0) == 8);
+			REQUIRE(SdlAudioSink::RingPower(192000, 4000000, 0) == 24);
+		}
+	}
+}
+
+SCENARIO("SdlAudioSink rounds device periods to powers of two", "[sdl-audio-sink]") {
+	WHEN("no period is requested") {
+		THEN("SDL is left to choose") {
+			REQUIRE(SdlAudioSink::PeriodFrames(44100, 0) == 0);
+		}
+	}
+
+	WHEN("a period is requested") {
+		THEN("it is rounded up to a power of two samples") {
+			// 10ms at 48kHz is 480 samples.
+			REQUIRE(SdlAudioSink::PeriodFrames(48000, 10) == 512);
+			// 1ms at 44.1kHz is 44.1 samples.
+			REQUIRE(SdlAudioSink::PeriodFrames(44100, 1) == 64);
+		}
+	}
+
+	WHEN("an absurd period is requested") {
+		THEN("it is clamped to what SDL can express") {
+			REQUIRE(SdlAudioSink::PeriodFrames(48000, 100000) == 32768);
+		}
+	}
+}
+
+SCENARIO("SdlAudioSink interpolates its playback clock", "[sdl-audio-sink]") {
+	GIVEN("a running clock at 1000Hz, with 500 samples heard at time 1s") {
+		const std::int64_t second = 1000000000;
+		SdlAudioSink::Clock clock{500, 400, 1000, second, true};
+
+		WHEN("the clock is read at the time of the snapshot") {
+			THEN("the position is the snapshot's") {
+				REQUIRE(SdlAudioSink::Interpolate(clock, second, 1000) == 500);
+			}
+		}
+
+		WHEN("the clock is read later") {
+			THEN("the position advances at the sample rate") {
+				REQUIRE(SdlAudioSink::Interpolate(clock, second + second / 4, 1000) == 750);
+				// Fractions of a sample are rounded down.
+				REQUIRE(SdlAudioSink::Interpolate(clock, second + 1500000, 1000) == 501);
+			}
+
+			THEN("the position never passes what was handed to the device") {
+				REQUIRE(SdlAudioSink::Interpolate(clock, 3 * second, 1000) == 1000);
+			}
+		}
+
+		WHEN("the snapshot says nothing was audible yet") {
+			clock.base = -200;
+			clock.floor = 0;
+
+			THEN("the position stays at the floor until the audio is heard") {
+				REQUIRE(SdlAudioSink::Interpolate(clock, second, 1000) == 0);
+				REQUIRE(SdlAudioSink::Interpolate(clock, second + second / 10, 1000) == 0);
+				REQUIRE(SdlAudioSink::Interpolate(clock, second + second / 2, 1000) == 300);
+			}
+		}
+
+		WHEN("the clock is stopped") {
+			clock.running = false;
+
+			THEN("the position doesn't advance") {
+				REQUIRE(SdlAudioSink::Interpolate(clock, 2 * second, 1000) == 500);
+			}
+		}
+	}
+}
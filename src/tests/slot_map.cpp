@@ -0,0 +1,98 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the SlotMap class template.
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../slot_map.hpp"
+
+SCENARIO("SlotMap hands out IDs that find their values", "[slot-map]") {
+	GIVEN("an empty SlotMap") {
+		SlotMap<std::string> m;
+
+		THEN("it is empty") {
+			REQUIRE(m.Empty());
+			REQUIRE(m.Size() == 0);
+			REQUIRE(m.begin() == m.end());
+		}
+
+		THEN("ID 0 finds nothing") {
+			REQUIRE(m.Find(0) == nullptr);
+		}
+
+		WHEN("values are inserted") {
+			auto next = m.NextID();
+			auto a = m.Insert("a");
+			auto b = m.Insert("b");
+			auto c = m.Insert("c");
+
+			THEN("NextID() predicted the first ID") {
+				REQUIRE(a == next);
+			}
+
+			THEN("the IDs are distinct and non-zero") {
+				REQUIRE(a != 0);
+				REQUIRE(a != b);
+				REQUIRE(b != c);
+				REQUIRE(a != c);
+			}
+
+			THEN("the IDs find their values") {
+				REQUIRE(*m.Find(a) == "a");
+				REQUIRE(*m.Find(b) == "b");
+				REQUIRE(*m.Find(c) == "c");
+				REQUIRE(m.Size() == 3);
+			}
+
+			AND_WHEN("a value in the middle is erased") {
+				REQUIRE(m.Erase(b));
+
+				THEN("its ID finds nothing") {
+					REQUIRE(m.Find(b) == nullptr);
+					REQUIRE_FALSE(m.Erase(b));
+				}
+
+				THEN("the other IDs still find their values") {
+					REQUIRE(*m.Find(a) == "a");
+					REQUIRE(*m.Find(c) == "c");
+				}
+
+				THEN("iteration only sees live values") {
+					std::vector<std::string> seen(m.begin(), m.end());
+					std::sort(seen.begin(), seen.end());
+					REQUIRE(seen == (std::vector<std::string>{"a", "c"}));
+				}
+
+				AND_WHEN("another value is inserted") {
+					auto d = m.Insert("d");
+
+					THEN("it reuses the slot under a fresh ID") {
+						REQUIRE(d != b);
+						REQUIRE(m.Find(b) == nullptr);
+						REQUIRE(*m.Find(d) == "d");
+						REQUIRE(m.Size() == 3);
+					}
+				}
+			}
+
+			AND_WHEN("everything is erased") {
+				REQUIRE(m.Erase(a));
+				REQUIRE(m.Erase(c));
+				REQUIRE(m.Erase(b));
+
+				THEN("it is empty again") {
+					REQUIRE(m.Empty());
+					REQUIRE(m.begin() == m.end());
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the SpscQueue class template.
+ */
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../spsc_queue.hpp"
+
+SCENARIO("SpscQueue hands values over in order", "[spsc-queue]") {
+	GIVEN("an empty SpscQueue") {
+		SpscQueue<std::string> q;
+		std::string value;
+
+		THEN("nothing can be popped") {
+			REQUIRE_FALSE(q.Pop(value));
+		}
+
+		WHEN("values are pushed") {
+			q.Push("a");
+			q.Push("b");
+
+			THEN("they are popped in the order they were pushed") {
+				REQUIRE(q.Pop(value));
+				REQUIRE(value == "a");
+				REQUIRE(q.Pop(value));
+				REQUIRE(value == "b");
+				REQUIRE_FALSE(q.Pop(value));
+			}
+		}
+
+		WHEN("values are pushed but never popped") {
+			auto shared = std::make_shared<int>(0);
+			{
+				SpscQueue<std::shared_ptr<int>> p;
+				p.Push(shared);
+				p.Push(shared);
+				REQUIRE(shared.use_count() == 3);
+			}
+
+			THEN("destroying the queue destroys them") {
+				REQUIRE(shared.use_count() == 1);
+			}
+		}
+	}
+
+	GIVEN("a producer thread and a consumer thread") {
+		SpscQueue<int> q;
+		const int count = 100000;
+
+		WHEN("the producer pushes while the consumer pops") {
+			std::thread producer([&q, count] {
+				for (int i = 0; i < count; i++) q.Push(i);
+			});
+
+			bool ordered = true;
+			int expected = 0;
+			while (expected < count) {
+				int value;
+				if (!q.Pop(value)) continue;
+				if (value != expected) ordered = false;
+				expected++;
+			}
+			producer.join();
+
+			THEN("every value arrives, in order") {
+				REQUIRE(ordered);
+				int value;
+				REQUIRE_FALSE(q.Pop(value));
+			}
+		}
+	}
+}
@@ -0,0 +1,116 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the StatusPage class.
+ */
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "../audio/audio.hpp"
+#include "../status_page.hpp"
+
+/// Makes a shared memory name no other test run will use.
+static std::string PageName()
+{
+	return "/playd_test_" + std::to_string(getpid());
+}
+
+SCENARIO("StatusPage publishes the player's status", "[status-page]") {
+	GIVEN("a fresh StatusPage") {
+		StatusPage page(PageName());
+		auto &layout = page.Page();
+
+		THEN("the header is filled in") {
+			REQUIRE(layout.magic == StatusPage::MAGIC);
+			REQUIRE(layout.version == StatusPage::VERSION);
+		}
+
+		THEN("it says nothing is loaded") {
+			auto snap = StatusPage::Read(layout);
+			REQUIRE(snap.state == Audio::State::NONE);
+			REQUIRE(snap.path.empty());
+			REQUIRE(snap.rate == 0);
+			REQUIRE_FALSE(snap.playing);
+		}
+
+		WHEN("a status is published") {
+			auto before = StatusPage::Read(layout).counter;
+			page.Publish(Audio::State::PLAYING, "/music/a.mp3", 44100,
+			             44100);
+			auto snap = StatusPage::Read(layout);
+
+			THEN("readers see it") {
+				REQUIRE(snap.state == Audio::State::PLAYING);
+				REQUIRE(snap.path == "/music/a.mp3");
+				REQUIRE(snap.position == 44100);
+				REQUIRE(snap.rate == 44100);
+				REQUIRE(snap.playing);
+			}
+
+			THEN("the counter goes up") {
+				REQUIRE(snap.counter == before + 1);
+			}
+
+			AND_WHEN("a position is published") {
+				REQUIRE(page.PublishPosition(88200, 1234));
+				auto moved = StatusPage::Read(layout);
+
+				THEN("only the position and its time change") {
+					REQUIRE(moved.position == 88200);
+					REQUIRE(moved.stamp == 1234);
+					REQUIRE(moved.path == "/music/a.mp3");
+					REQUIRE(moved.state == Audio::State::PLAYING);
+				}
+			}
+
+			AND_WHEN("a shorter path is published") {
+				page.Publish(Audio::State::STOPPED, "/b.wav", 0,
+				             48000);
+
+				THEN("none of the old path is left") {
+					auto moved = StatusPage::Read(layout);
+					REQUIRE(moved.path == "/b.wav");
+				}
+			}
+		}
+	}
+
+	GIVEN("a StatusPage being written by another thread") {
+		StatusPage page(PageName());
+		std::atomic<bool> done(false);
+
+		WHEN("a reader reads it throughout") {
+			// Position and stamp always move together, so any torn
+			// read shows up as a mismatch.
+			std::thread callback([&page, &done] {
+				for (std::uint64_t i = 1; i <= 100000; i++) {
+					auto stamp = static_cast<std::int64_t>(i);
+					page.PublishPosition(i, stamp);
+				}
+				done = true;
+			});
+
+			bool consistent = true;
+			while (!done) {
+				auto snap = StatusPage::Read(page.Page());
+				auto stamp = static_cast<std::uint64_t>(snap.stamp);
+				if (snap.position != 0 && snap.position != stamp) {
+					consistent = false;
+				}
+			}
+			callback.join();
+
+			THEN("every read is consistent") {
+				REQUIRE(consistent);
+			}
+		}
+	}
+}
@@ -0,0 +1,55 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Definition of the SteppedDriver class.
+ * @see tests/stepped_driver.hpp
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+
+#include "../io.hpp"
+#include "../player.hpp"
+#include "stepped_driver.hpp"
+#include "virtual_clock_sink.hpp"
+
+const std::uint64_t SteppedDriver::DEFAULT_PERIOD =
+        IoCore::PLAYER_UPDATE_PERIOD * 1000;
+
+SteppedDriver::SteppedDriver(Player &player, VirtualClock &clock,
+                             std::uint64_t period)
+    : player(player), clock(clock), period(period)
+{
+	assert(0 < this->period);
+}
+
+bool SteppedDriver::Step()
+{
+	this->clock.Advance(this->period);
+
+	// This is IoCore::UpdatePlayer, less the connections to flush.
+	return this->player.Update();
+}
+
+std::uint64_t SteppedDriver::Run(std::uint64_t micros)
+{
+	std::uint64_t steps = 0;
+	for (std::uint64_t t = 0; t < micros; t += this->period) {
+		steps++;
+		if (!this->Step()) break;
+	}
+	return steps;
+}
+
+bool SteppedDriver::RunUntil(const std::function<bool()> &done,
+                             std::uint64_t limit)
+{
+	for (std::uint64_t t = 0; t < limit; t += this->period) {
+		if (done()) return true;
+		if (!this->Step()) break;
+	}
+	return done();
+}
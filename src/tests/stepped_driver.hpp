@@ -0,0 +1,78 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the SteppedDriver class.
+ * @see tests/stepped_driver.cpp
+ */
+
+#ifndef PLAYD_TESTS_STEPPED_DRIVER_HPP
+#define PLAYD_TESTS_STEPPED_DRIVER_HPP
+
+#include <cstdint>
+#include <functional>
+
+#include "../player.hpp"
+#include "virtual_clock_sink.hpp"
+
+/**
+ * Drives a Player's updates by hand, in virtual time.
+ *
+ * Each step moves a VirtualClock on by one update period, then updates the
+ * Player, just as IoCore's update timer would have done after that long.
+ * Hours of playback thus take as long as their updates take to run.
+ */
+class SteppedDriver
+{
+public:
+	/**
+	 * Constructs a SteppedDriver.
+	 * @param player The Player to update.
+	 * @param clock The clock to move on before each update.
+	 * @param period The update period, in microseconds; IoCore's, unless
+	 *   given.
+	 */
+	SteppedDriver(Player &player, VirtualClock &clock,
+	              std::uint64_t period = DEFAULT_PERIOD);
+
+	/// Deleted copy constructor.
+	SteppedDriver(const SteppedDriver &) = delete;
+
+	/// Deleted copy-assignment.
+	SteppedDriver &operator=(const SteppedDriver &) = delete;
+
+	/// IoCore's update period, in microseconds.
+	static const std::uint64_t DEFAULT_PERIOD;
+
+	/**
+	 * Moves the clock on one period, and updates the Player.
+	 * @return Whether the Player is still running.
+	 */
+	bool Step();
+
+	/**
+	 * Steps until at least a given length of virtual time has passed, or
+	 * the Player stops running.
+	 * @param micros The length of time, in microseconds.
+	 * @return The number of steps taken.
+	 */
+	std::uint64_t Run(std::uint64_t micros);
+
+	/**
+	 * Steps until a condition holds, or too long passes.
+	 * The condition is checked before each step.
+	 * @param done The condition.
+	 * @param limit The most virtual time to step through, in
+	 *   microseconds.
+	 * @return Whether the condition came to hold.
+	 */
+	bool RunUntil(const std::function<bool()> &done, std::uint64_t limit);
+
+private:
+	Player &player;       ///< The Player to update.
+	VirtualClock &clock;  ///< The clock to move on.
+	std::uint64_t period; ///< The update period, in microseconds.
+};
+
+#endif // PLAYD_TESTS_STEPPED_DRIVER_HPP
@@ -0,0 +1,152 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Subscriptions class.
+ */
+
+#include <chrono>
+#include <string>
+
+#include "catch.hpp"
+
+#include "../response.hpp"
+#include "../subscriptions.hpp"
+
+SCENARIO("Subscriptions parse intervals", "[subscriptions]") {
+	std::chrono::milliseconds ms(0);
+
+	WHEN("the interval is a bare number") {
+		THEN("it is in milliseconds") {
+			REQUIRE(Subscriptions::ParseInterval("50", ms));
+			REQUIRE(ms.count() == 50);
+		}
+	}
+
+	WHEN("the interval has a unit") {
+		THEN("the unit is respected") {
+			REQUIRE(Subscriptions::ParseInterval("50ms", ms));
+			REQUIRE(ms.count() == 50);
+			REQUIRE(Subscriptions::ParseInterval("2s", ms));
+			REQUIRE(ms.count() == 2000);
+		}
+	}
+
+	WHEN("the interval is malformed") {
+		THEN("it is rejected") {
+			REQUIRE_FALSE(Subscriptions::ParseInterval("", ms));
+			REQUIRE_FALSE(Subscriptions::ParseInterval("ms", ms));
+			REQUIRE_FALSE(Subscriptions::ParseInterval("-5ms", ms));
+			REQUIRE_FALSE(Subscriptions::ParseInterval("5 ms", ms));
+			REQUIRE_FALSE(Subscriptions::ParseInterval("5h", ms));
+			REQUIRE_FALSE(Subscriptions::ParseInterval("12345678901", ms));
+		}
+	}
+}
+
+SCENARIO("Subscriptions filter broadcasts", "[subscriptions]") {
+	GIVEN("some Subscriptions") {
+		Subscriptions s;
+		auto state = Response::Res("Entry", "/control/state", "Playing");
+		auto time = Response::Res("Entry", "/player/time/elapsed", "0");
+		auto end = Response(Response::Code::END);
+
+		WHEN("nothing is watched") {
+			THEN("everything is delivered") {
+				REQUIRE(s.Offer(*state));
+				REQUIRE(s.Offer(*time));
+				REQUIRE(s.Offer(end));
+			}
+		}
+
+		WHEN("a subtree is watched without an interval") {
+			s.Watch("/control", std::chrono::milliseconds(0));
+
+			THEN("only resources inside it are delivered") {
+				REQUIRE(s.Offer(*state));
+				REQUIRE_FALSE(s.Offer(*time));
+			}
+
+			THEN("non-resources are still delivered") {
+				REQUIRE(s.Offer(end));
+			}
+
+			THEN("samples are ignored") {
+				s.OfferSample(*state);
+				REQUIRE(s.Due(Subscriptions::Clock::now()).empty());
+			}
+
+			AND_WHEN("it is unwatched") {
+				REQUIRE(s.Unwatch("/control"));
+
+				THEN("everything is delivered again") {
+					REQUIRE(s.Offer(*time));
+				}
+
+				THEN("it can't be unwatched twice") {
+					REQUIRE_FALSE(s.Unwatch("/control"));
+				}
+			}
+		}
+
+		WHEN("the root is watched") {
+			s.Watch("/", std::chrono::milliseconds(0));
+
+			THEN("everything is delivered") {
+				REQUIRE(s.Offer(*state));
+				REQUIRE(s.Offer(*time));
+			}
+		}
+
+		WHEN("a path that is only a prefix of a resource is watched") {
+			s.Watch("/control/st", std::chrono::milliseconds(0));
+
+			THEN("the resource is not delivered") {
+				REQUIRE_FALSE(s.Offer(*state));
+			}
+		}
+	}
+}
+
+SCENARIO("Subscriptions coalesce resources watched with an interval", "[subscriptions]") {
+	GIVEN("Subscriptions watching the time every 50ms, and the state immediately") {
+		Subscriptions s;
+		s.Watch("/player/time", std::chrono::milliseconds(50));
+		s.Watch("/control", std::chrono::milliseconds(0));
+
+		auto start = Subscriptions::Clock::now();
+
+		WHEN("several samples arrive") {
+			s.OfferSample(*Response::Res("Entry", "/player/time/elapsed", "1"));
+			s.OfferSample(*Response::Res("Entry", "/player/time/elapsed", "2"));
+			auto state = Response::Res("Entry", "/control/state", "Playing");
+
+			THEN("they are held back, but other watches are unaffected") {
+				REQUIRE_FALSE(s.Offer(*Response::Res("Entry", "/player/time/elapsed", "3")));
+				REQUIRE(s.Offer(*state));
+			}
+
+			THEN("only the latest is delivered when due") {
+				auto due = s.Due(start);
+				REQUIRE(due.size() == 1);
+				REQUIRE(due.at(0).Pack() == "RES /player/time/elapsed Entry 2");
+
+				AND_THEN("nothing more is due until the interval passes") {
+					s.OfferSample(*Response::Res("Entry", "/player/time/elapsed", "4"));
+					REQUIRE(s.Due(start + std::chrono::milliseconds(49)).empty());
+
+					due = s.Due(start + std::chrono::milliseconds(50));
+					REQUIRE(due.size() == 1);
+					REQUIRE(due.at(0).Pack() == "RES /player/time/elapsed Entry 4");
+				}
+			}
+		}
+
+		WHEN("nothing has changed") {
+			THEN("nothing is due") {
+				REQUIRE(s.Due(start).empty());
+			}
+		}
+	}
+}
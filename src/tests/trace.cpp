@@ -0,0 +1,140 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the Tracer and TraceSpan classes.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../errors.hpp"
+#include "../trace.hpp"
+
+/**
+ * Counts the occurrences of a string in another.
+ * @param haystack The string to search.
+ * @param needle The string to count.
+ * @return The number of occurrences.
+ */
+static size_t Occurrences(const std::string &haystack, const std::string &needle)
+{
+	size_t count = 0;
+	for (auto pos = haystack.find(needle); pos != std::string::npos;
+	     pos = haystack.find(needle, pos + 1)) {
+		count++;
+	}
+	return count;
+}
+
+SCENARIO("A disabled Tracer records nothing", "[trace]") {
+	GIVEN("a fresh Tracer") {
+		Tracer t;
+
+		WHEN("a span is traced") {
+			{
+				TraceSpan span("test", t);
+			}
+
+			THEN("the trace is empty") {
+				std::string out;
+				REQUIRE(t.Chrome(out) == 0);
+				REQUIRE(out.find("\"test\"") == std::string::npos);
+			}
+
+			THEN("it can't be dumped") {
+				REQUIRE_THROWS_AS(t.Dump(), FileError);
+			}
+		}
+	}
+}
+
+SCENARIO("An enabled Tracer records spans per thread", "[trace]") {
+	GIVEN("an enabled Tracer") {
+		auto path = "/tmp/playd_trace_" + std::to_string(std::rand()) + ".json";
+		Tracer t;
+		t.Enable(path);
+
+		WHEN("spans are traced on two threads") {
+			t.NameThread("first");
+			{
+				TraceSpan span("one", t);
+			}
+			std::thread other([&t] {
+				t.NameThread("second");
+				TraceSpan span("two", t);
+			});
+			other.join();
+
+			THEN("both are in the trace, as complete events") {
+				std::string out;
+				REQUIRE(t.Chrome(out) == 2);
+				REQUIRE(out.compare(0, 15, "{\"traceEvents\":") == 0);
+				REQUIRE(Occurrences(out, "\"ph\":\"X\"") == 2);
+				REQUIRE(out.find("\"name\":\"one\",\"ph\":\"X\",\"pid\":1,\"tid\":1,") != std::string::npos);
+				REQUIRE(out.find("\"name\":\"two\",\"ph\":\"X\",\"pid\":1,\"tid\":2,") != std::string::npos);
+			}
+
+			THEN("the threads are named") {
+				std::string out;
+				t.Chrome(out);
+				REQUIRE(out.find("\"tid\":1,\"args\":{\"name\":\"first\"}") != std::string::npos);
+				REQUIRE(out.find("\"tid\":2,\"args\":{\"name\":\"second\"}") != std::string::npos);
+			}
+
+			THEN("the trace can be dumped to its file") {
+				REQUIRE(t.Dump() == 2);
+
+				std::ifstream f(path);
+				std::stringstream ss;
+				ss << f.rdbuf();
+				std::string out;
+				t.Chrome(out);
+				REQUIRE(ss.str() == out);
+
+				std::remove(path.c_str());
+			}
+		}
+
+		WHEN("more threads than there are rings trace one after another") {
+			for (size_t i = 0; i < Tracer::MAX_THREADS * 2; i++) {
+				std::thread brief([&t] {
+					TraceSpan span("brief", t);
+				});
+				brief.join();
+			}
+			std::thread latest([&t] {
+				TraceSpan span("latest", t);
+			});
+			latest.join();
+
+			THEN("each exited thread's ring is reused, and nothing is dropped") {
+				std::string out;
+				t.Chrome(out);
+				REQUIRE(t.Dropped() == 0);
+				REQUIRE(out.find("\"name\":\"latest\"") != std::string::npos);
+			}
+		}
+
+		WHEN("more spans are traced than a ring holds") {
+			for (size_t i = 0; i < Tracer::CAPACITY + 10; i++) {
+				t.Record("many", i * 1000, 500);
+			}
+
+			THEN("only the newest are kept") {
+				// The oldest might be mid-overwrite, so isn't dumped.
+				std::string out;
+				REQUIRE(t.Chrome(out) == Tracer::CAPACITY - 1);
+				REQUIRE(out.find("\"ts\":10.000,") == std::string::npos);
+				REQUIRE(out.find("\"ts\":11.000,\"dur\":0.500") != std::string::npos);
+			}
+		}
+	}
+}
@@ -0,0 +1,114 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for the UnderrunMonitor class.
+ */
+
+#include "catch.hpp"
+
+#include "../audio/underrun.hpp"
+
+/// One millisecond, in nanoseconds.
+static const std::int64_t MS = 1000000;
+
+SCENARIO("UnderrunMonitor counts underruns", "[underrun]") {
+	GIVEN("an UnderrunMonitor that resumes at once") {
+		UnderrunMonitor m;
+
+		WHEN("the buffer is empty before anything has played") {
+			auto n = m.Playable(0, 10, false, 0);
+
+			THEN("nothing plays, but it isn't an underrun") {
+				REQUIRE(n == 0);
+				REQUIRE(m.Count() == 0);
+			}
+		}
+
+		WHEN("the buffer runs short after playing, then recovers") {
+			REQUIRE(m.Playable(10, 10, false, 0) == 10);
+			REQUIRE(m.Playable(4, 10, false, 5 * MS) == 4);
+			REQUIRE(m.Playable(0, 10, false, 10 * MS) == 0);
+
+			THEN("it counts as one underrun while in progress") {
+				REQUIRE(m.Count() == 1);
+				REQUIRE(m.Take().empty());
+			}
+
+			AND_WHEN("the buffer fills again") {
+				REQUIRE(m.Playable(10, 10, false, 15 * MS) == 10);
+
+				THEN("the underrun is finished, with its start and length") {
+					REQUIRE(m.Count() == 1);
+					REQUIRE(m.Total() == 10000);
+
+					auto underruns = m.Take();
+					REQUIRE(underruns.size() == 1);
+					REQUIRE(underruns[0].stamp == 5000);
+					REQUIRE(underruns[0].duration == 10000);
+					REQUIRE(m.Take().empty());
+				}
+			}
+		}
+
+		WHEN("the source runs out") {
+			REQUIRE(m.Playable(10, 10, false, 0) == 10);
+			REQUIRE(m.Playable(4, 10, true, MS) == 4);
+			REQUIRE(m.Playable(0, 10, true, 2 * MS) == 0);
+
+			THEN("running short isn't an underrun") {
+				REQUIRE(m.Count() == 0);
+			}
+		}
+
+		WHEN("the monitor is reset during an underrun") {
+			m.Playable(10, 10, false, 0);
+			m.Playable(0, 10, false, MS);
+			m.Reset(3 * MS);
+
+			THEN("the underrun finishes there") {
+				auto underruns = m.Take();
+				REQUIRE(underruns.size() == 1);
+				REQUIRE(underruns[0].duration == 2000);
+			}
+
+			THEN("an empty buffer isn't an underrun until something plays") {
+				m.Playable(0, 10, false, 4 * MS);
+				REQUIRE(m.Count() == 1);
+			}
+		}
+
+		WHEN("more underruns finish than the history holds") {
+			std::int64_t now = 0;
+			for (size_t i = 0; i < UnderrunMonitor::HISTORY + 4; i++) {
+				m.Playable(10, 10, false, now += MS);
+				m.Playable(0, 10, false, now += MS);
+			}
+			m.Playable(10, 10, false, now += MS);
+
+			THEN("all are counted, but only the latest are taken") {
+				REQUIRE(m.Count() == UnderrunMonitor::HISTORY + 4);
+				auto underruns = m.Take();
+				REQUIRE(underruns.size() == UnderrunMonitor::HISTORY);
+				REQUIRE(underruns.back().stamp == (now - MS) / 1000);
+			}
+		}
+	}
+
+	GIVEN("an UnderrunMonitor that rebuffers to 8 samples") {
+		UnderrunMonitor m(8);
+		m.Playable(10, 10, false, 0);
+
+		WHEN("the buffer runs short") {
+			REQUIRE(m.Playable(4, 10, false, MS) == 4);
+
+			THEN("nothing plays until 8 samples are buffered") {
+				REQUIRE(m.Playable(2, 10, false, 2 * MS) == 0);
+				REQUIRE(m.Playable(7, 10, false, 3 * MS) == 0);
+				REQUIRE(m.Playable(8, 10, false, 4 * MS) == 8);
+				REQUIRE(m.Count() == 1);
+			}
+		}
+	}
+}
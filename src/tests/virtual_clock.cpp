@@ -0,0 +1,344 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Tests for playback in virtual time, using VirtualClockAudioSink and
+ * SteppedDriver.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "../audio/audio_system.hpp"
+#include "../errors.hpp"
+#include "../messages.h"
+#include "../player.hpp"
+#include "../response.hpp"
+#include "dummy_audio_source.hpp"
+#include "stepped_driver.hpp"
+#include "virtual_clock_sink.hpp"
+
+/// The sample rate of LongAudioSource, in Hz.
+static const std::uint32_t LONG_RATE = 8000;
+
+/// An AudioSource of mono, 8-bit silence, decoded a second at a time.
+class LongAudioSource : public DummyAudioSource
+{
+public:
+	/**
+	 * Constructs a LongAudioSource.
+	 * @param path The path of the file this LongAudioSource 'represents'.
+	 * @param seconds The length of the file, in seconds.
+	 * @param stalled If not nullptr, while this is true, decoding gives
+	 *   nothing, as a decoder waiting on a slow disk would.
+	 */
+	LongAudioSource(const std::string &path, std::uint64_t seconds,
+	                const bool *stalled = nullptr)
+	    : DummyAudioSource(path),
+	      length(seconds * LONG_RATE),
+	      stalled(stalled)
+	{
+		this->position = 0;
+	}
+
+	AudioSource::DecodeResult Decode() override
+	{
+		if (this->length <= this->position) {
+			return std::make_pair(DecodeState::END_OF_FILE, DecodeVector());
+		}
+		if (this->stalled != nullptr && *this->stalled) {
+			return std::make_pair(DecodeState::DECODING, DecodeVector());
+		}
+
+		auto count = std::min<std::uint64_t>(LONG_RATE, this->length - this->position);
+		this->position += count;
+		return std::make_pair(DecodeState::DECODING, DecodeVector(count, 0));
+	}
+
+	std::uint8_t ChannelCount() const override
+	{
+		return 1;
+	}
+
+	std::uint32_t SampleRate() const override
+	{
+		return LONG_RATE;
+	}
+
+	SampleFormat OutputSampleFormat() const override
+	{
+		return SampleFormat::PACKED_UNSIGNED_INT_8;
+	}
+
+	std::uint64_t Seek(std::uint64_t position) override
+	{
+		if (this->length < position) throw SeekError(MSG_SEEK_FAIL);
+		this->position = position;
+		return this->position;
+	}
+
+private:
+	std::uint64_t length;  ///< The length of the file, in samples.
+	const bool *stalled;   ///< Whether decoding is stalled, if given.
+};
+
+/// A ResponseSink that keeps every response it is sent, as lines.
+class RecordingResponseSink : public ResponseSink
+{
+public:
+	void Respond(const Response &response, size_t = 0) const override
+	{
+		this->lines.push_back(response.Pack());
+		if (this->lines.back() == "END") this->ends++;
+	}
+
+	/**
+	 * Gets the lines recorded so far with a given prefix.
+	 * @param prefix The prefix.
+	 * @return The matching lines, in order.
+	 */
+	std::vector<std::string> Lines(const std::string &prefix) const
+	{
+		std::vector<std::string> matches;
+		for (const auto &line : this->lines) {
+			if (line.compare(0, prefix.size(), prefix) == 0) matches.push_back(line);
+		}
+		return matches;
+	}
+
+	/// The lines recorded so far.
+	mutable std::vector<std::string> lines;
+
+	/// The number of END responses recorded so far.
+	mutable size_t ends = 0;
+};
+
+/// The prefix of a broadcast of the elapsed time.
+static const std::string ELAPSED = "RES /player/time/elapsed Entry ";
+
+SCENARIO("A two-hour file plays to the end in virtual time", "[virtual-clock]") {
+	GIVEN("a Player playing a two-hour file into a VirtualClockAudioSink") {
+		VirtualClock clock;
+		AudioSystem ds(0);
+		ds.SetSink([&clock](const AudioSource &src, int) {
+			return VirtualClockAudioSink::Build(src, clock, LONG_RATE);
+		});
+		ds.AddSource("mp3", [](const std::string &path) {
+			return std::unique_ptr<AudioSource>(new LongAudioSource(path, 2 * 60 * 60));
+		});
+
+		Player p(ds);
+		RecordingResponseSink rs;
+		p.SetSink(rs);
+
+		// Ten updates a second is plenty to keep a second's buffer full,
+		// and keeps two hours to 72000 updates.
+		SteppedDriver driver(p, clock, 100000);
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", "long.mp3"}).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Playing"}).IsSuccess());
+		rs.lines.clear();
+
+		WHEN("the player is driven until the file ends") {
+			auto ended = driver.RunUntil([&rs] { return 0 < rs.ends; },
+			                             3ULL * 60 * 60 * 1000000);
+
+			// Each THEN would play the two hours again, so there is
+			// only the one.
+			THEN("the file ends on time, having announced each second, and rewinds") {
+				REQUIRE(ended);
+				REQUIRE(rs.Lines("END").size() == 1);
+				REQUIRE(rs.Lines("UNDERRUN").empty());
+
+				auto now = clock.Now();
+				REQUIRE(now >= 2LL * 60 * 60 * 1000000);
+				REQUIRE(now <= 2LL * 60 * 60 * 1000000 + 100000);
+
+				// Second 0 went out when the file was loaded.
+				auto times = rs.Lines(ELAPSED);
+				REQUIRE(times.size() == 2 * 60 * 60);
+				REQUIRE(times.front() == ELAPSED + "1000000");
+				REQUIRE(times[59] == ELAPSED + "60000000");
+				REQUIRE(times[times.size() - 2] == ELAPSED + "7199000000");
+				REQUIRE(times.back() == ELAPSED + "0");
+
+				rs.lines.clear();
+				REQUIRE(p.RunCommand(std::vector<std::string>{"read", "tag", "/control/state"}).IsSuccess());
+				REQUIRE(rs.lines.front() == "RES /control/state Entry Stopped");
+			}
+		}
+	}
+}
+
+SCENARIO("Time broadcasts are throttled to one a virtual second", "[virtual-clock]") {
+	GIVEN("a Player playing into a VirtualClockAudioSink, at IoCore's update rate") {
+		VirtualClock clock;
+		AudioSystem ds(0);
+		ds.SetSink([&clock](const AudioSource &src, int) {
+			return VirtualClockAudioSink::Build(src, clock, LONG_RATE);
+		});
+		ds.AddSource("mp3", [](const std::string &path) {
+			return std::unique_ptr<AudioSource>(new LongAudioSource(path, 60));
+		});
+
+		Player p(ds);
+		RecordingResponseSink rs;
+		p.SetSink(rs);
+
+		SteppedDriver driver(p, clock);
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", "short.mp3"}).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Playing"}).IsSuccess());
+		rs.lines.clear();
+
+		WHEN("ten virtual seconds pass") {
+			auto steps = driver.Run(10 * 1000000);
+
+			THEN("every update ran, but the time went out once a second") {
+				REQUIRE(steps == 2000);
+
+				auto times = rs.Lines(ELAPSED);
+				// Second 0 went out when the file was loaded.
+				REQUIRE(times.size() == 9);
+				for (size_t i = 0; i < times.size(); i++) {
+					// Each broadcast is the first update in its
+					// second.
+					auto secs = std::stoull(times[i].substr(ELAPSED.size())) / 1000000;
+					REQUIRE(secs == i + 1);
+				}
+			}
+		}
+
+		WHEN("the player seeks back within the second it has announced") {
+			driver.Run(3200000);
+			rs.lines.clear();
+			REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/time/elapsed", "3100000"}).IsSuccess());
+			driver.Run(500000);
+
+			THEN("the seek was announced, but no repeats of that second") {
+				auto times = rs.Lines(ELAPSED);
+				REQUIRE(times.size() == 1);
+				REQUIRE(times[0].substr(ELAPSED.size(), 1) == "3");
+			}
+		}
+	}
+}
+
+SCENARIO("Seeks to the end of a file end it in virtual time", "[virtual-clock]") {
+	GIVEN("a Player playing a two-hour file into a VirtualClockAudioSink") {
+		VirtualClock clock;
+		AudioSystem ds(0);
+		ds.SetSink([&clock](const AudioSource &src, int) {
+			return VirtualClockAudioSink::Build(src, clock, LONG_RATE);
+		});
+		ds.AddSource("mp3", [](const std::string &path) {
+			return std::unique_ptr<AudioSource>(new LongAudioSource(path, 2 * 60 * 60));
+		});
+
+		Player p(ds);
+		RecordingResponseSink rs;
+		p.SetSink(rs);
+
+		SteppedDriver driver(p, clock);
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", "long.mp3"}).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Playing"}).IsSuccess());
+		driver.Run(1000000);
+		rs.lines.clear();
+
+		auto seek = [&p](const std::string &micros) {
+			return p.RunCommand(std::vector<std::string>{"write", "tag", "/player/time/elapsed", micros}).IsSuccess();
+		};
+		auto ended = [&rs] { return 0 < rs.ends; };
+
+		WHEN("the player seeks past the end") {
+			REQUIRE(seek("7201000000"));
+
+			THEN("the file ends at once, and rewinds") {
+				REQUIRE(ended());
+				REQUIRE(rs.Lines(ELAPSED).back() == ELAPSED + "0");
+			}
+		}
+
+		WHEN("the player seeks to exactly the end") {
+			REQUIRE(seek("7200000000"));
+			auto start = clock.Now();
+
+			THEN("the file ends at the next update") {
+				REQUIRE(driver.RunUntil(ended, 1000000));
+				auto taken = clock.Now() - start;
+				REQUIRE(taken == 5000);
+			}
+		}
+
+		WHEN("the player seeks to half a second before the end") {
+			REQUIRE(seek("7199500000"));
+			auto start = clock.Now();
+
+			THEN("the file ends once that half second has played") {
+				REQUIRE(driver.RunUntil(ended, 2000000));
+				auto taken = clock.Now() - start;
+				REQUIRE(500000 <= taken);
+				REQUIRE(taken < 500000 + 5000 + 5000);
+			}
+		}
+	}
+}
+
+SCENARIO("A stalled decoder underruns in virtual time", "[virtual-clock]") {
+	GIVEN("a Player playing a file whose decoder can be stalled") {
+		VirtualClock clock;
+		static bool stalled;
+		stalled = false;
+
+		AudioSystem ds(0);
+		ds.SetSink([&clock](const AudioSource &src, int) {
+			return VirtualClockAudioSink::Build(src, clock, LONG_RATE);
+		});
+		ds.AddSource("mp3", [](const std::string &path) {
+			return std::unique_ptr<AudioSource>(new LongAudioSource(path, 60, &stalled));
+		});
+
+		Player p(ds);
+		RecordingResponseSink rs;
+		p.SetSink(rs);
+
+		SteppedDriver driver(p, clock);
+
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/player/file", "slow.mp3"}).IsSuccess());
+		REQUIRE(p.RunCommand(std::vector<std::string>{"write", "tag", "/control/state", "Playing"}).IsSuccess());
+		driver.Run(2000000);
+		rs.lines.clear();
+
+		WHEN("the decoder stalls for three seconds") {
+			stalled = true;
+			driver.Run(3000000);
+			stalled = false;
+			driver.Run(1000000);
+
+			THEN("one underrun is announced, from when the buffer ran dry to when decoding resumed") {
+				auto underruns = rs.Lines("UNDERRUN ");
+				REQUIRE(underruns.size() == 1);
+
+				std::istringstream is(underruns[0].substr(9));
+				std::int64_t stamp;
+				std::uint64_t duration;
+				is >> stamp >> duration;
+
+				// The buffer held a second, give or take an
+				// update, and took an update to refill.
+				REQUIRE(stamp >= 3000000);
+				REQUIRE(stamp <= 3010000);
+				auto end = stamp + static_cast<std::int64_t>(duration);
+				REQUIRE(end >= 5000000);
+				REQUIRE(end <= 5010000);
+			}
+		}
+	}
+}
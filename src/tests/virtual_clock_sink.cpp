@@ -0,0 +1,178 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Definition of the VirtualClock and VirtualClockAudioSink classes.
+ * @see audio/audio_sink.hpp
+ * @see tests/virtual_clock_sink.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_sink.hpp"
+#include "../audio/audio_source.hpp"
+#include "virtual_clock_sink.hpp"
+
+//
+// VirtualClock
+//
+
+VirtualClock::VirtualClock() : now(0)
+{
+}
+
+std::int64_t VirtualClock::Now() const
+{
+	return this->now;
+}
+
+void VirtualClock::Advance(std::uint64_t micros)
+{
+	this->now += static_cast<std::int64_t>(micros);
+}
+
+//
+// VirtualClockAudioSink
+//
+
+/* static */ std::unique_ptr<AudioSink> VirtualClockAudioSink::Build(
+        const AudioSource &source, const VirtualClock &clock,
+        std::uint64_t capacity)
+{
+	return std::unique_ptr<AudioSink>(
+	        new VirtualClockAudioSink(source, clock, capacity));
+}
+
+VirtualClockAudioSink::VirtualClockAudioSink(const AudioSource &source,
+                                             const VirtualClock &clock,
+                                             std::uint64_t capacity)
+    : clock(clock),
+      rate(source.SampleRate()),
+      bytes_per_sample(source.BytesPerSample()),
+      capacity(capacity),
+      state(Audio::State::STOPPED),
+      position(0),
+      buffered(0),
+      source_out(false),
+      played_to(clock.Now()),
+      carry(0)
+{
+	assert(0 < this->capacity);
+}
+
+void VirtualClockAudioSink::Start()
+{
+	this->CatchUp();
+	if (this->state != Audio::State::STOPPED) return;
+	this->state = Audio::State::PLAYING;
+}
+
+void VirtualClockAudioSink::Stop()
+{
+	this->CatchUp();
+	if (this->state == Audio::State::STOPPED) return;
+	this->underruns.Reset(this->clock.Now() * 1000);
+	this->state = Audio::State::STOPPED;
+}
+
+Audio::State VirtualClockAudioSink::State()
+{
+	this->CatchUp();
+	return this->state;
+}
+
+std::uint64_t VirtualClockAudioSink::Position()
+{
+	this->CatchUp();
+	return this->position;
+}
+
+void VirtualClockAudioSink::SetPosition(std::uint64_t samples)
+{
+	this->CatchUp();
+
+	this->position = samples;
+	this->buffered = 0;
+	this->carry = 0;
+	this->source_out = false;
+	this->underruns.Reset(this->clock.Now() * 1000);
+
+	if (this->state == Audio::State::AT_END) {
+		this->state = Audio::State::STOPPED;
+	}
+}
+
+std::uint64_t VirtualClockAudioSink::BufferLatency() const
+{
+	return this->capacity * 1000000 / this->rate;
+}
+
+UnderrunMonitor *VirtualClockAudioSink::Underruns()
+{
+	return &this->underruns;
+}
+
+std::int64_t VirtualClockAudioSink::Stamp() const
+{
+	return this->clock.Now();
+}
+
+void VirtualClockAudioSink::SourceOut()
+{
+	this->source_out = true;
+}
+
+void VirtualClockAudioSink::Transfer(AudioSink::TransferIterator &start,
+                                     const AudioSink::TransferIterator &end)
+{
+	assert(start <= end);
+	this->CatchUp();
+
+	auto offered = static_cast<std::uint64_t>(end - start);
+	assert(offered % this->bytes_per_sample == 0);
+
+	auto taken = std::min(offered / this->bytes_per_sample,
+	                      this->capacity - this->buffered);
+	this->buffered += taken;
+	start += static_cast<std::ptrdiff_t>(taken * this->bytes_per_sample);
+}
+
+std::uint64_t VirtualClockAudioSink::Buffered()
+{
+	this->CatchUp();
+	return this->buffered;
+}
+
+void VirtualClockAudioSink::CatchUp()
+{
+	auto now = this->clock.Now();
+	auto elapsed = static_cast<std::uint64_t>(now - this->played_to);
+	this->played_to = now;
+
+	// A stopped device asks for nothing, and an ended one has nothing.
+	if (this->state != Audio::State::PLAYING) return;
+
+	// The carry keeps rates that don't divide a second evenly from
+	// drifting over long runs.
+	auto due = elapsed * this->rate + this->carry;
+	auto wanted = due / 1000000;
+	this->carry = due % 1000000;
+
+	// Asking for nothing would end any underrun, which a device that
+	// hasn't called back yet can't do.
+	if (0 < wanted) {
+		auto played = this->underruns.Playable(
+		        this->buffered, wanted, this->source_out, now * 1000);
+		this->buffered -= played;
+		this->position += played;
+	}
+
+	if (this->source_out && this->buffered == 0) {
+		this->state = Audio::State::AT_END;
+	}
+}
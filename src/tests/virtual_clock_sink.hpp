@@ -0,0 +1,123 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the VirtualClock and VirtualClockAudioSink classes.
+ * @see audio/audio_sink.hpp
+ * @see tests/virtual_clock_sink.cpp
+ */
+
+#ifndef PLAYD_TESTS_VIRTUAL_CLOCK_SINK_HPP
+#define PLAYD_TESTS_VIRTUAL_CLOCK_SINK_HPP
+
+#include <cstdint>
+#include <memory>
+
+#include "../audio/audio.hpp"
+#include "../audio/audio_sink.hpp"
+#include "../audio/audio_source.hpp"
+#include "../audio/underrun.hpp"
+
+/// A clock that only moves when a test moves it.
+class VirtualClock
+{
+public:
+	/// Constructs a VirtualClock, at time 0.
+	VirtualClock();
+
+	/// Deleted copy constructor.
+	VirtualClock(const VirtualClock &) = delete;
+
+	/// Deleted copy-assignment.
+	VirtualClock &operator=(const VirtualClock &) = delete;
+
+	/**
+	 * Gets the current time.
+	 * @return The time, in microseconds.
+	 */
+	std::int64_t Now() const;
+
+	/**
+	 * Moves the clock forwards.
+	 * @param micros How far to move it, in microseconds.
+	 */
+	void Advance(std::uint64_t micros);
+
+private:
+	std::int64_t now; ///< The current time, in microseconds.
+};
+
+/**
+ * An AudioSink that plays out in real time, where time is a VirtualClock.
+ *
+ * It behaves like SdlAudioSink with an ideal device: it buffers what it is
+ * given, up to its capacity, and plays the buffer out at the source's
+ * sample rate as the clock advances.  Running dry before the source is out
+ * is an underrun; running dry after it is the end of the file.
+ *
+ * Playing out happens whenever the sink is next asked anything, so one
+ * long Advance plays out as much as several short ones.
+ */
+class VirtualClockAudioSink : public AudioSink
+{
+public:
+	/**
+	 * Helper function for creating uniquely pointed-to AudioSinks.
+	 * @param source The source from which this sink will receive audio.
+	 * @param clock The clock driving the sink.
+	 * @param capacity The buffer size, in samples.
+	 * @return A unique pointer to an AudioSink.
+	 */
+	static std::unique_ptr<AudioSink> Build(const AudioSource &source,
+	                                        const VirtualClock &clock,
+	                                        std::uint64_t capacity);
+
+	/**
+	 * Constructs a VirtualClockAudioSink.
+	 * @param source The source from which this sink will receive audio.
+	 * @param clock The clock driving the sink.
+	 * @param capacity The buffer size, in samples.
+	 */
+	VirtualClockAudioSink(const AudioSource &source,
+	                      const VirtualClock &clock, std::uint64_t capacity);
+
+	void Start() override;
+	void Stop() override;
+	Audio::State State() override;
+	std::uint64_t Position() override;
+	void SetPosition(std::uint64_t samples) override;
+	std::uint64_t BufferLatency() const override;
+	UnderrunMonitor *Underruns() override;
+	std::int64_t Stamp() const override;
+	void SourceOut() override;
+	void Transfer(AudioSink::TransferIterator &start,
+	              const AudioSink::TransferIterator &end) override;
+
+	/**
+	 * Gets the number of samples buffered but not yet played.
+	 * @return The count.
+	 */
+	std::uint64_t Buffered();
+
+private:
+	const VirtualClock &clock; ///< The clock driving the sink.
+	std::uint32_t rate;        ///< The sample rate, in Hz.
+	size_t bytes_per_sample;   ///< Bytes per sample, all channels.
+	std::uint64_t capacity;    ///< The buffer size, in samples.
+
+	Audio::State state;     ///< The state of the sink.
+	std::uint64_t position; ///< The position last played, in samples.
+	std::uint64_t buffered; ///< Samples buffered but not yet played.
+	bool source_out;        ///< Whether the source has run out.
+
+	std::int64_t played_to; ///< The clock time played out to, in µs.
+	std::uint64_t carry;    ///< Sample-microseconds not yet played.
+
+	UnderrunMonitor underruns; ///< Counts the sink's underruns.
+
+	/// Plays out everything due between the last call and now.
+	void CatchUp();
+};
+
+#endif // PLAYD_TESTS_VIRTUAL_CLOCK_SINK_HPP
@@ -0,0 +1,268 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Tracer class.
+ * @see trace.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "errors.hpp"
+#include "trace.hpp"
+
+const size_t Tracer::MAX_THREADS;
+const size_t Tracer::CAPACITY;
+
+/// Hands out Tracer IDs; 0 is never handed out.
+static std::atomic<std::uint64_t> next_tracer_id(1);
+
+/// The ring the calling thread holds, which it gives back when it exits.
+struct RingClaim {
+	/// The ID of the Tracer whose ring this is, or 0 if none.
+	std::uint64_t owner = 0;
+
+	/// The ring, or nullptr if none.
+	void *ring = nullptr;
+
+	/// The ring's taken flag, sharing ownership of the Tracer's rings.
+	std::shared_ptr<std::atomic<bool>> taken;
+
+	/// Gives the ring back, if one is held.
+	void Release()
+	{
+		if (this->taken) this->taken->store(false, std::memory_order_release);
+		this->taken.reset();
+	}
+
+	/// Gives the ring back as the thread exits.
+	~RingClaim()
+	{
+		this->Release();
+	}
+};
+
+/// The calling thread's ring.
+static thread_local RingClaim ring_claim;
+
+Tracer::Tracer()
+    : id(next_tracer_id.fetch_add(1)), enabled(false), claimed(0), dropped(0)
+{
+}
+
+/* static */ Tracer &Tracer::Global()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+void Tracer::Enable(const std::string &path)
+{
+	assert(!this->Enabled());
+
+	this->path = path;
+	this->rings.reset(new Ring[MAX_THREADS](), std::default_delete<Ring[]>());
+	this->enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::Record(const char *name, std::int64_t start,
+                    std::int64_t duration)
+{
+	auto ring = this->ThreadRing();
+	if (ring == nullptr) {
+		this->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	// Dump knows the span at head may be half-written, but only if it
+	// sees head move before it sees any of the span.
+	auto n = ring->head.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	auto &span = ring->spans[n % CAPACITY];
+	span.name.store(name, std::memory_order_relaxed);
+	span.start.store(start, std::memory_order_relaxed);
+	span.duration.store(duration, std::memory_order_relaxed);
+
+	ring->head.store(n + 1, std::memory_order_release);
+}
+
+void Tracer::NameThread(const char *name)
+{
+	if (!this->Enabled()) return;
+
+	auto ring = this->ThreadRing();
+	if (ring != nullptr) ring->name.store(name, std::memory_order_relaxed);
+}
+
+size_t Tracer::Dump() const
+{
+	if (!this->Enabled()) throw FileError("tracing is not enabled");
+
+	std::string trace;
+	auto count = this->Chrome(trace);
+
+	// Write and rename, so nobody opens a half-written trace.
+	auto temp = this->path + ".tmp";
+	{
+		std::ofstream os(temp, std::ios::out | std::ios::trunc);
+		os << trace;
+		if (!os) throw FileError("can't write trace to " + temp);
+	}
+	if (std::rename(temp.c_str(), this->path.c_str()) != 0) {
+		throw FileError("can't move trace to " + this->path);
+	}
+
+	Debug() << "Dumped" << count << "spans to" << this->path << std::endl;
+	return count;
+}
+
+/**
+ * Appends a time in nanoseconds as Chrome's fractional microseconds.
+ * @param out The string to which the time is appended.
+ * @param ns The time.
+ */
+static void ChromeTime(std::string &out, std::int64_t ns)
+{
+	char buf[32];
+	auto us = ns / 1000;
+	auto frac = ns % 1000;
+	if (frac < 0) {
+		us--;
+		frac += 1000;
+	}
+	std::snprintf(buf, sizeof(buf), "%lld.%03d", static_cast<long long>(us),
+	              static_cast<int>(frac));
+	out += buf;
+}
+
+size_t Tracer::Chrome(std::string &out) const
+{
+	size_t count = 0;
+	out += "{\"traceEvents\":[";
+	out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+	       "\"args\":{\"name\":\"playd\"}}";
+	if (!this->Enabled()) {
+		out += "]}\n";
+		return count;
+	}
+
+	auto rings = std::min(this->claimed.load(std::memory_order_acquire),
+	                      MAX_THREADS);
+	for (size_t t = 0; t < rings; t++) {
+		const auto &ring = this->rings.get()[t];
+		auto tid = std::to_string(t + 1);
+
+		auto name = ring.name.load(std::memory_order_relaxed);
+		if (name != nullptr) {
+			out += ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			       "\"tid\":" + tid + ",\"args\":{\"name\":\"";
+			out += name;
+			out += "\"}}";
+		}
+
+		// Copy out the spans, then throw away any that the thread
+		// might have been overwriting as we copied.
+		auto head = ring.head.load(std::memory_order_acquire);
+		auto first = CAPACITY < head ? head - CAPACITY : 0;
+
+		struct Copy {
+			std::uint64_t n;
+			const char *name;
+			std::int64_t start;
+			std::int64_t duration;
+		};
+		std::unique_ptr<Copy[]> copies(new Copy[head - first]);
+		for (auto n = first; n < head; n++) {
+			const auto &span = ring.spans[n % CAPACITY];
+			auto &copy = copies[n - first];
+			copy.n = n;
+			copy.name = span.name.load(std::memory_order_relaxed);
+			copy.start = span.start.load(std::memory_order_relaxed);
+			copy.duration = span.duration.load(
+			        std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto after = ring.head.load(std::memory_order_relaxed);
+
+		for (auto n = first; n < head; n++) {
+			const auto &copy = copies[n - first];
+			if (copy.n + CAPACITY <= after) continue;
+
+			out += ",{\"name\":\"";
+			out += copy.name;
+			out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid +
+			       ",\"ts\":";
+			ChromeTime(out, copy.start);
+			out += ",\"dur\":";
+			ChromeTime(out, copy.duration);
+			out += "}";
+			count++;
+		}
+	}
+
+	out += "]}\n";
+	return count;
+}
+
+std::uint64_t Tracer::Dropped() const
+{
+	return this->dropped.load(std::memory_order_relaxed);
+}
+
+/* static */ std::int64_t Tracer::Now()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+	        .count();
+}
+
+Tracer::Ring *Tracer::ThreadRing()
+{
+	if (ring_claim.owner == this->id) {
+		return static_cast<Ring *>(ring_claim.ring);
+	}
+
+	// A thread only ever traces to one Tracer at a time.
+	ring_claim.Release();
+
+	Ring *ring = nullptr;
+	for (size_t slot = 0; slot < MAX_THREADS; slot++) {
+		auto &candidate = this->rings.get()[slot];
+		bool expected = false;
+		if (!candidate.taken.compare_exchange_strong(
+		            expected, true, std::memory_order_acq_rel)) {
+			continue;
+		}
+
+		// The last holder's name mustn't stick to the new one.
+		candidate.name.store(nullptr, std::memory_order_relaxed);
+
+		auto used = this->claimed.load(std::memory_order_relaxed);
+		while (used < slot + 1 &&
+		       !this->claimed.compare_exchange_weak(
+		               used, slot + 1, std::memory_order_acq_rel)) {
+		}
+
+		ring = &candidate;
+		ring_claim.taken = std::shared_ptr<std::atomic<bool>>(
+		        this->rings, &candidate.taken);
+		break;
+	}
+
+	// A thread that found no ring doesn't look again; it'd only slow
+	// down every span it records.
+	ring_claim.owner = this->id;
+	ring_claim.ring = static_cast<void *>(ring);
+	return ring;
+}
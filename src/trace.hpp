@@ -0,0 +1,212 @@
+// This file is part of playd.
+// playd is licensed under the MIT licence: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Tracer and TraceSpan classes.
+ * @see trace.cpp
+ */
+
+#ifndef PLAYD_TRACE_HPP
+#define PLAYD_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * A flight recorder of what each of playd's threads has been doing.
+ *
+ * Once enabled, each thread that records a span claims a fixed ring of
+ * span records, and overwrites its oldest records as it goes.  A thread
+ * gives its ring back when it exits, so that short-lived threads, such as
+ * the one SDL starts for each audio device, don't use the rings up; the
+ * next thread to claim the ring carries on where the last left off.
+ * Rings are all allocated by Enable, so recording never allocates, locks
+ * or waits, and is safe in the audio callback.  While the Tracer is
+ * disabled, recording a span is one relaxed load.
+ *
+ * Dump writes what the rings hold as a Chrome trace-event JSON file, which
+ * chrome://tracing and Perfetto can both open.
+ */
+class Tracer
+{
+public:
+	/// The most threads that can record spans at once; any more are
+	/// ignored.
+	static const size_t MAX_THREADS = 64;
+
+	/// The number of spans each thread's ring holds.
+	static const size_t CAPACITY = 4096;
+
+	/// Constructs a disabled Tracer.
+	Tracer();
+
+	/// Deleted copy constructor.
+	Tracer(const Tracer &) = delete;
+
+	/// Deleted copy-assignment.
+	Tracer &operator=(const Tracer &) = delete;
+
+	/**
+	 * Gets the Tracer that playd's own spans go to.
+	 * @return The global Tracer.
+	 */
+	static Tracer &Global();
+
+	/**
+	 * Enables the Tracer.
+	 * This must happen before any other thread uses the Tracer, and the
+	 * Tracer can't be disabled again.
+	 * @param path The file to which Dump writes.
+	 */
+	void Enable(const std::string &path);
+
+	/**
+	 * Checks whether the Tracer is recording spans.
+	 * @return Whether Enable has been called.
+	 */
+	bool Enabled() const
+	{
+		return this->enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Records a span on the calling thread's ring.
+	 * @param name The span's name, which must outlive the Tracer.
+	 * @param start The start of the span, from Now.
+	 * @param duration The length of the span, in nanoseconds.
+	 */
+	void Record(const char *name, std::int64_t start, std::int64_t duration);
+
+	/**
+	 * Names the calling thread, for the dump's benefit.
+	 * Does nothing unless the Tracer is enabled.
+	 * @param name The thread's name, which must outlive the Tracer.
+	 */
+	void NameThread(const char *name);
+
+	/**
+	 * Writes every span the rings hold to the file given to Enable.
+	 * @return The number of spans written.
+	 * @exception FileError Thrown if the Tracer is disabled, or the file
+	 *   can't be written.
+	 */
+	size_t Dump() const;
+
+	/**
+	 * Writes every span the rings hold as a Chrome trace.
+	 * The oldest span of a full ring is left out, as its thread may be
+	 * overwriting it.
+	 * @param out The string to which the trace is appended.
+	 * @return The number of spans written.
+	 */
+	size_t Chrome(std::string &out) const;
+
+	/**
+	 * Gets the number of spans dropped because too many threads traced.
+	 * @return The count.
+	 */
+	std::uint64_t Dropped() const;
+
+	/**
+	 * Gets the current monotonic time, in nanoseconds.
+	 * @return The time.
+	 */
+	static std::int64_t Now();
+
+private:
+	/// One recorded span.  The fields are atomic only so Dump can read
+	/// them while the owning thread overwrites them.
+	struct Span {
+		std::atomic<const char *> name;     ///< The span's name.
+		std::atomic<std::int64_t> start;    ///< From Now, in ns.
+		std::atomic<std::int64_t> duration; ///< In ns.
+	};
+
+	/// The spans of one thread.
+	struct Ring {
+		/// The number of spans ever recorded; only the owner writes it.
+		std::atomic<std::uint64_t> head;
+
+		/// The owning thread's name, or nullptr if it has none.
+		std::atomic<const char *> name;
+
+		/// Whether a thread holds the ring.
+		std::atomic<bool> taken;
+
+		/// The spans, indexed by their number modulo CAPACITY.
+		Span spans[CAPACITY];
+	};
+
+	/// A number unique to this Tracer, so threads know whose ring
+	/// they hold.
+	std::uint64_t id;
+
+	/// Whether the Tracer is recording.
+	std::atomic<bool> enabled;
+
+	/// The file to which Dump writes.
+	std::string path;
+
+	/// The rings, allocated by Enable.  Threads share ownership, so
+	/// that they can give their rings back even after the Tracer is gone.
+	std::shared_ptr<Ring> rings;
+
+	/// The number of rings that have ever been claimed, counting from
+	/// the first; rings past this have never held a span.
+	std::atomic<size_t> claimed;
+
+	/// The number of spans dropped for want of a ring.
+	std::atomic<std::uint64_t> dropped;
+
+	/**
+	 * Gets the calling thread's ring, claiming one if need be.
+	 * @return The ring, or nullptr if every ring is held by a thread.
+	 */
+	Ring *ThreadRing();
+};
+
+/**
+ * Records the lifetime of a scope as a span.
+ *
+ * Constructing one is all it takes to trace a function:
+ *
+ *     TraceSpan span("PipeAudio::Update");
+ */
+class TraceSpan
+{
+public:
+	/**
+	 * Starts a span, if the Tracer is enabled.
+	 * @param name The span's name, which must outlive the Tracer.
+	 * @param tracer The Tracer to which the span goes.
+	 */
+	explicit TraceSpan(const char *name, Tracer &tracer = Tracer::Global())
+	    : name(name), tracer(tracer.Enabled() ? &tracer : nullptr),
+	      start(this->tracer == nullptr ? 0 : Tracer::Now())
+	{
+	}
+
+	/// Ends the span, recording it if it was started.
+	~TraceSpan()
+	{
+		if (this->tracer == nullptr) return;
+		auto duration = Tracer::Now() - this->start;
+		this->tracer->Record(this->name, this->start, duration);
+	}
+
+	/// Deleted copy constructor.
+	TraceSpan(const TraceSpan &) = delete;
+
+	/// Deleted copy-assignment.
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+	const char *name;   ///< The span's name.
+	Tracer *tracer;     ///< The Tracer, or nullptr if not tracing.
+	std::int64_t start; ///< The start of the span, from Tracer::Now.
+};
+
+#endif // PLAYD_TRACE_HPP